@@ -39,14 +39,18 @@
  */
 static void flt_ot_vars_scope_dump(struct vars *vars, const char *scope)
 {
+	struct var  **slots;
 	const struct var *var;
+	unsigned int  i;
 
 	if (vars == NULL)
 		return;
 
 	vars_rdlock(vars);
-	list_for_each_entry(var, &(vars->head), l)
-		FLT_OT_DBG(2, "'%s.%016" PRIx64 "' -> '%.*s'", scope, var->name_hash, (int)b_data(&(var->data.u.str)), b_orig(&(var->data.u.str)));
+	slots = vars_slots(vars);
+	for (i = 0; i <= vars->mask; i++)
+		if ((var = slots[i]) != NULL)
+			FLT_OT_DBG(2, "'%s.%016" PRIx64 "' -> '%.*s'", scope, var->name_hash, (int)b_data(&(var->data.u.str)), b_orig(&(var->data.u.str)));
 	vars_rdunlock(vars);
 }
 
@@ -14,6 +14,7 @@
  */
 
 #include <haproxy/action-t.h>
+#include <haproxy/activity.h>
 #include <haproxy/api.h>
 #include <haproxy/applet.h>
 #include <haproxy/backend.h>
@@ -2196,6 +2197,192 @@ static enum act_parse_ret service_parse_prometheus_exporter(const char **args, i
 
 	return ACT_RET_PRS_OK;
 }
+/* Scheduler profiling module: exports the number of calls and the latency
+ * and CPU time histograms of each task function, as collected when tasks
+ * profiling is enabled. Entries are aggregated by function. Histograms follow
+ * the Prometheus conventions, with cumulative "le" buckets.
+ */
+enum promex_sched_metrics {
+	PROMEX_SCHED_CALLS = 0,
+	PROMEX_SCHED_LAT_BUCKET,
+	PROMEX_SCHED_LAT_SUM,
+	PROMEX_SCHED_CPU_BUCKET,
+	PROMEX_SCHED_CPU_SUM,
+	PROMEX_SCHED_METRICS_COUNT,
+};
+
+static const struct promex_metric promex_sched_metrics[PROMEX_SCHED_METRICS_COUNT] = {
+	[PROMEX_SCHED_CALLS]      = { .n = IST("task_calls_total"),            .type = PROMEX_MT_COUNTER, .flags = PROMEX_FL_MODULE_METRIC },
+	[PROMEX_SCHED_LAT_BUCKET] = { .n = IST("task_latency_seconds_bucket"), .type = PROMEX_MT_COUNTER, .flags = PROMEX_FL_MODULE_METRIC },
+	[PROMEX_SCHED_LAT_SUM]    = { .n = IST("task_latency_seconds_sum"),    .type = PROMEX_MT_COUNTER, .flags = PROMEX_FL_MODULE_METRIC },
+	[PROMEX_SCHED_CPU_BUCKET] = { .n = IST("task_cpu_seconds_bucket"),     .type = PROMEX_MT_COUNTER, .flags = PROMEX_FL_MODULE_METRIC },
+	[PROMEX_SCHED_CPU_SUM]    = { .n = IST("task_cpu_seconds_sum"),        .type = PROMEX_MT_COUNTER, .flags = PROMEX_FL_MODULE_METRIC },
+};
+
+static const struct ist promex_sched_desc[PROMEX_SCHED_METRICS_COUNT] = {
+	[PROMEX_SCHED_CALLS]      = IST("Total number of profiled calls of this task function."),
+	[PROMEX_SCHED_LAT_BUCKET] = IST("Histogram of the wakeup latency of this task function."),
+	[PROMEX_SCHED_LAT_SUM]    = IST("Total wakeup latency of this task function."),
+	[PROMEX_SCHED_CPU_BUCKET] = IST("Histogram of the CPU time per call of this task function."),
+	[PROMEX_SCHED_CPU_SUM]    = IST("Total CPU time spent in this task function."),
+};
+
+/* dump context: a snapshot of the profiling entries aggregated by function */
+struct promex_sched_ctx {
+	struct sched_activity act[SCHED_ACT_HASH_BUCKETS];
+	int nb;           /* number of valid entries in act[] */
+	int pos;          /* current time series */
+	char func[128];   /* storage for the "function" label */
+	char le[32];      /* storage for the "le" label */
+};
+
+static int promex_sched_metric_info(unsigned int id, struct promex_metric *metric, struct ist *desc)
+{
+	if (id >= PROMEX_SCHED_METRICS_COUNT)
+		return -1;
+
+	*metric = promex_sched_metrics[id];
+	*desc = promex_sched_desc[id];
+	return 1;
+}
+
+static void *promex_sched_start_metrics_dump()
+{
+	struct promex_sched_ctx *ctx;
+	int i, j, b;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	for (i = 0; i < SCHED_ACT_HASH_BUCKETS; i++) {
+		const struct sched_activity *act = &sched_activity[i];
+
+		if (!HA_ATOMIC_LOAD(&act->calls))
+			continue;
+
+		for (j = 0; j < ctx->nb; j++)
+			if (ctx->act[j].func == act->func)
+				break;
+
+		if (j == ctx->nb) {
+			ctx->act[j].func = act->func;
+			ctx->nb++;
+		}
+
+		ctx->act[j].calls    += HA_ATOMIC_LOAD(&act->calls);
+		ctx->act[j].cpu_time += HA_ATOMIC_LOAD(&act->cpu_time);
+		ctx->act[j].lat_time += HA_ATOMIC_LOAD(&act->lat_time);
+		for (b = 0; b < SCHED_ACT_HIST_BUCKETS; b++) {
+			ctx->act[j].lat_hist[b] += HA_ATOMIC_LOAD(&act->lat_hist[b]);
+			ctx->act[j].cpu_hist[b] += HA_ATOMIC_LOAD(&act->cpu_hist[b]);
+		}
+	}
+	return ctx;
+}
+
+static void promex_sched_stop_metrics_dump(void *ctx)
+{
+	free(ctx);
+}
+
+/* returns the number of time series per function for metric <id> */
+static int promex_sched_ts_per_func(unsigned int id)
+{
+	if (id == PROMEX_SCHED_LAT_BUCKET || id == PROMEX_SCHED_CPU_BUCKET)
+		return SCHED_ACT_HIST_BUCKETS + 1; // all buckets + "+Inf"
+	return 1;
+}
+
+static void *promex_sched_start_ts(void *ctx, unsigned int id)
+{
+	struct promex_sched_ctx *sctx = ctx;
+
+	sctx->pos = 0;
+	return sctx->nb ? &sctx->pos : NULL;
+}
+
+static void *promex_sched_next_ts(void *ctx, void *ts_ctx, unsigned int id)
+{
+	struct promex_sched_ctx *sctx = ctx;
+
+	sctx->pos++;
+	if (sctx->pos >= sctx->nb * promex_sched_ts_per_func(id))
+		return NULL;
+	return &sctx->pos;
+}
+
+static int promex_sched_fill_ts(void *ctx, void *ts_ctx, unsigned int id, struct promex_label *labels, struct field *field)
+{
+	struct promex_sched_ctx *sctx = ctx;
+	int per_func = promex_sched_ts_per_func(id);
+	const struct sched_activity *act = &sctx->act[sctx->pos / per_func];
+	const uint32_t *hist = NULL;
+	struct buffer name = b_make(sctx->func, sizeof(sctx->func) - 1, 0, 0);
+	uint64_t cum;
+	int b, i;
+
+	if (!act->func)
+		chunk_strcpy(&name, "other");
+	else
+		resolve_sym_name(&name, "", act->func);
+	name.area[name.data] = 0;
+
+	labels[0].name  = ist("function");
+	labels[0].value = ist2(name.area, name.data);
+
+	switch (id) {
+	case PROMEX_SCHED_CALLS:
+		*field = mkf_u64(FN_COUNTER, act->calls);
+		return 1;
+	case PROMEX_SCHED_LAT_SUM:
+		*field = mkf_flt(FN_COUNTER, act->lat_time / 1000000000.0);
+		return 1;
+	case PROMEX_SCHED_CPU_SUM:
+		*field = mkf_flt(FN_COUNTER, act->cpu_time / 1000000000.0);
+		return 1;
+	case PROMEX_SCHED_LAT_BUCKET:
+		hist = act->lat_hist;
+		break;
+	case PROMEX_SCHED_CPU_BUCKET:
+		hist = act->cpu_hist;
+		break;
+	default:
+		return -1;
+	}
+
+	/* the last series of each function is the "+Inf" bucket */
+	b = sctx->pos % per_func;
+	for (cum = i = 0; i <= b && i < SCHED_ACT_HIST_BUCKETS; i++)
+		cum += hist[i];
+
+	if (b < SCHED_ACT_HIST_BUCKETS)
+		snprintf(sctx->le, sizeof(sctx->le), "%g", sched_act_hist_limit(b) / 1000000000.0);
+	else
+		strlcpy2(sctx->le, "+Inf", sizeof(sctx->le));
+
+	labels[1].name  = ist("le");
+	labels[1].value = ist(sctx->le);
+	*field = mkf_u64(FN_COUNTER, cum);
+	return 1;
+}
+
+static struct promex_module promex_sched_module = {
+	.name               = IST("sched"),
+	.metric_info        = promex_sched_metric_info,
+	.start_metrics_dump = promex_sched_start_metrics_dump,
+	.stop_metrics_dump  = promex_sched_stop_metrics_dump,
+	.start_ts           = promex_sched_start_ts,
+	.next_ts            = promex_sched_next_ts,
+	.fill_ts            = promex_sched_fill_ts,
+	.nb_metrics         = PROMEX_SCHED_METRICS_COUNT,
+};
+
+static void promex_register_sched_module(void)
+{
+	promex_register_module(&promex_sched_module);
+}
+
 static void promex_register_build_options(void)
 {
         char *ptr = NULL;
@@ -2212,3 +2399,4 @@ static struct action_kw_list service_actions = { ILH, {
 
 INITCALL1(STG_REGISTER, service_keywords_register, &service_actions);
 INITCALL0(STG_REGISTER, promex_register_build_options);
+INITCALL0(STG_REGISTER, promex_register_sched_module);
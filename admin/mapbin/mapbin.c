@@ -0,0 +1,499 @@
+/*
+ * Pattern file compiler
+ *
+ * This program reads a map file (one key and one value per line) or an ACL
+ * file (one pattern per line) and produces a precompiled binary file that
+ * haproxy maps in memory and looks up directly instead of loading it entry
+ * per entry. Such files load instantly regardless of their size, and their
+ * memory is shared between all processes using them, including across
+ * reloads. They may only be used with the "str" (case sensitive) or "ip"
+ * match methods, depending on the key type selected with "-t".
+ *
+ * The output file is first written under a temporary name then renamed, so
+ * that processes still using a previous version are not affected. Since the
+ * file is mapped in memory by haproxy, it must never be rewritten in place
+ * (e.g. using "cp" over it), as the processes would then read inconsistent
+ * contents or receive a SIGBUS if it gets truncated.
+ *
+ * Usage: mapbin [-a] [-t str|ip] -o <output> <input>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <haproxy/mapbin-t.h>
+
+typedef unsigned __int128 u128;
+
+/* a source entry */
+struct entry {
+	uint32_t key;           /* offset of the key in the text area */
+	uint32_t key_len;       /* key length */
+	uint32_t val;           /* offset of the value or MAPBIN_NO_VALUE */
+	uint64_t line;          /* source line, to keep the first duplicate */
+	u128 start, end;        /* network for IP keys */
+	int plen;               /* prefix length for IP keys */
+	int v6;                 /* IPv6 network */
+};
+
+static const char *progname;
+static char *text;              /* text area */
+static size_t text_len, text_size;
+static struct entry *entries;
+static size_t nb_entries, alloc_entries;
+
+static void die(const char *fmt, ...) __attribute__((format(printf, 1, 2), noreturn));
+static void die(const char *fmt, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "%s: ", progname);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fputc('\n', stderr);
+	exit(1);
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-a] [-t str|ip] -o <output> <input>\n"
+		"  -a        : input is an ACL file (one pattern per line, no value)\n"
+		"  -t str|ip : type of the keys (default: str)\n"
+		"  -o <file> : output file\n", progname);
+	exit(1);
+}
+
+/* appends the <len> bytes of <str> and a trailing zero to the text area and
+ * returns their offset.
+ */
+static uint32_t text_add(const char *str, size_t len)
+{
+	size_t ofs = text_len;
+
+	if (text_len + len + 1 >= MAPBIN_NO_VALUE)
+		die("text area too large");
+
+	if (text_len + len + 1 > text_size) {
+		text_size = (text_len + len + 1) * 2;
+		text = realloc(text, text_size);
+		if (!text)
+			die("out of memory");
+	}
+	memcpy(text + text_len, str, len);
+	text[text_len + len] = 0;
+	text_len += len + 1;
+	return ofs;
+}
+
+static struct entry *entry_new(void)
+{
+	if (nb_entries == alloc_entries) {
+		alloc_entries = alloc_entries ? alloc_entries * 2 : 65536;
+		entries = realloc(entries, alloc_entries * sizeof(*entries));
+		if (!entries)
+			die("out of memory");
+	}
+	memset(&entries[nb_entries], 0, sizeof(*entries));
+	return &entries[nb_entries++];
+}
+
+/* parses network <str> into <e>, returns 0 on error */
+static int parse_net(const char *str, struct entry *e)
+{
+	char addr[64];
+	const char *slash = strchr(str, '/');
+	size_t len = slash ? (size_t)(slash - str) : strlen(str);
+	unsigned char a6[16];
+	struct in_addr a4, m4;
+	int max, i;
+	u128 a = 0, mask;
+
+	if (len >= sizeof(addr))
+		return 0;
+	memcpy(addr, str, len);
+	addr[len] = 0;
+
+	if (inet_pton(AF_INET, addr, &a4) == 1) {
+		e->v6 = 0;
+		max = 32;
+		a = ntohl(a4.s_addr);
+	}
+	else if (inet_pton(AF_INET6, addr, a6) == 1) {
+		e->v6 = 1;
+		max = 128;
+		for (i = 0; i < 16; i++)
+			a = (a << 8) | a6[i];
+	}
+	else
+		return 0;
+
+	e->plen = max;
+	if (slash) {
+		char *end;
+
+		if (!e->v6 && strchr(slash + 1, '.')) {
+			/* dotted netmask, must be contiguous */
+			uint32_t m;
+
+			if (inet_pton(AF_INET, slash + 1, &m4) != 1)
+				return 0;
+			m = ntohl(m4.s_addr);
+			if (m & (~m >> 1))
+				return 0;
+			for (e->plen = 0; m & 0x80000000U; m <<= 1)
+				e->plen++;
+		}
+		else {
+			e->plen = strtol(slash + 1, &end, 10);
+			if (end == slash + 1 || *end || e->plen < 0 || e->plen > max)
+				return 0;
+		}
+	}
+
+	/* mask of the host bits */
+	if (max - e->plen == 128)
+		mask = ~(u128)0;
+	else
+		mask = ((u128)1 << (max - e->plen)) - 1;
+
+	e->start = a & ~mask;
+	e->end = e->start | mask;
+	return 1;
+}
+
+/* reads the source file using the same rules as haproxy */
+static void read_file(const char *name, int acl, int ip)
+{
+	FILE *file;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	uint64_t lineno = 0;
+	char *c, *key_beg, *key_end, *val_beg, *val_end;
+	struct entry *e;
+
+	file = fopen(name, "r");
+	if (!file)
+		die("cannot open '%s': %s", name, strerror(errno));
+
+	while ((len = getline(&line, &size, file)) >= 0) {
+		lineno++;
+		c = line;
+
+		if (*c == '#')
+			continue;
+
+		while (*c == ' ' || *c == '\t')
+			c++;
+
+		if (*c == '\0' || *c == '\r' || *c == '\n')
+			continue;
+
+		key_beg = c;
+		if (acl) {
+			/* the whole line is the pattern */
+			while (*c && *c != '\n' && *c != '\r')
+				c++;
+			key_end = c;
+			val_beg = val_end = NULL;
+		}
+		else {
+			while (*c && *c != ' ' && *c != '\t' && *c != '\n' && *c != '\r')
+				c++;
+			key_end = c;
+
+			while (*c == ' ' || *c == '\t')
+				c++;
+
+			val_beg = c;
+			while (*c && *c != '\n' && *c != '\r')
+				c++;
+			val_end = c;
+
+			while (val_end > val_beg && (val_end[-1] == ' ' || val_end[-1] == '\t'))
+				val_end--;
+		}
+
+		*key_end = 0;
+		e = entry_new();
+		e->line = lineno;
+		e->key_len = key_end - key_beg;
+		e->key = text_add(key_beg, e->key_len);
+		e->val = val_beg ? text_add(val_beg, val_end - val_beg) : MAPBIN_NO_VALUE;
+
+		if (ip && !parse_net(key_beg, e))
+			die("%s:%llu: invalid network '%s'", name, (unsigned long long)lineno, key_beg);
+	}
+
+	if (ferror(file))
+		die("error while reading '%s': %s", name, strerror(errno));
+
+	free(line);
+	fclose(file);
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+	size_t len = x->key_len < y->key_len ? x->key_len : y->key_len;
+	int ret = memcmp(text + x->key, text + y->key, len);
+
+	if (ret)
+		return ret;
+	if (x->key_len != y->key_len)
+		return x->key_len < y->key_len ? -1 : 1;
+	return (x->line > y->line) - (x->line < y->line);
+}
+
+/* sorts by family, network start, then from the largest to the smallest
+ * network, then by source line.
+ */
+static int cmp_net(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+
+	if (x->v6 != y->v6)
+		return x->v6 - y->v6;
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	if (x->plen != y->plen)
+		return x->plen - y->plen;
+	return (x->line > y->line) - (x->line < y->line);
+}
+
+static FILE *out;
+static uint64_t out_ofs;
+
+static void out_write(const void *buf, size_t len)
+{
+	if (len && fwrite(buf, len, 1, out) != 1)
+		die("write error: %s", strerror(errno));
+	out_ofs += len;
+}
+
+static void out_align(void)
+{
+	static const char zero[8];
+
+	out_write(zero, (8 - (out_ofs & 7)) & 7);
+}
+
+/* emits the range <start>..<end> reporting network <e> */
+static void emit_range(u128 start, u128 end, const struct entry *e, uint64_t *count)
+{
+	(*count)++;
+	if (!out)
+		return;
+
+	if (!e->v6) {
+		struct mapbin_ip4 r = {
+			.start = (uint32_t)start, .end = (uint32_t)end,
+			.key = e->key, .val = e->val,
+		};
+
+		out_write(&r, sizeof(r));
+	}
+	else {
+		struct mapbin_ip6 r = { .key = e->key, .val = e->val };
+		int i;
+
+		for (i = 15; i >= 0; i--) {
+			r.start[i] = (uint8_t)start;
+			r.end[i] = (uint8_t)end;
+			start >>= 8;
+			end >>= 8;
+		}
+		out_write(&r, sizeof(r));
+	}
+}
+
+/* Turns the sorted networks of entries <first> to <last> (excluded), which
+ * may be nested, into disjoint ranges reporting the most specific network.
+ * When <out> is NULL, they are only counted. Returns the number of ranges.
+ */
+static uint64_t flatten(size_t first, size_t last)
+{
+	const struct entry **stack;
+	const struct entry *top;
+	uint64_t count = 0;
+	size_t sp = 0, i;
+	u128 pos = 0;
+
+	stack = malloc((last - first + 1) * sizeof(*stack));
+	if (!stack)
+		die("out of memory");
+
+	for (i = first; i < last; i++) {
+		const struct entry *e = &entries[i];
+
+		/* duplicate network: the first one wins */
+		if (i > first && e->start == entries[i - 1].start && e->plen == entries[i - 1].plen)
+			continue;
+
+		while (sp && stack[sp - 1]->end < e->start) {
+			top = stack[--sp];
+			if (pos <= top->end)
+				emit_range(pos, top->end, top, &count);
+			pos = top->end + 1;
+		}
+
+		if (sp && pos < e->start)
+			emit_range(pos, e->start - 1, stack[sp - 1], &count);
+
+		pos = e->start;
+		stack[sp++] = e;
+	}
+
+	while (sp) {
+		top = stack[--sp];
+		if (pos <= top->end)
+			emit_range(pos, top->end, top, &count);
+		if (top->end == (top->v6 ? ~(u128)0 : 0xffffffffU))
+			break;
+		pos = top->end + 1;
+	}
+
+	free(stack);
+	return count;
+}
+
+int main(int argc, char **argv)
+{
+	struct mapbin_hdr hdr;
+	const char *output = NULL;
+	char *tmpname;
+	int acl = 0, ip = 0;
+	size_t nb4, i, j;
+	int opt;
+
+	progname = argv[0];
+	while ((opt = getopt(argc, argv, "at:o:")) != -1) {
+		switch (opt) {
+		case 'a':
+			acl = 1;
+			break;
+		case 't':
+			if (strcmp(optarg, "ip") == 0)
+				ip = 1;
+			else if (strcmp(optarg, "str") == 0)
+				ip = 0;
+			else
+				usage();
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (!output || optind != argc - 1)
+		usage();
+
+	read_file(argv[optind], acl, ip);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MAPBIN_MAGIC, sizeof(hdr.magic));
+	hdr.endian = MAPBIN_ENDIAN;
+	hdr.kind = ip ? MAPBIN_KIND_IP : MAPBIN_KIND_STR;
+	hdr.flags = acl ? 0 : MAPBIN_F_VALUES;
+	for (i = 0; i < nb_entries; i++) {
+		if (entries[i].key_len > hdr.max_key_len)
+			hdr.max_key_len = entries[i].key_len;
+	}
+
+	if (ip) {
+		qsort(entries, nb_entries, sizeof(*entries), cmp_net);
+		for (nb4 = 0; nb4 < nb_entries && !entries[nb4].v6; nb4++)
+			;
+		hdr.nb_ip4 = flatten(0, nb4);
+		hdr.nb_ip6 = flatten(nb4, nb_entries);
+	}
+	else {
+		/* sort and only keep the first occurrence of each key */
+		qsort(entries, nb_entries, sizeof(*entries), cmp_str);
+		for (i = j = 0; i < nb_entries; i++) {
+			if (j && entries[j - 1].key_len == entries[i].key_len &&
+			    memcmp(text + entries[j - 1].key, text + entries[i].key, entries[i].key_len) == 0)
+				continue;
+			entries[j++] = entries[i];
+		}
+		nb_entries = j;
+		hdr.nb_str = nb_entries;
+	}
+
+	/* compute the layout */
+	out_ofs = (sizeof(hdr) + 7) & ~7ULL;
+	hdr.str_ofs = out_ofs;
+	out_ofs = (out_ofs + hdr.nb_str * sizeof(struct mapbin_str) + 7) & ~7ULL;
+	hdr.ip4_ofs = out_ofs;
+	out_ofs = (out_ofs + hdr.nb_ip4 * sizeof(struct mapbin_ip4) + 7) & ~7ULL;
+	hdr.ip6_ofs = out_ofs;
+	out_ofs = (out_ofs + hdr.nb_ip6 * sizeof(struct mapbin_ip6) + 7) & ~7ULL;
+	hdr.text_ofs = out_ofs;
+	hdr.text_len = text_len;
+	hdr.size = hdr.text_ofs + text_len;
+
+	tmpname = malloc(strlen(output) + 32);
+	if (!tmpname)
+		die("out of memory");
+	sprintf(tmpname, "%s.tmp.%d", output, (int)getpid());
+
+	out = fopen(tmpname, "w");
+	if (!out)
+		die("cannot create '%s': %s", tmpname, strerror(errno));
+
+	out_ofs = 0;
+	out_write(&hdr, sizeof(hdr));
+	out_align();
+
+	for (i = 0; i < hdr.nb_str; i++) {
+		struct mapbin_str s = {
+			.key = entries[i].key, .key_len = entries[i].key_len, .val = entries[i].val,
+		};
+
+		out_write(&s, sizeof(s));
+	}
+	out_align();
+
+	if (ip) {
+		flatten(0, nb4);
+		out_align();
+		flatten(nb4, nb_entries);
+		out_align();
+	}
+
+	out_write(text, text_len);
+
+	if (out_ofs != hdr.size)
+		die("internal error: wrote %llu bytes instead of %llu",
+		    (unsigned long long)out_ofs, (unsigned long long)hdr.size);
+
+	if (fclose(out) != 0)
+		die("write error: %s", strerror(errno));
+
+	if (rename(tmpname, output) < 0) {
+		unlink(tmpname);
+		die("cannot rename '%s' to '%s': %s", tmpname, output, strerror(errno));
+	}
+
+	fprintf(stderr, "%s: %llu entries, %llu IPv4 ranges, %llu IPv6 ranges, %llu bytes\n",
+		output, (unsigned long long)hdr.nb_str, (unsigned long long)hdr.nb_ip4,
+		(unsigned long long)hdr.nb_ip6, (unsigned long long)hdr.size);
+	return 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * HTTP/1 header parser benchmark. Replays captured messages through
+ * h1_headers_to_hdr_list() with each available scanner and reports the
+ * throughput, so that parsing performance can be compared between releases.
+ *
+ * The input files contain one or more raw HTTP/1 messages, each one ending
+ * with an empty line (CRLF or LF alone). Bodies are not supported. Messages
+ * are parsed as requests unless -r is passed. The parsing results of each
+ * scanner are compared to those of the "generic" one and any difference is
+ * reported as an error.
+ *
+ * Build like this from the top directory, after building haproxy:
+ *    make dev/h1/h1-bench
+ *
+ * Example:
+ *    dev/h1/h1-bench -n 100000 reqs.txt
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <haproxy/api.h>
+#include <haproxy/cfgparse.h>
+#include <haproxy/h1.h>
+#include <haproxy/http-hdr-t.h>
+#include <haproxy/tools.h>
+
+#define MAX_MSG_SIZE 65536
+#define MAX_HDR_NUM  101
+#define MAX_MSGS     10000
+
+struct msg {
+	char *raw;
+	size_t len;
+};
+
+static struct msg msgs[MAX_MSGS];
+static int nb_msgs;
+static size_t total_len;
+
+static char work[MAX_MSG_SIZE];
+static struct http_hdr hdrs[MAX_HDR_NUM];
+
+/* The parser doesn't use these but they're referenced by the objects we're
+ * linked with.
+ */
+void ha_backtrace_to_stderr(void) { }
+void complain(int *counter, const char *msg, int taint) { fputs(msg, stderr); }
+void cfg_register_keywords(struct cfg_kw_list *kwl) { }
+unsigned int read_uint(const char **s, const char *end) { abort(); }
+unsigned int strl2ui(const char *s, int len) { abort(); }
+char *memprintf(char **out, const char *format, ...) { abort(); }
+uint64_t ha_random64(void) { abort(); }
+
+__attribute__((noreturn)) static void usage(const char *name, int code)
+{
+	fprintf(stderr,
+		"Usage: %s [-n loops] [-s scanner] [-l] [-r] file...\n"
+		"  -n loops   : number of times all messages are parsed (default: 10000)\n"
+		"  -s scanner : only test this scanner (default: all supported ones)\n"
+		"  -l         : ask the parser to turn header names to lower case\n"
+		"  -r         : parse messages as responses instead of requests\n"
+		"  -h         : show this help\n", name);
+	exit(code);
+}
+
+/* loads all messages from file <name>, returns 0 on error */
+static int load_file(const char *name)
+{
+	FILE *f;
+	char *data = NULL;
+	size_t size = 0, len = 0, ret;
+	char *p, *e, *msg;
+
+	f = fopen(name, "r");
+	if (!f) {
+		fprintf(stderr, "Cannot open '%s': %s\n", name, strerror(errno));
+		return 0;
+	}
+
+	do {
+		if (len == size) {
+			size = size ? size * 2 : 65536;
+			data = realloc(data, size);
+			if (!data) {
+				fprintf(stderr, "Out of memory\n");
+				fclose(f);
+				return 0;
+			}
+		}
+		ret = fread(data + len, 1, size - len, f);
+		len += ret;
+	} while (ret);
+	fclose(f);
+
+	/* cut the messages after each empty line */
+	for (p = msg = data, e = data + len; p < e; p++) {
+		if (*p != '\n')
+			continue;
+		if (!((p + 1 < e && p[1] == '\n') ||
+		      (p + 2 < e && p[1] == '\r' && p[2] == '\n')))
+			continue;
+
+		p += (p[1] == '\n') ? 1 : 2;
+		if (nb_msgs >= MAX_MSGS || p + 1 - msg > MAX_MSG_SIZE) {
+			fprintf(stderr, "Too many or too large messages in '%s'\n", name);
+			return 0;
+		}
+		msgs[nb_msgs].raw = msg;
+		msgs[nb_msgs].len = p + 1 - msg;
+		total_len += msgs[nb_msgs].len;
+		nb_msgs++;
+		msg = p + 1;
+	}
+	return 1;
+}
+
+/* FNV-1a hash of <len> bytes at <p> */
+static uint64_t hash_blk(const char *p, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (len--)
+		hash = (hash ^ (unsigned char)*p++) * 0x100000001b3ULL;
+	return hash;
+}
+
+/* parses message <m> and returns a hash of the result, which includes the
+ * return value, the error position and the headers found, if <check> is set.
+ * Otherwise only the return value is returned.
+ */
+static uint64_t parse_one(const struct msg *m, int resp, int lower, int check)
+{
+	struct h1m h1m;
+	uint64_t hash;
+	int ret, i;
+
+	memcpy(work, m->raw, m->len);
+	if (resp)
+		h1m_init_res(&h1m);
+	else
+		h1m_init_req(&h1m);
+	if (lower)
+		h1m.flags |= H1_MF_TOLOWER;
+
+	ret = h1_headers_to_hdr_list(work, work + m->len, hdrs, MAX_HDR_NUM, &h1m, NULL);
+	if (!check)
+		return ret;
+
+	hash = (uint64_t)ret * 0x9E3779B97F4A7C15ULL + h1m.err_pos + h1m.flags;
+	for (i = 0; ret > 0 && i < MAX_HDR_NUM && istlen(hdrs[i].n); i++) {
+		hash = hash * 31 + hash_blk(istptr(hdrs[i].n), istlen(hdrs[i].n));
+		hash = hash * 31 + hash_blk(istptr(hdrs[i].v), istlen(hdrs[i].v));
+	}
+	return hash;
+}
+
+/* parses all messages and returns the combined hash of the results */
+static uint64_t parse_all(int resp, int lower, int check)
+{
+	uint64_t hash = 0;
+	int i;
+
+	for (i = 0; i < nb_msgs; i++)
+		hash = hash * 31 + parse_one(&msgs[i], resp, lower, check);
+	return hash;
+}
+
+/* runs the benchmark with scanner <name>. Returns 0 if the results differ
+ * from <ref>.
+ */
+static int bench(const char *name, int loops, int resp, int lower, uint64_t ref)
+{
+	struct timespec t0, t1;
+	double sec;
+	int loop;
+
+	if (parse_all(resp, lower, 1) != ref) {
+		printf("%-8s : results differ from the generic scanner!\n", name);
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (loop = 0; loop < loops; loop++)
+		parse_all(resp, lower, 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%-8s : %10.0f msg/s %9.1f MB/s %8.1f ns/msg\n", name,
+	       (double)nb_msgs * loops / sec,
+	       (double)total_len * loops / sec / 1e6,
+	       sec * 1e9 / ((double)nb_msgs * loops));
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *const scanners[] = { "avx2", "sse2", "neon", "generic" };
+	const char *only = NULL;
+	int loops = 10000;
+	int resp = 0, lower = 0;
+	uint64_t ref;
+	int opt, i, err = 0;
+
+	while ((opt = getopt(argc, argv, "n:s:lrh")) != -1) {
+		switch (opt) {
+		case 'n': loops = atoi(optarg); break;
+		case 's': only = optarg; break;
+		case 'l': lower = 1; break;
+		case 'r': resp = 1; break;
+		case 'h': usage(argv[0], 0);
+		default:  usage(argv[0], 1);
+		}
+	}
+
+	if (optind >= argc)
+		usage(argv[0], 1);
+
+	for (; optind < argc; optind++)
+		if (!load_file(argv[optind]))
+			return 1;
+
+	if (!nb_msgs) {
+		fprintf(stderr, "No message found\n");
+		return 1;
+	}
+
+	printf("%d messages, %zu bytes, %d loops\n", nb_msgs, total_len, loops);
+
+	h1_select_scanner("generic");
+	ref = parse_all(resp, lower, 1);
+
+	for (i = 0; i < sizeof(scanners) / sizeof(*scanners); i++) {
+		if (only && strcmp(only, scanners[i]) != 0)
+			continue;
+		if (!h1_select_scanner(scanners[i])) {
+			if (only) {
+				fprintf(stderr, "Scanner '%s' is not supported here\n", only);
+				return 1;
+			}
+			continue;
+		}
+		if (!bench(scanners[i], loops, resp, lower, ref))
+			err = 1;
+	}
+	return err;
+}
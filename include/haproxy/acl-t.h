@@ -142,6 +142,10 @@ struct acl_cond {
 	unsigned int val;           /* or'ed bit mask of all suites's SMP_VAL_* */
 	const char *file;           /* config file where the condition is declared */
 	int line;                   /* line in the config file where the condition is declared */
+	struct list by_all;         /* member of the acl_conds list of parsed conditions */
+	uint64_t prof_calls;        /* number of evaluations while rules profiling is on */
+	uint64_t prof_match;        /* number of evaluations where the condition was met */
+	uint64_t prof_time;         /* total evaluation time in nanoseconds */
 };
 
 struct acl_sample {
@@ -28,6 +28,9 @@
 
 struct stream;
 
+extern struct list acl_conds;
+extern int acl_rules_optimize;
+
 /*
  * FIXME: we need destructor functions too !
  */
@@ -33,6 +33,7 @@
 #define HA_PROF_TASKS_MASK  0x00000003     /* per-task CPU profiling mask */
 
 #define HA_PROF_MEMORY      0x00000004     /* memory profiling */
+#define HA_PROF_RULES       0x00000008     /* rules profiling */
 
 
 #ifdef USE_MEMORY_PROFILING
@@ -107,6 +108,9 @@ struct activity {
 	unsigned int pool_fail;    // failed a pool allocation
 	unsigned int buf_wait;     // waited on a buffer allocation
 	unsigned int check_started;// number of times a check was started on this thread
+	unsigned int poll_sysc;    // syscalls performed by the poller (waits and polling updates)
+	unsigned int smp_cache_hit; // sample fetches served from a stream's sample cache
+	unsigned int smp_cache_miss;// cacheable sample fetches not found in the cache
 #if defined(DEBUG_DEV)
 	/* keep these ones at the end */
 	unsigned int ctr0;         // general purposee debug counter
@@ -121,6 +125,13 @@ struct activity {
 #define SCHED_ACT_HASH_BITS 8
 #define SCHED_ACT_HASH_BUCKETS (1U << SCHED_ACT_HASH_BITS)
 
+/* Latencies and CPU times are also accounted in log2 histograms. Bucket 0
+ * counts values below 1024ns, and bucket N counts values between 2^(N+9) and
+ * 2^(N+10)-1 ns. Since values are 32-bit nanoseconds, 23 buckets cover all
+ * of them, the last one ending at ~4.3s.
+ */
+#define SCHED_ACT_HIST_BUCKETS 23
+
 /* global profiling stats from the scheduler: each entry corresponds to a
  * task or tasklet ->process function pointer, with a number of calls and
  * a total time. Each entry is unique, except entry 0 which is for colliding
@@ -132,6 +143,8 @@ struct sched_activity {
 	uint64_t calls;
 	uint64_t cpu_time;
 	uint64_t lat_time;
+	uint32_t lat_hist[SCHED_ACT_HIST_BUCKETS]; /* wakeup latency histogram */
+	uint32_t cpu_hist[SCHED_ACT_HIST_BUCKETS]; /* CPU time histogram */
 };
 
 #endif /* _HAPROXY_ACTIVITY_T_H */
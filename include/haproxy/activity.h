@@ -24,6 +24,7 @@
 
 #include <haproxy/activity-t.h>
 #include <haproxy/api.h>
+#include <haproxy/intops.h>
 
 extern unsigned int profiling;
 extern struct activity activity[MAX_THREADS];
@@ -33,6 +34,34 @@ void report_stolen_time(uint64_t stolen);
 void activity_count_runtime(uint32_t run_time);
 struct sched_activity *sched_activity_entry(struct sched_activity *array, const void *func, const void *caller);
 
+uint64_t sched_act_hist_quantile(const uint32_t *hist, uint permille);
+
+/* returns the sched_activity histogram bucket for <ns> nanoseconds */
+static inline uint sched_act_hist_bucket(uint32_t ns)
+{
+	return ns < 1024 ? 0 : my_flsl(ns) - 10;
+}
+
+/* returns the upper bound in nanoseconds of histogram bucket <bucket> */
+static inline uint64_t sched_act_hist_limit(uint bucket)
+{
+	return 1ULL << (bucket + 10);
+}
+
+/* accounts wakeup latency <lat> in nanoseconds to profiling entry <entry> */
+static inline void sched_activity_add_lat(struct sched_activity *entry, uint32_t lat)
+{
+	HA_ATOMIC_ADD(&entry->lat_time, lat);
+	HA_ATOMIC_INC(&entry->lat_hist[sched_act_hist_bucket(lat)]);
+}
+
+/* accounts CPU time <cpu> in nanoseconds to profiling entry <entry> */
+static inline void sched_activity_add_cpu(struct sched_activity *entry, uint32_t cpu)
+{
+	HA_ATOMIC_ADD(&entry->cpu_time, cpu);
+	HA_ATOMIC_INC(&entry->cpu_hist[sched_act_hist_bucket(cpu)]);
+}
+
 #ifdef USE_MEMORY_PROFILING
 struct memprof_stats *memprof_get_bin(const void *ra, enum memprof_method meth);
 #endif
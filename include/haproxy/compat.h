@@ -205,6 +205,46 @@ typedef struct { } empty_t;
 #endif
 #endif
 
+/* UDP segmentation offload (GSO, Linux 4.18) and receive offload (GRO, Linux
+ * 5.0) may be missing from older libc headers. sendmmsg()/recvmmsg() exist
+ * since Linux 3.0 and glibc 2.14.
+ */
+#if defined(__linux__)
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#define HA_HAVE_UDP_GSO
+#define HA_HAVE_UDP_GRO
+#if defined(__GNU_LIBRARY__) && (__GLIBC__ > 2 || __GLIBC__ == 2 && __GLIBC_MINOR__ >= 14)
+#define HA_HAVE_MMSG
+#endif
+#endif /* __linux__ */
+
+/* MSG_ZEROCOPY for TCP appeared in Linux 4.14 and may be missing from older
+ * libc headers. Completions are reported on the socket's error queue.
+ */
+#if defined(__linux__)
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#define HA_HAVE_MSG_ZEROCOPY
+#endif /* __linux__ */
+
 /* If IPv6 is supported, define IN6_IS_ADDR_V4MAPPED() if missing. */
 #if defined(IPV6_TCLASS) && !defined(IN6_IS_ADDR_V4MAPPED)
 #define IN6_IS_ADDR_V4MAPPED(a) \
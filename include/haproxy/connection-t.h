@@ -86,7 +86,9 @@ enum {
 
 	CO_FL_OPT_TOS       = 0x00000020,  /* connection has a special sockopt tos */
 
-	/* unused : 0x00000040, 0x00000080 */
+	CO_FL_OPT_ZEROCOPY  = 0x00000040,  /* connection may send with MSG_ZEROCOPY */
+
+	/* unused : 0x00000080 */
 
 	/* These flags indicate whether the Control and Transport layers are initialized */
 	CO_FL_CTRL_READY    = 0x00000100, /* FD was registered, fd_delete() needed */
@@ -168,14 +170,14 @@ static forceinline char *conn_show_flags(char *buf, size_t len, const char *deli
 	_(0);
 	/* flags */
 	_(CO_FL_SAFE_LIST, _(CO_FL_IDLE_LIST, _(CO_FL_CTRL_READY,
-	_(CO_FL_REVERSED, _(CO_FL_ACT_REVERSING, _(CO_FL_OPT_MARK, _(CO_FL_OPT_TOS,
+	_(CO_FL_REVERSED, _(CO_FL_ACT_REVERSING, _(CO_FL_OPT_MARK, _(CO_FL_OPT_TOS, _(CO_FL_OPT_ZEROCOPY,
 	_(CO_FL_XPRT_READY, _(CO_FL_WANT_DRAIN, _(CO_FL_WAIT_ROOM, _(CO_FL_EARLY_SSL_HS,
 	_(CO_FL_EARLY_DATA, _(CO_FL_SOCKS4_SEND, _(CO_FL_SOCKS4_RECV, _(CO_FL_SOCK_RD_SH,
 	_(CO_FL_SOCK_WR_SH, _(CO_FL_ERROR, _(CO_FL_FDLESS, _(CO_FL_WAIT_L4_CONN,
 	_(CO_FL_WAIT_L6_CONN, _(CO_FL_SEND_PROXY, _(CO_FL_ACCEPT_PROXY, _(CO_FL_ACCEPT_CIP,
 	_(CO_FL_SSL_WAIT_HS, _(CO_FL_PRIVATE, _(CO_FL_RCVD_PROXY, _(CO_FL_SESS_IDLE,
 	_(CO_FL_XPRT_TRACKED
-	))))))))))))))))))))))))))));
+	)))))))))))))))))))))))))))));
 	/* epilogue */
 	_(~0U);
 	return buf;
@@ -280,6 +282,7 @@ enum {
 	CO_SFL_MSG_MORE    = 0x0001,    /* More data to come afterwards */
 	CO_SFL_STREAMER    = 0x0002,    /* Producer is continuously streaming data */
 	CO_SFL_LAST_DATA   = 0x0003,    /* Sent data are the last ones, shutdown is pending */
+	CO_SFL_ZEROCOPY    = 0x0004,    /* Buffer will be held until released by the kernel, may use MSG_ZEROCOPY */
 };
 
 /* known transport layers (for ease of lookup) */
@@ -565,6 +568,35 @@ struct connection {
 	} reverse;
 	uint32_t mark;                 /* set network mark, if CO_FL_OPT_MARK is set */
 	uint8_t tos;                   /* set ip tos, if CO_FL_OPT_TOS is set */
+	struct conn_zc *zc;            /* MSG_ZEROCOPY send tracking, allocated on first use, or NULL */
+};
+
+/* Maximum number of buffers a connection may hold while waiting for the
+ * kernel to report completion of the MSG_ZEROCOPY sends which reference them.
+ */
+#define CONN_ZC_MAX_HELD 8
+
+/* MSG_ZEROCOPY tracking for a connection. Each successful zero-copy send()
+ * consumes one 32-bit id from the socket's counter, and the kernel reports
+ * ranges of completed ids on the socket's error queue. The buffers passed to
+ * these sends must not be reused before their last id is completed, so they
+ * are held here in a ring, in send order, until then. If the connection is
+ * closed before, the context is detached from it and parked with a duplicate
+ * of the socket's FD until the last completions are collected.
+ */
+struct conn_zc {
+	uint32_t next_id;              /* id the kernel will assign to the next zero-copy send */
+	uint32_t done_id;              /* all ids strictly below this one were completed */
+	uint16_t head;                 /* index of the oldest held buffer */
+	uint16_t count;                /* number of held buffers */
+	int fd;                        /* duplicate of the socket's FD, only once parked */
+	size_t last_sent;              /* bytes sent with MSG_ZEROCOPY by the last snd_buf() call */
+	struct list list;              /* entry in the thread's list of parked contexts */
+	int expire;                    /* date after which a parked context is force-released */
+	struct {
+		struct buffer buf;     /* the held buffer */
+		uint32_t last_id;      /* id of the last send which referenced it */
+	} held[CONN_ZC_MAX_HELD];
 };
 
 /* node for backend connection in the idle trees for http-reuse
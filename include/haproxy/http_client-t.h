@@ -46,6 +46,7 @@ struct httpclient {
 /* status (FS) */
 #define    HTTPCLIENT_FS_STARTED      0x00010000 /* the httpclient was started */
 #define    HTTPCLIENT_FS_ENDED        0x00020000 /* the httpclient is stopped */
+#define    HTTPCLIENT_FS_RES_COMPLETE 0x00040000 /* the whole response was received */
 
 /* States of the HTTP Client Appctx */
 enum {
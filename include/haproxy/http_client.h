@@ -31,6 +31,12 @@ static inline int httpclient_ended(struct httpclient *hc)
 	return !!(hc->flags & HTTPCLIENT_FS_ENDED);
 }
 
+/* Return 1 if the httpclient ended after receiving the whole response */
+static inline int httpclient_res_complete(struct httpclient *hc)
+{
+	return !!(hc->flags & HTTPCLIENT_FS_RES_COMPLETE);
+}
+
 /* Return 1 if the httpclient started */
 static inline int httpclient_started(struct httpclient *hc)
 {
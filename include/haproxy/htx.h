@@ -36,6 +36,7 @@
 #define HTX_UNKOWN_PAYLOAD_LENGTH ULLONG_MAX
 
 extern struct htx htx_empty;
+extern THREAD_LOCAL unsigned int htx_hdr_gen;
 
 struct htx_blk *htx_defrag(struct htx *htx, struct htx_blk *blk, uint32_t info);
 struct htx_blk *htx_add_blk(struct htx *htx, enum htx_blk_type type, uint32_t blksz);
@@ -62,6 +63,19 @@ struct htx_blk *htx_add_last_data(struct htx *htx, struct ist data);
 void htx_move_blk_before(struct htx *htx, struct htx_blk **blk, struct htx_blk **ref);
 int htx_append_msg(struct htx *dst, const struct htx *src);
 
+/* Reports that a block of type <type> was added, modified or removed. When it
+ * is part of the start-line or the headers, the thread's headers generation
+ * number is incremented so that results derived from the headers of any
+ * message may be invalidated (e.g. cached sample fetches). The HTX functions
+ * call it themselves, but code modifying the contents of a block in place
+ * through its pointer must call it explicitly.
+ */
+static inline void htx_hdr_changed(enum htx_blk_type type)
+{
+	if (type < HTX_BLK_DATA)
+		htx_hdr_gen++;
+}
+
 /* Functions and macros to get parts of the start-line or length of these
  * parts. Request and response start-lines are both composed of 3 parts.
  */
@@ -336,6 +350,7 @@ static inline void htx_change_blk_value_len(struct htx *htx, struct htx_blk *blk
 	uint32_t oldlen, sz;
 	int32_t delta;
 
+	htx_hdr_changed(type);
 	sz = htx_get_blksz(blk);
 	switch (type) {
 		case HTX_BLK_HDR:
@@ -0,0 +1,91 @@
+/*
+ * include/haproxy/mapbin-t.h
+ * Layout of the precompiled pattern files produced by admin/mapbin.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HAPROXY_MAPBIN_T_H
+#define _HAPROXY_MAPBIN_T_H
+
+#include <stdint.h>
+
+/* A precompiled pattern file is made of a header followed by sorted arrays of
+ * fixed-size entries and by a text area holding the zero-terminated keys and
+ * values as they appeared in the source file. It is meant to be mapped
+ * read-only in memory and directly looked up, so all integers are stored in
+ * the byte order of the machine which generated it, which is checked using
+ * <endian>. All offsets are relative to the beginning of the file, except the
+ * key and value offsets of entries, which are relative to the text area. All
+ * arrays are 8-byte aligned.
+ */
+#define MAPBIN_MAGIC      "HAPMAPB\x01"  /* 8 bytes, last one is the version */
+#define MAPBIN_ENDIAN     0x01020304U
+#define MAPBIN_NO_VALUE   (~0U)          /* value offset of entries without value */
+
+/* kinds of keys */
+enum {
+	MAPBIN_KIND_STR = 1,    /* exact strings, for "str" matching */
+	MAPBIN_KIND_IP  = 2,    /* IPv4/IPv6 networks, for "ip" matching */
+};
+
+/* header flags */
+#define MAPBIN_F_VALUES   0x00000001  /* entries have a value (map file) */
+
+struct mapbin_hdr {
+	char magic[8];          /* MAPBIN_MAGIC */
+	uint32_t endian;        /* MAPBIN_ENDIAN in the generator's byte order */
+	uint32_t kind;          /* MAPBIN_KIND_* */
+	uint32_t flags;         /* MAPBIN_F_* */
+	uint32_t max_key_len;   /* length of the longest key */
+	uint64_t size;          /* total file size */
+	uint64_t nb_str;        /* number of string entries */
+	uint64_t str_ofs;       /* offset of the mapbin_str array */
+	uint64_t nb_ip4;        /* number of IPv4 ranges */
+	uint64_t ip4_ofs;       /* offset of the mapbin_ip4 array */
+	uint64_t nb_ip6;        /* number of IPv6 ranges */
+	uint64_t ip6_ofs;       /* offset of the mapbin_ip6 array */
+	uint64_t text_ofs;      /* offset of the text area */
+	uint64_t text_len;      /* length of the text area */
+};
+
+/* string entry, sorted by key bytes then length. Duplicate keys are removed
+ * and only the first one of the source file is kept.
+ */
+struct mapbin_str {
+	uint32_t key;           /* offset of the key in the text area */
+	uint32_t key_len;       /* key length, without the trailing zero */
+	uint32_t val;           /* offset of the value, or MAPBIN_NO_VALUE */
+};
+
+/* IPv4 range, in host byte order. Ranges are sorted and disjoint, and each of
+ * them reports the most specific network of the source file covering it.
+ */
+struct mapbin_ip4 {
+	uint32_t start;         /* first address of the range */
+	uint32_t end;           /* last address of the range */
+	uint32_t key;           /* offset of the network as written in the source */
+	uint32_t val;           /* offset of the value, or MAPBIN_NO_VALUE */
+};
+
+/* IPv6 range, in network byte order, with the same rules as IPv4 ranges */
+struct mapbin_ip6 {
+	uint8_t start[16];      /* first address of the range */
+	uint8_t end[16];        /* last address of the range */
+	uint32_t key;           /* offset of the network as written in the source */
+	uint32_t val;           /* offset of the value, or MAPBIN_NO_VALUE */
+};
+
+#endif /* _HAPROXY_MAPBIN_T_H */
@@ -119,6 +119,23 @@
 #endif
 
 
+/* kernel TLS offload relies on OpenSSL >= 3.0 passing the keys to the BIO.
+ * The BIO controls used to set it up are not exported, only the two ones used
+ * to query the state are. The private ones are numbered around them, which we
+ * check below before deriving them, so that an unexpected layout simply turns
+ * the feature off instead of misinterpreting controls.
+ */
+#if defined(__linux__) && defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS) && \
+    (HA_OPENSSL_VERSION_NUMBER >= 0x30000000L) && !defined(LIBRESSL_VERSION_NUMBER) && \
+    !defined(USE_OPENSSL_WOLFSSL) && !defined(USE_OPENSSL_AWSLC) && \
+    defined(BIO_CTRL_GET_KTLS_SEND) && defined(BIO_CTRL_GET_KTLS_RECV) && \
+    (BIO_CTRL_GET_KTLS_RECV == BIO_CTRL_GET_KTLS_SEND + 3)
+#define HAVE_SSL_KTLS
+#define HA_BIO_CTRL_SET_KTLS                  (BIO_CTRL_GET_KTLS_SEND - 1)
+#define HA_BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG (BIO_CTRL_GET_KTLS_SEND + 1)
+#define HA_BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG    (BIO_CTRL_GET_KTLS_SEND + 2)
+#endif
+
 #if defined(SSL_CTX_set_security_level) || HA_OPENSSL_VERSION_NUMBER >= 0x1010100fL
 #define HAVE_SSL_SET_SECURITY_LEVEL
 #endif
@@ -25,7 +25,9 @@
 #include <import/ebtree-t.h>
 
 #include <haproxy/api-t.h>
+#include <haproxy/mapbin-t.h>
 #include <haproxy/regex-t.h>
+#include <haproxy/regex_set-t.h>
 #include <haproxy/sample_data-t.h>
 #include <haproxy/thread-t.h>
 
@@ -70,6 +72,7 @@ enum {
 enum {
 	PAT_SF_TREE        = 1 << 0,       /* some patterns are arranged in a tree */
 	PAT_SF_REGFREE     = 1 << 1,       /* run regex_free() on the pointer */
+	PAT_SF_MMAP        = 1 << 2,       /* comes from a precompiled file mapped in memory */
 };
 
 /* ACL match methods */
@@ -92,6 +95,70 @@ enum {
 	PAT_MATCH_NUM
 };
 
+/* kinds of string automatons which may be built from the patterns list of an
+ * expression, depending on the match method.
+ */
+enum {
+	PAT_AC_SUB = 0,  /* Aho-Corasick automaton for "sub" */
+	PAT_AC_BEG,      /* anchored trie for "beg" */
+	PAT_AC_END,      /* anchored trie of reversed patterns for "end" */
+	PAT_AC_KINDS     /* must be last */
+};
+
+/* automatons used by the heads of an expression (pattern_expr->automatons) */
+#define PAT_AUTO_AC(kind)  (1U << (kind))       /* string automaton of this PAT_AC_* kind */
+#define PAT_AUTO_RSET      (1U << PAT_AC_KINDS) /* regex set, if enabled */
+
+/* Automaton built from the string patterns of an expression for a given
+ * generation and revision of its reference. Nodes are numbered in breadth-first
+ * order from the root (0), so that the children of a node are consecutive and
+ * sorted by the label of the edge leading to them. The patterns are numbered
+ * in the list order, and <order> stores for each node the lowest pattern
+ * number matching there, so that the first matching pattern of the list is
+ * returned. An automaton without nodes means that the list is cheaper to use.
+ */
+struct pat_ac {
+	unsigned long long revision; /* revision of the pat_ref it was built for */
+	unsigned int gen;            /* generation of the pat_ref it was built for */
+	unsigned int built;          /* date of the build, in ticks */
+	unsigned int nb_nodes;       /* number of nodes, 0 if unused */
+	struct pattern **pats;       /* patterns indexed by their list order */
+	unsigned int *first;         /* first child of each node */
+	unsigned int *fail;          /* failure link of each node (PAT_AC_SUB only) */
+	unsigned int *order;         /* lowest order of the patterns matching at each node, ~0 if none */
+	unsigned short *nb_child;    /* number of children of each node */
+	unsigned char *label;        /* label of the edge leading to each node */
+	unsigned int root_next[256]; /* children of the root by label, 0 if none */
+};
+
+/* Regex patterns of an expression compiled into a single regex set for a given
+ * generation and revision of its reference. The patterns are numbered in the
+ * list order, which is the number reported by the set. Those the set does not
+ * support are listed by increasing number in <fallback> and are matched one at
+ * a time. A missing set means that the list is cheaper to use.
+ */
+struct pat_rset {
+	unsigned long long revision; /* revision of the pat_ref it was built for */
+	unsigned int gen;            /* generation of the pat_ref it was built for */
+	unsigned int built;          /* date of the last build or flush, in ticks */
+	struct regex_set *rs;        /* compiled regexes, NULL if unused */
+	struct pattern **pats;       /* patterns indexed by their list order */
+	unsigned int *fallback;      /* numbers of the patterns not in <rs> */
+	unsigned int nb_fallback;    /* number of entries in <fallback> */
+};
+
+/* A precompiled pattern file (see mapbin-t.h) mapped in memory. Its entries
+ * are looked up in place after those added at run time.
+ */
+struct pat_bin {
+	const struct mapbin_hdr *hdr;  /* start of the mapping */
+	const struct mapbin_str *str;  /* string entries */
+	const struct mapbin_ip4 *ip4;  /* IPv4 ranges */
+	const struct mapbin_ip6 *ip6;  /* IPv6 ranges */
+	const char *text;              /* keys and values */
+	size_t size;                   /* size of the mapping */
+};
+
 #define PAT_REF_MAP  0x01 /* Set if the reference is used by at least one map. */
 #define PAT_REF_ACL  0x02 /* Set if the reference is used by at least one acl. */
 #define PAT_REF_SMP  0x04 /* Flag used if the reference contains a sample. */
@@ -114,6 +181,8 @@ struct pat_ref {
 	int unique_id; /* Each pattern reference have unique id. */
 	unsigned long long revision; /* updated for each update */
 	unsigned long long entry_cnt; /* the total number of entries */
+	unsigned int updates; /* incremented each time the set of current entries changes */
+	struct pat_bin *bin; /* precompiled file mapped in memory, or NULL */
 	THREAD_ALIGN(64);
 	__decl_thread(HA_RWLOCK_T lock); /* Lock used to protect pat ref elements */
 };
@@ -207,6 +276,10 @@ struct pattern_expr {
 	struct eb_root pattern_tree;  /* may be used for lookup in large datasets */
 	struct eb_root pattern_tree_2;  /* may be used for different types */
 	int mflags;                     /* flags relative to the parsing or matching method. */
+	struct pat_ac *ac[PAT_AC_KINDS]; /* string automatons built from <patterns>, by kind */
+	struct pat_rset *rset;          /* regex set built from <patterns> for "reg" and "regm" */
+	unsigned int automatons;        /* PAT_AUTO_* used by the heads of this expression */
+	struct task *refresh_task;      /* task (re)building the automatons, or NULL */
 	__decl_thread(HA_RWLOCK_T lock);               /* lock used to protect patterns */
 };
 
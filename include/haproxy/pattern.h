@@ -234,8 +234,10 @@ static inline void pat_ref_giveup(struct pat_ref *ref, unsigned int gen)
  */
 static inline int pat_ref_commit(struct pat_ref *ref, unsigned int gen)
 {
-	if ((int)(gen - ref->curr_gen) > 0)
+	if ((int)(gen - ref->curr_gen) > 0) {
 		ref->curr_gen = gen;
+		HA_ATOMIC_INC(&ref->updates);
+	}
 	return gen - ref->curr_gen;
 }
 
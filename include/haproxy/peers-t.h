@@ -78,6 +78,13 @@ struct peer {
 	struct shared_table *tables;
 	struct server *srv;
 	struct dcache *dcache;        /* dictionary cache */
+	struct peer_batch *batch;     /* compressed updates batching context, if negotiated */
+	uint64_t tx_batch_upd;        /* updates sent in compressed batches */
+	uint64_t tx_batch_raw;        /* uncompressed size of these updates */
+	uint64_t tx_batch_wire;       /* bytes emitted on the wire for these batches */
+	uint64_t tx_upd;              /* update messages sent */
+	uint64_t rx_upd;              /* update messages received */
+	int resync_id;                /* local resync stream index, 0 for the main local session */
 	struct peers *peers;          /* associated peer section */
 	struct peer *next;            /* next peer in the list */
 };
@@ -100,6 +107,8 @@ struct peers {
 	unsigned int resync_timeout;    /* resync timeout timer */
 	int count;                      /* total of peers */
 	int nb_shards;                  /* Number of peer shards */
+	int resync_streams;             /* Number of parallel sessions used to resync from the local peer */
+	struct peer **resync_stream;    /* local peer sessions by stream, [0] is the local peer itself */
 	int disabled;                   /* peers proxy disabled if >0 */
 	int applet_count[MAX_THREADS];  /* applet count per thread */
 };
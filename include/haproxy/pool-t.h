@@ -27,6 +27,7 @@
 
 #define MEM_F_SHARED	0x1
 #define MEM_F_EXACT	0x2
+#define MEM_F_ARENA	0x4	/* objects are carved from the memory arena when possible */
 
 /* A special pointer for the pool's free_list that indicates someone is
  * currently manipulating it. Serves as a short-lived lock.
@@ -51,6 +52,7 @@
 #define POOL_DBG_TAG        0x00000080  // place a tag at the end of the area
 #define POOL_DBG_POISON     0x00000100  // poison memory area on pool_alloc()
 #define POOL_DBG_UAF        0x00000200  // enable use-after-free protection
+#define POOL_DBG_NUMA       0x00000400  // per-node shared caches, objects return home
 
 
 /* This is the head of a thread-local cache */
@@ -136,6 +138,29 @@ struct pool_head {
 		unsigned int failed;	/* failed allocations (indexed by hash of TID) */
 	} buckets[CONFIG_HAP_POOL_BUCKETS];
 
+	/* per-node shared caches, only used with POOL_DBG_NUMA. A node is a
+	 * thread group. Objects always return to the node they were first
+	 * allocated on, so that a node's threads only recycle memory that was
+	 * first touched by one of them.
+	 */
+	struct {
+		THREAD_ALIGN(64);
+		struct pool_item *free_list; /* free objects belonging to this node */
+		unsigned int hits;	/* refills satisfied from this node's list */
+		unsigned int misses;	/* refills which found this node's list empty */
+		unsigned int remote;	/* objects released by another node's threads */
+	} nodes[MAX_TGROUPS];
+
+	/* objects carved from the memory arena, only used with MEM_F_ARENA.
+	 * They are never released to the OS but go back to this list instead.
+	 */
+	struct {
+		THREAD_ALIGN(64);
+		struct pool_item *free_list; /* free objects carved from the arena */
+		unsigned int carved;	/* number of objects carved from the arena */
+		unsigned int avail;	/* number of carved objects in free_list */
+	} arena;
+
 	struct pool_cache_head cache[MAX_THREADS] THREAD_ALIGNED(64); /* pool caches */
 } __attribute__((aligned(64)));
 
@@ -97,6 +97,12 @@
 		*(typeof(caller)*)(((char *)__i) + __p->alloc_sz - sizeof(void*)) = __c; \
 	} while (0)
 
+/* With per-node shared caches, the ID of the node an object belongs to is
+ * stored after the end of the area and the optional mark above, and before
+ * the optional caller. It remains valid for the whole object's life.
+ */
+# define POOL_EXTRA_NODE (sizeof(void *))
+
 /* poison each newly allocated area with this byte if >= 0 */
 extern int mem_poison_byte;
 
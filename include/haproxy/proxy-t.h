@@ -218,6 +218,7 @@ enum PR_SRV_STATE_FILE {
 #define PR_FL_CHECKED            0x40  /* The proxy configuration was fully checked (including postparsing checks) */
 
 struct stream;
+struct switching_keys;
 
 struct http_snapshot {
 	unsigned int sid;		/* ID of the faulty stream */
@@ -472,10 +473,34 @@ struct switching_rule {
 		char *name;			/* target backend name during config parsing */
 		struct lf_expr expr;	        /* logformat expression to use for dynamic rules */
 	} be;
+	struct switching_table *table;		/* table evaluating the chain starting here, or NULL */
 	char *file;
 	int line;
 };
 
+/* A switching table replaces a chain of consecutive switching rules which all
+ * compare the same sample expression to strings. All the strings of the chain
+ * are indexed with the position of the first rule they appear in, so that the
+ * first matching rule is found with a single fetch and lookup. The table is
+ * rebuilt by a task from the pattern references when any of them changes, and
+ * is not used until then.
+ */
+struct switching_table {
+	struct list list;			/* member of the switching_tables list */
+	struct switching_rule **rules;		/* the <nb_rules> rules of the chain, in order */
+	int nb_rules;
+	struct sample_expr *expr;		/* the sample expression shared by all rules */
+	struct switching_keys *keys;		/* the indexed strings */
+	struct pat_ref **refs;			/* the <nb_refs> pattern references of the rules */
+	int nb_refs;
+	unsigned int gen;			/* sum of the refs' updates counters when built */
+	struct task *task;			/* task rebuilding the keys */
+	uint64_t prof_lookups;			/* lookups while rules profiling is on */
+	uint64_t prof_hits;			/* lookups which found a matching rule */
+	uint64_t prof_time;			/* total lookup time in nanoseconds */
+	__decl_thread(HA_RWLOCK_T lock);
+};
+
 struct server_rule {
 	struct list list;			/* list linked to from the proxy */
 	struct acl_cond *cond;			/* acl condition to meet */
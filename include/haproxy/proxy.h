@@ -36,6 +36,7 @@ extern struct proxy *proxies_list;
 extern struct eb_root used_proxy_id;	/* list of proxy IDs in use */
 extern unsigned int error_snapshot_id;  /* global ID assigned to each error then incremented */
 extern struct eb_root proxy_by_name;    /* tree of proxies sorted by name */
+extern struct list switching_tables;    /* list of all switching tables */
 
 extern const struct cfg_opt cfg_opts[];
 extern const struct cfg_opt cfg_opts2[];
@@ -86,6 +87,8 @@ struct proxy *cli_find_frontend(struct appctx *appctx, const char *arg);
 int resolve_stick_rule(struct proxy *curproxy, struct sticking_rule *mrule);
 void free_stick_rules(struct list *rules);
 void free_server_rules(struct list *srules);
+int switching_table_lookup(struct switching_table *tbl, struct proxy *px,
+                           struct session *sess, struct stream *strm);
 
 /*
  * This function returns a string containing the type of the proxy in a format
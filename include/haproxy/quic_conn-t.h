@@ -255,6 +255,8 @@ struct quic_conn_cntrs {
 	long long sendto_err;            /* total number of errors on sendto() calls, EAGAIN excepted */
 	long long sendto_err_unknown;    /* total number of errors on sendto() calls which are currently not supported */
 	long long sent_pkt;              /* total number of sent packets */
+	long long sent_dgram;            /* total number of sent datagrams */
+	long long snd_syscall;           /* total number of syscalls used to send datagrams */
 	long long lost_pkt;              /* total number of lost packets */
 	long long conn_migration_done;   /* total number of connection migration handled */
 	/* Streams related counters */
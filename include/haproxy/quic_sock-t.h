@@ -40,6 +40,25 @@ struct quic_dgram {
 	struct mt_list handler_list; /* element pointing to quic_dghdlr <dgrams>. */
 };
 
+/* Maximum number of datagrams sent in a single syscall, either coalesced
+ * with UDP GSO or batched with sendmmsg(). 64 is the kernel UDP_MAX_SEGMENTS.
+ */
+#define QUIC_MAX_SND_DGRAMS    64
+/* Maximum payload of a single GSO send, below the 64kB IP datagram limit. */
+#define QUIC_MAX_GSO_PAYLOAD   64000
+/* Maximum number of datagrams received with a single recvmmsg() call. */
+#define QUIC_MAX_RCV_DGRAMS    16
+/* Buffer size to receive UDP GRO coalesced datagrams without truncation. */
+#define QUIC_GRO_RCV_SZ        65535
+
+/* Reception slot used when receiving several datagrams in a single syscall. */
+struct quic_rx_slot {
+	struct sockaddr_storage saddr; /* peer address */
+	struct sockaddr_storage daddr; /* local reception address */
+	size_t len;                    /* number of bytes received in this slot */
+	size_t seg_sz;                 /* GRO segment size, 0 if not coalesced */
+};
+
 /* QUIC datagram handler */
 struct quic_dghdlr {
 	struct mt_list dgrams;
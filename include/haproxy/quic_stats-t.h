@@ -25,6 +25,10 @@ enum {
 	QUIC_ST_HALF_OPEN_CONN,
 	QUIC_ST_HDSHK_FAIL,
 	QUIC_ST_STATELESS_RESET_SENT,
+	QUIC_ST_SENT_DGRAM,
+	QUIC_ST_SND_SYSCALL,
+	QUIC_ST_RCVD_DGRAM,
+	QUIC_ST_RCV_SYSCALL,
 	/* Special events of interest */
 	QUIC_ST_CONN_MIGRATION_DONE,
 	/* Transport errors */
@@ -72,6 +76,10 @@ struct quic_counters {
 	long long half_open_conn;    /* current number of connections waiting for address validation */
 	long long hdshk_fail;        /* total number of handshake failures */
 	long long stateless_reset_sent; /* total number of handshake failures */
+	long long sent_dgram;        /* total number of sent datagrams */
+	long long snd_syscall;       /* total number of syscalls used to send datagrams */
+	long long rcvd_dgram;        /* total number of datagrams received on listener sockets */
+	long long rcv_syscall;       /* total number of syscalls used to receive datagrams on listener sockets */
 	/* Special events of interest */
 	long long conn_migration_done; /* total number of connection migration handled */
 	/* Transport errors */
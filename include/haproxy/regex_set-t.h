@@ -0,0 +1,87 @@
+/*
+ * include/haproxy/regex_set-t.h
+ * Types for sets of regular expressions matched at once
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HAPROXY_REGEX_SET_T_H
+#define _HAPROXY_REGEX_SET_T_H
+
+#include <haproxy/api-t.h>
+#include <haproxy/thread-t.h>
+
+/* special values returned by regex_set_exec() */
+#define RSET_NOMATCH   (~0U)      /* no regex matched */
+#define RSET_FULL      (~0U - 1)  /* the DFA cache is full, the caller must match by itself */
+
+/* maximum number of DFA states cached per set */
+#define RSET_MAX_STATES  4096
+
+/* NFA node types */
+enum {
+	RSET_N_SET = 0,  /* consumes one byte from <set>, goes to <out> */
+	RSET_N_SPLIT,    /* goes to both <out> and <out1> */
+	RSET_N_BOL,      /* goes to <out> at the beginning of the subject only */
+	RSET_N_EOL,      /* goes to <out> at the end of the subject only */
+	RSET_N_MATCH,    /* regex number <arg> matched */
+};
+
+struct rset_node {
+	unsigned int type;           /* RSET_N_* */
+	unsigned int out;            /* next node */
+	unsigned int out1;           /* alternate next node for RSET_N_SPLIT */
+	unsigned int arg;            /* set index for RSET_N_SET, regex number for RSET_N_MATCH */
+};
+
+/* A DFA state is a set of NFA nodes, created on first use. Transitions are
+ * stored as the next state number, 0 meaning not computed yet (state 0 is the
+ * initial state, which is never reached again).
+ */
+struct rset_state {
+	unsigned int trans[256];     /* next state for each byte, 0 if unknown */
+	unsigned int order;          /* lowest regex number matched in this state */
+	unsigned int eorder;         /* lowest regex number matched if the subject ends here */
+	unsigned int hnext;          /* next state in the same hash bucket, 0 if none */
+	unsigned int nb_nodes;       /* number of NFA nodes below */
+	uint64_t hash;               /* hash of the nodes list */
+	unsigned int nodes[VAR_ARRAY]; /* sorted NFA nodes of this state */
+};
+
+/* A set of regular expressions compiled together into a single NFA, which is
+ * lazily turned into a DFA while matching. Regex numbers are assigned by the
+ * caller and the lowest matching one is reported.
+ */
+struct regex_set {
+	struct rset_node *nodes;     /* NFA nodes */
+	unsigned int nb_nodes;       /* number of used NFA nodes */
+	unsigned int alloc_nodes;    /* number of allocated NFA nodes */
+	uint64_t (*sets)[4];         /* byte sets used by RSET_N_SET nodes */
+	unsigned int nb_sets;        /* number of used sets */
+	unsigned int alloc_sets;     /* number of allocated sets */
+	unsigned int root;           /* root node, leading to all regexes */
+	int icase;                   /* regexes ignore case */
+
+	/* DFA cache, only modified under the lock */
+	struct rset_state *states[RSET_MAX_STATES];
+	unsigned int nb_states;      /* number of states in the cache */
+	unsigned int hash[RSET_MAX_STATES]; /* hash buckets: first state, 0 if none */
+	unsigned int *work;          /* work area: 3*nb_nodes entries */
+	unsigned int *marks;         /* closure marks, one per NFA node */
+	unsigned int mark;           /* current closure mark */
+	__decl_thread(HA_SPINLOCK_T lock);
+};
+
+#endif /* _HAPROXY_REGEX_SET_T_H */
@@ -0,0 +1,39 @@
+/*
+ * include/haproxy/regex_set.h
+ * Functions for sets of regular expressions matched at once
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, version 2.1
+ * exclusively.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _HAPROXY_REGEX_SET_H
+#define _HAPROXY_REGEX_SET_H
+
+#include <haproxy/api.h>
+#include <haproxy/regex_set-t.h>
+
+struct regex_set *regex_set_new(int icase);
+int regex_set_add(struct regex_set *rs, const char *str, unsigned int order);
+int regex_set_compile(struct regex_set *rs);
+unsigned int regex_set_exec(struct regex_set *rs, const char *str, size_t len);
+void regex_set_flush(struct regex_set *rs);
+void regex_set_free(struct regex_set *rs);
+
+/* returns non-zero if the DFA cache of set <rs> is full */
+static inline int regex_set_full(const struct regex_set *rs)
+{
+	return HA_ATOMIC_LOAD(&rs->nb_states) >= RSET_MAX_STATES;
+}
+
+#endif /* _HAPROXY_REGEX_SET_H */
@@ -252,6 +252,13 @@ struct sample {
 };
 
 /* Descriptor for a sample conversion */
+/* Flags of sample fetch and converter keywords (sample_fetch->flags and
+ * sample_conv->flags). An expression using any keyword with one of them may
+ * not be evaluated in a different order nor less often than it was written.
+ */
+#define SMP_KW_F_SIDE_EFFECT  0x00000001  /* evaluating it changes some state (variables, counters, captures...) */
+#define SMP_KW_F_VOLATILE     0x00000002  /* it returns a different result each time it is evaluated */
+
 struct sample_conv {
 	const char *kw;                           /* configuration keyword  */
 	int (*process)(const struct arg *arg_p,
@@ -265,6 +272,7 @@ struct sample_conv {
 	unsigned int in_type;                     /* expected input sample type */
 	unsigned int out_type;                    /* output sample type */
 	void *private;                            /* private values. only used by maps and Lua */
+	unsigned int flags;                       /* SMP_KW_F_* */
 };
 
 /* sample conversion expression */
@@ -288,6 +296,7 @@ struct sample_fetch {
 	unsigned int use;                         /* fetch source (SMP_USE_*) */
 	unsigned int val;                         /* fetch validity (SMP_VAL_*) */
 	void *private;                            /* private values. only used by Lua */
+	unsigned int flags;                       /* SMP_KW_F_* */
 };
 
 /* sample expression */
@@ -312,4 +321,37 @@ struct sample_conv_kw_list {
 
 typedef int (*sample_cast_fct)(struct sample *smp);
 
+/* A sample fetch call whose result(s) are kept in a stream's sample cache. An
+ * iterated fetch (SMP_F_NOT_LAST) keeps all its successive results.
+ */
+struct smp_cache_ent {
+	const struct sample_fetch *fetch;         /* fetch keyword */
+	const struct arg *args;                   /* fetch arguments, compared by value */
+	unsigned int opt;                         /* SMP_OPT_DIR and SMP_OPT_ITERATE of the call */
+	unsigned int flags;                       /* SMP_F_* reported when the fetch failed */
+	unsigned int first;                       /* index of the first result in res[] */
+	unsigned int count;                       /* number of results, 0 if the fetch failed */
+};
+
+/* one cached fetch result */
+struct smp_cache_res {
+	struct sample_data data;                  /* result, strings point to the cache's area */
+	unsigned int flags;                       /* SMP_F_* reported with this result */
+};
+
+/* Per-stream cache of sample fetch results which only depend on the start-line
+ * and headers of HTTP messages. It is emptied as soon as any of these changes,
+ * which is detected using htx_hdr_gen. The entries, results and storage area
+ * are allocated at once after the structure, sized by "tune.sample-cache".
+ */
+struct smp_cache {
+	unsigned int gen;                         /* htx_hdr_gen the results were fetched at */
+	unsigned int nb_ent;                      /* number of used entries */
+	unsigned int nb_res;                      /* number of used results */
+	unsigned int area_used;                   /* number of bytes used in area */
+	struct smp_cache_ent *ent;                /* entries */
+	struct smp_cache_res *res;                /* results */
+	char *area;                               /* storage for string and binary results */
+};
+
 #endif /* _HAPROXY_SAMPLE_T_H */
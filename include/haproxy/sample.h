@@ -41,6 +41,10 @@ struct sample *sample_process(struct proxy *px, struct session *sess,
                               struct stream *strm, unsigned int opt,
                               struct sample_expr *expr, struct sample *p);
 int sample_process_cnv(struct sample_expr *expr, struct sample *p);
+void smp_cache_free(struct smp_cache *cache);
+int sample_args_eq(const struct arg *a, const struct arg *b);
+int sample_expr_eq(const struct sample_expr *a, const struct sample_expr *b);
+int sample_expr_pure(const struct sample_expr *expr);
 struct sample *sample_fetch_as_type(struct proxy *px, struct session *sess,
                                    struct stream *strm, unsigned int opt,
                                    struct sample_expr *expr, int smp_type);
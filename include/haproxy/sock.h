@@ -45,6 +45,7 @@ void sock_accept_iocb(int fd);
 void sock_conn_ctrl_init(struct connection *conn);
 void sock_conn_ctrl_close(struct connection *conn);
 void sock_conn_iocb(int fd);
+void sock_conn_zc_drain(struct connection *conn);
 int sock_conn_check(struct connection *conn);
 int sock_drain(struct connection *conn);
 int sock_check_events(struct connection *conn, int event_type);
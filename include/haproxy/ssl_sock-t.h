@@ -50,6 +50,8 @@
 #define SSL_SOCK_SEND_UNLIMITED     0x00000004
 #define SSL_SOCK_RECV_HEARTBEAT     0x00000008
 #define SSL_SOCK_SEND_MORE          0x00000010  /* set MSG_MORE at lower levels */
+#define SSL_SOCK_KTLS_TX            0x00000020  /* records are encrypted by the kernel */
+#define SSL_SOCK_KTLS_RX            0x00000040  /* records are decrypted by the kernel */
 
 /* bits 0xFFFFFF00 are reserved to store verify errors.
  * The CA en CRT error codes will be stored on 7 bits each
@@ -256,6 +258,9 @@ struct ssl_sock_ctx {
 	unsigned long error_code;     /* last error code of the error stack */
 	struct buffer early_buf;      /* buffer to store the early data received */
 	int sent_early_data;          /* Amount of early data we sent so far */
+#ifdef HAVE_SSL_KTLS
+	int ktls_rec_type;            /* record type of the next kTLS write, 0 for application data */
+#endif
 
 #ifdef USE_QUIC
 	struct quic_conn *qc;
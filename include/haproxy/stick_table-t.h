@@ -93,6 +93,12 @@ enum {
 /* stick table key type flags */
 #define STK_F_CUSTOM_KEYSIZE      0x00000001   /* this table's key size is configurable */
 
+/* number of rows of the count-min sketch of heavy-hitter tables */
+#define STKTABLE_SKETCH_DEPTH 4
+
+/* number of sketch counters halved per wakeup of the decay task */
+#define STKTABLE_SKETCH_DECAY_BATCH 65536
+
 /* WARNING: if new fields are added, they must be initialized in stream_accept()
  * and freed in stream_free() !
  *
@@ -180,6 +186,13 @@ struct stktable {
 	unsigned int server_key_type; /* What type of key is used to identify servers */
 	unsigned int size;        /* maximum number of sticky sessions in table */
 	int nopurge;              /* if non-zero, don't purge sticky sessions when full */
+	int deferred;             /* if non-zero, counter updates are merged per thread in batches */
+	unsigned int sketch_width; /* columns per row of the admission sketch, 0 if none */
+	unsigned int *sketch;     /* count-min sketch of STKTABLE_SKETCH_DEPTH rows, or NULL */
+	struct task *sketch_task; /* sketch decay task */
+	unsigned int sketch_decay_pos; /* next counter to be halved by the decay task */
+	unsigned int sketch_victim; /* cached estimate of the next entry to be purged */
+	unsigned int sketch_victim_date; /* date of the last sketch_victim refresh (ms) */
 	int expire;               /* time to live for sticky sessions (milliseconds) */
 	int data_size;            /* the size of the data that is prepended *before* stksess */
 	int data_ofs[STKTABLE_DATA_TYPES]; /* negative offsets of present data types, or 0 if absent */
@@ -222,6 +235,7 @@ struct stktable {
 
 	/* rarely used config stuff below (should not interfere with updt_lock) */
 	struct proxy *proxies_list; /* The list of proxies which reference this stick-table. */
+	char *snapshot;             /* path of the snapshot file, or NULL if none */
 	struct {
 		const char *file;     /* The file where the stick-table is declared. */
 		int line;             /* The line in this <file> the stick-table is declared. */
@@ -59,6 +59,8 @@ void stktable_requeue_exp(struct stktable *t, const struct stksess *ts);
 void stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int decrefcount, int expire, int decrefcnt);
 void stktable_touch_remote(struct stktable *t, struct stksess *ts, int decrefcnt);
 void stktable_touch_local(struct stktable *t, struct stksess *ts, int decrefccount);
+int stktable_defer_ctr(struct stktable *t, struct stksess *ts, int cnt_type, int rate_type,
+                      unsigned int idx, unsigned long long inc);
 struct stksess *stktable_lookup(struct stktable *t, struct stksess *ts);
 struct stksess *stktable_lookup_key(struct stktable *t, struct stktable_key *key);
 struct stksess *stktable_update_key(struct stktable *table, struct stktable_key *key);
@@ -72,6 +74,8 @@ int stktable_compatible_sample(struct sample_expr *expr, unsigned long table_typ
 int stktable_register_data_store(int idx, const char *name, int std_type, int arg_type);
 int stktable_get_data_type(char *name);
 int stktable_trash_oldest(struct stktable *t, int to_batch);
+int stktable_snapshot_save(struct stktable *t, char **err);
+int stktable_snapshot_load(struct stktable *t, char **err);
 int __stksess_kill(struct stktable *t, struct stksess *ts);
 
 /************************* Composite address manipulation *********************
@@ -276,6 +280,10 @@ static inline int stkctr_inc_http_req_ctr(struct stkctr *stkctr)
 	if (!ts)
 		return 0;
 
+	if (stkctr->table->deferred)
+		return stktable_defer_ctr(stkctr->table, ts, STKTABLE_DT_HTTP_REQ_CNT,
+		                          STKTABLE_DT_HTTP_REQ_RATE, 0, 1);
+
 	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
 
 	ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_REQ_CNT);
@@ -308,6 +316,10 @@ static inline int stkctr_inc_http_err_ctr(struct stkctr *stkctr)
 	if (!ts)
 		return 0;
 
+	if (stkctr->table->deferred)
+		return stktable_defer_ctr(stkctr->table, ts, STKTABLE_DT_HTTP_ERR_CNT,
+		                          STKTABLE_DT_HTTP_ERR_RATE, 0, 1);
+
 	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
 
 	ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_ERR_CNT);
@@ -340,6 +352,10 @@ static inline int stkctr_inc_http_fail_ctr(struct stkctr *stkctr)
 	if (!ts)
 		return 0;
 
+	if (stkctr->table->deferred)
+		return stktable_defer_ctr(stkctr->table, ts, STKTABLE_DT_HTTP_FAIL_CNT,
+		                          STKTABLE_DT_HTTP_FAIL_RATE, 0, 1);
+
 	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
 
 	ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_HTTP_FAIL_CNT);
@@ -372,6 +388,10 @@ static inline int stkctr_inc_bytes_in_ctr(struct stkctr *stkctr, unsigned long l
 	if (!ts)
 		return 0;
 
+	if (stkctr->table->deferred)
+		return stktable_defer_ctr(stkctr->table, ts, STKTABLE_DT_BYTES_IN_CNT,
+		                          STKTABLE_DT_BYTES_IN_RATE, 0, bytes);
+
 	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
 	ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_BYTES_IN_CNT);
 	if (ptr1)
@@ -403,6 +423,10 @@ static inline int stkctr_inc_bytes_out_ctr(struct stkctr *stkctr, unsigned long
 	if (!ts)
 		return 0;
 
+	if (stkctr->table->deferred)
+		return stktable_defer_ctr(stkctr->table, ts, STKTABLE_DT_BYTES_OUT_CNT,
+		                          STKTABLE_DT_BYTES_OUT_RATE, 0, bytes);
+
 	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
 	ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_BYTES_OUT_CNT);
 	if (ptr1)
@@ -434,6 +458,10 @@ static inline int stkctr_add_glitch_ctr(struct stkctr *stkctr, uint inc)
 	if (!ts)
 		return 0;
 
+	if (stkctr->table->deferred)
+		return stktable_defer_ctr(stkctr->table, ts, STKTABLE_DT_GLITCH_CNT,
+		                          STKTABLE_DT_GLITCH_RATE, 0, inc);
+
 	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
 
 	ptr1 = stktable_data_ptr(stkctr->table, ts, STKTABLE_DT_GLITCH_CNT);
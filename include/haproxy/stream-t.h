@@ -180,6 +180,7 @@ struct proxy;
 struct pendconn;
 struct session;
 struct server;
+struct smp_cache;
 struct task;
 struct sockaddr_storage;
 
@@ -227,6 +228,7 @@ struct stream {
 	struct pendconn *pend_pos;      /* if not NULL, points to the pending position in the pending queue */
 
 	struct http_txn *txn;           /* current HTTP transaction being processed. Should become a list. */
+	struct smp_cache *smp_cache;    /* cached sample fetch results, or NULL */
 
 	struct task *task;              /* the task associated with this stream */
 	unsigned int pending_events;	/* the pending events not yet processed by the stream.
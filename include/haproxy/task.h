@@ -390,7 +390,7 @@ static inline void _tasklet_wakeup_on(struct tasklet *tl, int thr, const struct
 #endif
 	}
 
-	if (_HA_ATOMIC_LOAD(&th_ctx->flags) & TH_FL_TASK_PROFILING)
+	if (_HA_ATOMIC_LOAD(&th_ctx->flags) & (TH_FL_TASK_PROFILING | TH_FL_SCHED_ADAPTIVE))
 		tl->wake_date = now_mono_time();
 	__tasklet_wakeup_on(tl, thr);
 }
@@ -447,7 +447,7 @@ static inline void _task_instant_wakeup(struct task *t, unsigned int f, const st
 #endif
 	}
 
-	if (_HA_ATOMIC_LOAD(&th_ctx->flags) & TH_FL_TASK_PROFILING)
+	if (_HA_ATOMIC_LOAD(&th_ctx->flags) & (TH_FL_TASK_PROFILING | TH_FL_SCHED_ADAPTIVE))
 		t->wake_date = now_mono_time();
 	__tasklet_wakeup_on((struct tasklet *)t, thr);
 }
@@ -484,7 +484,7 @@ static inline struct list *_tasklet_wakeup_after(struct list *head, struct taskl
 #endif
 	}
 
-	if (th_ctx->flags & TH_FL_TASK_PROFILING)
+	if (th_ctx->flags & (TH_FL_TASK_PROFILING | TH_FL_SCHED_ADAPTIVE))
 		tl->wake_date = now_mono_time();
 	return __tasklet_wakeup_after(head, tl);
 }
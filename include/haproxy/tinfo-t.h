@@ -54,6 +54,9 @@ enum {
 	TL_CLASSES       /* must be last */
 };
 
+/* number of loops the per-class queue latency is averaged over */
+#define SCHED_LAT_SAMPLES 16
+
 /* thread_ctx flags, for ha_thread_ctx[].flags. These flags describe the
  * thread's state and are visible to other threads, so they must be used
  * with atomic ops.
@@ -64,6 +67,7 @@ enum {
 #define TH_FL_SLEEPING          0x00000008  /* thread won't check its task list before next wakeup */
 #define TH_FL_STARTED           0x00000010  /* set once the thread starts */
 #define TH_FL_IN_LOOP           0x00000020  /* set only inside the polling loop */
+#define TH_FL_SCHED_ADAPTIVE    0x00000040  /* measure per-class latency to adapt the scheduler's weights */
 
 
 /* Thread group information. This defines a base and a count of global thread
@@ -145,6 +149,10 @@ struct thread_ctx {
 
 	ALWAYS_ALIGN(2*sizeof(void*));
 	struct list tasklets[TL_CLASSES];   /* tasklets (and/or tasks) to run, by class */
+	uint sched_weights[TL_CLASSES];     /* per-class budget weights used by process_runnable_tasks() */
+	uint sched_lat_avg[TL_CLASSES];     /* per-class sliding sum of queue latencies in us (adaptive mode) */
+	uint sched_lat_cnt[TL_CLASSES];     /* per-class number of latency samples since last adjustment */
+	uint64_t sched_lat_sum[TL_CLASSES]; /* per-class sum of queue latencies in ns since last adjustment */
 
 	// third cache line here on 64 bits: accessed mostly using atomic ops
 	ALWAYS_ALIGN(64);
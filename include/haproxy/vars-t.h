@@ -47,11 +47,23 @@ enum vars_scope {
 	SCOPE_CHECK,
 };
 
+/* Number of slots stored directly in struct vars. Must be a power of two. The
+ * table only gets allocated once more than 3/4 of them are used.
+ */
+#define VARS_INLINE_SLOTS   8
+
+/* Variables are indexed by their name hash in an open-addressed table using
+ * linear probing. Empty slots are NULL. The table is <inl> as long as <tab> is
+ * NULL, otherwise it was allocated. In both cases it has <mask>+1 slots.
+ */
 struct vars {
-	struct list head;
+	struct var **tab;        /* allocated table of slots or NULL for <inl> */
+	unsigned int mask;       /* number of slots minus one */
+	unsigned int count;      /* number of variables in the table */
 	enum vars_scope scope;
 	unsigned int size;
 	__decl_thread(HA_RWLOCK_T rwlock);
+	struct var *inl[VARS_INLINE_SLOTS]; /* slots used for small tables */
 };
 
 /* This struct describes a variable as found in an arg_data */
@@ -61,7 +73,6 @@ struct var_desc {
 };
 
 struct var {
-	struct list l; /* Used for chaining vars. */
 	uint64_t name_hash;      /* XXH3() of the variable's name */
 	uint flags;       // VF_*
 	/* 32-bit hole here */
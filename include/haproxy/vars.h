@@ -34,7 +34,7 @@ struct arg;
 
 void vars_init_head(struct vars *vars, enum vars_scope scope);
 void var_accounting_diff(struct vars *vars, struct session *sess, struct stream *strm, int size);
-unsigned int var_clear(struct var *var, int force);
+unsigned int var_clear(struct vars *vars, struct var *var, int force);
 void vars_prune(struct vars *vars, struct session *sess, struct stream *strm);
 void vars_prune_per_sess(struct vars *vars);
 int var_set(uint64_t name_hash, enum vars_scope scope, struct sample *smp, uint flags);
@@ -46,6 +46,22 @@ int vars_unset_by_name_ifexist(const char *name, size_t len, struct sample *smp)
 int vars_get_by_desc(const struct var_desc *var_desc, struct sample *smp, const struct buffer *def);
 int vars_check_arg(struct arg *arg, char **err);
 
+/* returns the slots of the table of <vars>, there are vars->mask + 1 of them,
+ * empty ones being NULL.
+ */
+static inline struct var **vars_slots(struct vars *vars)
+{
+	return vars->tab ? vars->tab : vars->inl;
+}
+
+/* returns non-zero if <vars> doesn't contain any variable nor any allocated
+ * table, i.e. if there is nothing to prune.
+ */
+static inline int vars_is_empty(const struct vars *vars)
+{
+	return !vars->count && !vars->tab;
+}
+
 /* locks the <vars> for writes if it's in a shared scope */
 static inline void vars_wrlock(struct vars *vars)
 {
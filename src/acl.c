@@ -17,9 +17,11 @@
 #include <import/ebsttree.h>
 
 #include <haproxy/acl.h>
+#include <haproxy/activity.h>
 #include <haproxy/api.h>
 #include <haproxy/arg.h>
 #include <haproxy/auth.h>
+#include <haproxy/clock.h>
 #include <haproxy/errors.h>
 #include <haproxy/global.h>
 #include <haproxy/list.h>
@@ -35,6 +37,14 @@ static struct acl_kw_list acl_keywords = {
 	.list = LIST_HEAD_INIT(acl_keywords.list)
 };
 
+/* List of all conditions built by parse_acl_cond() */
+struct list acl_conds = LIST_HEAD_INIT(acl_conds);
+
+/* set by "tune.rules.optimize": conditions and rule sets are rearranged after
+ * parsing so that they are evaluated faster.
+ */
+int acl_rules_optimize __read_mostly = 0;
+
 /* input values are 0 or 3, output is the same */
 static inline enum acl_test_res pat2acl(struct pattern *pat)
 {
@@ -844,6 +854,7 @@ struct acl_cond *parse_acl_cond(const char **args, struct list *known_acl,
 
 	LIST_INIT(&cond->list);
 	LIST_INIT(&cond->suites);
+	LIST_APPEND(&acl_conds, &cond->by_all);
 	cond->pol = pol;
 	cond->val = 0;
 
@@ -1024,7 +1035,7 @@ struct acl_cond *build_acl_cond(const char *file, int line, struct list *known_a
  *     if (cond->pol == ACL_COND_UNLESS)
  *         res = !res;
  */
-enum acl_test_res acl_exec_cond(struct acl_cond *cond, struct proxy *px, struct session *sess, struct stream *strm, unsigned int opt)
+static enum acl_test_res __acl_exec_cond(struct acl_cond *cond, struct proxy *px, struct session *sess, struct stream *strm, unsigned int opt)
 {
 	__label__ fetch_next;
 	struct acl_term_suite *suite;
@@ -1124,6 +1135,26 @@ enum acl_test_res acl_exec_cond(struct acl_cond *cond, struct proxy *px, struct
 	return cond_res;
 }
 
+/* Execute condition <cond> the same way as __acl_exec_cond() does, but also
+ * account for it when rules profiling is enabled.
+ */
+enum acl_test_res acl_exec_cond(struct acl_cond *cond, struct proxy *px, struct session *sess, struct stream *strm, unsigned int opt)
+{
+	enum acl_test_res res;
+	uint64_t start;
+
+	if (likely(!(profiling & HA_PROF_RULES)))
+		return __acl_exec_cond(cond, px, sess, strm, opt);
+
+	start = now_mono_time();
+	res = __acl_exec_cond(cond, px, sess, strm, opt);
+	HA_ATOMIC_ADD(&cond->prof_time, now_mono_time() - start);
+	HA_ATOMIC_INC(&cond->prof_calls);
+	if (res != ACL_TEST_MISS && acl_pass(res) != (cond->pol == ACL_COND_UNLESS))
+		HA_ATOMIC_INC(&cond->prof_match);
+	return res;
+}
+
 /* Returns a pointer to the first ACL conflicting with usage at place <where>
  * which is one of the SMP_VAL_* bits indicating a check place, or NULL if
  * no conflict is found. Only full conflicts are detected (ACL is not usable).
@@ -1310,9 +1341,138 @@ void free_acl_cond(struct acl_cond *cond)
 		free(suite);
 	}
 
+	LIST_DELETE(&cond->by_all);
 	free(cond);
 }
 
+/* Returns an estimate of the cost of evaluating ACL expression <expr>, in
+ * arbitrary units. Contents are more expensive to fetch than header values,
+ * themselves more expensive than internal states. Indexed patterns cost the
+ * same whatever their number while listed ones are scanned linearly, and
+ * regular expressions are the most expensive of all.
+ */
+static unsigned long long acl_expr_cost(const struct acl_expr *expr)
+{
+	const struct sample_conv_expr *conv;
+	const struct pattern_expr_list *pel;
+	unsigned int use = expr->smp->fetch->use;
+	unsigned long long cost;
+
+	if (use & (SMP_USE_L6REQ | SMP_USE_L6RES | SMP_USE_HRQBO | SMP_USE_HRSBO))
+		cost = 16;
+	else if (use & (SMP_USE_HRQHV | SMP_USE_HRSHV))
+		cost = 4;
+	else
+		cost = 1;
+
+	list_for_each_entry(conv, &expr->smp->conv_exprs, list)
+		cost++;
+
+	if (!expr->pat.match || expr->pat.match == pat_match_nothing)
+		return cost;
+
+	list_for_each_entry(pel, &expr->pat.head, list) {
+		if (expr->pat.match == pat_match_reg || expr->pat.match == pat_match_regm)
+			cost += 8 * pel->expr->ref->entry_cnt;
+		else if (LIST_ISEMPTY(&pel->expr->patterns))
+			cost += 2;
+		else
+			cost += pel->expr->ref->entry_cnt;
+	}
+	return cost;
+}
+
+/* Returns the estimated cost of evaluating term <term>, or ~0ULL if the term
+ * must not be moved because one of its expressions has side effects.
+ */
+static unsigned long long acl_term_cost(const struct acl_term *term)
+{
+	const struct acl_expr *expr;
+	unsigned long long cost = 0;
+
+	list_for_each_entry(expr, &term->acl->expr, list) {
+		if (!sample_expr_pure(expr->smp))
+			return ~0ULL;
+		cost += acl_expr_cost(expr);
+	}
+	return cost;
+}
+
+/* Reorders the terms of suite <suite> by increasing estimated cost, so that
+ * cheap terms get a chance to fail before expensive ones are evaluated. The
+ * terms being ANDed, this does not change the result, except that a failure
+ * may be reported before waiting for more data. Terms of equal cost keep
+ * their relative order, and nothing is changed if any term has side effects.
+ */
+static void acl_sort_suite(struct acl_term_suite *suite)
+{
+	struct list sorted = LIST_HEAD_INIT(sorted);
+	struct acl_term *term, *best;
+	unsigned long long cost, best_cost;
+
+	list_for_each_entry(term, &suite->terms, list) {
+		if (acl_term_cost(term) == ~0ULL)
+			return;
+	}
+
+	while (!LIST_ISEMPTY(&suite->terms)) {
+		best = LIST_NEXT(&suite->terms, struct acl_term *, list);
+		best_cost = acl_term_cost(best);
+		list_for_each_entry(term, &suite->terms, list) {
+			cost = acl_term_cost(term);
+			if (cost < best_cost) {
+				best = term;
+				best_cost = cost;
+			}
+		}
+		LIST_DELETE(&best->list);
+		LIST_APPEND(&sorted, &best->list);
+	}
+	LIST_SPLICE(&suite->terms, &sorted);
+}
+
+/* Post-parsing optimization of all conditions, enabled by
+ * "tune.rules.optimize". Patterns are loaded at this point so that their
+ * number may be taken into account.
+ */
+static int acl_optimize_conds(void)
+{
+	struct acl_term_suite *suite;
+	struct acl_cond *cond;
+
+	if (!acl_rules_optimize)
+		return ERR_NONE;
+
+	list_for_each_entry(cond, &acl_conds, by_all) {
+		list_for_each_entry(suite, &cond->suites, list) {
+			if (suite->terms.n != suite->terms.p)
+				acl_sort_suite(suite);
+		}
+	}
+	return ERR_NONE;
+}
+
+REGISTER_POST_CHECK(acl_optimize_conds);
+
+/* config parser for global "tune.rules.optimize", accepts "on" or "off" */
+static int cfg_parse_rules_optimize(char **args, int section_type, struct proxy *curpx,
+                                    const struct proxy *defpx, const char *file, int line,
+                                    char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		acl_rules_optimize = 1;
+	else if (strcmp(args[1], "off") == 0)
+		acl_rules_optimize = 0;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
 
 static int smp_fetch_acl(const struct arg *args, struct sample *smp, const char *kw, void *private)
 {
@@ -1382,12 +1542,20 @@ static struct acl_kw_list acl_kws = {ILH, {
 INITCALL1(STG_REGISTER, acl_register_keywords, &acl_kws);
 
 static struct sample_fetch_kw_list smp_kws = {ILH, {
-	{ "acl", smp_fetch_acl, ARG12(1,STR,STR,STR,STR,STR,STR,STR,STR,STR,STR,STR,STR), smp_fetch_acl_parse, SMP_T_BOOL, SMP_USE_CONST },
+	/* the ACLs it evaluates may use keywords with side effects */
+	{ "acl", smp_fetch_acl, ARG12(1,STR,STR,STR,STR,STR,STR,STR,STR,STR,STR,STR,STR), smp_fetch_acl_parse, SMP_T_BOOL, SMP_USE_CONST, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ /* END */ },
 }};
 
 INITCALL1(STG_REGISTER, sample_register_fetches, &smp_kws);
 
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.rules.optimize", cfg_parse_rules_optimize },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
 /*
  * Local variables:
  *  c-indent-level: 8
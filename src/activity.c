@@ -10,6 +10,7 @@
  *
  */
 
+#include <haproxy/acl.h>
 #include <haproxy/activity-t.h>
 #include <haproxy/api.h>
 #include <haproxy/applet.h>
@@ -19,17 +20,19 @@
 #include <haproxy/cli.h>
 #include <haproxy/freq_ctr.h>
 #include <haproxy/listener.h>
+#include <haproxy/proxy.h>
 #include <haproxy/sc_strm.h>
 #include <haproxy/stconn.h>
 #include <haproxy/tools.h>
 
 /* CLI context for the "show profiling" command */
 struct show_prof_ctx {
-	int dump_step;  /* 0,1,2,4,5,6; see cli_iohandler_show_profiling() */
+	int dump_step;  /* 0,1,2,3,4,5,6,7; see cli_iohandler_show_profiling() */
 	int linenum;    /* next line to be dumped (starts at 0) */
 	int maxcnt;     /* max line count per step (0=not set)  */
 	int by_what;    /* 0=sort by usage, 1=sort by address, 2=sort by time */
 	int aggr;       /* 0=dump raw, 1=aggregate on callee    */
+	int hist;       /* 0=no histograms, 1=dump latency/cpu histograms */
 };
 
 /* CLI context for the "show activity" command */
@@ -56,6 +59,8 @@ uint64_t prof_task_start_ns = 0;
 uint64_t prof_task_stop_ns = 0;
 uint64_t prof_mem_start_ns = 0;
 uint64_t prof_mem_stop_ns = 0;
+uint64_t prof_rules_start_ns = 0;
+uint64_t prof_rules_stop_ns = 0;
 
 /* One struct per thread containing all collected measurements */
 struct activity activity[MAX_THREADS] __attribute__((aligned(64))) = { };
@@ -457,12 +462,50 @@ static int cli_parse_set_profiling(char **args, char *payload, struct appctx *ap
 #endif
 	}
 
+	if (strcmp(args[2], "rules") == 0) {
+		if (strcmp(args[3], "on") == 0) {
+			unsigned int old = profiling;
+			struct switching_table *tbl;
+			struct acl_cond *cond;
+
+			while (!_HA_ATOMIC_CAS(&profiling, &old, old | HA_PROF_RULES))
+				;
+
+			HA_ATOMIC_STORE(&prof_rules_start_ns, now_ns);
+			HA_ATOMIC_STORE(&prof_rules_stop_ns, 0);
+
+			/* also flush current profiling stats */
+			list_for_each_entry(cond, &acl_conds, by_all) {
+				HA_ATOMIC_STORE(&cond->prof_calls, 0);
+				HA_ATOMIC_STORE(&cond->prof_match, 0);
+				HA_ATOMIC_STORE(&cond->prof_time, 0);
+			}
+			list_for_each_entry(tbl, &switching_tables, list) {
+				HA_ATOMIC_STORE(&tbl->prof_lookups, 0);
+				HA_ATOMIC_STORE(&tbl->prof_hits, 0);
+				HA_ATOMIC_STORE(&tbl->prof_time, 0);
+			}
+		}
+		else if (strcmp(args[3], "off") == 0) {
+			unsigned int old = profiling;
+
+			while (!_HA_ATOMIC_CAS(&profiling, &old, old & ~HA_PROF_RULES))
+				;
+
+			if (HA_ATOMIC_LOAD(&prof_rules_start_ns))
+				HA_ATOMIC_STORE(&prof_rules_stop_ns, now_ns);
+		}
+		else
+			return cli_err(appctx, "Expects either 'on' or 'off'.\n");
+		return 1;
+	}
+
 	if (strcmp(args[2], "tasks") != 0)
-		return cli_err(appctx, "Expects either 'tasks' or 'memory'.\n");
+		return cli_err(appctx, "Expects either 'tasks', 'memory' or 'rules'.\n");
 
 	if (strcmp(args[3], "on") == 0) {
 		unsigned int old = profiling;
-		int i;
+		int i, j;
 
 		while (!_HA_ATOMIC_CAS(&profiling, &old, (old & ~HA_PROF_TASKS_MASK) | HA_PROF_TASKS_ON))
 			;
@@ -475,6 +518,10 @@ static int cli_parse_set_profiling(char **args, char *payload, struct appctx *ap
 			HA_ATOMIC_STORE(&sched_activity[i].calls, 0);
 			HA_ATOMIC_STORE(&sched_activity[i].cpu_time, 0);
 			HA_ATOMIC_STORE(&sched_activity[i].lat_time, 0);
+			for (j = 0; j < SCHED_ACT_HIST_BUCKETS; j++) {
+				HA_ATOMIC_STORE(&sched_activity[i].lat_hist[j], 0);
+				HA_ATOMIC_STORE(&sched_activity[i].cpu_hist[j], 0);
+			}
 			HA_ATOMIC_STORE(&sched_activity[i].func, NULL);
 			HA_ATOMIC_STORE(&sched_activity[i].caller, NULL);
 		}
@@ -623,13 +670,60 @@ struct sched_activity *sched_activity_entry(struct sched_activity *array, const
 	return array;
 }
 
+/* Returns the upper bound in nanoseconds of the bucket of histogram <hist>
+ * (made of SCHED_ACT_HIST_BUCKETS entries) which contains the quantile
+ * <permille> expressed in thousandths (e.g. 990 for p99, 999 for p999). Zero
+ * is returned for an empty histogram.
+ */
+uint64_t sched_act_hist_quantile(const uint32_t *hist, uint permille)
+{
+	uint64_t total, target, cum;
+	uint b;
+
+	for (total = b = 0; b < SCHED_ACT_HIST_BUCKETS; b++)
+		total += hist[b];
+
+	if (!total)
+		return 0;
+
+	target = (total * permille + 999) / 1000;
+	for (cum = b = 0; b < SCHED_ACT_HIST_BUCKETS - 1; b++) {
+		cum += hist[b];
+		if (cum >= target)
+			break;
+	}
+	return sched_act_hist_limit(b);
+}
+
+/* Appends to <out> the quantiles and the non-empty buckets of histogram
+ * <hist>, on a line starting with <name>.
+ */
+static void sched_act_dump_hist(struct buffer *out, const char *name, const uint32_t *hist)
+{
+	uint b;
+
+	chunk_appendf(out, "      %s:", name);
+	print_time_short(out, " p50<", sched_act_hist_quantile(hist, 500), "");
+	print_time_short(out, " p99<", sched_act_hist_quantile(hist, 990), "");
+	print_time_short(out, " p999<", sched_act_hist_quantile(hist, 999), "");
+	chunk_appendf(out, " |");
+	for (b = 0; b < SCHED_ACT_HIST_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		print_time_short(out, " <", sched_act_hist_limit(b), "");
+		chunk_appendf(out, ":%u", hist[b]);
+	}
+	b_putchr(out, '\n');
+}
+
 /* This function dumps all profiling settings. It returns 0 if the output
  * buffer is full and it needs to be called again, otherwise non-zero.
  * It dumps some parts depending on the following states from show_prof_ctx:
  *    dump_step:
  *       0, 4: dump status, then jump to 1 if 0
  *       1, 5: dump tasks, then jump to 2 if 1
- *       2, 6: dump memory, then stop
+ *       2, 6: dump memory, then jump to 3 if 2
+ *       3, 7: dump rules, then stop
  *    linenum:
  *       restart line for each step (starts at zero)
  *    maxcnt:
@@ -637,6 +731,9 @@ struct sched_activity *sched_activity_entry(struct sched_activity *array, const
  *    byaddr:
  *       0: sort by usage
  *       1: sort by address
+ *    hist:
+ *       0: only dump averages
+ *       1: also dump latency and CPU time histograms for each task
  */
 static int cli_io_handler_show_profiling(struct appctx *appctx)
 {
@@ -649,9 +746,11 @@ static int cli_io_handler_show_profiling(struct appctx *appctx)
 #endif
 	struct buffer *name_buffer = get_trash_chunk();
 	const struct ha_caller *caller;
+	struct switching_table *tbl;
+	struct acl_cond *cond;
 	const char *str;
 	int max_lines;
-	int i, j, max;
+	int i, j, b, max;
 
 	chunk_reset(&trash);
 
@@ -667,8 +766,10 @@ static int cli_io_handler_show_profiling(struct appctx *appctx)
 
 	chunk_printf(&trash,
 	             "Per-task CPU profiling              : %-8s      # set profiling tasks {on|auto|off}\n"
-	             "Memory usage profiling              : %-8s      # set profiling memory {on|off}\n",
-	             str, (profiling & HA_PROF_MEMORY) ? "on" : "off");
+	             "Memory usage profiling              : %-8s      # set profiling memory {on|off}\n"
+	             "Rules evaluation profiling          : %-8s      # set profiling rules {on|off}\n",
+	             str, (profiling & HA_PROF_MEMORY) ? "on" : "off",
+	             (profiling & HA_PROF_RULES) ? "on" : "off");
 
 	if (applet_putchk(appctx, &trash) == -1) {
 		/* failed, try again */
@@ -695,6 +796,10 @@ static int cli_io_handler_show_profiling(struct appctx *appctx)
 				tmp_activity[i].calls    += tmp_activity[j].calls;
 				tmp_activity[i].cpu_time += tmp_activity[j].cpu_time;
 				tmp_activity[i].lat_time += tmp_activity[j].lat_time;
+				for (b = 0; b < SCHED_ACT_HIST_BUCKETS; b++) {
+					tmp_activity[i].lat_hist[b] += tmp_activity[j].lat_hist[b];
+					tmp_activity[i].cpu_hist[b] += tmp_activity[j].cpu_hist[b];
+				}
 				tmp_activity[j].calls = 0;
 			}
 		}
@@ -748,6 +853,11 @@ static int cli_io_handler_show_profiling(struct appctx *appctx)
 
 		b_putchr(&trash, '\n');
 
+		if (ctx->hist) {
+			sched_act_dump_hist(&trash, "lat", tmp_activity[i].lat_hist);
+			sched_act_dump_hist(&trash, "cpu", tmp_activity[i].cpu_hist);
+		}
+
 		if (applet_putchk(appctx, &trash) == -1) {
 			/* failed, try again */
 			return 0;
@@ -850,13 +960,85 @@ static int cli_io_handler_show_profiling(struct appctx *appctx)
 		ctx->dump_step++; // next step
 
  skip_mem:
+#else
+	if ((ctx->dump_step & 7) == 2)
+		ctx->dump_step++; // no memory profiling, next step
 #endif // USE_MEMORY_PROFILING
 
+	if ((ctx->dump_step & 3) != 3)
+		goto skip_rules;
+
+	if (!ctx->linenum)
+		chunk_appendf(&trash, "Rules evaluation over %.3f sec till %.3f sec ago:\n"
+		                      "        calls       match   cpu_tot   cpu_avg   condition\n",
+			      (prof_rules_start_ns ? (prof_rules_stop_ns ? prof_rules_stop_ns : now_ns) - prof_rules_start_ns : 0) / 1000000000.0,
+			      (prof_rules_stop_ns ? now_ns - prof_rules_stop_ns : 0) / 1000000000.0);
+
+	max_lines = ctx->maxcnt;
+	if (!max_lines)
+		max_lines = INT_MAX;
+
+	/* conditions and switching tables which were evaluated, in declaration
+	 * order. Lines are numbered in order to resume after the last one dumped.
+	 */
+	i = 0;
+	list_for_each_entry(cond, &acl_conds, by_all) {
+		uint64_t calls = HA_ATOMIC_LOAD(&cond->prof_calls);
+
+		if (!calls)
+			continue;
+		if (i >= max_lines)
+			break;
+		if (i++ < ctx->linenum)
+			continue;
+
+		chunk_appendf(&trash, "  %11llu %11llu", (ullong)calls, (ullong)HA_ATOMIC_LOAD(&cond->prof_match));
+		print_time_short(&trash, "   ", HA_ATOMIC_LOAD(&cond->prof_time), "");
+		print_time_short(&trash, "   ", HA_ATOMIC_LOAD(&cond->prof_time) / calls, "");
+		chunk_appendf(&trash, "   %s:%d\n", cond->file ? cond->file : "?", cond->line);
+
+		if (applet_putchk(appctx, &trash) == -1) {
+			ctx->linenum = i - 1;
+			return 0;
+		}
+	}
+
+	list_for_each_entry(tbl, &switching_tables, list) {
+		uint64_t calls = HA_ATOMIC_LOAD(&tbl->prof_lookups);
+
+		if (!calls)
+			continue;
+		if (i >= max_lines)
+			break;
+		if (i++ < ctx->linenum)
+			continue;
+
+		chunk_appendf(&trash, "  %11llu %11llu", (ullong)calls, (ullong)HA_ATOMIC_LOAD(&tbl->prof_hits));
+		print_time_short(&trash, "   ", HA_ATOMIC_LOAD(&tbl->prof_time), "");
+		print_time_short(&trash, "   ", HA_ATOMIC_LOAD(&tbl->prof_time) / calls, "");
+		chunk_appendf(&trash, "   %s:%d-%d (table of %d rules)\n",
+			      tbl->rules[0]->file, tbl->rules[0]->line,
+			      tbl->rules[tbl->nb_rules - 1]->line, tbl->nb_rules);
+
+		if (applet_putchk(appctx, &trash) == -1) {
+			ctx->linenum = i - 1;
+			return 0;
+		}
+	}
+
+	if (applet_putchk(appctx, &trash) == -1)
+		return 0;
+
+	ctx->linenum = 0; // reset first line to dump
+	if ((ctx->dump_step & 4) == 0)
+		ctx->dump_step++; // next step
+
+ skip_rules:
 	return 1;
 }
 
 /* parse a "show profiling" command. It returns 1 on failure, 0 if it starts to dump.
- *  - cli.i0 is set to the first state (0=all, 4=status, 5=tasks, 6=memory)
+ *  - cli.i0 is set to the first state (0=all, 4=status, 5=tasks, 6=memory, 7=rules)
  *  - cli.o1 is set to 1 if the output must be sorted by addr instead of usage
  *  - cli.o0 is set to the number of lines of output
  */
@@ -881,6 +1063,9 @@ static int cli_parse_show_profiling(char **args, char *payload, struct appctx *a
 		else if (strcmp(args[arg], "memory") == 0) {
 			ctx->dump_step = 6; // will visit memory only
 		}
+		else if (strcmp(args[arg], "rules") == 0) {
+			ctx->dump_step = 7; // will visit rules only
+		}
 		else if (strcmp(args[arg], "byaddr") == 0) {
 			ctx->by_what = 1; // sort output by address instead of usage
 		}
@@ -890,11 +1075,14 @@ static int cli_parse_show_profiling(char **args, char *payload, struct appctx *a
 		else if (strcmp(args[arg], "aggr") == 0) {
 			ctx->aggr = 1;    // aggregate output by callee
 		}
+		else if (strcmp(args[arg], "hist") == 0) {
+			ctx->hist = 1;    // dump latency/cpu histograms
+		}
 		else if (isdigit((unsigned char)*args[arg])) {
 			ctx->maxcnt = atoi(args[arg]); // number of entries to dump
 		}
 		else
-			return cli_err(appctx, "Expects either 'all', 'status', 'tasks', 'memory', 'byaddr', 'bytime', 'aggr' or a max number of output lines.\n");
+			return cli_err(appctx, "Expects either 'all', 'status', 'tasks', 'memory', 'rules', 'byaddr', 'bytime', 'aggr', 'hist' or a max number of output lines.\n");
 	}
 	return 0;
 }
@@ -1137,6 +1325,12 @@ static int cli_io_handler_show_activity(struct appctx *appctx)
 		case __LINE__: SHOW_VAL("empty_rq:",     activity[thr].empty_rq, _tot); break;
 		case __LINE__: SHOW_VAL("long_rq:",      activity[thr].long_rq, _tot); break;
 		case __LINE__: SHOW_VAL("curr_rq:",      _HA_ATOMIC_LOAD(&ha_thread_ctx[thr].rq_total), _tot); break;
+		case __LINE__: SHOW_VAL("sched_w_urg:",  ha_thread_ctx[thr].sched_weights[TL_URGENT], (_tot + _nbt/2) / _nbt); break;
+		case __LINE__: SHOW_VAL("sched_w_norm:", ha_thread_ctx[thr].sched_weights[TL_NORMAL], (_tot + _nbt/2) / _nbt); break;
+		case __LINE__: SHOW_VAL("sched_w_bulk:", ha_thread_ctx[thr].sched_weights[TL_BULK], (_tot + _nbt/2) / _nbt); break;
+		case __LINE__: SHOW_VAL("sched_lat_urg:",  swrate_avg(ha_thread_ctx[thr].sched_lat_avg[TL_URGENT], SCHED_LAT_SAMPLES), (_tot + _nbt/2) / _nbt); break;
+		case __LINE__: SHOW_VAL("sched_lat_norm:", swrate_avg(ha_thread_ctx[thr].sched_lat_avg[TL_NORMAL], SCHED_LAT_SAMPLES), (_tot + _nbt/2) / _nbt); break;
+		case __LINE__: SHOW_VAL("sched_lat_bulk:", swrate_avg(ha_thread_ctx[thr].sched_lat_avg[TL_BULK], SCHED_LAT_SAMPLES), (_tot + _nbt/2) / _nbt); break;
 		case __LINE__: SHOW_VAL("loops:",        activity[thr].loops, _tot); break;
 		case __LINE__: SHOW_VAL("wake_tasks:",   activity[thr].wake_tasks, _tot); break;
 		case __LINE__: SHOW_VAL("wake_signal:",  activity[thr].wake_signal, _tot); break;
@@ -1144,8 +1338,11 @@ static int cli_io_handler_show_activity(struct appctx *appctx)
 		case __LINE__: SHOW_VAL("poll_exp:",     activity[thr].poll_exp, _tot); break;
 		case __LINE__: SHOW_VAL("poll_drop_fd:", activity[thr].poll_drop_fd, _tot); break;
 		case __LINE__: SHOW_VAL("poll_skip_fd:", activity[thr].poll_skip_fd, _tot); break;
+		case __LINE__: SHOW_VAL("poll_sysc:",    activity[thr].poll_sysc, _tot); break;
 		case __LINE__: SHOW_VAL("conn_dead:",    activity[thr].conn_dead, _tot); break;
 		case __LINE__: SHOW_VAL("stream_calls:", activity[thr].stream_calls, _tot); break;
+		case __LINE__: SHOW_VAL("smp_cache_hit:", activity[thr].smp_cache_hit, _tot); break;
+		case __LINE__: SHOW_VAL("smp_cache_miss:",activity[thr].smp_cache_miss, _tot); break;
 		case __LINE__: SHOW_VAL("pool_fail:",    activity[thr].pool_fail, _tot); break;
 		case __LINE__: SHOW_VAL("buf_wait:",     activity[thr].buf_wait, _tot); break;
 		case __LINE__: SHOW_VAL("cpust_ms_tot:", activity[thr].cpust_total / 2, _tot); break;
@@ -1223,9 +1420,9 @@ INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
 
 /* register cli keywords */
 static struct cli_kw_list cli_kws = {{ },{
-	{ { "set",  "profiling", NULL }, "set profiling <what> {auto|on|off}      : enable/disable resource profiling (tasks,memory)", cli_parse_set_profiling,  NULL },
+	{ { "set",  "profiling", NULL }, "set profiling <what> {auto|on|off}      : enable/disable resource profiling (tasks,memory,rules)", cli_parse_set_profiling,  NULL },
 	{ { "show", "activity", NULL },  "show activity [-1|0|thread_num]         : show per-thread activity stats (for support/developers)", cli_parse_show_activity, cli_io_handler_show_activity, NULL },
-	{ { "show", "profiling", NULL }, "show profiling [<what>|<#lines>|<opts>]*: show profiling state (all,status,tasks,memory)",   cli_parse_show_profiling, cli_io_handler_show_profiling, NULL },
+	{ { "show", "profiling", NULL }, "show profiling [<what>|<#lines>|<opts>]*: show profiling state (all,status,tasks,memory,rules)",   cli_parse_show_profiling, cli_io_handler_show_profiling, NULL },
 	{ { "show", "tasks", NULL },     "show tasks                              : show running tasks",                               NULL, cli_io_handler_show_tasks,     NULL },
 	{{},}
 }};
@@ -1668,6 +1668,10 @@ int connect_server(struct stream *s)
 				srv_conn->flags |= CO_FL_OPT_TOS;
 			}
 
+			/* large requests may be sent using MSG_ZEROCOPY */
+			if (srv && (srv->flags & SRV_F_ZEROCOPY))
+				srv_conn->flags |= CO_FL_OPT_ZEROCOPY;
+
 			srv_conn->hash_node->node.key = hash;
 		}
 	}
@@ -10,6 +10,13 @@
  * 2 of the License, or (at your option) any later version.
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <import/eb32tree.h>
 #include <import/sha1.h>
 
@@ -21,9 +28,11 @@
 #include <haproxy/cli.h>
 #include <haproxy/errors.h>
 #include <haproxy/filters.h>
+#include <haproxy/global.h>
 #include <haproxy/hash.h>
 #include <haproxy/http.h>
 #include <haproxy/http_ana.h>
+#include <haproxy/http_client.h>
 #include <haproxy/http_htx.h>
 #include <haproxy/http_rules.h>
 #include <haproxy/htx.h>
@@ -51,12 +60,41 @@ struct flt_ops cache_ops;
 
 struct cache_tree {
 	struct eb_root entries;  /* head of cache entries based on keys */
+	struct eb_root pending;  /* objects being fetched by a leader stream (collapsed forwarding) */
 	__decl_thread(HA_RWLOCK_T lock);
 
 	struct list cleanup_list;
 	__decl_thread(HA_SPINLOCK_T cleanup_lock);
 } ALIGNED(64);
 
+/* Optional second tier of a cache, where objects evicted from the shctx are
+ * stored. It is a file mapped in memory, made of a header, an index of
+ * <nb_slots> slots and a data ring. Records are appended to the ring at the
+ * logical position hdr->wpos, which only grows, so that a record at logical
+ * position <pos> is intact as long as pos >= hdr->wpos - ring_size. Since the
+ * index lives in the file, the objects are still available after a reload or
+ * a restart. The file may be shared by several processes during a reload, so
+ * modifications are serialized using flock() in addition to the thread lock.
+ * Evicted objects are copied to a queue under the shctx lock, and written to
+ * the file later by a task, so that the file is never accessed under the shctx
+ * lock.
+ */
+struct cache_disk {
+	char *path;                     /* file name */
+	unsigned long long size;        /* size of the data ring in bytes */
+	int fd;                         /* file descriptor, -1 if not opened */
+	struct cache_disk_hdr *hdr;     /* start of the mapping */
+	struct cache_disk_slot *slots;  /* index */
+	unsigned char *ring;            /* data ring */
+	unsigned long long stored;      /* number of objects written */
+	unsigned long long promoted;    /* number of objects loaded back */
+	__decl_thread(HA_SPINLOCK_T lock);
+	struct list queue;              /* cache_disk_pending waiting to be written */
+	unsigned long long queued;      /* number of bytes in <queue> */
+	struct task *writer;            /* task writing the queued objects */
+	__decl_thread(HA_SPINLOCK_T queue_lock);
+};
+
 struct cache {
 	struct cache_tree trees[CACHE_TREE_NUM];
 	struct list list;        /* cache linked list */
@@ -65,7 +103,12 @@ struct cache {
 	unsigned int maxobjsz;   /* max-object-size (in bytes) */
 	unsigned int max_secondary_entries;  /* maximum number of secondary entries with the same primary hash */
 	uint8_t vary_processing_enabled;     /* boolean : manage Vary header (disabled by default) */
+	uint8_t collapse;                    /* boolean : collapse concurrent misses (disabled by default) */
+	unsigned int collapse_timeout;       /* max time a miss waits for the object to be fetched (ms) */
+	unsigned int max_stale;  /* max-stale (in seconds), 0 disables the delivery of stale objects */
+	unsigned int slice_size; /* slice-size (in bytes), 0 disables the storage of objects larger than maxobjsz */
 	char id[33];             /* cache name */
+	struct cache_disk *disk; /* optional disk tier, NULL if none */
 };
 
 /* the appctx context of a cache applet, stored in appctx->svcctx */
@@ -76,9 +119,17 @@ struct cache_appctx {
 	unsigned int offset;             /* start offset of remaining data relative to beginning of the next block */
 	unsigned int rem_data;           /* Remaining bytes for the last data block (HTX only, 0 means process next block) */
 	unsigned int send_notmodified:1; /* In case of conditional request, we might want to send a "304 Not Modified" response instead of the stored data. */
-	unsigned int unused:31;
-	/* 4 bytes hole here */
+	unsigned int streaming:1;        /* The entry was not complete when its delivery started */
+	unsigned int range:1;            /* Only the bytes <range_start> to <range_start>+<range_len>-1 of the body are sent */
+	unsigned int unused:29;
+	unsigned int range_start;        /* first byte of the body to send when <range> is set */
+	unsigned int range_len;          /* number of bytes of the body to send when <range> is set */
+	unsigned int slice_idx;          /* index of the slice being sent for a sliced entry */
 	struct shared_block *next;       /* The next block of data to be sent for this cache entry. */
+	struct cache_entry *slice;       /* The slice being sent for a sliced entry, or NULL when it is the entry itself */
+	struct cache_tree *slice_tree;   /* Tree of <slice> */
+	struct appctx *appctx;           /* The applet, to be woken up when streaming */
+	struct list waiter;              /* Element of entry->waiters while waiting for more data */
 };
 
 /* cache config for filters */
@@ -185,9 +236,57 @@ static inline void cache_wrunlock(struct cache_tree *cache)
 struct cache_st {
 	struct shared_block *first_block;
 	struct list detached_head;
+	struct task *task;               /* the stream's task */
+	struct cache_tree *pending_tree; /* tree of <pending>, protected by its lock */
+	struct cache_pending *pending;   /* pending fetch this stream leads or waits for */
+	struct list waiter;              /* element of pending->waiters for followers */
+	unsigned int flags;              /* CACHE_ST_F_* */
+	struct shared_block *slice_block; /* slice being stored for a sliced object, NULL while it is first_block */
+	unsigned int slice_idx;          /* index of the slice being stored */
+	unsigned int slice_room;         /* number of body bytes which may still be stored in the current slice */
+};
+
+#define CACHE_ST_F_LEADER      0x00000001 /* this stream fetches <pending> */
+#define CACHE_ST_F_NO_COLLAPSE 0x00000002 /* do not collapse this request anymore */
+#define CACHE_ST_F_WAITING     0x00000004 /* cache-use waits for another stream to fetch the object */
+
+/* An object which is not in the cache yet and is being fetched from the
+ * origin by a leader stream. Other streams missing the same object wait for
+ * it to be stored and then deliver it while it is being received, instead of
+ * fetching it too (collapsed forwarding). It is only visible to the current
+ * process and is protected by the lock of its cache tree.
+ */
+struct cache_pending {
+	struct eb32_node eb;     /* node in cache_tree->pending */
+	char hash[20];           /* primary key */
+	struct list waiters;     /* cache_st->waiter of the waiting streams */
 };
 
+/* context of a background refresh of a stale object, made by the HTTP client */
+struct cache_refresh {
+	struct cache *cache;
+	struct cache_tree *cache_tree;
+	struct cache_entry *stale;       /* the object being refreshed, retained */
+	struct shared_block *first;      /* first block of the new object, or NULL */
+	int maxage;                      /* effective max-age of the new object */
+	unsigned int revalidate;         /* stale-while-revalidate period of the new object */
+	unsigned int error;              /* stale-if-error period of the new object */
+	int status;                      /* CACHE_REFRESH_* */
+};
+
+#define CACHE_REFRESH_OK      0 /* the new object is being stored */
+#define CACHE_REFRESH_ERROR   1 /* the server failed, the stale object is kept */
+#define CACHE_REFRESH_ABORT   2 /* the new object could not be stored, the stale one is kept */
+#define CACHE_REFRESH_DISCARD 3 /* the new object may not be stored, neither the stale one */
+
+#define CACHE_REFRESH_TIMEOUT 10000 /* ms, when the backend has no server timeout */
+
+/* flags for get_entry() and get_secondary_entry() */
+#define CACHE_GET_DELETE      0x01 /* delete the expired entries found */
+#define CACHE_GET_STALE       0x02 /* also return the expired entries which may still be delivered */
+
 #define DEFAULT_MAX_SECONDARY_ENTRY 10
+#define DEFAULT_COLLAPSE_TIMEOUT    5000 /* ms */
 
 struct cache_entry {
 	unsigned int complete;    /* An entry won't be valid until complete is not null. */
@@ -218,36 +317,147 @@ struct cache_entry {
 			       * be used in case of an "If-Modified-Since"-based
 			       * conditional request. */
 
+	unsigned long long disk_pos; /* logical position of the entry in the disk tier, or 0 */
+
+	unsigned int avail;       /* number of bytes after the cache_entry which may be read */
+	unsigned int aborted;     /* the entry will never be completed */
+	unsigned int nb_waiters;  /* number of applets in <waiters> */
+	struct list waiters;      /* cache_appctx->waiter waiting for <avail> or <complete> to change,
+	                           * protected by the lock of the cache tree */
+
+	unsigned int stale_revalidate; /* date until which it may be delivered once expired while it is refreshed, or 0 */
+	unsigned int stale_error;      /* date until which it may be delivered once expired if refreshing it fails, or 0 */
+	unsigned int refresh_date;     /* date of the last background refresh attempt */
+	unsigned int refreshing;       /* a background refresh is in progress */
+	unsigned int refresh_failed;   /* the last refresh attempt failed */
+	unsigned int origin_ssl;       /* the object was received over SSL */
+	struct sockaddr_storage origin; /* address of the server the object was received from */
+
+	unsigned int slice_size;  /* size of the body slices of a sliced object, or 0 */
+	unsigned int slice_gen;   /* generation of a sliced object, part of the key of its slices */
+	unsigned int slice;       /* index of this slice of a sliced object, 0 for the entry holding the headers */
+
 	unsigned char data[0];
 };
 
 #define CACHE_BLOCKSIZE 1024
 #define CACHE_ENTRY_MAX_AGE 2147483648U
 
+#define CACHE_DISK_MAGIC      0x314b534448435048ULL /* "HPCHDSK1" */
+#define CACHE_DISK_REC_MAGIC  0x31434552U           /* "REC1" */
+#define CACHE_DISK_HDR_SIZE   4096  /* room reserved for the header */
+#define CACHE_DISK_ALIGN      64    /* records alignment in the ring */
+#define CACHE_DISK_AVG_OBJSZ  8192  /* expected average object size, to size the index */
+#define CACHE_DISK_MIN_SLOTS  1024  /* minimum number of index slots */
+#define CACHE_DISK_PROBES     16    /* number of index slots visited per lookup */
+#define CACHE_DISK_DEF_SIZE   1024  /* default disk-max-size in megabytes */
+#define CACHE_DISK_MAX_QUEUED (16 << 20) /* max bytes of evicted objects waiting to be written */
+#define CACHE_DISK_WRITE_BATCH 64   /* max objects written per writer task wakeup */
+
+/* header at the beginning of a cache disk file */
+struct cache_disk_hdr {
+	uint64_t magic;          /* CACHE_DISK_MAGIC once initialized */
+	uint32_t version;        /* sizeof(struct cache_disk_rec), detects format changes */
+	uint32_t nb_slots;       /* number of index slots, power of two */
+	uint64_t ring_size;      /* size of the data ring in bytes */
+	uint64_t wpos;           /* logical write position in the ring, starts at ring_size */
+	uint64_t seed;           /* cache_hash_seed used to build the secondary keys */
+};
+
+/* an index slot, locating a record in the ring */
+struct cache_disk_slot {
+	uint64_t pos;            /* logical position of the record, 0 if never used */
+	uint32_t len;            /* length of the record (aligned) */
+	uint32_t expire;         /* expiration date, 0 once deleted */
+	char hash[20];           /* primary key of the object */
+	uint32_t reserved;
+};
+
+/* a record in the data ring, followed by the object's data as stored in the
+ * shctx after the cache_entry.
+ */
+struct cache_disk_rec {
+	uint32_t magic;                  /* CACHE_DISK_REC_MAGIC */
+	uint32_t data_len;               /* length of <data> */
+	uint64_t sum;                    /* XXH3 of <data> */
+	char hash[20];
+	char secondary_key[HTTP_CACHE_SEC_KEY_LEN];
+	uint32_t secondary_key_signature;
+	uint32_t latest_validation;
+	uint32_t expire;
+	uint32_t age;
+	uint32_t body_size;
+	uint32_t etag_length;
+	uint32_t etag_offset;            /* relative to <data> */
+	int64_t last_modified;
+	unsigned char data[VAR_ARRAY];
+};
+
+/* an evicted object waiting in the queue of the disk tier, with its record
+ * fully built in <rec> except for the checksum.
+ */
+struct cache_disk_pending {
+	struct list list;                /* entry in the disk queue */
+	uint64_t disk_pos;               /* position it was loaded from, or 0 */
+	uint64_t len;                    /* size of <rec> */
+	unsigned char rec[VAR_ARRAY] ALIGNED(8); /* the struct cache_disk_rec */
+};
+
 static struct list caches = LIST_HEAD_INIT(caches);
 static struct list caches_config = LIST_HEAD_INIT(caches_config); /* cache config to init */
 static struct cache *tmp_cache_config = NULL;
 
 DECLARE_STATIC_POOL(pool_head_cache_st, "cache_st", sizeof(struct cache_st));
+DECLARE_STATIC_POOL(pool_head_cache_pending, "cache_pending", sizeof(struct cache_pending));
+DECLARE_STATIC_POOL(pool_head_cache_refresh, "cache_refresh", sizeof(struct cache_refresh));
+
+/* HTTP client proxy used to refresh stale objects, if any cache may deliver them */
+static struct proxy *cache_refresh_px;
+
+/* last generation assigned to a sliced object */
+static unsigned int cache_slice_gen;
 
 static struct eb32_node *insert_entry(struct cache *cache, struct cache_tree *tree, struct cache_entry *new_entry);
 static void delete_entry(struct cache_entry *del_entry);
 static inline void release_entry_locked(struct cache_tree *cache, struct cache_entry *entry);
 static inline void release_entry_unlocked(struct cache_tree *cache, struct cache_entry *entry);
 
+/* Returns non-zero if <entry> is expired but may still be delivered in some
+ * conditions, which is the case during its stale-while-revalidate and
+ * stale-if-error periods.
+ */
+static inline int cache_entry_is_stale(const struct cache_entry *entry)
+{
+	return entry->expire <= date.tv_sec &&
+		(entry->stale_revalidate > date.tv_sec || entry->stale_error > date.tv_sec);
+}
+
+/* Returns non-zero if stale entry <entry> may be delivered, which is the case
+ * during its stale-while-revalidate period, and during its stale-if-error
+ * period once refreshing it failed.
+ */
+static inline int cache_entry_stale_usable(struct cache_entry *entry)
+{
+	if (entry->stale_revalidate > date.tv_sec)
+		return 1;
+	return entry->stale_error > date.tv_sec && HA_ATOMIC_LOAD(&entry->refresh_failed);
+}
+
 /*
  * Find a cache_entry in the <cache>'s tree that has the hash <hash>.
- * If <delete_expired> is 0 then the entry is left untouched if it is found but
- * is already expired, and NULL is returned. Otherwise, the expired entry is
- * removed from the tree and NULL is returned.
+ * If CACHE_GET_DELETE is not set in <flags> then the entry is left untouched
+ * if it is found but is already expired, and NULL is returned. Otherwise, the
+ * expired entry is removed from the tree and NULL is returned. With
+ * CACHE_GET_STALE, an expired entry which may still be delivered in some
+ * conditions is returned, see cache_entry_stale_usable().
  * Returns a valid (not expired) cache_tree pointer.
  * The returned entry is not retained, it should be explicitly retained only
  * when necessary.
  *
  * This function must be called under a cache lock, either read if
- * delete_expired==0, write otherwise.
+ * CACHE_GET_DELETE is not set, write otherwise.
  */
-struct cache_entry *get_entry(struct cache_tree *cache_tree, char *hash, int delete_expired)
+struct cache_entry *get_entry(struct cache_tree *cache_tree, char *hash, int flags)
 {
 	struct eb32_node *node;
 	struct cache_entry *entry;
@@ -264,7 +474,13 @@ struct cache_entry *get_entry(struct cache_tree *cache_tree, char *hash, int del
 
 	if (entry->expire > date.tv_sec) {
 		return entry;
-	} else if (delete_expired) {
+	} else if ((flags & CACHE_GET_STALE) && cache_entry_is_stale(entry)) {
+		return entry;
+	} else if (flags & CACHE_GET_DELETE) {
+		/* It may still be delivered by some applets, so unlink it
+		 * now so that it cannot hide the entry replacing it.
+		 */
+		delete_entry(entry);
 		release_entry_locked(cache_tree, entry);
 	}
 	return NULL;
@@ -364,16 +580,14 @@ static int secondary_key_cmp(const char *ref_key, const char *new_key)
  * order to get the proper one out of the list, we use a secondary_key.
  * This function simply iterates over all the entries with the same primary_key
  * until it finds the right one.
- * If <delete_expired> is 0 then the entry is left untouched if it is found but
- * is already expired, and NULL is returned. Otherwise, the expired entry is
- * removed from the tree and NULL is returned.
+ * <flags> are the same as for get_entry().
  * Returns the cache_entry in case of success, NULL otherwise.
  *
  * This function must be called under a cache lock, either read if
- * delete_expired==0, write otherwise.
+ * CACHE_GET_DELETE is not set, write otherwise.
  */
 struct cache_entry *get_secondary_entry(struct cache_tree *cache, struct cache_entry *entry,
-                                        const char *secondary_key, int delete_expired)
+                                        const char *secondary_key, int flags)
 {
 	struct eb32_node *node = &entry->eb;
 
@@ -387,7 +601,7 @@ struct cache_entry *get_secondary_entry(struct cache_tree *cache, struct cache_e
 		 * when we find them. Calling delete_entry would be too costly
 		 * so we simply call eb32_delete. The secondary_entry count will
 		 * be updated when we try to insert a new entry to this list. */
-		if (entry->expire <= date.tv_sec && delete_expired) {
+		if (entry->expire <= date.tv_sec && (flags & CACHE_GET_DELETE)) {
 			release_entry_locked(cache, entry);
 		}
 
@@ -395,8 +609,10 @@ struct cache_entry *get_secondary_entry(struct cache_tree *cache, struct cache_e
 	}
 
 	/* Expired entry */
-	if (entry && entry->expire <= date.tv_sec) {
-		if (delete_expired) {
+	if (entry && entry->expire <= date.tv_sec &&
+	    !((flags & CACHE_GET_STALE) && cache_entry_is_stale(entry))) {
+		if (flags & CACHE_GET_DELETE) {
+			delete_entry(entry);
 			release_entry_locked(cache, entry);
 		}
 		entry = NULL;
@@ -568,231 +784,1098 @@ static inline struct shared_block *block_ptr(struct cache_entry *entry)
 }
 
 
+/*
+ * Collapsed forwarding
+ */
 
-static int
-cache_store_init(struct proxy *px, struct flt_conf *fconf)
+/* Returns the number of bytes after <entry> which may be read. It grows while
+ * the entry is being stored.
+ */
+static inline unsigned int cache_entry_avail(struct cache_entry *entry)
 {
-	fconf->flags |= FLT_CFG_FL_HTX;
-	return 0;
+	return HA_ATOMIC_LOAD(&entry->avail);
 }
 
-static void
-cache_store_deinit(struct proxy *px, struct flt_conf *fconf)
+/* Returns non-zero if <entry>, which is not complete, may already be delivered
+ * by the cache applet, which is the case once its headers are stored when
+ * collapsed forwarding is enabled on <cache>, unless it is sliced.
+ */
+static inline int cache_entry_streamable(const struct cache *cache, struct cache_entry *entry)
 {
-	struct cache_flt_conf *cconf = fconf->conf;
-
-	if (!(cconf->flags & CACHE_FLT_INIT))
-		free(cconf->c.name);
-	free(cconf);
+	return cache->collapse && cache_entry_avail(entry) && !HA_ATOMIC_LOAD(&entry->aborted) &&
+		!entry->slice_size;
 }
 
-static int
-cache_store_check(struct proxy *px, struct flt_conf *fconf)
+/* Wakes up the applets waiting for <object> to change. */
+static void cache_entry_wakeup(struct cache_tree *cache_tree, struct cache_entry *object)
 {
-	struct cache_flt_conf *cconf = fconf->conf;
-	struct flt_conf *f;
-	struct cache *cache;
-	int comp = 0;
+	struct cache_appctx *ctx, *back;
 
-	/* Find the cache corresponding to the name in the filter config.  The
-	*  cache will not be referenced now in the filter config because it is
-	*  not fully allocated. This step will be performed during the cache
-	*  post_check.
-	*/
-	list_for_each_entry(cache, &caches_config, list) {
-		if (strcmp(cache->id, cconf->c.name) == 0)
-			goto found;
+	/* pairs with the one in cache_entry_wait() */
+	__ha_barrier_full();
+	if (!HA_ATOMIC_LOAD(&object->nb_waiters))
+		return;
+
+	cache_wrlock(cache_tree);
+	list_for_each_entry_safe(ctx, back, &object->waiters, waiter) {
+		LIST_DEL_INIT(&ctx->waiter);
+		appctx_wakeup(ctx->appctx);
 	}
+	HA_ATOMIC_STORE(&object->nb_waiters, 0);
+	cache_wrunlock(cache_tree);
+}
 
-	ha_alert("config: %s '%s': unable to find the cache '%s' referenced by the filter 'cache'.\n",
-		 proxy_type_str(px), px->id, (char *)cconf->c.name);
-	return 1;
+/* Makes the first <avail> bytes after <object> readable by the applets
+ * delivering it while it is being stored, and wakes them up.
+ */
+static void cache_entry_publish(struct cache_tree *cache_tree, struct cache_entry *object,
+                                unsigned int avail)
+{
+	HA_ATOMIC_STORE(&object->avail, avail);
+	cache_entry_wakeup(cache_tree, object);
+}
 
-  found:
-	/* Here <cache> points on the cache the filter must use and <cconf>
-	 * points on the cache filter configuration. */
+/* Marks <object> as never to be completed, so that the applets delivering it
+ * abort their response.
+ */
+static void cache_entry_abort(struct cache_tree *cache_tree, struct cache_entry *object)
+{
+	HA_ATOMIC_STORE(&object->aborted, 1);
+	cache_entry_wakeup(cache_tree, object);
+}
 
-	/* Check all filters for proxy <px> to know if the compression is
-	 * enabled and if it is after the cache. When the compression is before
-	 * the cache, an error is returned. Also check if the cache filter must
-	 * be explicitly declaired or not. */
-	list_for_each_entry(f, &px->filter_configs, list) {
-		if (f == fconf) {
-			/* The compression filter must be evaluated after the cache. */
-			if (comp) {
-				ha_alert("config: %s '%s': unable to enable the compression filter before "
-					 "the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
-				return 1;
-			}
-		}
-		else if (f->id == http_comp_flt_id)
-			comp = 1;
-		else if (f->id == fcgi_flt_id)
-			continue;
-		else if ((f->id != fconf->id) && (cconf->flags & CACHE_FLT_F_IMPLICIT_DECL)) {
-			/* Implicit declaration is only allowed with the
-			 * compression and fcgi. For other filters, an implicit
-			 * declaration is required. */
-			ha_alert("config: %s '%s': require an explicit filter declaration "
-				 "to use the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
-			return 1;
-		}
+/* Registers the cache applet <appctx> as waiting for its entry to change.
+ * Returns 1 if the applet must wait, or 0 if the entry already changed since
+ * the applet sent its last byte, in which case it must check it again.
+ */
+static int cache_entry_wait(struct appctx *appctx)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+	struct cache_entry *entry = ctx->entry;
 
+	cache_wrlock(ctx->cache_tree);
+	if (!LIST_INLIST(&ctx->waiter)) {
+		LIST_APPEND(&entry->waiters, &ctx->waiter);
+		HA_ATOMIC_INC(&entry->nb_waiters);
 	}
-	return 0;
+	cache_wrunlock(ctx->cache_tree);
+
+	/* pairs with the one in cache_entry_wakeup() */
+	__ha_barrier_full();
+	if (HA_ATOMIC_LOAD(&entry->complete) || HA_ATOMIC_LOAD(&entry->aborted) ||
+	    cache_entry_avail(entry) != ctx->sent)
+		return 0;
+	return 1;
 }
 
-static int
-cache_store_strm_init(struct stream *s, struct filter *filter)
+/* Looks up the pending fetch of primary key <hash> in <cache_tree>. Must be
+ * called with the tree locked.
+ */
+static struct cache_pending *cache_pending_lookup(struct cache_tree *cache_tree, const char *hash)
 {
-	struct cache_st *st;
-
-	st = pool_alloc(pool_head_cache_st);
-	if (st == NULL)
-		return -1;
-
-	st->first_block = NULL;
-	filter->ctx     = st;
+	struct eb32_node *node;
+	struct cache_pending *pending;
 
-	/* Register post-analyzer on AN_RES_WAIT_HTTP */
-	filter->post_analyzers |= AN_RES_WAIT_HTTP;
-	return 1;
+	for (node = eb32_lookup(&cache_tree->pending, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		pending = eb32_entry(node, struct cache_pending, eb);
+		if (memcmp(pending->hash, hash, sizeof(pending->hash)) == 0)
+			return pending;
+	}
+	return NULL;
 }
 
-static void
-cache_store_strm_deinit(struct stream *s, struct filter *filter)
+/* Detaches the stream owning filter context <st> from the pending fetch it
+ * leads or waits for, if any. When the leader leaves, the pending fetch is
+ * released and all the streams waiting for it are woken up so that they look
+ * the object up again.
+ */
+static void cache_collapse_detach(struct cache_st *st)
 {
-	struct cache_st *st = filter->ctx;
-	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct cache *cache = cconf->c.cache;
-	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_pending *pending;
+	struct cache_st *follower, *back;
 
-	/* Everything should be released in the http_end filter, but we need to do it
-	 * there too, in case of errors */
-	if (st && st->first_block) {
-		struct cache_entry *object = (struct cache_entry *)st->first_block->data;
-		if (!object->complete) {
-			/* The stream was closed but the 'complete' flag was not
-			 * set which means that cache_store_http_end was not
-			 * called. The stream must have been closed before we
-			 * could store the full answer in the cache.
-			 */
-			release_entry_unlocked(&cache->trees[object->eb.key % CACHE_TREE_NUM], object);
+	/* only the leader may reset it for us, and never sets it */
+	if (!HA_ATOMIC_LOAD(&st->pending))
+		return;
+
+	cache_wrlock(st->pending_tree);
+	pending = st->pending;
+	if (pending && (st->flags & CACHE_ST_F_LEADER)) {
+		list_for_each_entry_safe(follower, back, &pending->waiters, waiter) {
+			LIST_DEL_INIT(&follower->waiter);
+			HA_ATOMIC_STORE(&follower->pending, NULL);
+			task_wakeup(follower->task, TASK_WOKEN_MSG);
 		}
-		shctx_wrlock(shctx);
-		shctx_row_reattach(shctx, st->first_block);
-		shctx_wrunlock(shctx);
-	}
-	if (st) {
-		pool_free(pool_head_cache_st, st);
-		filter->ctx = NULL;
+		eb32_delete(&pending->eb);
+		pool_free(pool_head_cache_pending, pending);
 	}
+	else if (pending)
+		LIST_DEL_INIT(&st->waiter);
+	st->pending = NULL;
+	st->flags &= ~CACHE_ST_F_LEADER;
+	cache_wrunlock(st->pending_tree);
 }
 
-static int
-cache_store_post_analyze(struct stream *s, struct filter *filter, struct channel *chn,
-			 unsigned an_bit)
+/* Called on a miss of stream <s> on <cache> when collapsed forwarding is
+ * enabled. If another stream is already fetching the object, <s> waits for it
+ * and ACT_RET_YIELD is returned. Otherwise ACT_RET_CONT is returned and, for
+ * GET requests, <s> becomes the leader of the fetch.
+ */
+static enum act_return cache_collapse_miss(struct cache *cache, struct cache_tree *cache_tree,
+                                           struct cache_st *st, struct stream *s, int flags)
 {
 	struct http_txn *txn = s->txn;
-	struct http_msg *msg = &txn->rsp;
-	struct cache_st *st = filter->ctx;
+	struct cache_pending *pending;
 
-	if (an_bit != AN_RES_WAIT_HTTP)
-		goto end;
+	if (!st || (st->flags & CACHE_ST_F_NO_COLLAPSE) || (flags & ACT_OPT_FINAL))
+		return ACT_RET_CONT;
 
-	/* Here we need to check if any compression filter precedes the cache
-	 * filter. This is only possible when the compression is configured in
-	 * the frontend while the cache filter is configured on the
-	 * backend. This case cannot be detected during HAProxy startup. So in
-	 * such cases, the cache is disabled.
-	 */
-	if (st && (msg->flags & HTTP_MSGF_COMPRESSING)) {
-		pool_free(pool_head_cache_st, st);
-		filter->ctx = NULL;
+	cache_wrlock(cache_tree);
+	pending = cache_pending_lookup(cache_tree, txn->cache_hash);
+	if (pending) {
+		LIST_APPEND(&pending->waiters, &st->waiter);
+		st->pending_tree = cache_tree;
+		st->pending = pending;
+		st->flags |= CACHE_ST_F_WAITING;
+		cache_wrunlock(cache_tree);
+		s->req.analyse_exp = tick_add(now_ms, cache->collapse_timeout);
+		return ACT_RET_YIELD;
 	}
 
-  end:
-	return 1;
+	/* HEAD requests do not fetch the body so they may not lead */
+	if (txn->meth == HTTP_METH_GET) {
+		pending = pool_alloc(pool_head_cache_pending);
+		if (pending) {
+			memcpy(pending->hash, txn->cache_hash, sizeof(pending->hash));
+			pending->eb.key = read_u32(pending->hash);
+			LIST_INIT(&pending->waiters);
+			eb32_insert(&cache_tree->pending, &pending->eb);
+			st->pending_tree = cache_tree;
+			st->pending = pending;
+			st->flags |= CACHE_ST_F_LEADER;
+		}
+	}
+	st->flags |= CACHE_ST_F_NO_COLLAPSE;
+	cache_wrunlock(cache_tree);
+	return ACT_RET_CONT;
 }
 
-static int
-cache_store_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
-{
-	struct cache_st *st = filter->ctx;
 
-	if (!(msg->chn->flags & CF_ISRESP) || !st)
-		return 1;
 
-	if (st->first_block)
-		register_data_filter(s, msg->chn, filter);
-	return 1;
-}
+/*
+ * Sliced objects
+ */
 
-static inline void disable_cache_entry(struct cache_st *st,
-                                       struct filter *filter, struct shared_context *shctx)
+/* Objects larger than max-object-size are stored in slices of <slice_size>
+ * bytes of body, each in its own row of the shctx. The first one also holds
+ * the headers and is indexed under the primary key of the object, the other
+ * ones are indexed under a key derived from it, from the generation of the
+ * object and from their index, so that a new version of the object never uses
+ * the slices of an older one. The DATA blocks are split on slice boundaries,
+ * so the slice holding any byte of the body is known.
+ */
+
+/* Computes in <hash> the key of slice <idx> of sliced object <object>. */
+static void cache_slice_hash(const struct cache_entry *object, unsigned int idx, char *hash)
 {
-	struct cache_entry *object;
-	struct cache *cache = (struct cache*)shctx->data;
+	blk_SHA_CTX sha1_ctx;
+	unsigned int gen = htonl(object->slice_gen);
 
-	object = (struct cache_entry *)st->first_block->data;
-	filter->ctx = NULL; /* disable cache  */
-	release_entry_unlocked(&cache->trees[object->eb.key % CACHE_TREE_NUM], object);
-	shctx_wrlock(shctx);
-	shctx_row_reattach(shctx, st->first_block);
-	shctx_wrunlock(shctx);
-	pool_free(pool_head_cache_st, st);
+	idx = htonl(idx);
+	blk_SHA1_Init(&sha1_ctx);
+	blk_SHA1_Update(&sha1_ctx, object->hash, sizeof(object->hash));
+	blk_SHA1_Update(&sha1_ctx, &gen, sizeof(gen));
+	blk_SHA1_Update(&sha1_ctx, &idx, sizeof(idx));
+	blk_SHA1_Final((unsigned char *)hash, &sha1_ctx);
 }
 
-static int
-cache_store_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
-			 unsigned int offset, unsigned int len)
+/* Returns the number of slices of sliced object <object>. */
+static inline unsigned int cache_slice_count(const struct cache_entry *object)
 {
-	struct cache_flt_conf *cconf = FLT_CONF(filter);
-	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
-	struct cache_st *st = filter->ctx;
-	struct htx *htx = htxbuf(&msg->chn->buf);
-	struct htx_blk *blk;
-	struct shared_block *fb;
-	struct htx_ret htxret;
-	size_t data_len = 0;
-	unsigned int orig_len, to_forward;
-	int ret;
+	return object->body_size ? (object->body_size - 1) / object->slice_size + 1 : 1;
+}
 
-	if (!len)
-		return len;
+/* Looks up the slice of key <hash> in <cache_tree>. Slices do not expire
+ * before the object they belong to, so they are returned even once expired.
+ * Must be called with the tree locked.
+ */
+static struct cache_entry *cache_slice_lookup(struct cache_tree *cache_tree, const char *hash)
+{
+	struct eb32_node *node;
+	struct cache_entry *slice;
 
-	if (!st->first_block) {
-		unregister_data_filter(s, msg->chn, filter);
-		return len;
+	for (node = eb32_lookup(&cache_tree->entries, read_u32(hash)); node; node = eb32_next_dup(node)) {
+		slice = eb32_entry(node, struct cache_entry, eb);
+		if (memcmp(slice->hash, hash, sizeof(slice->hash)) == 0)
+			return slice;
 	}
+	return NULL;
+}
 
-	chunk_reset(&trash);
-	orig_len = len;
-	to_forward = 0;
-
-	htxret = htx_find_offset(htx, offset);
-	blk = htxret.blk;
-	offset = htxret.ret;
-	for (; blk && len; blk = htx_get_next_blk(htx, blk)) {
-		enum htx_blk_type type = htx_get_blk_type(blk);
-		uint32_t info, sz = htx_get_blksz(blk);
-		struct ist v;
+/* Returns non-zero if all the slices <first> to <last> of sliced object
+ * <object> are complete in <cache>. The first slice is the object itself.
+ */
+static int cache_slices_available(struct cache *cache, struct cache_entry *object,
+                                  unsigned int first, unsigned int last)
+{
+	struct cache_tree *cache_tree;
+	struct cache_entry *slice;
+	char hash[20];
 
-		switch (type) {
-			case HTX_BLK_UNUSED:
+	for (first = MAX(first, 1); first <= last; first++) {
+		cache_slice_hash(object, first, hash);
+		cache_tree = get_cache_tree_from_hash(cache, read_u32(hash));
+		cache_rdlock(cache_tree);
+		slice = cache_slice_lookup(cache_tree, hash);
+		if (!slice || !slice->complete) {
+			cache_rdunlock(cache_tree);
+			return 0;
+		}
+		cache_rdunlock(cache_tree);
+	}
+	return 1;
+}
+
+/* Ends the storage of the slice being stored by the stream owning filter
+ * context <st>, which is complete if <complete> is set, or is removed
+ * otherwise.
+ */
+static void cache_slice_close(struct cache *cache, struct cache_st *st, int complete)
+{
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_entry *slice;
+	struct cache_tree *cache_tree;
+
+	if (!st->slice_block)
+		return;
+
+	slice = (struct cache_entry *)st->slice_block->data;
+	cache_tree = get_cache_tree_from_hash(cache, read_u32(slice->hash));
+	if (complete)
+		HA_ATOMIC_STORE(&slice->complete, 1);
+	else {
+		cache_entry_abort(cache_tree, slice);
+		release_entry_unlocked(cache_tree, slice);
+	}
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, st->slice_block);
+	shctx_wrunlock(shctx);
+	st->slice_block = NULL;
+}
+
+/* Completes the slice being stored by the stream owning filter context <st>
+ * and reserves the next one in <cache>. Returns 0 if it cannot be reserved.
+ */
+static int cache_slice_open(struct cache *cache, struct cache_st *st)
+{
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_entry *object = (struct cache_entry *)st->first_block->data;
+	struct cache_entry *slice;
+	struct cache_tree *cache_tree;
+	struct shared_block *sb;
+
+	cache_slice_close(cache, st, 1);
+
+	sb = shctx_row_reserve_hot(shctx, NULL, sizeof(*slice));
+	if (!sb)
+		return 0;
+
+	slice = (struct cache_entry *)sb->data;
+	memset(slice, 0, sizeof(*slice));
+	LIST_INIT(&slice->waiters);
+	cache_slice_hash(object, st->slice_idx + 1, slice->hash);
+	slice->eb.key = read_u32(slice->hash);
+	slice->latest_validation = object->latest_validation;
+	slice->expire = object->expire;
+	slice->slice_size = object->slice_size;
+	slice->slice_gen = object->slice_gen;
+	slice->slice = st->slice_idx + 1;
+
+	cache_tree = get_cache_tree_from_hash(cache, slice->eb.key);
+	cache_wrlock(cache_tree);
+	insert_entry(cache, cache_tree, slice);
+	cache_wrunlock(cache_tree);
+
+	sb->len = sizeof(*slice);
+	sb->last_append = NULL;
+
+	st->slice_block = sb;
+	st->slice_idx++;
+	st->slice_room = object->slice_size;
+	return 1;
+}
+
+
+/*
+ * Disk tier
+ */
+
+/* Serializes accesses to the disk tier between threads and processes. */
+static inline void cache_disk_lock(struct cache_disk *disk)
+{
+	HA_SPIN_LOCK(CACHE_LOCK, &disk->lock);
+	while (flock(disk->fd, LOCK_EX) < 0 && errno == EINTR)
+		;
+}
+
+static inline void cache_disk_unlock(struct cache_disk *disk)
+{
+	flock(disk->fd, LOCK_UN);
+	HA_SPIN_UNLOCK(CACHE_LOCK, &disk->lock);
+}
+
+/* Returns non-zero if the record referenced by <slot> was not overwritten and
+ * is not expired. When called without the disk lock, the result is only a hint
+ * which must be verified again under the lock.
+ */
+static inline int cache_disk_slot_valid(const struct cache_disk *disk, const struct cache_disk_slot *slot)
+{
+	return slot->pos && slot->expire > date.tv_sec &&
+	       slot->pos >= disk->hdr->wpos - disk->hdr->ring_size;
+}
+
+/* Returns the record stored at logical position <pos> */
+static inline struct cache_disk_rec *cache_disk_rec(const struct cache_disk *disk, uint64_t pos)
+{
+	return (struct cache_disk_rec *)(disk->ring + pos % disk->hdr->ring_size);
+}
+
+/* Returns the first index slot to visit for primary key <hash> */
+static inline unsigned int cache_disk_first_slot(const struct cache_disk *disk, const char *hash)
+{
+	return read_u32(hash) & (disk->hdr->nb_slots - 1);
+}
+
+/* Writes record <rec> to the disk tier <disk>. <disk_pos> is the position the
+ * object was loaded from, if any, in which case nothing is done if it is still
+ * there.
+ */
+static void cache_disk_write(struct cache_disk *disk, struct cache_disk_rec *rec, uint64_t disk_pos)
+{
+	struct cache_disk_slot *slot, *victim = NULL;
+	unsigned int rec_len, idx, i;
+	uint64_t ring_size, pos;
+
+	rec_len = (sizeof(*rec) + rec->data_len + CACHE_DISK_ALIGN - 1) & -CACHE_DISK_ALIGN;
+	ring_size = disk->hdr->ring_size;
+
+	cache_disk_lock(disk);
+
+	/* Pick the slot to use: one already holding this object without a
+	 * secondary key, otherwise the first unused one, otherwise the
+	 * oldest one.
+	 */
+	idx = cache_disk_first_slot(disk, rec->hash);
+	for (i = 0; i < CACHE_DISK_PROBES; i++) {
+		slot = &disk->slots[(idx + i) & (disk->hdr->nb_slots - 1)];
+
+		if (!cache_disk_slot_valid(disk, slot)) {
+			if (!victim || cache_disk_slot_valid(disk, victim))
+				victim = slot;
+			if (!slot->pos)
+				break;
+			continue;
+		}
+
+		if (disk_pos && slot->pos == disk_pos)
+			goto out; /* still there */
+
+		if (!rec->secondary_key_signature &&
+		    memcmp(slot->hash, rec->hash, sizeof(slot->hash)) == 0) {
+			victim = slot;
+			break;
+		}
+
+		if (!victim || (cache_disk_slot_valid(disk, victim) && slot->pos < victim->pos))
+			victim = slot;
+	}
+
+	/* records never wrap at the end of the ring */
+	pos = disk->hdr->wpos;
+	if (pos % ring_size + rec_len > ring_size)
+		pos += ring_size - pos % ring_size;
+
+	/* Move the write position first so that the records we are going to
+	 * overwrite are considered invalid even if we are interrupted.
+	 */
+	disk->hdr->wpos = pos + rec_len;
+	memcpy(cache_disk_rec(disk, pos), rec, sizeof(*rec) + rec->data_len);
+
+	victim->pos = pos;
+	victim->len = rec_len;
+	victim->expire = rec->expire;
+	memcpy(victim->hash, rec->hash, sizeof(victim->hash));
+	disk->stored++;
+ out:
+	cache_disk_unlock(disk);
+}
+
+/* Task writing the objects queued for the disk tier <context> */
+static struct task *cache_disk_writer(struct task *t, void *context, unsigned int state)
+{
+	struct cache_disk *disk = context;
+	struct cache_disk_pending *pending;
+	struct cache_disk_rec *rec;
+	int done;
+
+	for (done = 0; done < CACHE_DISK_WRITE_BATCH; done++) {
+		HA_SPIN_LOCK(CACHE_LOCK, &disk->queue_lock);
+		pending = LIST_ISEMPTY(&disk->queue) ? NULL :
+			LIST_ELEM(disk->queue.n, struct cache_disk_pending *, list);
+		if (pending) {
+			LIST_DELETE(&pending->list);
+			disk->queued -= pending->len;
+		}
+		HA_SPIN_UNLOCK(CACHE_LOCK, &disk->queue_lock);
+
+		if (!pending)
+			return t;
+
+		rec = (struct cache_disk_rec *)pending->rec;
+		if (!stopping && rec->expire > date.tv_sec) {
+			rec->sum = XXH3(rec->data, rec->data_len, 0);
+			cache_disk_write(disk, rec, pending->disk_pos);
+		}
+		free(pending);
+	}
+
+	/* more work left, let other tasks run first */
+	task_wakeup(t, TASK_WOKEN_OTHER);
+	return t;
+}
+
+/* Queues the object whose first block is <first> to be written to the disk
+ * tier of <cache>, if any. This is called from cache_free_blocks() when the row
+ * is about to be reused, under the shctx lock, so the whole row is still
+ * intact. It is only copied here, the file is written later by the writer
+ * task. Incomplete and expired objects are ignored, as well as those which
+ * were loaded from the disk and are likely still there. Objects are also
+ * dropped when too many are already waiting.
+ */
+static void cache_disk_queue(struct cache *cache, struct shared_block *first)
+{
+	struct cache_disk *disk = cache->disk;
+	struct cache_entry *object = (struct cache_entry *)first->data;
+	struct cache_disk_pending *pending;
+	struct cache_disk_rec *rec;
+	unsigned int data_len, rec_len;
+
+	if (!disk || stopping || !object->complete || object->slice_size ||
+	    object->expire <= date.tv_sec + 1)
+		return;
+
+	/* checked again by the writer under the lock */
+	if (object->disk_pos && object->disk_pos >= disk->hdr->wpos - disk->hdr->ring_size)
+		return;
+
+	data_len = first->len - sizeof(*object);
+	rec_len = (sizeof(*rec) + data_len + CACHE_DISK_ALIGN - 1) & -CACHE_DISK_ALIGN;
+	if (rec_len > disk->hdr->ring_size / 2)
+		return;
+
+	if (HA_ATOMIC_LOAD(&disk->queued) + sizeof(*rec) + data_len > CACHE_DISK_MAX_QUEUED)
+		return;
+
+	pending = malloc(sizeof(*pending) + sizeof(*rec) + data_len);
+	if (!pending)
+		return;
+
+	pending->disk_pos = object->disk_pos;
+	pending->len = sizeof(*rec) + data_len;
+	rec = (struct cache_disk_rec *)pending->rec;
+	rec->magic = CACHE_DISK_REC_MAGIC;
+	rec->data_len = data_len;
+	rec->sum = 0;
+	memcpy(rec->hash, object->hash, sizeof(rec->hash));
+	memcpy(rec->secondary_key, object->secondary_key, sizeof(rec->secondary_key));
+	rec->secondary_key_signature = object->secondary_key_signature;
+	rec->latest_validation = object->latest_validation;
+	rec->expire = object->expire;
+	rec->age = object->age;
+	rec->body_size = object->body_size;
+	rec->etag_length = object->etag_length;
+	rec->etag_offset = object->etag_length ? object->etag_offset - sizeof(*object) : 0;
+	rec->last_modified = object->last_modified;
+	shctx_row_data_get(shctx_ptr(cache), first, rec->data, sizeof(*object), data_len);
+
+	HA_SPIN_LOCK(CACHE_LOCK, &disk->queue_lock);
+	LIST_APPEND(&disk->queue, &pending->list);
+	disk->queued += pending->len;
+	HA_SPIN_UNLOCK(CACHE_LOCK, &disk->queue_lock);
+
+	task_wakeup(disk->writer, TASK_WOKEN_OTHER);
+}
+
+/* Looks for the object requested by stream <s> in the disk tier of <cache>
+ * and loads it back into the shctx and into <cache_tree> if found, so that it
+ * can be delivered by the cache applet. Returns non-zero if an entry was
+ * inserted in the tree. The secondary key of the stream is preserved. The
+ * index is first looked up without locking, so that misses, which are the
+ * common case, never wait for the lock nor perform any system call. A record
+ * found this way is fully verified under the lock before being used.
+ */
+static int cache_disk_promote(struct cache *cache, struct cache_tree *cache_tree, struct stream *s)
+{
+	struct cache_disk *disk = cache->disk;
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct http_txn *txn = s->txn;
+	struct cache_disk_slot *slot;
+	struct cache_disk_rec *rec;
+	struct cache_entry *object, *old;
+	struct shared_block *first;
+	char sec_key[HTTP_CACHE_SEC_KEY_LEN];
+	unsigned int txn_flags = txn->flags;
+	unsigned int data_len = 0, idx, i;
+	uint64_t pos = 0;
+
+	if (!disk || stopping)
+		return 0;
+
+	/* building the secondary keys of the records below overwrites it */
+	memcpy(sec_key, txn->cache_secondary_hash, sizeof(sec_key));
+
+	idx = cache_disk_first_slot(disk, txn->cache_hash);
+	for (i = 0; i < CACHE_DISK_PROBES; i++) {
+		slot = &disk->slots[(idx + i) & (disk->hdr->nb_slots - 1)];
+		if (!slot->pos)
+			break;
+		if (slot->pos <= pos || !cache_disk_slot_valid(disk, slot) ||
+		    memcmp(slot->hash, txn->cache_hash, sizeof(slot->hash)) != 0)
+			continue;
+
+		rec = cache_disk_rec(disk, slot->pos);
+		if (rec->magic != CACHE_DISK_REC_MAGIC ||
+		    memcmp(rec->hash, txn->cache_hash, sizeof(rec->hash)) != 0)
+			continue;
+
+		if (rec->secondary_key_signature) {
+			if (!cache->vary_processing_enabled ||
+			    http_request_build_secondary_key(s, rec->secondary_key_signature) ||
+			    secondary_key_cmp(rec->secondary_key, txn->cache_secondary_hash) != 0)
+				continue;
+		}
+
+		/* keep the most recent one */
+		pos = slot->pos;
+		data_len = rec->data_len;
+	}
+
+	memcpy(txn->cache_secondary_hash, sec_key, sizeof(sec_key));
+	txn->flags = (txn->flags & ~TX_CACHE_HAS_SEC_KEY) | (txn_flags & TX_CACHE_HAS_SEC_KEY);
+
+	if (!pos)
+		return 0;
+
+	/* This may evict other objects to the disk tier, so the lock must not
+	 * be held, and the record must be checked again after.
+	 */
+	first = shctx_row_reserve_hot(shctx, NULL, sizeof(*object) + data_len);
+	if (!first)
+		return 0;
+
+	object = (struct cache_entry *)first->data;
+	memset(object, 0, sizeof(*object));
+	LIST_INIT(&object->waiters);
+	first->len = sizeof(*object);
+	first->last_append = NULL;
+
+	cache_disk_lock(disk);
+	rec = cache_disk_rec(disk, pos);
+	if (pos < disk->hdr->wpos - disk->hdr->ring_size ||
+	    rec->magic != CACHE_DISK_REC_MAGIC || rec->data_len != data_len ||
+	    memcmp(rec->hash, txn->cache_hash, sizeof(rec->hash)) != 0 ||
+	    rec->expire <= date.tv_sec || XXH3(rec->data, data_len, 0) != rec->sum ||
+	    shctx_row_data_append(shctx, first, rec->data, data_len) < 0) {
+		cache_disk_unlock(disk);
+		goto fail;
+	}
+
+	memcpy(object->hash, rec->hash, sizeof(object->hash));
+	memcpy(object->secondary_key, rec->secondary_key, sizeof(object->secondary_key));
+	object->secondary_key_signature = rec->secondary_key_signature;
+	object->latest_validation = rec->latest_validation;
+	object->expire = rec->expire;
+	object->age = rec->age;
+	object->body_size = rec->body_size;
+	object->etag_length = rec->etag_length;
+	object->etag_offset = rec->etag_length ? rec->etag_offset + sizeof(*object) : 0;
+	object->last_modified = rec->last_modified;
+	object->disk_pos = pos;
+	disk->promoted++;
+	cache_disk_unlock(disk);
+
+	object->eb.key = read_u32(object->hash);
+	object->avail = data_len;
+	object->complete = 1;
+
+	cache_wrlock(cache_tree);
+	old = get_entry(cache_tree, object->hash, CACHE_GET_DELETE);
+	if (old && object->secondary_key_signature)
+		old = get_secondary_entry(cache_tree, old, object->secondary_key, CACHE_GET_DELETE);
+	if (old || insert_entry(cache, cache_tree, object) != &object->eb) {
+		/* another stream was faster */
+		object->eb.key = 0;
+		cache_wrunlock(cache_tree);
+		goto fail;
+	}
+	cache_wrunlock(cache_tree);
+
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, first);
+	shctx_wrunlock(shctx);
+	return 1;
+
+ fail:
+	first->len = 0;
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, first);
+	shctx_wrunlock(shctx);
+	return 0;
+}
+
+/* Removes all the objects with primary key <hash> from the disk tier of
+ * <cache>, if any. The index is first checked without locking so that the
+ * lock is only taken when there is something to delete.
+ */
+static void cache_disk_delete(struct cache *cache, const char *hash)
+{
+	struct cache_disk *disk = cache->disk;
+	struct cache_disk_slot *slot;
+	unsigned int idx, i;
+
+	if (!disk || stopping)
+		return;
+
+	idx = cache_disk_first_slot(disk, hash);
+	for (i = 0; i < CACHE_DISK_PROBES; i++) {
+		slot = &disk->slots[(idx + i) & (disk->hdr->nb_slots - 1)];
+		if (!slot->pos)
+			return;
+		if (slot->expire && memcmp(slot->hash, hash, sizeof(slot->hash)) == 0)
+			break;
+	}
+	if (i == CACHE_DISK_PROBES)
+		return;
+
+	cache_disk_lock(disk);
+	for (i = 0; i < CACHE_DISK_PROBES; i++) {
+		slot = &disk->slots[(idx + i) & (disk->hdr->nb_slots - 1)];
+		if (!slot->pos)
+			break;
+		if (memcmp(slot->hash, hash, sizeof(slot->hash)) == 0)
+			slot->expire = 0;
+	}
+	cache_disk_unlock(disk);
+}
+
+/* Opens and maps the file of the disk tier of <cache>. A missing file or one
+ * which doesn't match the current settings is reinitialized, otherwise its
+ * index is kept. Returns 0 and fills <err> on failure, otherwise non-zero.
+ */
+static int cache_disk_open(struct cache *cache, char **err)
+{
+	static int seed_set = 0;
+	struct cache_disk *disk = cache->disk;
+	struct cache_disk_hdr *hdr;
+	uint64_t nb_slots, index_size, file_size;
+	struct stat st;
+	void *area;
+
+	nb_slots = CACHE_DISK_MIN_SLOTS;
+	while (nb_slots < disk->size / CACHE_DISK_AVG_OBJSZ)
+		nb_slots *= 2;
+	index_size = CACHE_DISK_HDR_SIZE + nb_slots * sizeof(struct cache_disk_slot);
+	file_size = index_size + disk->size;
+
+	disk->fd = open(disk->path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (disk->fd < 0) {
+		memprintf(err, "cannot open '%s' : %s", disk->path, strerror(errno));
+		return 0;
+	}
+
+	if (fstat(disk->fd, &st) < 0 ||
+	    (st.st_size != file_size && ftruncate(disk->fd, file_size) < 0)) {
+		memprintf(err, "cannot resize '%s' to %llu bytes : %s",
+		          disk->path, (ullong)file_size, strerror(errno));
+		goto fail;
+	}
+
+	area = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, disk->fd, 0);
+	if (area == MAP_FAILED) {
+		memprintf(err, "cannot map '%s' : %s", disk->path, strerror(errno));
+		goto fail;
+	}
+
+	disk->hdr = hdr = area;
+	disk->slots = area + CACHE_DISK_HDR_SIZE;
+	disk->ring = area + index_size;
+
+	flock(disk->fd, LOCK_EX);
+	if (hdr->magic == CACHE_DISK_MAGIC && hdr->seed != cache_hash_seed && !seed_set) {
+		/* secondary keys of the stored objects depend on this seed */
+		cache_hash_seed = hdr->seed;
+	}
+
+	if (hdr->magic != CACHE_DISK_MAGIC || hdr->version != sizeof(struct cache_disk_rec) ||
+	    hdr->nb_slots != nb_slots || hdr->ring_size != disk->size ||
+	    hdr->wpos < disk->size || hdr->seed != cache_hash_seed) {
+		/* new or incompatible file, start with an empty index */
+		memset(area, 0, index_size);
+		hdr->version = sizeof(struct cache_disk_rec);
+		hdr->nb_slots = nb_slots;
+		hdr->ring_size = disk->size;
+		hdr->wpos = disk->size;
+		hdr->seed = cache_hash_seed;
+		hdr->magic = CACHE_DISK_MAGIC;
+	}
+	seed_set = 1;
+	flock(disk->fd, LOCK_UN);
+
+	disk->writer = task_new_anywhere();
+	if (!disk->writer) {
+		memprintf(err, "out of memory while allocating the writer task");
+		goto fail;
+	}
+	disk->writer->process = cache_disk_writer;
+	disk->writer->context = disk;
+	LIST_INIT(&disk->queue);
+	disk->queued = 0;
+	HA_SPIN_INIT(&disk->lock);
+	HA_SPIN_INIT(&disk->queue_lock);
+	return 1;
+
+ fail:
+	close(disk->fd);
+	disk->fd = -1;
+	return 0;
+}
+
+/* Releases the disk tier of <cache>, if any */
+static void cache_disk_release(struct cache *cache)
+{
+	struct cache_disk *disk = cache->disk;
+
+	if (!disk)
+		return;
+
+	if (disk->writer) {
+		struct cache_disk_pending *pending, *back;
+
+		list_for_each_entry_safe(pending, back, &disk->queue, list) {
+			LIST_DELETE(&pending->list);
+			free(pending);
+		}
+		task_destroy(disk->writer);
+	}
+
+	if (disk->hdr)
+		munmap(disk->hdr, (void *)disk->ring - (void *)disk->hdr + disk->size);
+	if (disk->fd >= 0)
+		close(disk->fd);
+	free(disk->path);
+	ha_free(&cache->disk);
+}
+
+
+static int
+cache_store_init(struct proxy *px, struct flt_conf *fconf)
+{
+	fconf->flags |= FLT_CFG_FL_HTX;
+	return 0;
+}
+
+static void
+cache_store_deinit(struct proxy *px, struct flt_conf *fconf)
+{
+	struct cache_flt_conf *cconf = fconf->conf;
+
+	if (!(cconf->flags & CACHE_FLT_INIT))
+		free(cconf->c.name);
+	free(cconf);
+}
+
+static int
+cache_store_check(struct proxy *px, struct flt_conf *fconf)
+{
+	struct cache_flt_conf *cconf = fconf->conf;
+	struct flt_conf *f;
+	struct cache *cache;
+	int comp = 0;
+
+	/* Find the cache corresponding to the name in the filter config.  The
+	*  cache will not be referenced now in the filter config because it is
+	*  not fully allocated. This step will be performed during the cache
+	*  post_check.
+	*/
+	list_for_each_entry(cache, &caches_config, list) {
+		if (strcmp(cache->id, cconf->c.name) == 0)
+			goto found;
+	}
+
+	ha_alert("config: %s '%s': unable to find the cache '%s' referenced by the filter 'cache'.\n",
+		 proxy_type_str(px), px->id, (char *)cconf->c.name);
+	return 1;
+
+  found:
+	/* Here <cache> points on the cache the filter must use and <cconf>
+	 * points on the cache filter configuration. */
+
+	/* Check all filters for proxy <px> to know if the compression is
+	 * enabled and if it is after the cache. When the compression is before
+	 * the cache, an error is returned. Also check if the cache filter must
+	 * be explicitly declaired or not. */
+	list_for_each_entry(f, &px->filter_configs, list) {
+		if (f == fconf) {
+			/* The compression filter must be evaluated after the cache. */
+			if (comp) {
+				ha_alert("config: %s '%s': unable to enable the compression filter before "
+					 "the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
+				return 1;
+			}
+		}
+		else if (f->id == http_comp_flt_id)
+			comp = 1;
+		else if (f->id == fcgi_flt_id)
+			continue;
+		else if ((f->id != fconf->id) && (cconf->flags & CACHE_FLT_F_IMPLICIT_DECL)) {
+			/* Implicit declaration is only allowed with the
+			 * compression and fcgi. For other filters, an implicit
+			 * declaration is required. */
+			ha_alert("config: %s '%s': require an explicit filter declaration "
+				 "to use the cache '%s'.\n", proxy_type_str(px), px->id, cache->id);
+			return 1;
+		}
+
+	}
+	return 0;
+}
+
+static int
+cache_store_strm_init(struct stream *s, struct filter *filter)
+{
+	struct cache_st *st;
+
+	st = pool_alloc(pool_head_cache_st);
+	if (st == NULL)
+		return -1;
+
+	st->first_block = NULL;
+	st->task = s->task;
+	st->pending_tree = NULL;
+	st->pending = NULL;
+	LIST_INIT(&st->waiter);
+	st->flags = 0;
+	st->slice_block = NULL;
+	st->slice_idx = 0;
+	st->slice_room = 0;
+	filter->ctx     = st;
+
+	/* Register post-analyzer on AN_RES_WAIT_HTTP */
+	filter->post_analyzers |= AN_RES_WAIT_HTTP;
+	return 1;
+}
+
+static void
+cache_store_strm_deinit(struct stream *s, struct filter *filter)
+{
+	struct cache_st *st = filter->ctx;
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
+	struct cache *cache = cconf->c.cache;
+	struct shared_context *shctx = shctx_ptr(cache);
+
+	/* Everything should be released in the http_end filter, but we need to do it
+	 * there too, in case of errors */
+	if (st && st->first_block) {
+		struct cache_entry *object = (struct cache_entry *)st->first_block->data;
+		if (!object->complete) {
+			/* The stream was closed but the 'complete' flag was not
+			 * set which means that cache_store_http_end was not
+			 * called. The stream must have been closed before we
+			 * could store the full answer in the cache.
+			 */
+			struct cache_tree *cache_tree = get_cache_tree_from_hash(cache, read_u32(object->hash));
+
+			cache_slice_close(cache, st, 0);
+			cache_entry_abort(cache_tree, object);
+			release_entry_unlocked(cache_tree, object);
+		}
+		shctx_wrlock(shctx);
+		shctx_row_reattach(shctx, st->first_block);
+		shctx_wrunlock(shctx);
+	}
+	if (st) {
+		cache_collapse_detach(st);
+		pool_free(pool_head_cache_st, st);
+		filter->ctx = NULL;
+	}
+}
+
+static int
+cache_store_post_analyze(struct stream *s, struct filter *filter, struct channel *chn,
+			 unsigned an_bit)
+{
+	struct http_txn *txn = s->txn;
+	struct http_msg *msg = &txn->rsp;
+	struct cache_st *st = filter->ctx;
+
+	if (an_bit != AN_RES_WAIT_HTTP)
+		goto end;
+
+	/* Here we need to check if any compression filter precedes the cache
+	 * filter. This is only possible when the compression is configured in
+	 * the frontend while the cache filter is configured on the
+	 * backend. This case cannot be detected during HAProxy startup. So in
+	 * such cases, the cache is disabled.
+	 */
+	if (st && (msg->flags & HTTP_MSGF_COMPRESSING)) {
+		cache_collapse_detach(st);
+		pool_free(pool_head_cache_st, st);
+		filter->ctx = NULL;
+	}
+
+  end:
+	return 1;
+}
+
+static int
+cache_store_http_headers(struct stream *s, struct filter *filter, struct http_msg *msg)
+{
+	struct cache_st *st = filter->ctx;
+
+	if (!(msg->chn->flags & CF_ISRESP) || !st)
+		return 1;
+
+	/* the object is not being stored if it was not done yet, the
+	 * waiting streams must not wait for it anymore.
+	 */
+	cache_collapse_detach(st);
+
+	if (st->first_block)
+		register_data_filter(s, msg->chn, filter);
+	return 1;
+}
+
+static inline void disable_cache_entry(struct cache_st *st,
+                                       struct filter *filter, struct shared_context *shctx)
+{
+	struct cache_entry *object;
+	struct cache *cache = (struct cache*)shctx->data;
+	struct cache_tree *cache_tree;
+
+	object = (struct cache_entry *)st->first_block->data;
+	cache_tree = get_cache_tree_from_hash(cache, read_u32(object->hash));
+	filter->ctx = NULL; /* disable cache  */
+	cache_slice_close(cache, st, 0);
+	cache_entry_abort(cache_tree, object);
+	release_entry_unlocked(cache_tree, object);
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, st->first_block);
+	shctx_wrunlock(shctx);
+	cache_collapse_detach(st);
+	pool_free(pool_head_cache_st, st);
+}
+
+/* Appends the blocks copied to the trash to the row being stored by the stream
+ * owning filter context <st>, which is the slice being stored for a sliced
+ * object. <data_len> is the number of bytes of body they contain. Returns 0 if
+ * they cannot be stored.
+ */
+static int cache_store_flush(struct cache *cache, struct cache_st *st, unsigned int data_len)
+{
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct shared_block *sb = st->slice_block ? st->slice_block : st->first_block;
+	struct cache_entry *object, *row;
+
+	if (!shctx_row_reserve_hot(shctx, sb, trash.data))
+		return 0;
+
+	/* disguise below to shut a warning on */
+	object = DISGUISE((struct cache_entry *)st->first_block->data);
+	row = DISGUISE((struct cache_entry *)sb->data);
+	object->body_size += data_len;
+	if (row != object)
+		row->body_size += data_len;
+	if (shctx_row_data_append(shctx, sb, (unsigned char *)b_head(&trash), b_data(&trash)) < 0)
+		return 0;
+
+	cache_entry_publish(get_cache_tree_from_hash(cache, read_u32(row->hash)), row,
+	                    sb->len - sizeof(*row));
+	chunk_reset(&trash);
+	return 1;
+}
+
+static int
+cache_store_http_payload(struct stream *s, struct filter *filter, struct http_msg *msg,
+			 unsigned int offset, unsigned int len)
+{
+	struct cache_flt_conf *cconf = FLT_CONF(filter);
+	struct cache *cache = cconf->c.cache;
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_st *st = filter->ctx;
+	struct htx *htx = htxbuf(&msg->chn->buf);
+	struct htx_blk *blk;
+	struct cache_entry *object;
+	struct htx_ret htxret;
+	size_t data_len = 0;
+	unsigned int orig_len, to_forward;
+
+	if (!len)
+		return len;
+
+	if (!st->first_block) {
+		unregister_data_filter(s, msg->chn, filter);
+		return len;
+	}
+
+	chunk_reset(&trash);
+	orig_len = len;
+	to_forward = 0;
+	object = (struct cache_entry *)st->first_block->data;
+
+	htxret = htx_find_offset(htx, offset);
+	blk = htxret.blk;
+	offset = htxret.ret;
+	for (; blk && len; blk = htx_get_next_blk(htx, blk)) {
+		enum htx_blk_type type = htx_get_blk_type(blk);
+		uint32_t info, sz = htx_get_blksz(blk);
+		struct ist v;
+
+		switch (type) {
+			case HTX_BLK_UNUSED:
 				break;
 
 			case HTX_BLK_DATA:
 				v = htx_get_blk_value(htx, blk);
 				v = istadv(v, offset);
 				v = isttrim(v, len);
-
-				info = (type << 28) + v.len;
-				chunk_memcat(&trash, (char *)&info, sizeof(info));
-				chunk_istcat(&trash, v);
 				to_forward += v.len;
-				data_len += v.len;
 				len -= v.len;
+
+				while (v.len) {
+					struct ist part = v;
+
+					/* The data of a sliced object are split
+					 * on slice boundaries. The next slice is
+					 * only started once there are data to
+					 * store in it.
+					 */
+					if (object->slice_size) {
+						if (!st->slice_room) {
+							if (!cache_store_flush(cache, st, data_len) ||
+							    !cache_slice_open(cache, st))
+								goto no_cache;
+							data_len = 0;
+						}
+						part = isttrim(v, st->slice_room);
+						st->slice_room -= part.len;
+					}
+
+					info = (type << 28) + part.len;
+					chunk_memcat(&trash, (char *)&info, sizeof(info));
+					chunk_istcat(&trash, part);
+					data_len += part.len;
+					v = istadv(v, part.len);
+				}
 				break;
 
 			default:
@@ -814,17 +1897,7 @@ cache_store_http_payload(struct stream *s, struct filter *filter, struct http_ms
 	}
 
   end:
-
-	fb = shctx_row_reserve_hot(shctx, st->first_block, trash.data);
-	if (!fb) {
-		goto no_cache;
-	}
-
-	/* disguise below to shut a warning on */
-	DISGUISE((struct cache_entry *)st->first_block->data)->body_size += data_len;
-	ret = shctx_row_data_append(shctx, st->first_block,
-				    (unsigned char *)b_head(&trash), b_data(&trash));
-	if (ret < 0)
+	if (!cache_store_flush(cache, st, data_len))
 		goto no_cache;
 
 	return to_forward;
@@ -852,15 +1925,18 @@ cache_store_http_end(struct stream *s, struct filter *filter,
 
 		object = (struct cache_entry *)st->first_block->data;
 
-		shctx_wrlock(shctx);
 		/* The whole payload was cached, the entry can now be used. */
-		object->complete = 1;
+		cache_slice_close(cache, st, 1);
+		HA_ATOMIC_STORE(&object->complete, 1);
+		cache_entry_wakeup(get_cache_tree_from_hash(cache, read_u32(object->hash)), object);
+
+		shctx_wrlock(shctx);
 		/* remove from the hotlist */
 		shctx_row_reattach(shctx, st->first_block);
 		shctx_wrunlock(shctx);
-
 	}
 	if (st) {
+		cache_collapse_detach(st);
 		pool_free(pool_head_cache_st, st);
 		filter->ctx = NULL;
 	}
@@ -907,7 +1983,7 @@ char *directive_value(const char *sample, int slen, const char *word, int wlen)
 }
 
 /*
- * Return the maxage in seconds of an HTTP response.
+ * Return the maxage in seconds of the HTTP response in <htx>.
  * The returned value will always take the cache's configuration into account
  * (cache->maxage) but the actual max age of the response will be set in the
  * true_maxage parameter. It will be used to determine if a response is already
@@ -920,9 +1996,8 @@ char *directive_value(const char *sample, int slen, const char *word, int wlen)
  *  - the default-max-age of the cache
  *
  */
-int http_calc_maxage(struct stream *s, struct cache *cache, int *true_maxage)
+int http_calc_maxage(struct htx *htx, struct cache *cache, int *true_maxage)
 {
-	struct htx *htx = htxbuf(&s->res.buf);
 	struct http_hdr_ctx ctx = { .blk = NULL };
 	long smaxage = -1;
 	long maxage = -1;
@@ -1006,8 +2081,51 @@ int http_calc_maxage(struct stream *s, struct cache *cache, int *true_maxage)
 		return MIN(expires, cache->maxage);
 	}
 
-	return cache->maxage;
+	return cache->maxage;
+
+}
+
+/*
+ * Computes the periods in seconds during which the HTTP response in <htx> may
+ * be delivered after its expiration, from its stale-while-revalidate and
+ * stale-if-error Cache-Control directives (RFC 5861), and stores them in
+ * <revalidate> and <error>. Both are limited to the cache's max-stale, and
+ * are 0 if the directive is absent or invalid.
+ */
+static void http_calc_stale(struct htx *htx, struct cache *cache,
+                            unsigned int *revalidate, unsigned int *error)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	struct buffer *chk;
+	unsigned int *period;
+	char *value, *endptr;
+	int len, offset;
+	long val;
+
+	*revalidate = *error = 0;
+	if (!cache->max_stale)
+		return;
+
+	while (http_find_header(htx, ist("cache-control"), &ctx, 0)) {
+		if ((value = directive_value(ctx.value.ptr, ctx.value.len, "stale-while-revalidate", 22))) {
+			period = revalidate;
+			len = 22;
+		}
+		else if ((value = directive_value(ctx.value.ptr, ctx.value.len, "stale-if-error", 14))) {
+			period = error;
+			len = 14;
+		}
+		else
+			continue;
 
+		chk = get_trash_chunk();
+		chunk_memcat(chk, value, ctx.value.len - len - 1);
+		chunk_memcat(chk, "", 1);
+		offset = (*chk->area == '"') ? 1 : 0;
+		val = strtol(chk->area + offset, &endptr, 10);
+		if (val > 0 && endptr != chk->area + offset)
+			*period = MIN(val, cache->max_stale);
+	}
 }
 
 
@@ -1018,6 +2136,7 @@ static void cache_free_blocks(struct shared_block *first, void *data)
 	struct cache_tree *cache_tree;
 
 	if (object->eb.key) {
+		cache_disk_queue(cache, first);
 		object->complete = 0;
 		cache_tree = &cache->trees[object->eb.key % CACHE_TREE_NUM];
 		retain_entry(object);
@@ -1097,6 +2216,42 @@ static time_t get_last_modified_time(struct htx *htx)
 	return last_modified;
 }
 
+/*
+ * Copies the HTX blocks of <htx> up to the EOH block to <out>, in the format
+ * they are stored in the cache, and records the location of the optional ETag
+ * header in <object>. Returns the size of these blocks in the HTX message.
+ */
+static size_t cache_dump_headers(struct htx *htx, struct cache_entry *object, struct buffer *out)
+{
+	size_t hdrs_len = 0;
+	int32_t pos;
+
+	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+		struct htx_blk *blk = htx_get_blk(htx, pos);
+		enum htx_blk_type type = htx_get_blk_type(blk);
+		uint32_t sz = htx_get_blksz(blk);
+
+		hdrs_len += sizeof(*blk) + sz;
+		chunk_memcat(out, (char *)&blk->info, sizeof(blk->info));
+		chunk_memcat(out, htx_get_blk_ptr(htx, blk), sz);
+
+		/* Look for optional ETag header.
+		 * We need to store the offset of the ETag value in order for
+		 * future conditional requests to be able to perform ETag
+		 * comparisons. */
+		if (type == HTX_BLK_HDR) {
+			struct ist header_name = htx_get_blk_name(htx, blk);
+			if (isteq(header_name, ist("etag"))) {
+				object->etag_length = sz - istlen(header_name);
+				object->etag_offset = sizeof(struct cache_entry) + b_data(out) - sz + istlen(header_name);
+			}
+		}
+		if (type == HTX_BLK_EOH)
+			break;
+	}
+	return hdrs_len;
+}
+
 /*
  * Checks the vary header's value. The headers on which vary should be applied
  * must be explicitly supported in the vary_information array (see cache.c). If
@@ -1197,9 +2352,10 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	struct htx *htx;
 	struct http_hdr_ctx ctx;
 	size_t hdrs_len = 0;
-	int32_t pos;
 	unsigned int vary_signature = 0;
 	struct cache_tree *cache_tree = NULL;
+	struct connection *srv_conn;
+	int sliced = 0;
 
 	/* Don't cache if the response came from a cache */
 	if ((obj_type(s->target) == OBJ_TYPE_APPLET) &&
@@ -1232,10 +2388,11 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 				 * unsafe request (such as PUT, POST or DELETE). */
 				cache_wrlock(cache_tree);
 
-				old = get_entry(cache_tree, txn->cache_hash, 1);
+				old = get_entry(cache_tree, txn->cache_hash, CACHE_GET_DELETE);
 				if (old)
 					release_entry_locked(cache_tree, old);
 				cache_wrunlock(cache_tree);
+				cache_disk_delete(cache, txn->cache_hash);
 			}
 		}
 		goto out;
@@ -1245,6 +2402,18 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	if (!key)
 		goto out;
 
+	/* A server error allows to deliver the expired object during its
+	 * stale-if-error period (RFC 5861#4).
+	 */
+	if (txn->status >= 500 && cache->max_stale) {
+		cache_rdlock(cache_tree);
+		old = get_entry(cache_tree, txn->cache_hash, CACHE_GET_STALE);
+		if (old && old->expire <= date.tv_sec)
+			HA_ATOMIC_STORE(&old->refresh_failed, 1);
+		cache_rdunlock(cache_tree);
+		goto out;
+	}
+
 	/* cache only 200 status code */
 	if (txn->status != 200)
 		goto out;
@@ -1263,10 +2432,13 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	/* from there, cache_ctx is always defined */
 	htx = htxbuf(&s->res.buf);
 
-	/* Do not cache too big objects. */
+	/* Do not cache too big objects, unless they may be sliced. */
 	if ((msg->flags & HTTP_MSGF_CNT_LEN) && shctx->max_obj_size > 0 &&
-	    htx->data + htx->extra > shctx->max_obj_size)
-		goto out;
+	    htx->data + htx->extra > shctx->max_obj_size) {
+		if (!cache->slice_size || htx->data + htx->extra > UINT_MAX)
+			goto out;
+		sliced = 1;
+	}
 
 	/* Only a subset of headers are supported in our Vary implementation. If
 	 * any other header is present in the Vary header value, we won't be
@@ -1288,17 +2460,21 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 		goto out;
 	}
 
+	/* Sliced objects have a single version */
+	if (sliced && vary_signature)
+		goto out;
+
 	http_check_response_for_cacheability(s, &s->res);
 
 	if (!(txn->flags & TX_CACHEABLE) || !(txn->flags & TX_CACHE_COOK))
 		goto out;
 
 	cache_wrlock(cache_tree);
-	old = get_entry(cache_tree, txn->cache_hash, 1);
+	old = get_entry(cache_tree, txn->cache_hash, CACHE_GET_DELETE);
 	if (old) {
 		if (vary_signature)
 			old = get_secondary_entry(cache_tree, old,
-			                          txn->cache_secondary_hash, 1);
+			                          txn->cache_secondary_hash, CACHE_GET_DELETE);
 		if (old) {
 			if (!old->complete) {
 				/* An entry with the same primary key is already being
@@ -1322,6 +2498,7 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	 */
 	object = (struct cache_entry *)first->data;
 	memset(object, 0, sizeof(*object));
+	LIST_INIT(&object->waiters);
 	object->eb.key = key;
 	object->secondary_key_signature = vary_signature;
 	/* We need to temporarily set a valid expiring time until the actual one
@@ -1350,7 +2527,7 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	/* Determine the entry's maximum age (taking into account the cache's
 	 * configuration) as well as the response's explicit max age (extracted
 	 * from cache-control directives or the expires header). */
-	effective_maxage = http_calc_maxage(s, cache, &true_maxage);
+	effective_maxage = http_calc_maxage(htx, cache, &true_maxage);
 
 	ctx.blk = NULL;
 	if (http_find_header(htx, ist("Age"), &ctx, 0)) {
@@ -1374,29 +2551,7 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	object->last_modified = get_last_modified_time(htx);
 
 	chunk_reset(&trash);
-	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
-		struct htx_blk *blk = htx_get_blk(htx, pos);
-		enum htx_blk_type type = htx_get_blk_type(blk);
-		uint32_t sz = htx_get_blksz(blk);
-
-		hdrs_len += sizeof(*blk) + sz;
-		chunk_memcat(&trash, (char *)&blk->info, sizeof(blk->info));
-		chunk_memcat(&trash, htx_get_blk_ptr(htx, blk), sz);
-
-		/* Look for optional ETag header.
-		 * We need to store the offset of the ETag value in order for
-		 * future conditional requests to be able to perform ETag
-		 * comparisons. */
-		if (type == HTX_BLK_HDR) {
-			struct ist header_name = htx_get_blk_name(htx, blk);
-			if (isteq(header_name, ist("etag"))) {
-				object->etag_length = sz - istlen(header_name);
-				object->etag_offset = sizeof(struct cache_entry) + b_data(&trash) - sz + istlen(header_name);
-			}
-		}
-		if (type == HTX_BLK_EOH)
-			break;
-	}
+	hdrs_len = cache_dump_headers(htx, object, &trash);
 
 	/* Do not cache objects if the headers are too big. */
 	if (hdrs_len > htx->size - global.tune.maxrewrite)
@@ -1433,10 +2588,46 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 		/* store latest value and expiration time */
 		object->latest_validation = date.tv_sec;
 		object->expire = date.tv_sec + effective_maxage;
+
+		/* the body is stored in slices, the first one being this
+		 * entry.
+		 */
+		if (sliced) {
+			object->slice_size = cache->slice_size;
+			object->slice_gen = _HA_ATOMIC_ADD_FETCH(&cache_slice_gen, 1);
+			cache_ctx->slice_block = NULL;
+			cache_ctx->slice_idx = 0;
+			cache_ctx->slice_room = cache->slice_size;
+		}
+
+		/* the object may be delivered once expired, and refreshed from
+		 * the server it came from. This is not supported for sliced
+		 * objects.
+		 */
+		if (cache->max_stale && !sliced) {
+			unsigned int revalidate, error;
+
+			http_calc_stale(htx, cache, &revalidate, &error);
+			object->stale_revalidate = revalidate ? object->expire + revalidate : 0;
+			object->stale_error = error ? object->expire + error : 0;
+
+			srv_conn = sc_conn(s->scb);
+			if (srv_conn && conn_get_dst(srv_conn) && is_inet_addr(srv_conn->dst)) {
+				object->origin = *srv_conn->dst;
+				object->origin_ssl = conn_is_ssl(srv_conn);
+			}
+		}
+
+		/* the streams waiting for this object may now deliver it */
+		cache_entry_publish(cache_tree, object, first->len - sizeof(*object));
+		cache_collapse_detach(cache_ctx);
 		return ACT_RET_CONT;
 	}
 
 out:
+	if (cache_ctx)
+		cache_collapse_detach(cache_ctx);
+
 	/* if does not cache */
 	if (first) {
 		first->len = 0;
@@ -1451,12 +2642,466 @@ enum act_return http_action_store_cache(struct act_rule *rule, struct proxy *px,
 	return ACT_RET_CONT;
 }
 
+/*
+ * Background refresh of stale objects
+ */
+
+/* Called by the HTTP client once the headers of the response to a background
+ * refresh were received. If the response may be stored, the new object is
+ * reserved in the cache and its headers are stored.
+ */
+static void cache_refresh_res_headers(struct httpclient *hc)
+{
+	struct cache_refresh *ctx = hc->caller;
+	struct cache *cache = ctx->cache;
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_entry *stale = ctx->stale;
+	struct cache_entry *object;
+	struct http_hdr_ctx hctx;
+	struct http_hdr *hdr;
+	struct buffer *chk;
+	struct htx_sl *sl;
+	struct htx *htx;
+	unsigned int sl_flags = HTX_SL_F_IS_RESP | HTX_SL_F_VER_11 | HTX_SL_F_XFER_LEN;
+	unsigned int vary_signature = 0;
+	int true_maxage = 0;
+	long long age = 0;
+
+	if (hc->res.status != 200) {
+		/* Only a server error allows to deliver the stale object
+		 * (RFC 5861#4), any other status means it changed.
+		 */
+		ctx->status = (hc->res.status >= 500) ? CACHE_REFRESH_ERROR : CACHE_REFRESH_DISCARD;
+		return;
+	}
+
+	ctx->status = CACHE_REFRESH_ABORT;
+	chk = alloc_trash_chunk();
+	if (!chk)
+		return;
+
+	/* rebuild the HTX headers to apply the same checks as when storing */
+	htx = htx_from_buf(chk);
+	for (hdr = hc->res.hdrs; hdr && isttest(hdr->n); hdr++) {
+		if (isteqi(hdr->n, ist("content-length")))
+			sl_flags |= HTX_SL_F_CLEN;
+	}
+	sl = htx_add_stline(htx, HTX_BLK_RES_SL, sl_flags, ist("HTTP/1.1"), ist("200"), hc->res.reason);
+	if (!sl)
+		goto out;
+	sl->info.res.status = 200;
+
+	for (hdr = hc->res.hdrs; hdr && isttest(hdr->n); hdr++) {
+		if (isteqi(hdr->n, ist("age"))) {
+			if (strl2llrc(hdr->v.ptr, hdr->v.len, &age) || age < 0)
+				goto discard;
+			if (unlikely(age > CACHE_ENTRY_MAX_AGE))
+				age = CACHE_ENTRY_MAX_AGE;
+			continue;
+		}
+		if (!htx_add_header(htx, hdr->n, hdr->v))
+			goto out;
+	}
+	if (!htx_add_endof(htx, HTX_BLK_EOH))
+		goto out;
+
+	hctx.blk = NULL;
+	if (http_find_header(htx, ist("pragma"), &hctx, 1) && isteqi(hctx.value, ist("no-cache")))
+		goto discard;
+
+	hctx.blk = NULL;
+	while (http_find_header(htx, ist("cache-control"), &hctx, 0)) {
+		if (isteqi(hctx.value, ist("private")) ||
+		    isteqi(hctx.value, ist("no-cache")) ||
+		    isteqi(hctx.value, ist("no-store")) ||
+		    istmatchi(hctx.value, ist("no-cache=")))
+			goto discard;
+	}
+
+	/* the request was not built by the client, cookies are not cached */
+	hctx.blk = NULL;
+	if (http_find_header(htx, ist("set-cookie"), &hctx, 1))
+		goto discard;
+
+	ctx->maxage = http_calc_maxage(htx, cache, &true_maxage);
+	if (ctx->maxage <= 0 || age > true_maxage)
+		goto discard;
+
+	/* the secondary key cannot be built again, so it must not change */
+	hctx.blk = NULL;
+	if (cache->vary_processing_enabled) {
+		if (!http_check_vary_header(htx, &vary_signature) ||
+		    vary_signature != stale->secondary_key_signature)
+			goto discard;
+	}
+	else if (http_find_header(htx, ist("vary"), &hctx, 0))
+		goto discard;
+
+	http_calc_stale(htx, cache, &ctx->revalidate, &ctx->error);
+
+	ctx->first = shctx_row_reserve_hot(shctx, NULL, sizeof(*object));
+	if (!ctx->first)
+		goto out;
+
+	object = (struct cache_entry *)ctx->first->data;
+	memset(object, 0, sizeof(*object));
+	LIST_INIT(&object->waiters);
+	ctx->first->len = sizeof(*object);
+	ctx->first->last_append = NULL;
+
+	memcpy(object->hash, stale->hash, sizeof(object->hash));
+	object->secondary_key_signature = vary_signature;
+	if (vary_signature) {
+		memcpy(object->secondary_key, stale->secondary_key, HTTP_CACHE_SEC_KEY_LEN);
+		if (set_secondary_key_encoding(htx, object->secondary_key))
+			goto discard;
+	}
+	object->origin = stale->origin;
+	object->origin_ssl = stale->origin_ssl;
+	object->age = age;
+	object->last_modified = get_last_modified_time(htx);
+
+	chunk_reset(&trash);
+	cache_dump_headers(htx, object, &trash);
+	if (!shctx_row_reserve_hot(shctx, ctx->first, trash.data) ||
+	    shctx_row_data_append(shctx, ctx->first, (unsigned char *)trash.area, trash.data) < 0)
+		goto out;
+
+	ctx->status = CACHE_REFRESH_OK;
+	goto out;
+
+  discard:
+	ctx->status = CACHE_REFRESH_DISCARD;
+  out:
+	free_trash_chunk(chk);
+}
+
+/* Called by the HTTP client when some payload of the response to a background
+ * refresh was received. It is always consumed, and stored as HTX DATA blocks
+ * in the new object if any.
+ */
+static void cache_refresh_res_payload(struct httpclient *hc)
+{
+	struct cache_refresh *ctx = hc->caller;
+	struct shared_context *shctx = shctx_ptr(ctx->cache);
+	struct cache_entry *object;
+	uint32_t info;
+
+	while (httpclient_data(hc)) {
+		/* leave room for the block info */
+		chunk_reset(&trash);
+		trash.data = sizeof(info);
+		httpclient_res_xfer(hc, &trash);
+
+		if (ctx->status != CACHE_REFRESH_OK)
+			continue;
+
+		info = (HTX_BLK_DATA << 28) + (trash.data - sizeof(info));
+		memcpy(trash.area, &info, sizeof(info));
+
+		if (!shctx_row_reserve_hot(shctx, ctx->first, trash.data) ||
+		    shctx_row_data_append(shctx, ctx->first, (unsigned char *)trash.area, trash.data) < 0) {
+			ctx->status = CACHE_REFRESH_ABORT;
+			continue;
+		}
+		object = (struct cache_entry *)ctx->first->data;
+		object->body_size += trash.data - sizeof(info);
+	}
+}
+
+/* Called by the HTTP client at the end of a background refresh, whatever its
+ * outcome. The new object replaces the stale one if it was entirely received,
+ * otherwise the stale one is kept or removed depending on the response.
+ */
+static void cache_refresh_res_end(struct httpclient *hc)
+{
+	struct cache_refresh *ctx = hc->caller;
+	struct cache *cache = ctx->cache;
+	struct cache_tree *cache_tree = ctx->cache_tree;
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_entry *stale = ctx->stale;
+	struct cache_entry *object = NULL;
+	struct cache_entry *old;
+
+	if (ctx->status == CACHE_REFRESH_OK && !httpclient_res_complete(hc))
+		ctx->status = CACHE_REFRESH_ERROR;
+
+	if (ctx->first) {
+		object = (struct cache_entry *)ctx->first->data;
+		if (ctx->status == CACHE_REFRESH_OK) {
+			object->latest_validation = date.tv_sec;
+			object->expire = date.tv_sec + ctx->maxage;
+			object->stale_revalidate = ctx->revalidate ? object->expire + ctx->revalidate : 0;
+			object->stale_error = ctx->error ? object->expire + ctx->error : 0;
+			object->avail = ctx->first->len - sizeof(*object);
+			object->complete = 1;
+			object->eb.key = read_u32(object->hash);
+
+			cache_wrlock(cache_tree);
+			/* the expired stale object is removed by the lookup */
+			old = get_entry(cache_tree, object->hash, CACHE_GET_DELETE);
+			if (old && object->secondary_key_signature)
+				old = get_secondary_entry(cache_tree, old, object->secondary_key, CACHE_GET_DELETE);
+			if (old || insert_entry(cache, cache_tree, object) != &object->eb) {
+				/* another stream stored a fresh object meanwhile */
+				object->eb.key = 0;
+				object = NULL;
+			}
+			cache_wrunlock(cache_tree);
+		}
+		else
+			object = NULL;
+
+		shctx_wrlock(shctx);
+		if (!object)
+			ctx->first->len = 0;
+		shctx_row_reattach(shctx, ctx->first);
+		shctx_wrunlock(shctx);
+	}
+
+	if (ctx->status == CACHE_REFRESH_ERROR) {
+		HA_ATOMIC_STORE(&stale->refresh_failed, 1);
+	}
+	else if (ctx->status == CACHE_REFRESH_DISCARD) {
+		cache_wrlock(cache_tree);
+		if (stale->eb.key) {
+			delete_entry(stale);
+			release_entry_locked(cache_tree, stale);
+		}
+		cache_wrunlock(cache_tree);
+	}
+
+	HA_ATOMIC_STORE(&stale->refreshing, 0);
+	release_entry_unlocked(cache_tree, stale);
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, block_ptr(stale));
+	shctx_wrunlock(shctx);
+
+	hc->caller = NULL;
+	pool_free(pool_head_cache_refresh, ctx);
+}
+
+/* Starts the background refresh of stale object <stale> delivered to stream
+ * <s>, by sending the same request to the server the object came from,
+ * unless a refresh is already in progress or was attempted less than one
+ * second ago. The refresh retains the object until it is replaced.
+ */
+static void cache_refresh_start(struct cache *cache, struct cache_tree *cache_tree,
+                                struct cache_entry *stale, struct stream *s)
+{
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct htx *htx = htxbuf(&s->req.buf);
+	struct http_hdr hdrs[global.tune.max_http_hdr + 1];
+	struct http_uri_parser parser;
+	struct http_hdr_ctx hctx;
+	struct cache_refresh *ctx = NULL;
+	struct httpclient *hc = NULL;
+	struct htx_sl *sl;
+	struct ist authority, path;
+	struct buffer *url = NULL;
+	int32_t pos;
+	int nbhdrs = 0;
+
+	if (!cache_refresh_px || stale->origin.ss_family == AF_UNSPEC)
+		return;
+
+	if (HA_ATOMIC_LOAD(&stale->refresh_date) == date.tv_sec ||
+	    HA_ATOMIC_XCHG(&stale->refreshing, 1))
+		return;
+	HA_ATOMIC_STORE(&stale->refresh_date, date.tv_sec);
+
+	/* same URL and headers as the request, except the hop-by-hop and
+	 * conditional ones.
+	 */
+	sl = http_get_stline(htx);
+	parser = http_uri_parser_init(htx_sl_req_uri(sl));
+	if (sl->flags & HTX_SL_F_HAS_AUTHORITY) {
+		http_parse_scheme(&parser);
+		authority = http_parse_authority(&parser, 1);
+	}
+	else {
+		hctx.blk = NULL;
+		if (!http_find_header(htx, ist("host"), &hctx, 1))
+			goto error;
+		authority = hctx.value;
+	}
+	path = http_parse_path(&parser);
+
+	url = alloc_trash_chunk();
+	if (!url)
+		goto error;
+	chunk_istcat(url, stale->origin_ssl ? ist("https://") : ist("http://"));
+	chunk_istcat(url, authority);
+	chunk_istcat(url, isttest(path) ? path : ist("/"));
+
+	for (pos = htx_get_first(htx); pos != -1; pos = htx_get_next(htx, pos)) {
+		struct htx_blk *blk = htx_get_blk(htx, pos);
+		enum htx_blk_type type = htx_get_blk_type(blk);
+		struct ist n;
+
+		if (type == HTX_BLK_EOH)
+			break;
+		if (type != HTX_BLK_HDR)
+			continue;
+
+		n = htx_get_blk_name(htx, blk);
+		if (isteqi(n, ist("host")) || isteqi(n, ist("connection")) ||
+		    isteqi(n, ist("keep-alive")) || isteqi(n, ist("te")) ||
+		    isteqi(n, ist("upgrade")) || isteqi(n, ist("transfer-encoding")) ||
+		    isteqi(n, ist("content-length")) || isteqi(n, ist("range")) ||
+		    istmatchi(n, ist("proxy-")) || istmatchi(n, ist("if-")))
+			continue;
+		if (nbhdrs == global.tune.max_http_hdr)
+			goto error;
+		hdrs[nbhdrs].n = n;
+		hdrs[nbhdrs].v = htx_get_blk_value(htx, blk);
+		nbhdrs++;
+	}
+	hdrs[nbhdrs].n = IST_NULL;
+	hdrs[nbhdrs].v = IST_NULL;
+
+	ctx = pool_zalloc(pool_head_cache_refresh);
+	if (!ctx)
+		goto error;
+	ctx->cache = cache;
+	ctx->cache_tree = cache_tree;
+	ctx->stale = stale;
+	ctx->status = CACHE_REFRESH_ERROR;
+
+	hc = httpclient_new_from_proxy(cache_refresh_px, ctx, HTTP_METH_GET, ist2(url->area, url->data));
+	if (!hc)
+		goto error;
+	if (httpclient_req_gen(hc, hc->req.url, hc->req.meth, hdrs, IST_NULL) != ERR_NONE)
+		goto error;
+	if (!sockaddr_alloc(&hc->dst, &stale->origin, sizeof(stale->origin)))
+		goto error;
+	httpclient_set_timeout(hc, tick_isset(s->be->timeout.server) ? s->be->timeout.server : CACHE_REFRESH_TIMEOUT);
+	hc->ops.res_headers = cache_refresh_res_headers;
+	hc->ops.res_payload = cache_refresh_res_payload;
+	hc->ops.res_end = cache_refresh_res_end;
+
+	/* the stale object must survive until the refresh ends */
+	retain_entry(stale);
+	shctx_wrlock(shctx);
+	shctx_row_detach(shctx, block_ptr(stale));
+	shctx_wrunlock(shctx);
+
+	if (!httpclient_start(hc)) {
+		if (!hc->caller) {
+			/* the end callback was already called */
+			httpclient_destroy(hc);
+			free_trash_chunk(url);
+			return;
+		}
+		release_entry_unlocked(cache_tree, stale);
+		shctx_wrlock(shctx);
+		shctx_row_reattach(shctx, block_ptr(stale));
+		shctx_wrunlock(shctx);
+		goto error;
+	}
+	/* the client frees itself once done */
+	hc->flags |= HTTPCLIENT_FA_AUTOKILL;
+	free_trash_chunk(url);
+	return;
+
+  error:
+	httpclient_destroy(hc);
+	pool_free(pool_head_cache_refresh, ctx);
+	free_trash_chunk(url);
+	HA_ATOMIC_STORE(&stale->refreshing, 0);
+}
+
 #define 	HTX_CACHE_INIT   0  /* Initial state. */
 #define 	HTX_CACHE_HEADER 1  /* Cache entry headers forwarding */
 #define 	HTX_CACHE_DATA   2  /* Cache entry data forwarding */
 #define 	HTX_CACHE_EOM    3  /* Cache entry completely forwarded. Finish the HTX message */
 #define 	HTX_CACHE_END    4  /* Cache entry treatment terminated */
 
+/* Returns the entry whose row is being sent by the cache applet, which is the
+ * current slice for a sliced entry.
+ */
+static inline struct cache_entry *cache_appctx_row(const struct cache_appctx *ctx)
+{
+	return ctx->slice ? ctx->slice : ctx->entry;
+}
+
+/* Releases the slice being sent by the cache applet <appctx>, if any. */
+static void cache_appctx_close_slice(struct appctx *appctx)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+	struct cache_flt_conf *cconf = appctx->rule->arg.act.p[0];
+	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	struct cache_entry *slice = ctx->slice;
+
+	if (!slice)
+		return;
+
+	ctx->slice = NULL;
+	release_entry(ctx->slice_tree, slice, 1);
+	shctx_wrlock(shctx);
+	shctx_row_reattach(shctx, block_ptr(slice));
+	shctx_wrunlock(shctx);
+}
+
+/* Makes the cache applet <appctx> send the slice <idx> of its sliced entry,
+ * from its beginning. Returns 0 if this slice is not in the cache anymore.
+ */
+static int cache_appctx_open_slice(struct appctx *appctx, unsigned int idx)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+	struct cache_flt_conf *cconf = appctx->rule->arg.act.p[0];
+	struct cache *cache = cconf->c.cache;
+	struct shared_context *shctx = shctx_ptr(cache);
+	struct cache_tree *cache_tree;
+	struct cache_entry *slice;
+	char hash[20];
+
+	cache_appctx_close_slice(appctx);
+
+	cache_slice_hash(ctx->entry, idx, hash);
+	cache_tree = get_cache_tree_from_hash(cache, read_u32(hash));
+	cache_rdlock(cache_tree);
+	slice = cache_slice_lookup(cache_tree, hash);
+	if (slice) {
+		retain_entry(slice);
+		shctx_wrlock(shctx);
+		if (slice->complete)
+			shctx_row_detach(shctx, block_ptr(slice));
+		else {
+			release_entry(cache_tree, slice, 0);
+			slice = NULL;
+		}
+		shctx_wrunlock(shctx);
+	}
+	cache_rdunlock(cache_tree);
+
+	if (!slice)
+		return 0;
+
+	ctx->slice = slice;
+	ctx->slice_tree = cache_tree;
+	ctx->slice_idx = idx;
+	ctx->next = block_ptr(slice);
+	ctx->offset = sizeof(*slice);
+	ctx->sent = 0;
+	ctx->rem_data = 0;
+	return 1;
+}
+
+/* Makes the cache applet <appctx> go on with the next slice of its entry once
+ * the current row was entirely sent. Returns 1 if it must send the next
+ * slice, 0 if there is none, or -1 if it is not in the cache anymore.
+ */
+static int cache_appctx_next_slice(struct appctx *appctx)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+
+	if (!ctx->entry->slice_size || ctx->sent != cache_entry_avail(cache_appctx_row(ctx)) ||
+	    ctx->slice_idx + 1 >= cache_slice_count(ctx->entry))
+		return 0;
+	return cache_appctx_open_slice(appctx, ctx->slice_idx + 1) ? 1 : -1;
+}
+
 static void http_cache_applet_release(struct appctx *appctx)
 {
 	struct cache_appctx *ctx = appctx->svcctx;
@@ -1466,6 +3111,16 @@ static void http_cache_applet_release(struct appctx *appctx)
 	struct shared_context *shctx = shctx_ptr(cache);
 	struct shared_block *first = block_ptr(cache_ptr);
 
+	if (LIST_INLIST(&ctx->waiter)) {
+		cache_wrlock(ctx->cache_tree);
+		if (LIST_INLIST(&ctx->waiter)) {
+			LIST_DEL_INIT(&ctx->waiter);
+			HA_ATOMIC_DEC(&cache_ptr->nb_waiters);
+		}
+		cache_wrunlock(ctx->cache_tree);
+	}
+
+	cache_appctx_close_slice(appctx);
 	release_entry(ctx->cache_tree, cache_ptr, 1);
 
 	shctx_wrlock(shctx);
@@ -1508,7 +3163,7 @@ static unsigned int htx_cache_dump_blk(struct appctx *appctx, struct htx *htx, e
 		blksz  -= max;
 		total  += max;
 		ptr    += max;
-		if (blksz || offset == shctx->block_size) {
+		if (blksz) {
 			shblk = LIST_NEXT(&shblk->list, typeof(shblk), list);
 			offset = 0;
 		}
@@ -1542,8 +3197,13 @@ static unsigned int htx_cache_dump_data_blk(struct appctx *appctx, struct htx *h
 		blksz = (info & 0xfffffff);
 		total = 4;
 	}
+	/* the data past the requested range are never sent */
+	if (ctx->range && blksz > appctx->to_forward) {
+		rem_data = blksz - appctx->to_forward;
+		blksz = appctx->to_forward;
+	}
 	if (blksz > max) {
-		rem_data = blksz - max;
+		rem_data += blksz - max;
 		blksz = max;
 	}
 
@@ -1558,7 +3218,7 @@ static unsigned int htx_cache_dump_data_blk(struct appctx *appctx, struct htx *h
 		data_len += sz;
 		if (sz < max)
 			break;
-		if (blksz || offset == shctx->block_size) {
+		if (blksz) {
 			shblk = LIST_NEXT(&shblk->list, typeof(shblk), list);
 			offset = 0;
 		}
@@ -1568,7 +3228,8 @@ static unsigned int htx_cache_dump_data_blk(struct appctx *appctx, struct htx *h
 	ctx->next     = shblk;
 	ctx->sent    += total;
 	ctx->rem_data = rem_data + blksz;
-	appctx->to_forward -= data_len;
+	if (!ctx->streaming)
+		appctx->to_forward -= data_len;
 	return total;
 }
 
@@ -1586,6 +3247,10 @@ static size_t htx_cache_dump_msg(struct appctx *appctx, struct htx *htx, unsigne
 		enum htx_blk_type type;
 		uint32_t info;
 
+		/* the end of the requested range was reached */
+		if (ctx->range && !appctx->to_forward && appctx->st0 == HTX_CACHE_DATA)
+			break;
+
 		shblk  = ctx->next;
 		offset = ctx->offset;
 		if (ctx->rem_data) {
@@ -1625,6 +3290,65 @@ static size_t htx_cache_dump_msg(struct appctx *appctx, struct htx *htx, unsigne
 	return total;
 }
 
+/* Skips the first <skip> bytes of the body of the entry being sent by the cache
+ * applet <appctx>, whose headers were sent. Returns 0 if the slice holding the
+ * first byte to send is not in the cache anymore.
+ */
+static int htx_cache_skip_data(struct appctx *appctx, unsigned int skip)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+	struct cache_entry *cache_ptr = ctx->entry;
+	struct cache_flt_conf *cconf = appctx->rule->arg.act.p[0];
+	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
+	struct shared_block *shblk;
+	unsigned int offset, sz, max;
+	uint32_t info, blksz;
+
+	/* the data are split on slice boundaries */
+	if (cache_ptr->slice_size && skip >= cache_ptr->slice_size) {
+		if (!cache_appctx_open_slice(appctx, skip / cache_ptr->slice_size))
+			return 0;
+		skip %= cache_ptr->slice_size;
+	}
+
+	while (skip) {
+		shblk  = ctx->next;
+		offset = ctx->offset;
+
+		/* Get info of the next HTX block. May be split on 2 shblk */
+		sz = MIN(4, shctx->block_size - offset);
+		memcpy((char *)&info, (const char *)shblk->data + offset, sz);
+		offset += sz;
+		if (sz < 4) {
+			shblk = LIST_NEXT(&shblk->list, typeof(shblk), list);
+			memcpy(((char *)&info)+sz, (const char *)shblk->data, 4 - sz);
+			offset = (4 - sz);
+		}
+
+		if ((info >> 28) != HTX_BLK_DATA)
+			break;
+
+		/* Skip the whole DATA block, or only its beginning */
+		blksz = (info & 0xfffffff);
+		sz = MIN(blksz, skip);
+		ctx->rem_data = blksz - sz;
+		ctx->sent += 4 + sz;
+		skip -= sz;
+		while (sz) {
+			max = MIN(sz, shctx->block_size - offset);
+			offset += max;
+			sz -= max;
+			if (sz) {
+				shblk = LIST_NEXT(&shblk->list, typeof(shblk), list);
+				offset = 0;
+			}
+		}
+		ctx->next   = shblk;
+		ctx->offset = offset;
+	}
+	return 1;
+}
+
 static unsigned int ff_cache_dump_data_blk(struct appctx *appctx, struct buffer *buf, unsigned int len,
 					   uint32_t info, struct shared_block *shblk, unsigned int offset)
 {
@@ -1676,18 +3400,31 @@ static unsigned int ff_cache_dump_data_blk(struct appctx *appctx, struct buffer
 static size_t ff_cache_dump_msg(struct appctx *appctx, struct buffer *buf, unsigned int len)
 {
 	struct cache_appctx *ctx = appctx->svcctx;
-	struct cache_entry *cache_ptr = ctx->entry;
-	struct shared_block *first = block_ptr(cache_ptr);
 	struct cache_flt_conf *cconf = appctx->rule->arg.act.p[0];
 	struct shared_context *shctx = shctx_ptr(cconf->c.cache);
 	struct shared_block   *shblk;
 	unsigned int offset, sz;
 	unsigned int ret, total = 0;
 
-	while (len && (ctx->sent != first->len - sizeof(*cache_ptr))) {
+	while (len) {
 		enum htx_blk_type type;
 		uint32_t info;
 
+		if (ctx->sent == cache_entry_avail(cache_appctx_row(ctx))) {
+			int slice = cache_appctx_next_slice(appctx);
+
+			if (slice < 0) {
+				/* The response is truncated */
+				se_fl_clr(appctx->sedesc, SE_FL_MAY_FASTFWD_PROD);
+				applet_fl_clr(appctx, APPCTX_FL_FASTFWD);
+				applet_set_eos(appctx);
+				applet_set_error(appctx);
+				appctx->st0 = HTX_CACHE_END;
+			}
+			if (slice <= 0)
+				break;
+		}
+
 		shblk  = ctx->next;
 		offset = ctx->offset;
 		if (ctx->rem_data) {
@@ -1745,11 +3482,42 @@ static int htx_cache_add_age_hdr(struct appctx *appctx, struct htx *htx)
 	return 1;
 }
 
+/* Turns the response being sent by the cache applet <appctx> into a partial
+ * one holding the requested range of the body. Returns 0 on failure.
+ */
+static int htx_cache_set_range_hdrs(struct appctx *appctx, struct htx *htx)
+{
+	struct cache_appctx *ctx = appctx->svcctx;
+	struct http_hdr_ctx hdr = { .blk = NULL };
+	struct htx_sl *sl;
+
+	if (!http_replace_res_status(htx, ist("206"), ist("Partial Content")))
+		return 0;
+
+	while (http_find_header(htx, ist("content-length"), &hdr, 1))
+		http_remove_header(htx, &hdr);
+	hdr.blk = NULL;
+	while (http_find_header(htx, ist("transfer-encoding"), &hdr, 1))
+		http_remove_header(htx, &hdr);
+
+	sl = http_get_stline(htx);
+	sl->flags &= ~(HTX_SL_F_XFER_ENC|HTX_SL_F_CHNK|HTX_SL_F_BODYLESS);
+	sl->flags |= (HTX_SL_F_XFER_LEN|HTX_SL_F_CLEN);
+
+	chunk_printf(&trash, "%u", ctx->range_len);
+	if (!http_add_header(htx, ist("Content-Length"), ist2(b_head(&trash), b_data(&trash))))
+		return 0;
+
+	chunk_printf(&trash, "bytes %u-%u/%u", ctx->range_start,
+	             ctx->range_start + ctx->range_len - 1, ctx->entry->body_size);
+	if (!http_add_header(htx, ist("Content-Range"), ist2(b_head(&trash), b_data(&trash))))
+		return 0;
+	return 1;
+}
+
 static size_t http_cache_fastfwd(struct appctx *appctx, struct buffer *buf, size_t count, unsigned int flags)
 {
 	struct cache_appctx *ctx = appctx->svcctx;
-	struct cache_entry *cache_ptr = ctx->entry;
-	struct shared_block *first = block_ptr(cache_ptr);
 	size_t ret;
 
 	BUG_ON(!appctx->to_forward || count > appctx->to_forward);
@@ -1759,7 +3527,7 @@ static size_t http_cache_fastfwd(struct appctx *appctx, struct buffer *buf, size
 	if (!appctx->to_forward) {
 		se_fl_clr(appctx->sedesc, SE_FL_MAY_FASTFWD_PROD);
 		applet_fl_clr(appctx, APPCTX_FL_FASTFWD);
-		if (ctx->sent == first->len - sizeof(*cache_ptr)) {
+		if (ctx->range || ctx->sent == cache_entry_avail(cache_appctx_row(ctx))) {
 			applet_set_eoi(appctx);
 			applet_set_eos(appctx);
 			appctx->st0 = HTX_CACHE_END;
@@ -1772,7 +3540,6 @@ static void http_cache_io_handler(struct appctx *appctx)
 {
 	struct cache_appctx *ctx = appctx->svcctx;
 	struct cache_entry *cache_ptr = ctx->entry;
-	struct shared_block *first = block_ptr(cache_ptr);
 	struct htx *res_htx = NULL;
 	struct buffer *errmsg;
 	unsigned int len;
@@ -1795,7 +3562,7 @@ static void http_cache_io_handler(struct appctx *appctx)
 
 	res_htx = htx_from_buf(&appctx->outbuf);
 
-	len = first->len - sizeof(*cache_ptr) - ctx->sent;
+	len = cache_entry_avail(cache_appctx_row(ctx)) - ctx->sent;
 	res_htx = htx_from_buf(&appctx->outbuf);
 
 	if (appctx->st0 == HTX_CACHE_INIT) {
@@ -1803,6 +3570,8 @@ static void http_cache_io_handler(struct appctx *appctx)
 		ctx->offset = sizeof(*cache_ptr);
 		ctx->sent = 0;
 		ctx->rem_data = 0;
+		ctx->streaming = !HA_ATOMIC_LOAD(&cache_ptr->complete);
+		len = cache_entry_avail(cache_ptr);
 		appctx->st0 = HTX_CACHE_HEADER;
 	}
 
@@ -1834,23 +3603,62 @@ static void http_cache_io_handler(struct appctx *appctx)
 		if (find_http_meth(istptr(meth), istlen(meth)) == HTTP_METH_HEAD || ctx->send_notmodified)
 			appctx->st0 = HTX_CACHE_EOM;
 		else {
-			if (!(global.tune.no_zero_copy_fwd & NO_ZERO_COPY_FWD_APPLET))
-				se_fl_set(appctx->sedesc, SE_FL_MAY_FASTFWD_PROD);
+			/* The size of an entry being stored is not known yet,
+			 * it is sent as it comes, without fast-forwarding.
+			 */
+			if (!ctx->streaming) {
+				if (!(global.tune.no_zero_copy_fwd & NO_ZERO_COPY_FWD_APPLET))
+					se_fl_set(appctx->sedesc, SE_FL_MAY_FASTFWD_PROD);
+				appctx->to_forward = cache_ptr->body_size;
+			}
 
-			appctx->to_forward = cache_ptr->body_size;
-			len = first->len - sizeof(*cache_ptr) - ctx->sent;
+			/* Only send the requested range of the body */
+			if (ctx->range) {
+				if (!htx_cache_set_range_hdrs(appctx, res_htx) ||
+				    !htx_cache_skip_data(appctx, ctx->range_start))
+					goto error;
+				appctx->to_forward = ctx->range_len;
+			}
+			len = cache_entry_avail(cache_appctx_row(ctx)) - ctx->sent;
 			appctx->st0 = HTX_CACHE_DATA;
 		}
 	}
 
 	if (appctx->st0 == HTX_CACHE_DATA) {
+	  more_data:
 		if (len) {
 			ret = htx_cache_dump_msg(appctx, res_htx, len, HTX_BLK_UNUSED);
-			if (ret < len) {
+			if (ret < len && (!ctx->range || appctx->to_forward)) {
 				applet_fl_set(appctx, APPCTX_FL_OUTBLK_FULL);
 				goto out;
 			}
 		}
+		if (!ctx->streaming && (!ctx->range || appctx->to_forward)) {
+			/* go on with the next slice of a sliced entry */
+			int slice = cache_appctx_next_slice(appctx);
+
+			if (slice < 0)
+				goto abort;
+			if (slice) {
+				len = cache_entry_avail(cache_appctx_row(ctx)) - ctx->sent;
+				goto more_data;
+			}
+		}
+		if (ctx->streaming) {
+			/* The entry may still be being stored. <complete> must
+			 * be read first, so that all the data are available
+			 * once it is set.
+			 */
+			int complete = HA_ATOMIC_LOAD(&cache_ptr->complete);
+
+			if (!complete && HA_ATOMIC_LOAD(&cache_ptr->aborted))
+				goto abort;
+			len = cache_entry_avail(cache_ptr) - ctx->sent;
+			if (!len && !complete && cache_entry_wait(appctx))
+				goto out;
+			if (len || !complete)
+				goto more_data;
+		}
 		BUG_ON(appctx->to_forward);
 		appctx->st0 = HTX_CACHE_EOM;
 	}
@@ -1892,6 +3700,15 @@ static void http_cache_io_handler(struct appctx *appctx)
 	applet_set_error(appctx);
 	appctx->st0 = HTX_CACHE_END;
 	goto end;
+
+  abort:
+	/* The entry being delivered will never be completed, or one of its
+	 * slices is not in the cache anymore, the response is truncated.
+	 */
+	applet_set_eos(appctx);
+	applet_set_error(appctx);
+	appctx->st0 = HTX_CACHE_END;
+	goto out;
 }
 
 
@@ -2096,6 +3913,77 @@ static int should_send_notmodified_response(struct cache *cache, struct htx *htx
 	return retval;
 }
 
+/* Looks for a single byte range to send from complete entry <entry> in the
+ * "Range" header of the request in <htx> (RFC 9110#14.2). If the request also
+ * contains an "If-Range" header, it must strongly match the ETag or be the
+ * Last-Modified date of <entry>. Returns 1 and fills <start> and <len> if such
+ * a range can be satisfied, otherwise 0, in which case the whole entry must be
+ * sent. Several ranges are not supported.
+ */
+static int cache_entry_get_range(struct cache *cache, struct htx *htx, struct cache_entry *entry,
+                                 unsigned int *start, unsigned int *len)
+{
+	struct http_hdr_ctx ctx = { .blk = NULL };
+	unsigned long long first, last;
+	const char *ptr, *end, *num;
+	struct buffer *etag;
+	struct tm tm = {};
+
+	if (!entry->body_size || !http_find_header(htx, ist("range"), &ctx, 1))
+		return 0;
+
+	if (!istmatchi(ctx.value, ist("bytes=")))
+		return 0;
+	ptr = istptr(ctx.value) + 6;
+	end = istend(ctx.value);
+
+	num = ptr;
+	first = read_uint64(&ptr, end);
+	if (ptr == end || *ptr != '-')
+		return 0;
+	if (ptr++ == num) {
+		/* suffix range: the last <last> bytes */
+		num = ptr;
+		last = read_uint64(&ptr, end);
+		if (ptr == num || !last)
+			return 0;
+		first = entry->body_size - MIN(last, entry->body_size);
+		last = entry->body_size - 1;
+	}
+	else {
+		num = ptr;
+		last = read_uint64(&ptr, end);
+		if (ptr == num)
+			last = entry->body_size - 1;
+		if (last < first || first >= entry->body_size)
+			return 0;
+		last = MIN(last, entry->body_size - 1);
+	}
+	if (ptr != end)
+		return 0;
+
+	ctx.blk = NULL;
+	if (http_find_header(htx, ist("if-range"), &ctx, 1)) {
+		if (http_get_etag_type(ctx.value) != ETAG_INVALID) {
+			/* The comparison must be a strong one */
+			if (http_get_etag_type(ctx.value) != ETAG_STRONG || !entry->etag_length)
+				return 0;
+			etag = get_trash_chunk();
+			if (shctx_row_data_get(shctx_ptr(cache), block_ptr(entry), (unsigned char *)b_orig(etag),
+			                       entry->etag_offset, entry->etag_length) != 0 ||
+			    !isteq(ist2(b_orig(etag), entry->etag_length), ctx.value))
+				return 0;
+		}
+		else if (!parse_http_date(istptr(ctx.value), istlen(ctx.value), &tm) ||
+		         my_timegm(&tm) != entry->last_modified)
+			return 0;
+	}
+
+	*start = first;
+	*len = last - first + 1;
+	return 1;
+}
+
 enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *px,
                                          struct session *sess, struct stream *s, int flags)
 {
@@ -2106,9 +3994,42 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	struct cache *cache = cconf->c.cache;
 	struct shared_context *shctx = shctx_ptr(cache);
 	struct shared_block *entry_block;
+	struct cache_st *st = NULL;
+	struct filter *filter;
+	int promoted = 0;
+	int notmodified, range;
+	unsigned int range_start = 0, range_len = 0;
 
 	struct cache_tree *cache_tree = NULL;
 
+	/* The filter context is needed to wait for another stream fetching the
+	 * same object.
+	 */
+	if (cache->collapse) {
+		list_for_each_entry(filter, &s->strm_flt.filters, list) {
+			if (FLT_ID(filter) == cache_store_flt_id && FLT_CONF(filter) == cconf) {
+				st = filter->ctx;
+				break;
+			}
+		}
+	}
+
+	if (st && (st->flags & CACHE_ST_F_WAITING)) {
+		/* woken up while waiting for the object */
+		if (HA_ATOMIC_LOAD(&st->pending) && !(flags & ACT_OPT_FINAL) &&
+		    !tick_is_expired(s->req.analyse_exp, now_ms))
+			return ACT_RET_YIELD;
+
+		/* the leader stored the object or gave up, or we waited for
+		 * too long. Never wait again for this request.
+		 */
+		cache_collapse_detach(st);
+		st->flags = (st->flags & ~CACHE_ST_F_WAITING) | CACHE_ST_F_NO_COLLAPSE;
+		s->req.analyse_exp = TICK_ETERNITY;
+		cache_tree = get_cache_tree_from_hash(cache, read_u32(s->txn->cache_hash));
+		goto lookup;
+	}
+
 	/* Ignore cache for HTTP/1.0 requests and for requests other than GET
 	 * and HEAD */
 	if (!(txn->req.flags & HTTP_MSGF_VER_11) ||
@@ -2137,8 +4058,9 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	if (!cache_tree)
 		return ACT_RET_CONT;
 
+  lookup:
 	cache_rdlock(cache_tree);
-	res = get_entry(cache_tree, s->txn->cache_hash, 0);
+	res = get_entry(cache_tree, s->txn->cache_hash, CACHE_GET_STALE);
 	/* We must not use an entry that is not complete but the check will be
 	 * performed after we look for a potential secondary entry (in case of
 	 * Vary). */
@@ -2150,7 +4072,7 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 
 		entry_block = block_ptr(res);
 		shctx_wrlock(shctx);
-		if (res->complete) {
+		if (res->complete || cache_entry_streamable(cache, res)) {
 			shctx_row_detach(shctx, entry_block);
 			detached = 1;
 		} else {
@@ -2167,7 +4089,7 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 			if (!http_request_build_secondary_key(s, res->secondary_key_signature)) {
 				cache_rdlock(cache_tree);
 				sec_entry = get_secondary_entry(cache_tree, res,
-				                                s->txn->cache_secondary_hash, 0);
+				                                s->txn->cache_secondary_hash, CACHE_GET_STALE);
 				if (sec_entry && sec_entry != res) {
 					/* The wrong row was added to the hot list. */
 					release_entry(cache_tree, res, 0);
@@ -2192,17 +4114,64 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 			}
 		}
 
+		/* An expired object may only be delivered during its stale
+		 * periods, and is then refreshed in the background.
+		 */
+		if (res && res->expire <= date.tv_sec) {
+			if (res->complete && cache_entry_stale_usable(res)) {
+				cache_refresh_start(cache, cache_tree, res, s);
+			}
+			else {
+				release_entry(cache_tree, res, 1);
+				shctx_wrlock(shctx);
+				shctx_row_reattach(shctx, block_ptr(res));
+				shctx_wrunlock(shctx);
+				res = NULL;
+			}
+		}
+
 		/* We either looked for a valid secondary entry and could not
 		 * find one, or the entry we want to use is not complete. We
 		 * can't use the cache's entry and must forward the request to
 		 * the server. */
 		if (!res) {
+			if (!promoted && cache_disk_promote(cache, cache_tree, s)) {
+				promoted = 1;
+				goto lookup;
+			}
+			if (cache->collapse)
+				return cache_collapse_miss(cache, cache_tree, st, s, flags);
 			return ACT_RET_CONT;
-		} else if (!res->complete) {
+		} else if (!res->complete && !cache_entry_streamable(cache, res)) {
 			release_entry(cache_tree, res, 1);
 			return ACT_RET_CONT;
 		}
 
+		/* In case of a conditional request, we might want to send a
+		 * "304 Not Modified" response instead of the stored data.
+		 * Otherwise only a range of the body may be requested.
+		 */
+		notmodified = should_send_notmodified_response(cache, htxbuf(&s->req.buf), res);
+		range = 0;
+		if (!notmodified && res->complete && txn->meth == HTTP_METH_GET) {
+			range = cache_entry_get_range(cache, htxbuf(&s->req.buf), res, &range_start, &range_len);
+
+			/* All the slices of a sliced object holding the bytes
+			 * to send must still be in the cache.
+			 */
+			if (res->slice_size &&
+			    !cache_slices_available(cache, res,
+			                            range ? range_start / res->slice_size : 0,
+			                            range ? (range_start + range_len - 1) / res->slice_size
+			                                  : cache_slice_count(res) - 1)) {
+				release_entry(cache_tree, res, 1);
+				shctx_wrlock(shctx);
+				shctx_row_reattach(shctx, block_ptr(res));
+				shctx_wrunlock(shctx);
+				return ACT_RET_CONT;
+			}
+		}
+
 		s->target = &http_cache_applet.obj_type;
 		if ((appctx = sc_applet_create(s->scb, objt_applet(s->target)))) {
 			struct cache_appctx *ctx = applet_reserve_svcctx(appctx, sizeof(*ctx));
@@ -2213,8 +4182,15 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 			ctx->entry = res;
 			ctx->next = NULL;
 			ctx->sent = 0;
-			ctx->send_notmodified =
-                                should_send_notmodified_response(cache, htxbuf(&s->req.buf), res);
+			ctx->appctx = appctx;
+			LIST_INIT(&ctx->waiter);
+			ctx->send_notmodified = notmodified;
+			ctx->range = range;
+			ctx->range_start = range_start;
+			ctx->range_len = range_len;
+			ctx->slice = NULL;
+			ctx->slice_tree = NULL;
+			ctx->slice_idx = 0;
 
 			if (px == strm_fe(s))
 				_HA_ATOMIC_INC(&px->fe_counters.p.http.cache_hits);
@@ -2232,6 +4208,19 @@ enum act_return http_action_req_cache_use(struct act_rule *rule, struct proxy *p
 	}
 	cache_rdunlock(cache_tree);
 
+	/* The object may have been evicted to the disk tier, in which case it
+	 * is loaded back and looked up again.
+	 */
+	if (!promoted && cache_disk_promote(cache, cache_tree, s)) {
+		promoted = 1;
+		goto lookup;
+	}
+
+	/* Another stream may already be fetching it */
+	if (cache->collapse &&
+	    cache_collapse_miss(cache, cache_tree, st, s, flags) == ACT_RET_YIELD)
+		return ACT_RET_YIELD;
+
 	/* Shared context does not need to be locked while we calculate the
 	 * secondary hash. */
 	if (!res && cache->vary_processing_enabled) {
@@ -2304,6 +4293,10 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 			tmp_cache_config->maxblocks = 0;
 			tmp_cache_config->maxobjsz = 0;
 			tmp_cache_config->max_secondary_entries = DEFAULT_MAX_SECONDARY_ENTRY;
+			tmp_cache_config->collapse = 0;
+			tmp_cache_config->collapse_timeout = DEFAULT_COLLAPSE_TIMEOUT;
+			tmp_cache_config->max_stale = 0;
+			tmp_cache_config->slice_size = 0;
 		}
 	} else if (strcmp(args[0], "total-max-size") == 0) {
 		unsigned long int maxsize;
@@ -2368,6 +4361,23 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		}
 		tmp_cache_config->maxobjsz = maxobjsz;
+	} else if (strcmp(args[0], "slice-size") == 0) {
+		unsigned int slice_size;
+		char *err;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		slice_size = strtoul(args[1], &err, 10);
+		if (err == args[1] || *err != '\0' || !slice_size) {
+			ha_alert("parsing [%s:%d]: slice-size wrong value '%s'\n",
+			         file, linenum, args[1]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+		tmp_cache_config->slice_size = slice_size;
 	} else if (strcmp(args[0], "process-vary") == 0) {
 		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
 			err_code |= ERR_ABORT;
@@ -2411,6 +4421,119 @@ int cfg_parse_cache(const char *file, int linenum, char **args, int kwm)
 			goto out;
 		}
 		tmp_cache_config->max_secondary_entries = max_sec_entries;
+	} else if (strcmp(args[0], "collapsed-forwarding") == 0) {
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (strcmp(args[1], "on") == 0)
+			tmp_cache_config->collapse = 1;
+		else if (strcmp(args[1], "off") == 0)
+			tmp_cache_config->collapse = 0;
+		else {
+			ha_warning("parsing [%s:%d]: '%s' expects \"on\" or \"off\" (enable or disable collapsed forwarding).\n",
+				   file, linenum, args[0]);
+			err_code |= ERR_WARN;
+		}
+	} else if (strcmp(args[0], "collapse-timeout") == 0) {
+		unsigned int timeout;
+		const char *res;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a time value.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		res = parse_time_err(args[1], &timeout, TIME_UNIT_MS);
+		if (res || !timeout) {
+			ha_alert("parsing [%s:%d]: '%s' expects a strictly positive time value, got '%s'.\n",
+			         file, linenum, args[0], args[1]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->collapse_timeout = timeout;
+	} else if (strcmp(args[0], "max-stale") == 0) {
+		unsigned int max_stale;
+		const char *res;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects a time value.\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+
+		res = parse_time_err(args[1], &max_stale, TIME_UNIT_S);
+		if (res) {
+			ha_alert("parsing [%s:%d]: '%s' expects a time value, got '%s'.\n",
+			         file, linenum, args[0], args[1]);
+			err_code |= ERR_ALERT | ERR_ABORT;
+			goto out;
+		}
+		tmp_cache_config->max_stale = max_stale;
+	} else if (strcmp(args[0], "disk-path") == 0 || strcmp(args[0], "disk-max-size") == 0) {
+		struct cache_disk *disk = tmp_cache_config->disk;
+
+		if (alertif_too_many_args(1, file, linenum, args, &err_code)) {
+			err_code |= ERR_ABORT;
+			goto out;
+		}
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d]: '%s' expects an argument.\n",
+				 file, linenum, args[0]);
+			err_code |= ERR_ALERT | ERR_FATAL;
+			goto out;
+		}
+
+		if (!disk) {
+			disk = calloc(1, sizeof(*disk));
+			if (!disk) {
+				ha_alert("parsing [%s:%d]: out of memory.\n", file, linenum);
+				err_code |= ERR_ALERT | ERR_ABORT;
+				goto out;
+			}
+			disk->fd = -1;
+			disk->size = (unsigned long long)CACHE_DISK_DEF_SIZE << 20;
+			tmp_cache_config->disk = disk;
+		}
+
+		if (strcmp(args[0], "disk-path") == 0) {
+			free(disk->path);
+			disk->path = strdup(args[1]);
+			if (!disk->path) {
+				ha_alert("parsing [%s:%d]: out of memory.\n", file, linenum);
+				err_code |= ERR_ALERT | ERR_ABORT;
+				goto out;
+			}
+		}
+		else {
+			unsigned long int maxsize;
+			char *err;
+
+			maxsize = strtoul(args[1], &err, 10);
+			if (err == args[1] || *err != '\0' || !maxsize || maxsize > UINT_MAX) {
+				ha_alert("parsing [%s:%d]: disk-max-size wrong value '%s'\n",
+				         file, linenum, args[1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			/* size in megabytes */
+			disk->size = (unsigned long long)maxsize << 20;
+		}
 	}
 	else if (*args[0] != 0) {
 		ha_alert("parsing [%s:%d] : unknown keyword '%s' in 'cache' section\n", file, linenum, args[0]);
@@ -2446,6 +4569,25 @@ int cfg_post_parse_section_cache()
 			goto out;
 		}
 
+		if (tmp_cache_config->slice_size > tmp_cache_config->maxobjsz / 2) {
+			ha_alert("\"slice-size\" is limited to an half of \"max-object-size\" => %u\n", tmp_cache_config->maxobjsz / 2);
+			err_code |= ERR_FATAL | ERR_ALERT;
+			goto out;
+		}
+
+		if (tmp_cache_config->disk) {
+			if (!tmp_cache_config->disk->path) {
+				ha_alert("\"disk-max-size\" requires \"disk-path\" in cache '%s'\n", tmp_cache_config->id);
+				err_code |= ERR_FATAL | ERR_ALERT;
+				goto out;
+			}
+			if (tmp_cache_config->disk->size / 2 < tmp_cache_config->maxobjsz + sizeof(struct cache_disk_rec) + CACHE_DISK_ALIGN) {
+				ha_alert("\"disk-max-size\" must be at least twice as large as \"max-object-size\" in cache '%s'\n", tmp_cache_config->id);
+				err_code |= ERR_FATAL | ERR_ALERT;
+				goto out;
+			}
+		}
+
 		/* add to the list of cache to init and reinit tmp_cache_config
 		 * for next cache section, if any.
 		 */
@@ -2454,6 +4596,8 @@ int cfg_post_parse_section_cache()
 		return err_code;
 	}
 out:
+	if (tmp_cache_config)
+		cache_disk_release(tmp_cache_config);
 	ha_free(&tmp_cache_config);
 	return err_code;
 
@@ -2464,6 +4608,7 @@ int post_check_cache()
 	struct proxy *px;
 	struct cache *back, *cache_config, *cache;
 	struct shared_context *shctx;
+	char *errmsg = NULL;
 	int ret_shctx;
 	int err_code = ERR_NONE;
 	int i;
@@ -2493,8 +4638,16 @@ int post_check_cache()
 		LIST_APPEND(&caches, &cache->list);
 		LIST_DELETE(&cache_config->list);
 		free(cache_config);
+
+		if (cache->disk && !cache_disk_open(cache, &errmsg)) {
+			ha_alert("Unable to initialize the disk tier of cache '%s' : %s.\n", cache->id, errmsg);
+			ha_free(&errmsg);
+			err_code |= ERR_FATAL | ERR_ALERT;
+			goto out;
+		}
 		for (i = 0; i < CACHE_TREE_NUM; ++i) {
 			cache->trees[i].entries = EB_ROOT;
+			cache->trees[i].pending = EB_ROOT;
 			HA_RWLOCK_INIT(&cache->trees[i].lock);
 
 			LIST_INIT(&cache->trees[i].cleanup_list);
@@ -2698,8 +4851,11 @@ static int accept_encoding_normalizer(struct htx *htx, struct ist hdr_name,
 		if (istlen(ctx.value) == 0)
 			continue;
 
-		/* Turn accept-encoding value to lower case */
+		/* Turn accept-encoding value to lower case. The header is
+		 * modified in place so cached fetches must be invalidated.
+		 */
 		ist2bin_lc(istptr(ctx.value), ctx.value);
+		htx_hdr_changed(HTX_BLK_HDR);
 
 		/* Try to identify a known encoding and to manage null weights. */
 		if (!parse_encoding_value(ctx.value, &encoding_value, &rejected_encoding)) {
@@ -2994,6 +5150,16 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 			shctx_rdlock(shctx);
 			chunk_printf(buf, "%p: %s (shctx:%p, available blocks:%d)\n", cache, cache->id, shctx_ptr(cache), shctx_ptr(cache)->nbav);
 			shctx_rdunlock(shctx);
+			if (cache->disk) {
+				struct cache_disk *disk = cache->disk;
+
+				cache_disk_lock(disk);
+				chunk_appendf(buf, "  disk:%s (size:%llu, used:%llu, stored:%llu, promoted:%llu)\n",
+				              disk->path, disk->size,
+				              (ullong)MIN(disk->hdr->wpos - disk->size, disk->size),
+				              disk->stored, disk->promoted);
+				cache_disk_unlock(disk);
+			}
 			if (applet_putchk(appctx, buf) == -1) {
 				goto yield;
 			}
@@ -3020,13 +5186,16 @@ static int cli_io_handler_show_cache(struct appctx *appctx)
 				entry = container_of(node, struct cache_entry, eb);
 				next_key = node->key + 1;
 
-				if (entry->expire > date.tv_sec) {
+				if (entry->expire > date.tv_sec || cache_entry_is_stale(entry)) {
 					chunk_printf(buf, "%p hash:%u vary:0x", entry, read_u32(entry->hash));
 					for (i = 0; i < HTTP_CACHE_SEC_KEY_LEN; ++i)
 						chunk_appendf(buf, "%02x", (unsigned char)entry->secondary_key[i]);
-					chunk_appendf(buf, " size:%u (%u blocks), refcount:%u, expire:%d\n",
+					chunk_appendf(buf, " size:%u (%u blocks), refcount:%u, expire:%d",
 						      block_ptr(entry)->len, block_ptr(entry)->block_count,
 						      block_ptr(entry)->refcount, entry->expire - (int)date.tv_sec);
+					if (entry->slice_size)
+						chunk_appendf(buf, " slice:%u", entry->slice);
+					chunk_appendf(buf, "\n");
 				}
 
 				ctx->next_key = next_key;
@@ -3096,6 +5265,28 @@ smp_fetch_res_cache_name(const struct arg *args, struct sample *smp,
 }
 
 
+/* Creates the HTTP client proxy used to refresh stale objects in the
+ * background, if any cache may deliver them.
+ */
+static int cache_refresh_precheck()
+{
+	struct cache *cache;
+
+	list_for_each_entry(cache, &caches_config, list) {
+		if (!cache->max_stale)
+			continue;
+
+		cache_refresh_px = httpclient_create_proxy("<CACHE-REFRESH>");
+		if (!cache_refresh_px)
+			return ERR_RETRYABLE;
+		cache_refresh_px->options2 |= PR_O2_NOLOGNORM;
+		break;
+	}
+	return ERR_NONE;
+}
+
+REGISTER_PRE_CHECK(cache_refresh_precheck);
+
 /* early boot initialization */
 static void cache_init()
 {
@@ -3104,6 +5295,17 @@ static void cache_init()
 
 INITCALL0(STG_PREPARE, cache_init);
 
+/* releases the disk tier of all caches */
+static void cache_deinit()
+{
+	struct cache *cache;
+
+	list_for_each_entry(cache, &caches, list)
+		cache_disk_release(cache);
+}
+
+REGISTER_POST_DEINIT(cache_deinit);
+
 /* Declare the filter parser for "cache" keyword */
 static struct flt_kw_list filter_kws = { "CACHE", { }, {
 		{ "cache", parse_cache_flt, NULL },
@@ -291,6 +291,18 @@ static int cfg_parse_quic_tune_on_off(char **args, int section_type, struct prox
 		else
 			global.tune.options &= ~GTUNE_QUIC_CC_HYSTART;
 	}
+	else if (strcmp(suffix, "udp-gro") == 0) {
+		if (on)
+			global.tune.options &= ~GTUNE_QUIC_NO_UDP_GRO;
+		else
+			global.tune.options |= GTUNE_QUIC_NO_UDP_GRO;
+	}
+	else if (strcmp(suffix, "udp-gso") == 0) {
+		if (on)
+			global.tune.options &= ~GTUNE_QUIC_NO_UDP_GSO;
+		else
+			global.tune.options |= GTUNE_QUIC_NO_UDP_GSO;
+	}
 
 	return 0;
 }
@@ -305,6 +317,8 @@ static struct cfg_kw_list cfg_kws = {ILH, {
 	{ CFG_GLOBAL, "tune.quic.max-frame-loss", cfg_parse_quic_tune_setting },
 	{ CFG_GLOBAL, "tune.quic.reorder-ratio", cfg_parse_quic_tune_setting },
 	{ CFG_GLOBAL, "tune.quic.retry-threshold", cfg_parse_quic_tune_setting },
+	{ CFG_GLOBAL, "tune.quic.udp-gro", cfg_parse_quic_tune_on_off },
+	{ CFG_GLOBAL, "tune.quic.udp-gso", cfg_parse_quic_tune_on_off },
 	{ CFG_GLOBAL, "tune.quic.zero-copy-fwd-send", cfg_parse_quic_tune_on_off },
 	{ 0, NULL, NULL }
 }};
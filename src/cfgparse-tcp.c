@@ -78,6 +78,15 @@ static int bind_parse_tfo(char **args, int cur_arg, struct proxy *px, struct bin
 }
 #endif
 
+#ifdef HA_HAVE_MSG_ZEROCOPY
+/* parse the "msg-zerocopy" bind keyword */
+static int bind_parse_msg_zerocopy(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
+{
+	conf->options |= BC_O_ZEROCOPY;
+	return 0;
+}
+#endif
+
 #ifdef TCP_MAXSEG
 /* parse the "mss" bind keyword */
 static int bind_parse_mss(char **args, int cur_arg, struct proxy *px, struct bind_conf *conf, char **err)
@@ -230,6 +239,9 @@ static struct bind_kw_list bind_kws = { "TCP", { }, {
 #ifdef TCP_MAXSEG
 	{ "mss",           bind_parse_mss,          1 }, /* set MSS of listening socket */
 #endif
+#ifdef HA_HAVE_MSG_ZEROCOPY
+	{ "msg-zerocopy",  bind_parse_msg_zerocopy, 0 }, /* send large responses with MSG_ZEROCOPY */
+#endif
 #ifdef TCP_USER_TIMEOUT
 	{ "tcp-ut",        bind_parse_tcp_ut,       1 }, /* set User Timeout on listening socket */
 #endif
@@ -250,6 +262,7 @@ static struct bind_kw_list bind_kws = { "TCP", { }, {
 	{ "defer-accept",  NULL,  0 },
 	{ "interface",     NULL,  1 },
 	{ "mss",           NULL,  1 },
+	{ "msg-zerocopy",  NULL,  0 },
 	{ "transparent",   NULL,  0 },
 	{ "v4v6",          NULL,  0 },
 	{ "v6only",        NULL,  0 },
@@ -984,6 +984,30 @@ int cfg_parse_peers(const char *file, int linenum, char **args, int kwm)
 
 		nb_shards = curpeers->nb_shards;
 	}
+	else if (strcmp(args[0], "resync-streams") == 0) {
+		char *endptr;
+
+		if (!*args[1]) {
+			ha_alert("parsing [%s:%d] : '%s' : missing value\n", file, linenum, args[0]);
+			err_code |= ERR_FATAL;
+			goto out;
+		}
+
+		curpeers->resync_streams = strtol(args[1], &endptr, 10);
+		if (*endptr != '\0') {
+			ha_alert("parsing [%s:%d] : '%s' : expects an integer argument, found '%s'\n",
+			         file, linenum, args[0], args[1]);
+			err_code |= ERR_FATAL;
+			goto out;
+		}
+
+		if (curpeers->resync_streams < 1 || curpeers->resync_streams > 64) {
+			ha_alert("parsing [%s:%d] : '%s' : expects a value between 1 and 64\n",
+			         file, linenum, args[0]);
+			err_code |= ERR_FATAL;
+			goto out;
+		}
+	}
 	else if (strcmp(args[0], "table") == 0) {
 		struct stktable *t, *other;
 		char *id;
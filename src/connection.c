@@ -18,6 +18,7 @@
 #include <haproxy/arg.h>
 #include <haproxy/cfgparse.h>
 #include <haproxy/connection.h>
+#include <haproxy/dynbuf.h>
 #include <haproxy/fd.h>
 #include <haproxy/frontend.h>
 #include <haproxy/hash.h>
@@ -42,6 +43,7 @@ DECLARE_POOL(pool_head_conn_hash_node, "conn_hash_node", sizeof(struct conn_hash
 DECLARE_POOL(pool_head_sockaddr,       "sockaddr",       sizeof(struct sockaddr_storage));
 DECLARE_POOL(pool_head_pp_tlv_128,     "pp_tlv_128",     sizeof(struct conn_tlv_list) + HA_PP2_TLV_VALUE_128);
 DECLARE_POOL(pool_head_pp_tlv_256,     "pp_tlv_256",     sizeof(struct conn_tlv_list) + HA_PP2_TLV_VALUE_256);
+DECLARE_POOL(pool_head_conn_zc,        "conn_zc",        sizeof(struct conn_zc));
 
 struct idle_conns idle_conns[MAX_THREADS] = { };
 struct xprt_ops *registered_xprt[XPRT_ENTRIES] = { NULL, };
@@ -485,6 +487,7 @@ void conn_init(struct connection *conn, void *target)
 	conn->xprt = NULL;
 	conn->reverse.target = NULL;
 	conn->reverse.name = BUF_NULL;
+	conn->zc = NULL;
 }
 
 /* Initialize members used for backend connections.
@@ -599,10 +602,63 @@ void conn_free(struct connection *conn)
 	}
 
 
+	if (conn->zc) {
+		conn_zc_release(conn->zc, 1);
+		pool_free(pool_head_conn_zc, conn->zc);
+	}
+
 	conn_force_unsubscribe(conn);
 	pool_free(pool_head_connection, conn);
 }
 
+/* Makes <conn> hold the buffer <buf> until the kernel reports completion of
+ * the last zero-copy send referencing it, which is assumed to be the last one
+ * performed. On success, the buffer's ownership is transferred to the
+ * connection, <buf> is reset and 1 is returned. Otherwise 0 is returned and
+ * the buffer is left untouched.
+ */
+int conn_zc_hold(struct connection *conn, struct buffer *buf)
+{
+	struct conn_zc *zc = conn->zc;
+	uint idx;
+
+	if (!zc || zc->count >= CONN_ZC_MAX_HELD)
+		return 0;
+
+	idx = (zc->head + zc->count) % CONN_ZC_MAX_HELD;
+	zc->held[idx].buf = *buf;
+	zc->held[idx].last_id = zc->next_id - 1;
+	zc->count++;
+	*buf = BUF_NULL;
+	return 1;
+}
+
+/* Releases the buffers held by <zc> whose zero-copy sends were all reported
+ * as completed by the kernel, or all of them if <all> is non-zero. This last
+ * case is only meant to be used once the kernel cannot reference them anymore.
+ * Waiters in the buffer wait queue are notified about the released buffers.
+ */
+void conn_zc_release(struct conn_zc *zc, int all)
+{
+	int released = 0;
+
+	while (zc->count) {
+		struct buffer *buf = &zc->held[zc->head].buf;
+
+		/* ids wrap, so compare them using the signed distance */
+		if (!all && (int)(zc->held[zc->head].last_id - zc->done_id) >= 0)
+			break;
+
+		b_free(buf);
+		released++;
+		zc->head = (zc->head + 1) % CONN_ZC_MAX_HELD;
+		zc->count--;
+	}
+
+	if (released)
+		offer_buffers(NULL, released);
+}
+
 /* Close all <conn> internal layers accordingly prior to freeing it. */
 void conn_release(struct connection *conn)
 {
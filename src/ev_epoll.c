@@ -62,8 +62,10 @@ static void __fd_clo(int fd)
 		}
 
 		for (i = ha_tgroup_info[tgrp-1].base; i < ha_tgroup_info[tgrp-1].base + ha_tgroup_info[tgrp-1].count; i++)
-			if (m & ha_thread_info[i].ltid_bit)
+			if (m & ha_thread_info[i].ltid_bit) {
 				epoll_ctl(epoll_fd[i], EPOLL_CTL_DEL, fd, &ev);
+				activity[tid].poll_sysc++;
+			}
 	}
 }
 
@@ -152,6 +154,7 @@ static void _update_fd(int fd)
  done:
 	ev.data.fd = fd;
 	epoll_ctl(epoll_fd[tid], opcode, fd, &ev);
+	activity[tid].poll_sysc++;
 }
 
 /*
@@ -230,6 +233,7 @@ static void _do_poll(struct poller *p, int exp, int wake)
 		int timeout = (global.tune.options & GTUNE_BUSY_POLLING) ? 0 : wait_time;
 
 		status = epoll_wait(epoll_fd[tid], epoll_events, global.tune.maxpollevents, timeout);
+		activity[tid].poll_sysc++;
 		clock_update_local_date(timeout, status);
 
 		if (status) {
@@ -163,6 +163,7 @@ static void _do_poll(struct poller *p, int exp, int wake)
 		EV_SET(&kev[changes++], -1, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
 #endif
 		kevent(kqueue_fd[tid], kev, changes, kev_out, changes, &timeout_ts);
+		activity[tid].poll_sysc++;
 	}
 	fd_nbupdt = 0;
 
@@ -183,6 +184,7 @@ static void _do_poll(struct poller *p, int exp, int wake)
 		                kev,       // struct kevent *eventlist
 		                fd,        // int nevents
 		                &timeout_ts); // const struct timespec *timeout
+		activity[tid].poll_sysc++;
 		clock_update_local_date(timeout, status);
 
 		if (status) {
@@ -208,6 +208,7 @@ static void _do_poll(struct poller *p, int exp, int wake)
 	wait_time = wake ? 0 : compute_poll_timeout(exp);
 	clock_entering_poll();
 	status = poll(poll_events, nbfd, wait_time);
+	activity[tid].poll_sysc++;
 	clock_update_date(wait_time, status);
 
 	fd_leaving_poll(wait_time, status);
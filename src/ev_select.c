@@ -182,6 +182,7 @@ static void _do_poll(struct poller *p, int exp, int wake)
 			writenotnull ? tmp_evts[DIR_WR] : NULL,
 			NULL,
 			&delta);
+	activity[tid].poll_sysc++;
 	clock_update_date(delta_ms, status);
 	fd_leaving_poll(delta_ms, status);
 
@@ -0,0 +1,799 @@
+/*
+ * FD polling functions for Linux io_uring
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ * This poller relies on multishot poll requests (Linux >= 5.13): a poll
+ * request stays armed in the ring and posts one completion per readiness
+ * change, so that polling state changes and event retrieval are batched in a
+ * single io_uring_enter() call per loop, or none at all when completions are
+ * already available. Since this is edge-triggered, it is only used for FDs
+ * supporting it (FD_ET_POSSIBLE). Other ones (e.g. listeners, QUIC sockets)
+ * use one-shot poll requests which are re-armed after each completion, which
+ * provides the level-triggered semantics they expect. The ring is driven
+ * using raw syscalls so that no external library is needed.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+#include <haproxy/activity.h>
+#include <haproxy/api.h>
+#include <haproxy/cfgparse.h>
+#include <haproxy/clock.h>
+#include <haproxy/fd.h>
+#include <haproxy/global.h>
+#include <haproxy/signal.h>
+#include <haproxy/ticks.h>
+#include <haproxy/task.h>
+#include <haproxy/tools.h>
+
+#ifndef POLLRDHUP
+#define POLLRDHUP 0x2000
+#endif
+
+/* user_data of the requests whose completions must be ignored (poll updates
+ * and removals). Poll requests use the FD and its generation as user_data
+ * (see uring_ud()). An update may only fail if the poll request was
+ * terminated, in which case it will be re-armed with the current polling
+ * state once its last completion is reaped.
+ */
+#define URING_UD_IGNORE   (~0ULL)
+
+/* minimum number of entries of the rings */
+#define URING_SQ_ENTRIES  1024
+#define URING_CQ_ENTRIES  4096
+
+/* One io_uring instance per thread. The submission queue is only accessed
+ * under the lock because FDs shared between threads may have to be removed
+ * from the ring of another thread when closed.
+ */
+struct uring_ring {
+	__decl_thread(HA_SPINLOCK_T lock);
+	int fd;
+	unsigned int sq_pending;    /* SQEs filled but not yet submitted */
+	unsigned int skip_flags;    /* SQE flags to avoid successful completions */
+	/* submission queue */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_array;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	struct io_uring_sqe *sqes;
+	/* completion queue */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe *cqes;
+	/* mappings */
+	void *sq_map;
+	size_t sq_map_sz;
+	void *cq_map;
+	size_t cq_map_sz;
+	size_t sqes_sz;
+} THREAD_ALIGNED(64);
+
+/* private data */
+static struct uring_ring uring_rings[MAX_THREADS] __read_mostly;
+static struct poller *uring_poller = NULL;
+
+/* Generation of each FD, incremented when it is closed. Completions may still
+ * be reaped for a poll request after its FD was closed and the same number
+ * reused, they are recognized by their stale generation and ignored.
+ */
+static uint *uring_fd_gen = NULL;
+
+static inline int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                                     unsigned int flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/* Releases the ring <r> and its mappings. */
+static void uring_ring_free(struct uring_ring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_sz);
+	if (r->cq_map && r->cq_map != r->sq_map)
+		munmap(r->cq_map, r->cq_map_sz);
+	if (r->sq_map)
+		munmap(r->sq_map, r->sq_map_sz);
+	if (r->fd >= 0)
+		close(r->fd);
+
+	r->sqes = NULL;
+	r->sq_map = r->cq_map = NULL;
+	r->sq_pending = 0;
+	r->fd = -1;
+}
+
+/* Creates the ring <r> and maps its queues. Returns 1 on success, 0 on
+ * failure. The kernel must support the features this poller relies on.
+ */
+static int uring_ring_init(struct uring_ring *r)
+{
+	struct io_uring_params p;
+	uint cq_entries = URING_CQ_ENTRIES;
+	int fd;
+
+	r->fd = -1;
+	r->sqes = NULL;
+	r->sq_map = r->cq_map = NULL;
+	r->sq_pending = 0;
+
+	while (cq_entries < global.tune.maxpollevents * 4)
+		cq_entries <<= 1;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = cq_entries;
+	fd = sys_io_uring_setup(URING_SQ_ENTRIES, &p);
+	if (fd < 0 && errno == EINVAL) {
+		/* COOP_TASKRUN only appeared in 5.19 */
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = cq_entries;
+		fd = sys_io_uring_setup(URING_SQ_ENTRIES, &p);
+	}
+	if (fd < 0)
+		return 0;
+
+	r->fd = fd;
+
+	/* EXT_ARG (5.11) is needed for timeouts, RSRC_TAGS (5.13) indicates
+	 * multishot poll and poll updates support.
+	 */
+	if ((p.features & (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS)) !=
+	    (IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS))
+		goto fail;
+
+	r->sq_map_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_map_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_map_sz > r->sq_map_sz)
+			r->sq_map_sz = r->cq_map_sz;
+		r->cq_map_sz = r->sq_map_sz;
+	}
+
+	r->sq_map = mmap(NULL, r->sq_map_sz, PROT_READ | PROT_WRITE,
+	                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (r->sq_map == MAP_FAILED) {
+		r->sq_map = NULL;
+		goto fail;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_map = r->sq_map;
+	else {
+		r->cq_map = mmap(NULL, r->cq_map_sz, PROT_READ | PROT_WRITE,
+		                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (r->cq_map == MAP_FAILED) {
+			r->cq_map = NULL;
+			goto fail;
+		}
+	}
+
+	r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE,
+	               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		goto fail;
+	}
+
+	r->sq_head    = r->sq_map + p.sq_off.head;
+	r->sq_tail    = r->sq_map + p.sq_off.tail;
+	r->sq_array   = r->sq_map + p.sq_off.array;
+	r->sq_mask    = *(unsigned int *)(r->sq_map + p.sq_off.ring_mask);
+	r->sq_entries = p.sq_entries;
+	r->cq_head    = r->cq_map + p.cq_off.head;
+	r->cq_tail    = r->cq_map + p.cq_off.tail;
+	r->cq_mask    = *(unsigned int *)(r->cq_map + p.cq_off.ring_mask);
+	r->cqes       = r->cq_map + p.cq_off.cqes;
+
+	/* since 5.17, poll updates and removals do not need to wake us up */
+	r->skip_flags = 0;
+#if defined(IORING_FEAT_CQE_SKIP) && defined(IOSQE_CQE_SKIP_SUCCESS)
+	if (p.features & IORING_FEAT_CQE_SKIP)
+		r->skip_flags = IOSQE_CQE_SKIP_SUCCESS;
+#endif
+	return 1;
+
+ fail:
+	uring_ring_free(r);
+	return 0;
+}
+
+/* Submits the pending SQEs of ring <r> without waiting. Must be called with
+ * the ring's lock held. Returns the number of syscalls performed.
+ */
+static int uring_submit(struct uring_ring *r)
+{
+	int ret;
+
+	if (!r->sq_pending)
+		return 0;
+
+	do {
+		ret = sys_io_uring_enter(r->fd, r->sq_pending, 0, 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret > 0)
+		r->sq_pending -= ret;
+	return 1;
+}
+
+/* Returns a free SQE from ring <r>, submitting pending ones first if the
+ * queue is full. Must be called with the ring's lock held. The SQE is zeroed
+ * and already queued, so it must be filled by the caller.
+ */
+static struct io_uring_sqe *uring_get_sqe(struct uring_ring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int tail = *r->sq_tail;
+
+	while (tail - HA_ATOMIC_LOAD(r->sq_head) >= r->sq_entries) {
+		activity[tid].poll_sysc += uring_submit(r);
+		if (tail - HA_ATOMIC_LOAD(r->sq_head) >= r->sq_entries)
+			__ha_cpu_relax();
+	}
+
+	sqe = &r->sqes[tail & r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->sq_pending++;
+	return sqe;
+}
+
+/* Converts the FD_EV_ACTIVE_* bits in <en> to poll events */
+static inline uint uring_poll_events(uint en)
+{
+	return ((en & FD_EV_ACTIVE_R) ? POLLIN | POLLRDHUP : 0) |
+	       ((en & FD_EV_ACTIVE_W) ? POLLOUT : 0);
+}
+
+/* Returns the poll flags to use for <fd>: multishot requests are only used for
+ * FDs supporting edge-triggered polling.
+ */
+static inline uint uring_poll_flags(int fd)
+{
+	return (fdtab[fd].state & FD_ET_POSSIBLE) ? IORING_POLL_ADD_MULTI : 0;
+}
+
+/* Returns the user_data identifying the poll requests of <fd> */
+static inline uint64_t uring_ud(int fd)
+{
+	return (uint64_t)_HA_ATOMIC_LOAD(&uring_fd_gen[fd]) << 32 | (uint)fd;
+}
+
+/* Queues in ring <r> a poll request for <fd> on <events> */
+static void uring_poll_add(struct uring_ring *r, int fd, uint events)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->len = uring_poll_flags(fd);
+	sqe->poll32_events = events;
+	sqe->user_data = uring_ud(fd);
+}
+
+/* Queues in ring <r> an update of the events of the poll request of <fd> */
+static void uring_poll_update(struct uring_ring *r, int fd, uint events)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_ud(fd);
+	sqe->len = IORING_POLL_UPDATE_EVENTS | uring_poll_flags(fd);
+	sqe->poll32_events = events;
+	sqe->flags = r->skip_flags;
+	sqe->user_data = URING_UD_IGNORE;
+}
+
+/* Queues in ring <r> the removal of the poll request of <fd> */
+static void uring_poll_remove(struct uring_ring *r, int fd)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(r);
+
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = uring_ud(fd);
+	sqe->flags = r->skip_flags;
+	sqe->user_data = URING_UD_IGNORE;
+}
+
+/*
+ * Poll requests hold a reference to the file, so an FD must be removed from
+ * all rings polling it before being closed, otherwise the socket would stay
+ * open. Removals from the current thread's ring are processed in order with
+ * the next updates, but other threads' rings are flushed immediately since
+ * they may be sleeping. The FD's generation is then incremented so that the
+ * completions still pending for it are ignored once its number is reused.
+ */
+static void __fd_clo(int fd)
+{
+	unsigned long m = _HA_ATOMIC_LOAD(&polled_mask[fd].poll_recv) | _HA_ATOMIC_LOAD(&polled_mask[fd].poll_send);
+	int tgrp = fd_tgid(fd);
+	int i;
+
+	if (!m)
+		goto done;
+
+	for (i = ha_tgroup_info[tgrp-1].base; i < ha_tgroup_info[tgrp-1].base + ha_tgroup_info[tgrp-1].count; i++) {
+		struct uring_ring *r = &uring_rings[i];
+
+		if (!(m & ha_thread_info[i].ltid_bit) || r->fd < 0)
+			continue;
+
+		HA_SPIN_LOCK(OTHER_LOCK, &r->lock);
+		uring_poll_remove(r, fd);
+		if (i != tid)
+			activity[tid].poll_sysc += uring_submit(r);
+		HA_SPIN_UNLOCK(OTHER_LOCK, &r->lock);
+	}
+ done:
+	_HA_ATOMIC_INC(&uring_fd_gen[fd]);
+}
+
+static void _update_fd(int fd)
+{
+	struct uring_ring *r = &uring_rings[tid];
+	int en, opcode;
+	ulong pr, ps;
+
+	en = fdtab[fd].state;
+	pr = _HA_ATOMIC_LOAD(&polled_mask[fd].poll_recv);
+	ps = _HA_ATOMIC_LOAD(&polled_mask[fd].poll_send);
+
+	/* Multishot poll requests are edge-triggered, the poll request is
+	 * set once for both directions on FDs that support it.
+	 */
+	if (fdtab[fd].state & FD_ET_POSSIBLE) {
+		/* already done ? */
+		if (pr & ps & ti->ltid_bit)
+			return;
+
+		/* enable polling in both directions */
+		_HA_ATOMIC_OR(&polled_mask[fd].poll_recv, ti->ltid_bit);
+		_HA_ATOMIC_OR(&polled_mask[fd].poll_send, ti->ltid_bit);
+		en = FD_EV_ACTIVE_RW;
+		opcode = IORING_OP_POLL_ADD;
+		goto done;
+	}
+
+	/* if we're already polling or are going to poll for this FD and it's
+	 * neither active nor ready, force it to be active so that we don't
+	 * needlessly unsubscribe then re-subscribe it.
+	 */
+	if (!(en & (FD_EV_READY_R | FD_EV_SHUT_R | FD_EV_ERR_RW | FD_POLL_ERR)) &&
+	    ((en & FD_EV_ACTIVE_W) || ((ps | pr) & ti->ltid_bit)))
+		en |= FD_EV_ACTIVE_R;
+
+	if ((ps | pr) & ti->ltid_bit) {
+		if (!(fdtab[fd].thread_mask & ti->ltid_bit) || !(en & FD_EV_ACTIVE_RW)) {
+			/* fd removed from poll list */
+			opcode = IORING_OP_POLL_REMOVE;
+			if (pr & ti->ltid_bit)
+				_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~ti->ltid_bit);
+			if (ps & ti->ltid_bit)
+				_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~ti->ltid_bit);
+		}
+		else {
+			if (((en & FD_EV_ACTIVE_R) != 0) == ((pr & ti->ltid_bit) != 0) &&
+			    ((en & FD_EV_ACTIVE_W) != 0) == ((ps & ti->ltid_bit) != 0))
+				return;
+			if (en & FD_EV_ACTIVE_R) {
+				if (!(pr & ti->ltid_bit))
+					_HA_ATOMIC_OR(&polled_mask[fd].poll_recv, ti->ltid_bit);
+			} else {
+				if (pr & ti->ltid_bit)
+					_HA_ATOMIC_AND(&polled_mask[fd].poll_recv, ~ti->ltid_bit);
+			}
+			if (en & FD_EV_ACTIVE_W) {
+				if (!(ps & ti->ltid_bit))
+					_HA_ATOMIC_OR(&polled_mask[fd].poll_send, ti->ltid_bit);
+			} else {
+				if (ps & ti->ltid_bit)
+					_HA_ATOMIC_AND(&polled_mask[fd].poll_send, ~ti->ltid_bit);
+			}
+			/* fd status changed */
+			opcode = -1;
+		}
+	}
+	else if ((fdtab[fd].thread_mask & ti->ltid_bit) && (en & FD_EV_ACTIVE_RW)) {
+		/* new fd in the poll list */
+		opcode = IORING_OP_POLL_ADD;
+		if (en & FD_EV_ACTIVE_R)
+			_HA_ATOMIC_OR(&polled_mask[fd].poll_recv, ti->ltid_bit);
+		if (en & FD_EV_ACTIVE_W)
+			_HA_ATOMIC_OR(&polled_mask[fd].poll_send, ti->ltid_bit);
+	}
+	else {
+		return;
+	}
+
+ done:
+	HA_SPIN_LOCK(OTHER_LOCK, &r->lock);
+	if (opcode == IORING_OP_POLL_ADD)
+		uring_poll_add(r, fd, uring_poll_events(en));
+	else if (opcode == IORING_OP_POLL_REMOVE)
+		uring_poll_remove(r, fd);
+	else
+		uring_poll_update(r, fd, uring_poll_events(en));
+	HA_SPIN_UNLOCK(OTHER_LOCK, &r->lock);
+}
+
+/* Re-arms the poll request of <fd> after the kernel terminated it, if the
+ * current thread still polls it. This happens after each event for one-shot
+ * requests.
+ */
+static void uring_rearm_fd(int fd)
+{
+	struct uring_ring *r = &uring_rings[tid];
+	uint en = 0;
+
+	if (_HA_ATOMIC_LOAD(&polled_mask[fd].poll_recv) & ti->ltid_bit)
+		en |= FD_EV_ACTIVE_R;
+	if (_HA_ATOMIC_LOAD(&polled_mask[fd].poll_send) & ti->ltid_bit)
+		en |= FD_EV_ACTIVE_W;
+
+	if (!en)
+		return;
+
+	HA_SPIN_LOCK(OTHER_LOCK, &r->lock);
+	uring_poll_add(r, fd, uring_poll_events(en));
+	HA_SPIN_UNLOCK(OTHER_LOCK, &r->lock);
+}
+
+/*
+ * Linux io_uring poller
+ */
+static void _do_poll(struct poller *p, int exp, int wake)
+{
+	struct uring_ring *r = &uring_rings[tid];
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int status;
+	int fd;
+	int count;
+	int updt_idx;
+	int wait_time;
+	int old_fd;
+	uint head, tail;
+
+	/* first, scan the update list to find polling changes */
+	for (updt_idx = 0; updt_idx < fd_nbupdt; updt_idx++) {
+		fd = fd_updt[updt_idx];
+
+		if (!fd_grab_tgid(fd, tgid)) {
+			/* was reassigned */
+			activity[tid].poll_drop_fd++;
+			continue;
+		}
+
+		_HA_ATOMIC_AND(&fdtab[fd].update_mask, ~ti->ltid_bit);
+
+		if (fdtab[fd].owner)
+			_update_fd(fd);
+		else
+			activity[tid].poll_drop_fd++;
+
+		fd_drop_tgid(fd);
+	}
+	fd_nbupdt = 0;
+
+	/* Scan the shared update list */
+	for (old_fd = fd = update_list[tgid - 1].first; fd != -1; fd = fdtab[fd].update.next) {
+		if (fd == -2) {
+			fd = old_fd;
+			continue;
+		}
+		else if (fd <= -3)
+			fd = -fd -4;
+		if (fd == -1)
+			break;
+
+		if (!fd_grab_tgid(fd, tgid)) {
+			/* was reassigned */
+			activity[tid].poll_drop_fd++;
+			continue;
+		}
+
+		if (!(fdtab[fd].update_mask & ti->ltid_bit)) {
+			fd_drop_tgid(fd);
+			continue;
+		}
+
+		done_update_polling(fd);
+
+		if (fdtab[fd].owner)
+			_update_fd(fd);
+		else
+			activity[tid].poll_drop_fd++;
+
+		fd_drop_tgid(fd);
+	}
+
+	thread_idle_now();
+	thread_harmless_now();
+
+	/* Now let's wait for polled events. Pending completions are processed
+	 * without waiting, and if there is nothing to submit either, without
+	 * any syscall.
+	 */
+	wait_time = wake ? 0 : compute_poll_timeout(exp);
+	clock_entering_poll();
+
+	do {
+		int timeout = (global.tune.options & GTUNE_BUSY_POLLING) ? 0 : wait_time;
+
+		status = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head;
+		if (status)
+			timeout = 0;
+
+		/* The lock only protects the submission queue, it must not be
+		 * held while sleeping since other threads closing an FD may
+		 * need to queue a removal in this ring. Pending SQEs are thus
+		 * submitted first, and the wait is performed unlocked.
+		 */
+		HA_SPIN_LOCK(OTHER_LOCK, &r->lock);
+		activity[tid].poll_sysc += uring_submit(r);
+		HA_SPIN_UNLOCK(OTHER_LOCK, &r->lock);
+
+		if (timeout) {
+			memset(&arg, 0, sizeof(arg));
+			if (timeout > 0) {
+				ts.tv_sec  = timeout / 1000;
+				ts.tv_nsec = (timeout % 1000) * 1000000;
+				arg.ts = (ulong)&ts;
+			}
+
+			sys_io_uring_enter(r->fd, 0, 1,
+			                   IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			                   &arg, sizeof(arg));
+			activity[tid].poll_sysc++;
+		}
+		status = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head;
+
+		clock_update_local_date(timeout, status);
+
+		if (status) {
+			activity[tid].poll_io++;
+			break;
+		}
+		if (timeout || !wait_time)
+			break;
+		if (tick_isset(exp) && tick_is_expired(exp, now_ms))
+			break;
+	} while (1);
+
+	clock_update_global_date();
+	fd_leaving_poll(wait_time, status);
+
+	/* process polled events, remaining ones will be processed on next
+	 * call.
+	 */
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for (count = 0; head != tail && count < global.tune.maxpollevents; head++, count++) {
+		struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+		unsigned int n, e;
+
+		if (cqe->user_data == URING_UD_IGNORE)
+			continue;
+
+		/* the FD was closed since this request was armed, and its
+		 * number may already be reused: it must neither be reported
+		 * nor re-armed.
+		 */
+		fd = (uint)cqe->user_data;
+		if (cqe->user_data != uring_ud(fd))
+			continue;
+
+		if (cqe->res < 0) {
+			/* removed by us, or failed to be armed */
+			if (cqe->res != -ECANCELED && !(cqe->flags & IORING_CQE_F_MORE))
+				uring_rearm_fd(fd);
+			continue;
+		}
+
+		/* one-shot requests end with their first completion, and the
+		 * kernel may end a multishot request at any time (e.g. when
+		 * the CQ ring overflows), they must then be re-armed.
+		 */
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+			uring_rearm_fd(fd);
+
+		e = cqe->res;
+		if ((e & POLLRDHUP) && !(cur_poller.flags & HAP_POLL_F_RDHUP))
+			_HA_ATOMIC_OR(&cur_poller.flags, HAP_POLL_F_RDHUP);
+
+#ifdef DEBUG_FD
+		_HA_ATOMIC_INC(&fdtab[fd].event_count);
+#endif
+		n = ((e & POLLIN)    ? FD_EV_READY_R : 0) |
+		    ((e & POLLOUT)   ? FD_EV_READY_W : 0) |
+		    ((e & POLLRDHUP) ? FD_EV_SHUT_R  : 0) |
+		    ((e & POLLHUP)   ? FD_EV_SHUT_RW : 0) |
+		    ((e & POLLERR)   ? FD_EV_ERR_RW  : 0);
+
+		fd_update_events(fd, n);
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	/* the caller will take care of cached events */
+}
+
+static int init_uring_per_thread()
+{
+	if (MAX_THREADS > 1 && tid) {
+		if (!uring_ring_init(&uring_rings[tid]))
+			return 0;
+	}
+
+	/* we may have to unregister some events initially registered on the
+	 * original ring when it was alone, and/or to register events on the
+	 * new ring for this thread. Let's just mark them as updated, the poller
+	 * will do the rest.
+	 */
+	fd_reregister_all(tgid, ti->ltid_bit);
+
+	return 1;
+}
+
+static void deinit_uring_per_thread()
+{
+	if (MAX_THREADS > 1 && tid)
+		uring_ring_free(&uring_rings[tid]);
+}
+
+/*
+ * Initialization of the io_uring poller.
+ * Returns 0 in case of failure, non-zero in case of success. If it fails, it
+ * disables the poller by setting its pref to 0.
+ */
+static int _do_init(struct poller *p)
+{
+	p->private = NULL;
+
+	uring_fd_gen = calloc(global.maxsock, sizeof(*uring_fd_gen));
+	if (!uring_fd_gen)
+		goto fail;
+
+	if (!uring_ring_init(&uring_rings[tid]))
+		goto fail;
+
+	hap_register_per_thread_init(init_uring_per_thread);
+	hap_register_per_thread_deinit(deinit_uring_per_thread);
+
+	return 1;
+
+ fail:
+	ha_free(&uring_fd_gen);
+	p->pref = 0;
+	return 0;
+}
+
+/*
+ * Termination of the io_uring poller.
+ * Memory is released and the poller is marked as unselectable.
+ */
+static void _do_term(struct poller *p)
+{
+	uring_ring_free(&uring_rings[tid]);
+	ha_free(&uring_fd_gen);
+
+	p->private = NULL;
+	p->pref = 0;
+}
+
+/*
+ * Check that the poller works.
+ * Returns 1 if OK, otherwise 0.
+ */
+static int _do_test(struct poller *p)
+{
+	struct uring_ring r;
+
+	if (!uring_ring_init(&r))
+		return 0;
+	uring_ring_free(&r);
+	return 1;
+}
+
+/*
+ * Recreate the ring after a fork(). Returns 1 if OK, otherwise 0. The
+ * processes must not share their ring.
+ */
+static int _do_fork(struct poller *p)
+{
+	uring_ring_free(&uring_rings[tid]);
+	return uring_ring_init(&uring_rings[tid]);
+}
+
+/* config parser for global "tune.poller.uring", accepts "on" or "off" */
+static int cfg_parse_uring_poller(char **args, int section_type, struct proxy *curpx,
+                                  const struct proxy *defpx, const char *file, int line,
+                                  char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		uring_poller->pref = 350;
+	else if (strcmp(args[1], "off") == 0)
+		uring_poller->pref = 0;
+	else {
+		memprintf(err, "'%s' expects 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.poller.uring", cfg_parse_uring_poller },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
+
+/*
+ * Registers the poller. It is disabled by default and has to be enabled
+ * using "tune.poller.uring on", in which case it is preferred over epoll.
+ */
+static void _do_register(void)
+{
+	struct poller *p;
+	int i;
+
+	if (nbpollers >= MAX_POLLERS)
+		return;
+
+	for (i = 0; i < MAX_THREADS; i++) {
+		uring_rings[i].fd = -1;
+		HA_SPIN_INIT(&uring_rings[i].lock);
+	}
+
+	p = &pollers[nbpollers++];
+
+	p->name = "uring";
+	p->pref = 0;
+	p->flags = HAP_POLL_F_ERRHUP; // note: RDHUP might be dynamically added
+	p->private = NULL;
+
+	p->clo  = __fd_clo;
+	p->test = _do_test;
+	p->init = _do_init;
+	p->term = _do_term;
+	p->poll = _do_poll;
+	p->fork = _do_fork;
+
+	uring_poller = p;
+}
+
+INITCALL0(STG_REGISTER, _do_register);
+
+
+/*
+ * Local variables:
+ *  c-indent-level: 8
+ *  c-basic-offset: 8
+ * End:
+ */
@@ -20,6 +20,304 @@
 #include <haproxy/http-hdr.h>
 #include <haproxy/tools.h>
 
+/* vectorized scanners for h1_headers_to_hdr_list(): SSE2 is always available
+ * on x86_64 and AVX2 is enabled at run time using a function attribute, while
+ * NEON is always available on aarch64. The AVX2 ones finish with SSE2 since
+ * most header fields are shorter than 64 bytes. The SSE2 ones are inlined there
+ * so that they are VEX-encoded and do not suffer from AVX-SSE transitions.
+ */
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC_PREREQ__(4, 9))
+#define H1_SCAN_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define H1_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+/* A set of scanners used by h1_headers_to_hdr_list() to skip large series of
+ * bytes at once. Each of them returns the number of bytes starting at <ptr>
+ * which the byte-level parser would have consumed without doing anything but
+ * advancing, and never reads at or past <end>. They may stop earlier, in which
+ * case the byte-level parser takes over, so that the validation is always
+ * performed by the state machine itself. A NULL scanner is ignored.
+ *  - uri: bytes 0x24..0x7e in the request URI
+ *  - name: bytes [0-9A-Za-z-] in a header name. Upper case letters are
+ *    turned to lower case if <lower> is non-zero.
+ *  - value: any byte but CR, LF and NUL in a header value
+ */
+struct h1_scanner {
+	const char *name;
+	int (*supported)(void);
+	size_t (*uri)(const char *ptr, const char *end);
+	size_t (*hdr_name)(char *ptr, const char *end, int lower);
+	size_t (*hdr_val)(const char *ptr, const char *end);
+};
+
+#if defined(H1_SCAN_X86)
+static forceinline size_t h1_scan_uri_sse2(const char *ptr, const char *end)
+{
+	const __m128i lo = _mm_set1_epi8(0x23);
+	const __m128i hi = _mm_set1_epi8(0x7f);
+	const char *p = ptr;
+	uint mask;
+
+	/* bytes >= 0x80 are negative and fail the first test */
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmpgt_epi8(hi, v));
+
+		mask = ~_mm_movemask_epi8(ok) & 0xffff;
+		if (mask)
+			return p - ptr + __builtin_ctz(mask);
+		p += 16;
+	}
+	return p - ptr;
+}
+
+static forceinline size_t h1_scan_hdr_name_sse2(char *ptr, const char *end, int lower)
+{
+	const __m128i iota = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	char *p = ptr;
+	uint mask, n;
+
+	while (end - p >= 16) {
+		__m128i v  = _mm_loadu_si128((const __m128i *)p);
+		__m128i up = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v));
+		__m128i lc = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), v));
+		__m128i dg = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), v));
+		__m128i ok = _mm_or_si128(_mm_or_si128(up, lc), _mm_or_si128(dg, _mm_cmpeq_epi8(v, _mm_set1_epi8('-'))));
+
+		mask = ~_mm_movemask_epi8(ok) & 0xffff;
+		n = mask ? __builtin_ctz(mask) : 16;
+		if (lower && _mm_movemask_epi8(up)) {
+			/* only touch the <n> accepted bytes */
+			up = _mm_and_si128(up, _mm_cmpgt_epi8(_mm_set1_epi8(n), iota));
+			v = _mm_or_si128(v, _mm_and_si128(up, _mm_set1_epi8(0x20)));
+			_mm_storeu_si128((__m128i *)p, v);
+		}
+		p += n;
+		if (n < 16)
+			break;
+	}
+	return p - ptr;
+}
+
+static forceinline size_t h1_scan_hdr_val_sse2(const char *ptr, const char *end)
+{
+	const char *p = ptr;
+	uint mask;
+
+	while (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+		                                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+		                            _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+
+		mask = _mm_movemask_epi8(stop);
+		if (mask)
+			return p - ptr + __builtin_ctz(mask);
+		p += 16;
+	}
+	return p - ptr;
+}
+
+static int h1_scan_avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static size_t h1_scan_uri_avx2(const char *ptr, const char *end)
+{
+	const __m256i lo = _mm256_set1_epi8(0x23);
+	const __m256i hi = _mm256_set1_epi8(0x7f);
+	const char *p = ptr;
+	uint mask;
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		__m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, lo), _mm256_cmpgt_epi8(hi, v));
+
+		mask = ~(uint)_mm256_movemask_epi8(ok);
+		if (mask)
+			return p - ptr + __builtin_ctz(mask);
+		p += 32;
+	}
+	return p - ptr + h1_scan_uri_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static size_t h1_scan_hdr_name_avx2(char *ptr, const char *end, int lower)
+{
+	const __m256i iota = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	                                      16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+	char *p = ptr;
+	uint mask, n;
+
+	while (end - p >= 32) {
+		__m256i v  = _mm256_loadu_si256((const __m256i *)p);
+		__m256i up = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+		__m256i lc = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), v));
+		__m256i dg = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+		__m256i ok = _mm256_or_si256(_mm256_or_si256(up, lc), _mm256_or_si256(dg, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-'))));
+
+		mask = ~(uint)_mm256_movemask_epi8(ok);
+		n = mask ? __builtin_ctz(mask) : 32;
+		if (lower && _mm256_movemask_epi8(up)) {
+			/* only touch the <n> accepted bytes */
+			up = _mm256_and_si256(up, _mm256_cmpgt_epi8(_mm256_set1_epi8(n), iota));
+			v = _mm256_or_si256(v, _mm256_and_si256(up, _mm256_set1_epi8(0x20)));
+			_mm256_storeu_si256((__m256i *)p, v);
+		}
+		p += n;
+		if (n < 32)
+			return p - ptr;
+	}
+	return p - ptr + h1_scan_hdr_name_sse2(p, end, lower);
+}
+
+__attribute__((target("avx2")))
+static size_t h1_scan_hdr_val_avx2(const char *ptr, const char *end)
+{
+	const char *p = ptr;
+	uint mask;
+
+	while (end - p >= 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		__m256i stop = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+		                                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+		                               _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+
+		mask = _mm256_movemask_epi8(stop);
+		if (mask)
+			return p - ptr + __builtin_ctz(mask);
+		p += 32;
+	}
+	return p - ptr + h1_scan_hdr_val_sse2(p, end);
+}
+#endif /* H1_SCAN_X86 */
+
+#if defined(H1_SCAN_NEON)
+/* returns a 64-bit mask with 4 bits set for each byte set in <m> */
+static inline uint64_t h1_neon_mask(uint8x16_t m)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+static size_t h1_scan_uri_neon(const char *ptr, const char *end)
+{
+	const char *p = ptr;
+	uint64_t mask;
+
+	while (end - p >= 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)p);
+		uint8x16_t ok = vcltq_u8(vsubq_u8(v, vdupq_n_u8(0x24)), vdupq_n_u8(0x7f - 0x24));
+
+		mask = ~h1_neon_mask(ok);
+		if (mask)
+			return p - ptr + (__builtin_ctzll(mask) >> 2);
+		p += 16;
+	}
+	return p - ptr;
+}
+
+static size_t h1_scan_hdr_name_neon(char *ptr, const char *end, int lower)
+{
+	static const uint8_t iota_tbl[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+	const uint8x16_t iota = vld1q_u8(iota_tbl);
+	char *p = ptr;
+	uint64_t mask;
+	uint n;
+
+	while (end - p >= 16) {
+		uint8x16_t v  = vld1q_u8((const uint8_t *)p);
+		uint8x16_t up = vcltq_u8(vsubq_u8(v, vdupq_n_u8('A')), vdupq_n_u8(26));
+		uint8x16_t lc = vcltq_u8(vsubq_u8(v, vdupq_n_u8('a')), vdupq_n_u8(26));
+		uint8x16_t dg = vcltq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8(10));
+		uint8x16_t ok = vorrq_u8(vorrq_u8(up, lc), vorrq_u8(dg, vceqq_u8(v, vdupq_n_u8('-'))));
+
+		mask = ~h1_neon_mask(ok);
+		n = mask ? __builtin_ctzll(mask) >> 2 : 16;
+		if (lower && vmaxvq_u8(up)) {
+			/* only touch the <n> accepted bytes */
+			up = vandq_u8(up, vcltq_u8(iota, vdupq_n_u8(n)));
+			v = vorrq_u8(v, vandq_u8(up, vdupq_n_u8(0x20)));
+			vst1q_u8((uint8_t *)p, v);
+		}
+		p += n;
+		if (n < 16)
+			break;
+	}
+	return p - ptr;
+}
+
+static size_t h1_scan_hdr_val_neon(const char *ptr, const char *end)
+{
+	const char *p = ptr;
+	uint64_t mask;
+
+	while (end - p >= 16) {
+		uint8x16_t v = vld1q_u8((const uint8_t *)p);
+		uint8x16_t stop = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')), vceqq_u8(v, vdupq_n_u8('\n'))),
+		                           vceqq_u8(v, vdupq_n_u8(0)));
+
+		mask = h1_neon_mask(stop);
+		if (mask)
+			return p - ptr + (__builtin_ctzll(mask) >> 2);
+		p += 16;
+	}
+	return p - ptr;
+}
+#endif /* H1_SCAN_NEON */
+
+/* known scanners, by order of preference. The last one is always supported. */
+static const struct h1_scanner h1_scanners[] = {
+#if defined(H1_SCAN_X86)
+	{ "avx2", h1_scan_avx2_supported, h1_scan_uri_avx2, h1_scan_hdr_name_avx2, h1_scan_hdr_val_avx2 },
+	{ "sse2", NULL, h1_scan_uri_sse2, h1_scan_hdr_name_sse2, h1_scan_hdr_val_sse2 },
+#endif
+#if defined(H1_SCAN_NEON)
+	{ "neon", NULL, h1_scan_uri_neon, h1_scan_hdr_name_neon, h1_scan_hdr_val_neon },
+#endif
+	{ "generic", NULL, NULL, NULL, NULL },
+};
+
+/* the scanner in use */
+static const struct h1_scanner *h1_scanner = &h1_scanners[sizeof(h1_scanners) / sizeof(h1_scanners[0]) - 1];
+
+/* Selects the scanner named <name> for h1_headers_to_hdr_list(), or the best
+ * one supported by the CPU if <name> is NULL. Returns 0 if <name> is unknown
+ * or not supported, otherwise non-zero.
+ */
+int h1_select_scanner(const char *name)
+{
+	int i;
+
+	for (i = 0; i < sizeof(h1_scanners) / sizeof(h1_scanners[0]); i++) {
+		if (name && strcmp(name, h1_scanners[i].name) != 0)
+			continue;
+		if (h1_scanners[i].supported && !h1_scanners[i].supported())
+			continue;
+		h1_scanner = &h1_scanners[i];
+		return 1;
+	}
+	return 0;
+}
+
+/* Returns the name of the scanner used by h1_headers_to_hdr_list() */
+const char *h1_scanner_name(void)
+{
+	return h1_scanner->name;
+}
+
+static void h1_init_scanner(void)
+{
+	h1_select_scanner(NULL);
+}
+
+INITCALL0(STG_REGISTER, h1_init_scanner);
+
 /* Parse the Content-Length header field of an HTTP/1 request. The function
  * checks all possible occurrences of a comma-delimited value, and verifies
  * if any of them doesn't match a previous value. It returns <0 if a value
@@ -572,6 +870,8 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 
 	case H1_MSG_RQURI:
 	http_msg_rquri:
+		if (h1_scanner->uri)
+			ptr += h1_scanner->uri(ptr, end);
 #ifdef HA_UNALIGNED_LE
 		/* speedup: skip bytes not between 0x24 and 0x7e inclusive */
 		while (ptr <= end - sizeof(int)) {
@@ -851,6 +1151,15 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 
 	case H1_MSG_HDR_NAME:
 	http_msg_hdr_name:
+		/* speedup: skip the most common token chars at once */
+		if (h1_scanner->hdr_name) {
+			ptr += h1_scanner->hdr_name(ptr, end, !skip_update && (h1m->flags & H1_MF_TOLOWER));
+			if (ptr >= end) {
+				state = H1_MSG_HDR_NAME;
+				goto http_msg_ood;
+			}
+		}
+	http_msg_hdr_name2:
 		/* assumes sol points to the first char */
 		if (likely(HTTP_IS_TOKEN(*ptr))) {
 			if (!skip_update) {
@@ -858,7 +1167,7 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 				if (isupper((unsigned char)*ptr) && h1m->flags & H1_MF_TOLOWER)
 					*ptr = tolower((unsigned char)*ptr);
 			}
-			EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name, http_msg_ood, state, H1_MSG_HDR_NAME);
+			EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name2, http_msg_ood, state, H1_MSG_HDR_NAME);
 		}
 
 		if (likely(*ptr == ':')) {
@@ -879,7 +1188,7 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 			h1m->err_pos = ptr - start + skip; /* >= 0 now */
 
 		/* and we still accept this non-token character */
-		EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name, http_msg_ood, state, H1_MSG_HDR_NAME);
+		EAT_AND_JUMP_OR_RETURN(ptr, end, http_msg_hdr_name2, http_msg_ood, state, H1_MSG_HDR_NAME);
 
 	case H1_MSG_HDR_L1_SP:
 	http_msg_hdr_l1_sp:
@@ -927,7 +1236,10 @@ int h1_headers_to_hdr_list(char *start, const char *stop,
 		 * and lower. In fact since most of the time is spent in the loop, we
 		 * also remove the sign bit test so that bytes 0x8e..0x0d break the
 		 * loop, but we don't care since they're very rare in header values.
+		 * The vectorized scanner, if any, only stops on CR, LF and NUL.
 		 */
+		if (h1_scanner->hdr_val)
+			ptr += h1_scanner->hdr_val(ptr, end);
 #ifdef HA_UNALIGNED_LE64
 		while (ptr <= end - sizeof(long)) {
 			if ((*(long *)ptr - 0x0e0e0e0e0e0e0e0eULL) & 0x8080808080808080ULL)
@@ -10262,6 +10262,7 @@ __LJMP static int hlua_register_converters(lua_State *L)
 	sck->kw[0].in_type = SMP_T_STR;
 	sck->kw[0].out_type = SMP_T_STR;
 	sck->kw[0].private = fcn;
+	sck->kw[0].flags = SMP_KW_F_SIDE_EFFECT | SMP_KW_F_VOLATILE;
 
 	/* Register this new converter */
 	sample_register_convs(sck);
@@ -10349,6 +10350,7 @@ __LJMP static int hlua_register_fetches(lua_State *L)
 	sfk->kw[0].use = SMP_USE_HTTP_ANY;
 	sfk->kw[0].val = 0;
 	sfk->kw[0].private = fcn;
+	sfk->kw[0].flags = SMP_KW_F_SIDE_EFFECT | SMP_KW_F_VOLATILE;
 
 	/* Register this new fetch. */
 	sample_register_fetches(sfk);
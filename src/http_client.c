@@ -830,15 +830,17 @@ void httpclient_applet_io_handler(struct appctx *appctx)
 				if (hc->ops.res_stline)
 					hc->ops.res_stline(hc);
 
-				htx_to_buf(htx, &res->buf);
-
 				/* if there is no HTX data anymore and the EOM flag is
-				 * set, leave (no body) */
+				 * set, leave (no body). This must be checked before
+				 * htx_to_buf() which resets an empty message.
+				 */
 				if (htx_is_empty(htx) && htx->flags & HTX_FL_EOM)
 					appctx->st0 = HTTPCLIENT_S_RES_END;
 				else
 					appctx->st0 = HTTPCLIENT_S_RES_HDR;
 
+				htx_to_buf(htx, &res->buf);
+
 				break;
 
 			case HTTPCLIENT_S_RES_HDR:
@@ -878,6 +880,13 @@ void httpclient_applet_io_handler(struct appctx *appctx)
 						}
 						blk = htx_remove_blk(htx, blk);
 					}
+
+					/* if there is no HTX data anymore and the EOM flag is
+					 * set, leave (no body) */
+					if (htx_is_empty(htx) && htx->flags & HTX_FL_EOM)
+						appctx->st0 = HTTPCLIENT_S_RES_END;
+					else
+						appctx->st0 = HTTPCLIENT_S_RES_BODY;
 					htx_to_buf(htx, &res->buf);
 
 					if (hdr_num) {
@@ -891,14 +900,6 @@ void httpclient_applet_io_handler(struct appctx *appctx)
 						if (hc->ops.res_headers)
 							hc->ops.res_headers(hc);
 					}
-
-					/* if there is no HTX data anymore and the EOM flag is
-					 * set, leave (no body) */
-					if (htx_is_empty(htx) && htx->flags & HTX_FL_EOM) {
-						appctx->st0 = HTTPCLIENT_S_RES_END;
-					} else {
-						appctx->st0 = HTTPCLIENT_S_RES_BODY;
-					}
 				}
 				break;
 
@@ -971,11 +972,12 @@ void httpclient_applet_io_handler(struct appctx *appctx)
 					}
 				}
 
-				htx_to_buf(htx, &res->buf);
-
 				/* if not finished, should be called again */
-				if (!(htx_is_empty(htx) && (htx->flags & HTX_FL_EOM)))
+				if (!(htx_is_empty(htx) && (htx->flags & HTX_FL_EOM))) {
+					htx_to_buf(htx, &res->buf);
 					goto out;
+				}
+				htx_to_buf(htx, &res->buf);
 
 
 				/* end of message, we should quit */
@@ -1104,6 +1106,8 @@ void httpclient_applet_release(struct appctx *appctx)
 
 	/* mark the httpclient as ended */
 	hc->flags |= HTTPCLIENT_FS_ENDED;
+	if (appctx->st0 == HTTPCLIENT_S_RES_END)
+		hc->flags |= HTTPCLIENT_FS_RES_COMPLETE;
 	/* the applet is leaving, remove the ptr so we don't try to call it
 	 * again from the caller */
 	hc->appctx = NULL;
@@ -16,6 +16,9 @@
 
 struct htx htx_empty = { .size = 0, .data = 0, .head  = -1, .tail = -1, .first = -1 };
 
+/* incremented each time a start-line or header block changes, see htx_hdr_changed() */
+THREAD_LOCAL unsigned int htx_hdr_gen = 0;
+
 /* tests show that 63% of these calls are for 64-bit chunks, so better avoid calling
  * memcpy() for that!
  */
@@ -336,6 +339,7 @@ struct htx_blk *htx_add_blk(struct htx *htx, enum htx_blk_type type, uint32_t bl
 	BUG_ON(blk->addr > htx->size);
 
 	blk->info = (type << 28);
+	htx_hdr_changed(type);
 	return blk;
 }
 
@@ -354,6 +358,7 @@ struct htx_blk *htx_remove_blk(struct htx *htx, struct htx_blk *blk)
 	if (htx->head == htx->tail) {
 		uint32_t flags = (htx->flags & ~HTX_FL_FRAGMENTED); /* Preserve flags except FRAGMENTED */
 
+		htx_hdr_changed(htx_get_blk_type(blk));
 		htx_reset(htx);
 		htx->flags = flags; /* restore flags */
 		return NULL;
@@ -363,6 +368,7 @@ struct htx_blk *htx_remove_blk(struct htx *htx, struct htx_blk *blk)
 	pos  = htx_get_blk_pos(htx, blk);
 	sz   = htx_get_blksz(blk);
 	addr = blk->addr;
+	htx_hdr_changed(type);
 	if (type != HTX_BLK_UNUSED) {
 		/* Mark the block as unused, decrement allocated size */
 		htx->data -= htx_get_blksz(blk);
@@ -609,6 +615,8 @@ struct htx_blk *htx_replace_blk_value(struct htx *htx, struct htx_blk *blk,
 	if (!ret)
 		return NULL; /* not enough space */
 
+	htx_hdr_changed(htx_get_blk_type(blk));
+
 	if (ret == 1) { /* Replace in place */
 		if (delta <= 0) {
 			/* compression: copy new data first then move the end */
@@ -720,6 +728,7 @@ struct htx_ret htx_xfer_blks(struct htx *dst, struct htx *src, uint32_t count,
 		if (!dstblk)
 			break;
 		dstblk->info = info;
+		htx_hdr_changed(type);
 		htx_memcpy(htx_get_blk_ptr(dst, dstblk), htx_get_blk_ptr(src, blk), sz);
 
 		count -= sizeof(dstblk) + sz;
@@ -804,6 +813,7 @@ struct htx_blk *htx_replace_header(struct htx *htx, struct htx_blk *blk,
 	if (!ret)
 		return NULL; /* not enough space */
 
+	htx_hdr_changed(type);
 
 	/* Replace in place or at a new address is the same. We replace all the
 	 * header (name+value). Only take care to defrag the message if
@@ -852,6 +862,8 @@ struct htx_sl *htx_replace_stline(struct htx *htx, struct htx_blk *blk, const st
 	if (!ret)
 		return NULL; /* not enough space */
 
+	htx_hdr_changed(type);
+
 	/* Replace in place or at a new address is the same. We replace all the
 	 * start-line. Only take care to defrag the message if necessary. */
 	if (ret == 3)  {
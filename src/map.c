@@ -516,8 +516,11 @@ static int cli_io_handler_map_lookup(struct appctx *appctx)
 			sample.data.u.str.area = ctx->chunk.area;
 
 			if (ctx->expr->pat_head->match &&
-			    sample_convert(&sample, ctx->expr->pat_head->expect_type))
+			    sample_convert(&sample, ctx->expr->pat_head->expect_type)) {
+				HA_RWLOCK_RDLOCK(PATEXP_LOCK, &ctx->expr->lock);
 				pat = ctx->expr->pat_head->match(&sample, ctx->expr, 1);
+				HA_RWLOCK_RDUNLOCK(PATEXP_LOCK, &ctx->expr->lock);
+			}
 			else
 				pat = NULL;
 
@@ -555,6 +558,8 @@ static int cli_io_handler_map_lookup(struct appctx *appctx)
 				/* display index mode */
 				if (pat->sflags & PAT_SF_TREE)
 					chunk_appendf(&trash, ", idx=tree");
+				else if (pat->sflags & PAT_SF_MMAP)
+					chunk_appendf(&trash, ", idx=mmap");
 				else
 					chunk_appendf(&trash, ", idx=list");
 
@@ -33,6 +33,12 @@
 #include <haproxy/trace.h>
 #include <haproxy/xref.h>
 
+/* Minimum amount of data in the output buffer for a send to be attempted with
+ * MSG_ZEROCOPY. Below this, page pinning and completion notifications cost
+ * more than the copy.
+ */
+#define H1_ZC_MIN_SEND 8192
+
 /* H1 connection descriptor */
 struct h1c {
 	struct connection *conn;
@@ -222,6 +228,10 @@ enum {
 #if defined(USE_LINUX_SPLICE)
 	H1_ST_SPLICED_BYTES_IN,
 	H1_ST_SPLICED_BYTES_OUT,
+#endif
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	H1_ST_ZEROCOPY_BYTES_OUT,
+	H1_ST_COPIED_BYTES_OUT,
 #endif
 	H1_STATS_COUNT /* must be the last member of the enum */
 };
@@ -247,6 +257,12 @@ static struct name_desc h1_stats[] = {
 	[H1_ST_SPLICED_BYTES_OUT]    = { .name = "h1_spliced_bytes_out",
 		                         .desc = "Total number of bytes sendusing kernel splicing" },
 #endif
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	[H1_ST_ZEROCOPY_BYTES_OUT]   = { .name = "h1_zerocopy_bytes_out",
+	                                 .desc = "Total number of bytes sent from buffers using MSG_ZEROCOPY" },
+	[H1_ST_COPIED_BYTES_OUT]     = { .name = "h1_copied_bytes_out",
+	                                 .desc = "Total number of bytes sent from buffers by copy" },
+#endif
 
 };
 
@@ -262,6 +278,10 @@ static struct h1_counters {
 	long long spliced_bytes_in;   /* number of bytes received using kernel splicing */
 	long long spliced_bytes_out;  /* number of bytes sent using kernel splicing */
 #endif
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	long long zerocopy_bytes_out; /* number of bytes sent from buffers using MSG_ZEROCOPY */
+	long long copied_bytes_out;   /* number of bytes sent from buffers by copy */
+#endif
 } h1_counters;
 
 static int h1_fill_stats(void *data, struct field *stats, unsigned int *selected_field)
@@ -298,6 +318,14 @@ static int h1_fill_stats(void *data, struct field *stats, unsigned int *selected
 		case H1_ST_SPLICED_BYTES_OUT:
 			metric = mkf_u64(FN_COUNTER, counters->spliced_bytes_out);
 			break;
+#endif
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+		case H1_ST_ZEROCOPY_BYTES_OUT:
+			metric = mkf_u64(FN_COUNTER, counters->zerocopy_bytes_out);
+			break;
+		case H1_ST_COPIED_BYTES_OUT:
+			metric = mkf_u64(FN_COUNTER, counters->copied_bytes_out);
+			break;
 #endif
 		default:
 			/* not used for frontends. If a specific metric
@@ -3731,6 +3759,10 @@ static int h1_send(struct h1c *h1c)
 	unsigned int flags = 0;
 	size_t ret;
 	int sent = 0;
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	struct buffer spare = BUF_NULL;
+	uint32_t zc_id = 0;
+#endif
 
 	TRACE_ENTER(H1_EV_H1C_SEND, h1c->conn);
 
@@ -3750,6 +3782,19 @@ static int h1_send(struct h1c *h1c)
 	if (h1c->flags & H1C_F_CO_STREAMER)
 		flags |= CO_SFL_STREAMER;
 
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	/* Large sends may use MSG_ZEROCOPY, but then the kernel references the
+	 * buffer until the data are acknowledged. The buffer is then handed
+	 * over to the connection and replaced by <spare>, which must thus be
+	 * allocated first.
+	 */
+	if ((conn->flags & CO_FL_OPT_ZEROCOPY) && conn->xprt == xprt_get(XPRT_RAW) &&
+	    b_data(&h1c->obuf) >= H1_ZC_MIN_SEND && (!conn->zc || conn->zc->count < CONN_ZC_MAX_HELD) && b_alloc(&spare)) {
+		zc_id = conn->zc ? conn->zc->next_id : 0;
+		flags |= CO_SFL_ZEROCOPY;
+	}
+#endif
+
 	ret = conn->xprt->snd_buf(conn, conn->xprt_ctx, &h1c->obuf, b_data(&h1c->obuf), flags);
 	if (ret > 0) {
 		TRACE_DATA("data sent", H1_EV_H1C_SEND, h1c->conn, 0, 0, (size_t[]){ret});
@@ -3762,6 +3807,25 @@ static int h1_send(struct h1c *h1c)
 		sent = 1;
 	}
 
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	if (ret > 0 && (flags & CO_SFL_ZEROCOPY) && conn->zc && conn->zc->next_id != zc_id) {
+		/* copy the unsent data, if any, to the spare buffer and let
+		 * the connection hold the one the kernel still references.
+		 */
+		HA_ATOMIC_ADD(&h1c->px_counters->zerocopy_bytes_out, conn->zc->last_sent);
+		HA_ATOMIC_ADD(&h1c->px_counters->copied_bytes_out, ret - conn->zc->last_sent);
+		b_ncat(&spare, &h1c->obuf, b_data(&h1c->obuf));
+		conn_zc_hold(conn, &h1c->obuf);
+		h1c->obuf = spare;
+		spare = BUF_NULL;
+	}
+	else if (ret > 0)
+		HA_ATOMIC_ADD(&h1c->px_counters->copied_bytes_out, ret);
+
+	if (spare.size)
+		h1_release_buf(h1c, &spare);
+#endif
+
 	if (conn->flags & CO_FL_ERROR) {
 		/* connection error, nothing to send, clear the buffer to release it */
 		TRACE_DEVEL("connection error", H1_EV_H1C_SEND, h1c->conn);
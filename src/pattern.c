@@ -13,6 +13,10 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <import/ebistree.h>
 #include <import/ebpttree.h>
@@ -20,12 +24,17 @@
 #include <import/lru.h>
 
 #include <haproxy/api.h>
+#include <haproxy/cfgparse.h>
+#include <haproxy/clock.h>
 #include <haproxy/global.h>
 #include <haproxy/log.h>
 #include <haproxy/net_helper.h>
 #include <haproxy/pattern.h>
 #include <haproxy/regex.h>
+#include <haproxy/regex_set.h>
 #include <haproxy/sample.h>
+#include <haproxy/task.h>
+#include <haproxy/ticks.h>
 #include <haproxy/tools.h>
 #include <haproxy/xxhash.h>
 
@@ -433,6 +442,269 @@ struct pattern *pat_match_nothing(struct sample *smp, struct pattern_expr *expr,
 }
 
 
+/*
+ *
+ * The following functions manage the precompiled pattern files produced by
+ * admin/mapbin, which are mapped in memory and looked up in place.
+ *
+ */
+
+/* per-thread fake reference element describing the last matching entry of a
+ * precompiled file, since callers may need to know its key and value.
+ */
+static THREAD_LOCAL struct pat_ref_elt *pat_bin_elt;
+static unsigned int pat_bin_max_key; /* longest key of all mapped files */
+
+/* Fills the static pattern with the entry of key <key> and value <val> of the
+ * precompiled file of expression <expr>, and returns it, or NULL if the value
+ * cannot be parsed. <type> is the pattern type.
+ */
+static struct pattern *pat_bin_fill(struct pattern_expr *expr, uint32_t key, uint32_t val, int type, int fill)
+{
+	const struct pat_bin *bin = expr->ref->bin;
+	struct pat_ref_elt *elt = pat_bin_elt;
+	const char *k = bin->text + key;
+	size_t len;
+
+	if (!fill)
+		return &static_pattern;
+
+	static_pattern.data = NULL;
+	if (val != MAPBIN_NO_VALUE) {
+		if (!expr->pat_head->parse_smp ||
+		    !expr->pat_head->parse_smp(bin->text + val, &static_sample_data))
+			return NULL;
+		static_pattern.data = &static_sample_data;
+	}
+
+	static_pattern.ref = NULL;
+	len = strnlen(k, pat_bin_max_key + 1);
+	if (elt && len <= pat_bin_max_key) {
+		memcpy((char *)elt->pattern, k, len + 1);
+		elt->sample = (val != MAPBIN_NO_VALUE) ? (char *)bin->text + val : NULL;
+		elt->gen_id = expr->ref->curr_gen;
+		static_pattern.ref = elt;
+	}
+
+	static_pattern.sflags = PAT_SF_MMAP;
+	static_pattern.type = type;
+	static_pattern.ptr.str = (char *)k;
+	static_pattern.len = len;
+	return &static_pattern;
+}
+
+/* looks up string <str> of length <len> in the precompiled file of <expr> */
+static struct pattern *_pat_match_bin_str(const char *str, size_t len, struct pattern_expr *expr, int fill)
+{
+	const struct pat_bin *bin = expr->ref->bin;
+	const struct mapbin_str *e;
+	size_t l = 0, r = bin->hdr->nb_str, m;
+	int ret;
+
+	while (l < r) {
+		m = (l + r) / 2;
+		e = &bin->str[m];
+		ret = memcmp(bin->text + e->key, str, MIN(e->key_len, len));
+		if (!ret)
+			ret = (e->key_len > len) - (e->key_len < len);
+		if (!ret)
+			return pat_bin_fill(expr, e->key, e->val, SMP_T_STR, fill);
+		if (ret < 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return NULL;
+}
+
+/* looks up IPv4 address <key> in the ranges of the precompiled file of <expr> */
+static struct pattern *_pat_match_bin_ipv4(const struct in_addr *key, struct pattern_expr *expr, int fill)
+{
+	const struct pat_bin *bin = expr->ref->bin;
+	uint32_t addr = ntohl(key->s_addr);
+	size_t l = 0, r = bin->hdr->nb_ip4, m;
+
+	/* find the last range starting at or before <addr> */
+	while (l < r) {
+		m = (l + r) / 2;
+		if (bin->ip4[m].start <= addr)
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	if (!l || addr > bin->ip4[l - 1].end)
+		return NULL;
+	return pat_bin_fill(expr, bin->ip4[l - 1].key, bin->ip4[l - 1].val, SMP_T_IPV4, fill);
+}
+
+/* looks up IPv6 address <key> in the ranges of the precompiled file of <expr> */
+static struct pattern *_pat_match_bin_ipv6(const struct in6_addr *key, struct pattern_expr *expr, int fill)
+{
+	const struct pat_bin *bin = expr->ref->bin;
+	size_t l = 0, r = bin->hdr->nb_ip6, m;
+
+	while (l < r) {
+		m = (l + r) / 2;
+		if (memcmp(bin->ip6[m].start, key, 16) <= 0)
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	if (!l || memcmp(key, bin->ip6[l - 1].end, 16) > 0)
+		return NULL;
+	return pat_bin_fill(expr, bin->ip6[l - 1].key, bin->ip6[l - 1].val, SMP_T_IPV6, fill);
+}
+
+/* Maps the file of reference <ref> in memory if it is a precompiled one. If
+ * <load_smp> is set, the file must contain values. Returns 1 if the file was
+ * mapped, 0 if it is not a precompiled file, or -1 on error with <err> filled.
+ * The mapping is shared, so the file must be replaced by renaming a new one
+ * over it, and never rewritten in place.
+ */
+static int pat_ref_map_bin(struct pat_ref *ref, int load_smp, char **err)
+{
+	struct mapbin_hdr hdr;
+	struct pat_bin *bin;
+	struct stat st;
+	void *area;
+	int fd;
+
+	fd = open(ref->reference, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(hdr) ||
+	    read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    memcmp(hdr.magic, MAPBIN_MAGIC, sizeof(hdr.magic)) != 0) {
+		close(fd);
+		return 0;
+	}
+
+	if (hdr.endian != MAPBIN_ENDIAN) {
+		memprintf(err, "precompiled pattern file <%s> was generated for another byte order", ref->reference);
+		goto fail;
+	}
+
+	if (hdr.size != st.st_size || hdr.text_len > hdr.size || hdr.text_ofs > hdr.size - hdr.text_len ||
+	    hdr.nb_str > hdr.size / sizeof(struct mapbin_str) || hdr.str_ofs > hdr.size - hdr.nb_str * sizeof(struct mapbin_str) ||
+	    hdr.nb_ip4 > hdr.size / sizeof(struct mapbin_ip4) || hdr.ip4_ofs > hdr.size - hdr.nb_ip4 * sizeof(struct mapbin_ip4) ||
+	    hdr.nb_ip6 > hdr.size / sizeof(struct mapbin_ip6) || hdr.ip6_ofs > hdr.size - hdr.nb_ip6 * sizeof(struct mapbin_ip6) ||
+	    (hdr.str_ofs | hdr.ip4_ofs | hdr.ip6_ofs) & 7 || hdr.text_len >= MAPBIN_NO_VALUE ||
+	    (hdr.kind != MAPBIN_KIND_STR && hdr.kind != MAPBIN_KIND_IP)) {
+		memprintf(err, "precompiled pattern file <%s> is truncated or corrupted", ref->reference);
+		goto fail;
+	}
+
+	if (!!(hdr.flags & MAPBIN_F_VALUES) != !!load_smp) {
+		memprintf(err, "precompiled pattern file <%s> was generated for %s and cannot be used by %s",
+		          ref->reference, load_smp ? "an ACL" : "a map", load_smp ? "a map" : "an ACL");
+		goto fail;
+	}
+
+	area = mmap(NULL, hdr.size, PROT_READ, MAP_SHARED, fd, 0);
+	if (area == MAP_FAILED) {
+		memprintf(err, "failed to map precompiled pattern file <%s> : %s", ref->reference, strerror(errno));
+		goto fail;
+	}
+	close(fd);
+
+	bin = calloc(1, sizeof(*bin));
+	if (!bin) {
+		munmap(area, hdr.size);
+		memprintf(err, "out of memory");
+		return -1;
+	}
+
+	bin->hdr  = area;
+	bin->size = hdr.size;
+	bin->str  = area + hdr.str_ofs;
+	bin->ip4  = area + hdr.ip4_ofs;
+	bin->ip6  = area + hdr.ip6_ofs;
+	bin->text = area + hdr.text_ofs;
+
+	/* all keys and values must be zero-terminated */
+	if (hdr.text_len && bin->text[hdr.text_len - 1] != 0) {
+		memprintf(err, "precompiled pattern file <%s> is truncated or corrupted", ref->reference);
+		munmap(area, hdr.size);
+		free(bin);
+		return -1;
+	}
+
+	if (hdr.max_key_len > pat_bin_max_key)
+		pat_bin_max_key = hdr.max_key_len;
+
+	ref->bin = bin;
+	return 1;
+
+ fail:
+	close(fd);
+	return -1;
+}
+
+/* returns non-zero if key <key> and value <val> of precompiled file <bin> are
+ * valid for pattern head <head>.
+ */
+static int pat_bin_check_entry(const struct pat_bin *bin, const struct pattern_head *head,
+                               uint32_t key, uint32_t val)
+{
+	struct sample_data data;
+
+	if (key >= bin->hdr->text_len)
+		return 0;
+	if (val == MAPBIN_NO_VALUE)
+		return 1;
+	return val < bin->hdr->text_len && (!head->parse_smp || head->parse_smp(bin->text + val, &data));
+}
+
+/* Checks that the precompiled file of reference <ref> may be used by pattern
+ * head <head> with flags <patflags>, and that all of its entries are valid.
+ * Returns non-zero on success, otherwise 0 with <err> filled.
+ */
+static int pat_bin_check(struct pat_ref *ref, struct pattern_head *head, int patflags, char **err)
+{
+	const struct pat_bin *bin = ref->bin;
+	const struct mapbin_hdr *hdr = bin->hdr;
+	size_t i;
+
+	if (hdr->kind == MAPBIN_KIND_STR &&
+	    (head->match != pat_match_str || (patflags & PAT_MF_IGNORE_CASE))) {
+		memprintf(err, "precompiled pattern file <%s> may only be used with case-sensitive string matching",
+		          ref->reference);
+		return 0;
+	}
+
+	if (hdr->kind == MAPBIN_KIND_IP && head->match != pat_match_ip) {
+		memprintf(err, "precompiled pattern file <%s> may only be used with IP address matching",
+		          ref->reference);
+		return 0;
+	}
+
+	for (i = 0; i < hdr->nb_str; i++) {
+		if (!pat_bin_check_entry(bin, head, bin->str[i].key, bin->str[i].val) ||
+		    bin->str[i].key_len > hdr->max_key_len ||
+		    bin->str[i].key_len >= hdr->text_len - bin->str[i].key)
+			goto invalid;
+	}
+
+	for (i = 0; i < hdr->nb_ip4; i++) {
+		if (!pat_bin_check_entry(bin, head, bin->ip4[i].key, bin->ip4[i].val))
+			goto invalid;
+	}
+
+	for (i = 0; i < hdr->nb_ip6; i++) {
+		if (!pat_bin_check_entry(bin, head, bin->ip6[i].key, bin->ip6[i].val))
+			goto invalid;
+	}
+	return 1;
+
+ invalid:
+	memprintf(err, "precompiled pattern file <%s> is corrupted or contains a value not matching the map's output type",
+	          ref->reference);
+	return 0;
+}
+
 /* NB: For two strings to be identical, it is required that their length match */
 struct pattern *pat_match_str(struct sample *smp, struct pattern_expr *expr, int fill)
 {
@@ -492,6 +764,13 @@ struct pattern *pat_match_str(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	/* look in the precompiled file */
+	if (expr->ref->bin && !(expr->mflags & PAT_MF_IGNORE_CASE)) {
+		ret = _pat_match_bin_str(smp->data.u.str.area, smp->data.u.str.data, expr, fill);
+		if (ret)
+			return ret;
+	}
+
 	/* look in the list */
 	if (pat_lru_tree && !LIST_ISEMPTY(&expr->patterns)) {
 		unsigned long long seed = pat_lru_seed ^ (long)expr;
@@ -568,6 +847,181 @@ struct pattern *pat_match_bin(struct sample *smp, struct pattern_expr *expr, int
 	return ret;
 }
 
+/*
+ *
+ * The following functions manage the regex sets used to match the "reg" and
+ * "regm" patterns lists in a single pass over the sample when enabled.
+ *
+ */
+
+/* below this number of patterns supported by the regex set, the lists are
+ * walked instead.
+ */
+#define PAT_RSET_MIN_PATTERNS  4
+
+/* minimum delay between two builds of the regex set of an expression, see
+ * PAT_AC_REBUILD_DELAY.
+ */
+#define PAT_RSET_REBUILD_DELAY 100
+
+static int pat_rset_enabled = 0; /* set by "tune.pattern.regex-set" */
+
+static void pat_rset_free(struct pat_rset *rset)
+{
+	if (!rset)
+		return;
+	regex_set_free(rset->rs);
+	free(rset->pats);
+	free(rset->fallback);
+	free(rset);
+}
+
+/* returns non-zero if regex set <rset> is still valid for expression <expr> */
+static inline int pat_rset_is_current(const struct pat_rset *rset, const struct pattern_expr *expr)
+{
+	return rset && rset->revision == expr->ref->revision && rset->gen == expr->ref->curr_gen;
+}
+
+/* Builds the regex set from the patterns of the current generation of
+ * expression <expr>. The list must not change during the operation. The set
+ * is returned, possibly without regexes if too few of them are supported or
+ * on memory shortage, or NULL if it could not be allocated at all.
+ */
+static struct pat_rset *pat_rset_build(struct pattern_expr *expr)
+{
+	struct pattern_list *lst;
+	struct pat_rset *rset;
+	uint nb_pats, nb_set;
+
+	rset = calloc(1, sizeof(*rset));
+	if (!rset)
+		return NULL;
+
+	rset->revision = expr->ref->revision;
+	rset->gen = expr->ref->curr_gen;
+	rset->built = now_ms;
+
+	nb_pats = 0;
+	list_for_each_entry(lst, &expr->patterns, list) {
+		if (lst->pat.ref->gen_id == expr->ref->curr_gen)
+			nb_pats++;
+	}
+
+	if (nb_pats < PAT_RSET_MIN_PATTERNS)
+		return rset;
+
+	rset->pats = calloc(nb_pats, sizeof(*rset->pats));
+	rset->fallback = calloc(nb_pats, sizeof(*rset->fallback));
+	rset->rs = regex_set_new(expr->mflags & PAT_MF_IGNORE_CASE);
+	if (!rset->pats || !rset->fallback || !rset->rs)
+		goto fail;
+
+	nb_pats = nb_set = 0;
+	list_for_each_entry(lst, &expr->patterns, list) {
+		if (lst->pat.ref->gen_id != expr->ref->curr_gen)
+			continue;
+
+		rset->pats[nb_pats] = &lst->pat;
+		if (regex_set_add(rset->rs, lst->pat.ref->pattern, nb_pats))
+			nb_set++;
+		else
+			rset->fallback[rset->nb_fallback++] = nb_pats;
+		nb_pats++;
+	}
+
+	if (nb_set < PAT_RSET_MIN_PATTERNS || !regex_set_compile(rset->rs))
+		goto fail;
+
+	return rset;
+
+ fail:
+	/* keep an empty set so that the list is used */
+	regex_set_free(rset->rs);
+	rset->rs = NULL;
+	ha_free(&rset->pats);
+	ha_free(&rset->fallback);
+	rset->nb_fallback = 0;
+	return rset;
+}
+
+/* returns non-zero if the regex set of expression <expr> has to be rebuilt or
+ * flushed, and was not rebuilt too recently.
+ */
+static inline int pat_rset_needs_refresh(const struct pattern_expr *expr)
+{
+	const struct pat_rset *rset = expr->rset;
+
+	if (!pat_rset_enabled)
+		return 0;
+
+	if (pat_rset_is_current(rset, expr) && !(rset->rs && regex_set_full(rset->rs)))
+		return 0;
+
+	return !rset || tick_is_expired(tick_add(rset->built, PAT_RSET_REBUILD_DELAY), now_ms);
+}
+
+/* Rebuilds the regex set of expression <expr> if it is enabled and does not
+ * reflect the current patterns anymore, or flushes its DFA cache if it is
+ * full. The locking rules are the same as for pat_ac_refresh().
+ */
+static void pat_rset_refresh(struct pattern_expr *expr)
+{
+	struct pat_rset *old, *new;
+
+	if (!pat_rset_enabled)
+		return;
+
+	old = expr->rset;
+	if (pat_rset_is_current(old, expr)) {
+		/* only the DFA cache is full, start over with an empty one */
+		if (old->rs && regex_set_full(old->rs)) {
+			HA_RWLOCK_SKTOWR(PATEXP_LOCK, &expr->lock);
+			regex_set_flush(old->rs);
+			old->built = now_ms;
+			HA_RWLOCK_WRTOSK(PATEXP_LOCK, &expr->lock);
+		}
+		return;
+	}
+
+	new = pat_rset_build(expr);
+	HA_RWLOCK_SKTOWR(PATEXP_LOCK, &expr->lock);
+	expr->rset = new;
+	HA_RWLOCK_WRTOSK(PATEXP_LOCK, &expr->lock);
+	pat_rset_free(old);
+}
+
+/* Looks up string <str> of length <len> in the regex set of expression
+ * <expr>. Returns the first matching pattern of the list, or NULL if none
+ * matches. <*full> is set if the set could not be used, in which case the
+ * list must be walked.
+ */
+static struct pattern *pat_rset_lookup(struct pattern_expr *expr, const char *str, size_t len, int *full)
+{
+	const struct pat_rset *rset = expr->rset;
+	uint best, i, pat;
+
+	*full = 1;
+	if (!pat_rset_is_current(rset, expr) || !rset->rs)
+		return NULL;
+
+	best = regex_set_exec(rset->rs, str, len);
+	if (best == RSET_FULL)
+		return NULL;
+
+	*full = 0;
+
+	/* unsupported regexes placed before the best one must be tried too */
+	for (i = 0; i < rset->nb_fallback; i++) {
+		pat = rset->fallback[i];
+		if (pat >= best)
+			break;
+		if (regex_exec2(rset->pats[pat]->ptr.reg, (char *)str, len))
+			return rset->pats[pat];
+	}
+
+	return (best == RSET_NOMATCH) ? NULL : rset->pats[best];
+}
+
 /* Executes a regex. It temporarily changes the data to add a trailing zero,
  * and restores the previous character when leaving. This function fills
  * a matching array.
@@ -577,6 +1031,20 @@ struct pattern *pat_match_regm(struct sample *smp, struct pattern_expr *expr, in
 	struct pattern_list *lst;
 	struct pattern *pattern;
 	struct pattern *ret = NULL;
+	int full;
+
+	ret = pat_rset_lookup(expr, smp->data.u.str.area, smp->data.u.str.data, &full);
+	if (!full) {
+		/* only the winner needs to be executed to fill the match zones */
+		if (!ret)
+			return NULL;
+		if (regex_exec_match2(ret->ptr.reg, smp->data.u.str.area, smp->data.u.str.data,
+		                      MAX_MATCH, pmatch, 0)) {
+			smp->ctx.a[0] = pmatch;
+			return ret;
+		}
+		ret = NULL;
+	}
 
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
@@ -604,6 +1072,7 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern *pattern;
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
+	int full;
 
 	if (pat_lru_tree && !LIST_ISEMPTY(&expr->patterns)) {
 		unsigned long long seed = pat_lru_seed ^ (long)expr;
@@ -616,6 +1085,10 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	ret = pat_rset_lookup(expr, smp->data.u.str.area, smp->data.u.str.data, &full);
+	if (!full)
+		goto leave;
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
 
@@ -628,12 +1101,391 @@ struct pattern *pat_match_reg(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->ref->revision, NULL);
 
 	return ret;
 }
 
+/*
+ *
+ * The following functions manage the string automatons used to match the
+ * "sub", "beg" and "end" patterns lists in a time which only depends on the
+ * sample length, and not on the number of patterns.
+ *
+ */
+
+/* below this number of patterns, the lists are walked instead */
+#define PAT_AC_MIN_PATTERNS   4
+
+/* minimum delay between two builds of the automaton of an expression, so that
+ * a stream of updates from the CLI does not cause one full rebuild per entry.
+ * The lists are used in the mean time.
+ */
+#define PAT_AC_REBUILD_DELAY  100
+
+static void pat_ac_free(struct pat_ac *ac)
+{
+	if (!ac)
+		return;
+	free(ac->pats);
+	free(ac->first);
+	free(ac->fail);
+	free(ac->order);
+	free(ac->nb_child);
+	free(ac->label);
+	free(ac);
+}
+
+/* returns the automaton kind to be used with match function <match>, or -1 if
+ * this match function doesn't use any.
+ */
+static inline int pat_ac_kind(struct pattern *(*match)(struct sample *, struct pattern_expr *, int))
+{
+	if (match == pat_match_sub)
+		return PAT_AC_SUB;
+	if (match == pat_match_beg)
+		return PAT_AC_BEG;
+	if (match == pat_match_end)
+		return PAT_AC_END;
+	return -1;
+}
+
+/* returns non-zero if automaton <ac> is still valid for expression <expr> */
+static inline int pat_ac_is_current(const struct pat_ac *ac, const struct pattern_expr *expr)
+{
+	return ac && ac->revision == expr->ref->revision && ac->gen == expr->ref->curr_gen;
+}
+
+/* returns the automaton of kind <kind> to be used to match expression <expr>,
+ * or NULL if the list must be used.
+ */
+static inline const struct pat_ac *pat_ac_get(const struct pattern_expr *expr, int kind)
+{
+	const struct pat_ac *ac = expr->ac[kind];
+
+	return (pat_ac_is_current(ac, expr) && ac->nb_nodes) ? ac : NULL;
+}
+
+/* returns the child of node <node> in <ac> reached by label <c>, or 0 if none */
+static inline uint pat_ac_child(const struct pat_ac *ac, uint node, uchar c)
+{
+	uint l = ac->first[node];
+	uint end = l + ac->nb_child[node];
+	uint r = end;
+	uint m;
+
+	while (l < r) {
+		m = (l + r) / 2;
+		if (ac->label[m] < c)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return (l < end && ac->label[l] == c) ? l : 0;
+}
+
+/* Builds the automaton of kind <kind> from the patterns of the current
+ * generation of expression <expr>. The list must not change during the
+ * operation. The automaton is returned, possibly without nodes if the list is
+ * too short or on memory shortage, or NULL if it could not be allocated at all.
+ */
+static struct pat_ac *pat_ac_build(struct pattern_expr *expr, int kind)
+{
+	int icase = expr->mflags & PAT_MF_IGNORE_CASE;
+	struct pattern_list *lst;
+	struct pat_ac *ac;
+	uint *t_child = NULL, *t_next = NULL, *t_order = NULL, *queue = NULL;
+	uchar *t_label = NULL;
+	uint nb_pats, max_nodes, nb_nodes;
+	uint node, child, prev, head, tail;
+	uint i, j, u, v, f;
+	uchar c;
+
+	ac = calloc(1, sizeof(*ac));
+	if (!ac)
+		return NULL;
+
+	ac->revision = expr->ref->revision;
+	ac->gen = expr->ref->curr_gen;
+	ac->built = now_ms;
+
+	nb_pats = 0;
+	max_nodes = 1;
+	list_for_each_entry(lst, &expr->patterns, list) {
+		if (lst->pat.ref->gen_id != expr->ref->curr_gen)
+			continue;
+		nb_pats++;
+		max_nodes += lst->pat.len;
+	}
+
+	if (nb_pats < PAT_AC_MIN_PATTERNS)
+		return ac;
+
+	/* temporary trie using sibling lists sorted by label */
+	ac->pats  = calloc(nb_pats, sizeof(*ac->pats));
+	t_child   = calloc(max_nodes, sizeof(*t_child));
+	t_next    = calloc(max_nodes, sizeof(*t_next));
+	t_order   = malloc(max_nodes * sizeof(*t_order));
+	t_label   = calloc(max_nodes, sizeof(*t_label));
+	queue     = malloc(max_nodes * sizeof(*queue));
+	if (!ac->pats || !t_child || !t_next || !t_order || !t_label || !queue)
+		goto fail;
+
+	t_order[0] = ~0U;
+	nb_nodes = 1;
+	i = 0;
+	list_for_each_entry(lst, &expr->patterns, list) {
+		if (lst->pat.ref->gen_id != expr->ref->curr_gen)
+			continue;
+
+		ac->pats[i] = &lst->pat;
+		node = 0;
+		for (j = 0; j < lst->pat.len; j++) {
+			c = lst->pat.ptr.str[kind == PAT_AC_END ? lst->pat.len - 1 - j : j];
+			if (icase)
+				c = tolower(c);
+
+			for (prev = 0, child = t_child[node]; child && t_label[child] < c; child = t_next[child])
+				prev = child;
+
+			if (!child || t_label[child] != c) {
+				/* insert a new node between <prev> and <child> */
+				t_label[nb_nodes] = c;
+				t_order[nb_nodes] = ~0U;
+				t_next[nb_nodes] = child;
+				if (prev)
+					t_next[prev] = nb_nodes;
+				else
+					t_child[node] = nb_nodes;
+				child = nb_nodes++;
+			}
+			node = child;
+		}
+
+		/* the first pattern of the list wins */
+		if (t_order[node] == ~0U)
+			t_order[node] = i;
+		i++;
+	}
+
+	ac->first    = malloc(nb_nodes * sizeof(*ac->first));
+	ac->order    = malloc(nb_nodes * sizeof(*ac->order));
+	ac->nb_child = malloc(nb_nodes * sizeof(*ac->nb_child));
+	ac->label    = malloc(nb_nodes * sizeof(*ac->label));
+	if (kind == PAT_AC_SUB)
+		ac->fail = calloc(nb_nodes, sizeof(*ac->fail));
+	if (!ac->first || !ac->order || !ac->nb_child || !ac->label ||
+	    (kind == PAT_AC_SUB && !ac->fail))
+		goto fail;
+
+	/* renumber the nodes in breadth-first order so that the children of
+	 * each node are consecutive.
+	 */
+	queue[0] = 0;
+	for (head = 0, tail = 1; head < tail; head++) {
+		node = queue[head];
+		ac->first[head] = tail;
+		ac->nb_child[head] = 0;
+		ac->label[head] = t_label[node];
+		ac->order[head] = t_order[node];
+		for (child = t_child[node]; child; child = t_next[child]) {
+			queue[tail++] = child;
+			ac->nb_child[head]++;
+		}
+	}
+	ac->nb_nodes = nb_nodes;
+
+	for (c = 0; ; c++) {
+		ac->root_next[c] = pat_ac_child(ac, 0, c);
+		if (c == 255)
+			break;
+	}
+
+	if (kind == PAT_AC_SUB) {
+		/* compute the failure links in breadth-first order, and let each
+		 * node inherit the lowest order of the patterns matching as its
+		 * suffix.
+		 */
+		for (u = 0; u < nb_nodes; u++) {
+			for (v = ac->first[u]; v < ac->first[u] + ac->nb_child[u]; v++) {
+				c = ac->label[v];
+				f = u ? ac->fail[u] : 0;
+				while (u) {
+					ac->fail[v] = pat_ac_child(ac, f, c);
+					if (ac->fail[v] || !f)
+						break;
+					f = ac->fail[f];
+				}
+				if (ac->order[ac->fail[v]] < ac->order[v])
+					ac->order[v] = ac->order[ac->fail[v]];
+			}
+		}
+	}
+
+ leave:
+	free(t_child);
+	free(t_next);
+	free(t_order);
+	free(t_label);
+	free(queue);
+	return ac;
+
+ fail:
+	/* keep an empty automaton so that the list is used */
+	ha_free(&ac->pats);
+	ha_free(&ac->first);
+	ha_free(&ac->fail);
+	ha_free(&ac->order);
+	ha_free(&ac->nb_child);
+	ha_free(&ac->label);
+	ac->nb_nodes = 0;
+	goto leave;
+}
+
+/* returns non-zero if automaton <ac> of expression <expr> has to be rebuilt,
+ * and was not rebuilt too recently.
+ */
+static inline int pat_ac_needs_refresh(const struct pat_ac *ac, const struct pattern_expr *expr)
+{
+	return !pat_ac_is_current(ac, expr) &&
+	       (!ac || tick_is_expired(tick_add(ac->built, PAT_AC_REBUILD_DELAY), now_ms));
+}
+
+/* Rebuilds the automaton of kind <kind> of expression <expr> if it does not
+ * reflect the current patterns anymore. It must be called with the
+ * expression's seek lock held, which it only upgrades to swap the automatons,
+ * so that the other threads keep matching using the lists during the build.
+ */
+static void pat_ac_refresh(struct pattern_expr *expr, int kind)
+{
+	struct pat_ac *old, *new;
+
+	old = expr->ac[kind];
+	if (pat_ac_is_current(old, expr))
+		return;
+
+	new = pat_ac_build(expr, kind);
+	HA_RWLOCK_SKTOWR(PATEXP_LOCK, &expr->lock);
+	expr->ac[kind] = new;
+	HA_RWLOCK_WRTOSK(PATEXP_LOCK, &expr->lock);
+	pat_ac_free(old);
+}
+
+/* Returns the PAT_AUTO_* automatons which may be used with match function
+ * <match>.
+ */
+static unsigned int pat_automatons(struct pattern *(*match)(struct sample *, struct pattern_expr *, int))
+{
+	int kind = pat_ac_kind(match);
+
+	if (kind >= 0)
+		return PAT_AUTO_AC(kind);
+	if (match == pat_match_reg || match == pat_match_regm)
+		return PAT_AUTO_RSET;
+	return 0;
+}
+
+/* Builds or refreshes all the automatons used by the expression passed in
+ * <context>. It runs as a task woken up by the matching functions when they
+ * notice that the automatons are outdated, so that they are never built in
+ * the request path. It is also called once at boot.
+ */
+static struct task *pat_expr_refresh(struct task *t, void *context, unsigned int state)
+{
+	struct pattern_expr *expr = context;
+	int kind;
+
+	HA_RWLOCK_SKLOCK(PATEXP_LOCK, &expr->lock);
+	for (kind = 0; kind < PAT_AC_KINDS; kind++) {
+		if (expr->automatons & PAT_AUTO_AC(kind))
+			pat_ac_refresh(expr, kind);
+	}
+	if (expr->automatons & PAT_AUTO_RSET)
+		pat_rset_refresh(expr);
+	HA_RWLOCK_SKUNLOCK(PATEXP_LOCK, &expr->lock);
+	return t;
+}
+
+/* Wakes the refresh task of expression <expr> up if the automaton used by
+ * match function <match> needs to be rebuilt. The list is used until it is
+ * done. It must be called with the expression's read lock held.
+ */
+static inline void pat_expr_check_refresh(struct pattern_expr *expr, struct pattern *(*match)(struct sample *, struct pattern_expr *, int))
+{
+	int kind;
+
+	if (!expr->refresh_task)
+		return;
+
+	kind = pat_ac_kind(match);
+	if (kind >= 0 ? pat_ac_needs_refresh(expr->ac[kind], expr) :
+	    ((match == pat_match_reg || match == pat_match_regm) && pat_rset_needs_refresh(expr)))
+		task_wakeup(expr->refresh_task, TASK_WOKEN_OTHER);
+}
+
+/* Looks up string <str> of length <len> in "sub" automaton <ac>, and returns
+ * the first pattern of the list contained in it, or NULL if none.
+ */
+static struct pattern *pat_ac_match_sub(const struct pat_ac *ac, const char *str, size_t len, int icase)
+{
+	const char *end = str + len;
+	uint best = ac->order[0];
+	uint node = 0;
+	uint next;
+	uchar c;
+
+	for (; str < end && best; str++) {
+		c = *str;
+		if (icase)
+			c = tolower(c);
+
+		while (1) {
+			if (!node) {
+				node = ac->root_next[c];
+				break;
+			}
+			next = pat_ac_child(ac, node, c);
+			if (next) {
+				node = next;
+				break;
+			}
+			node = ac->fail[node];
+		}
+
+		if (ac->order[node] < best)
+			best = ac->order[node];
+	}
+	return best != ~0U ? ac->pats[best] : NULL;
+}
+
+/* Looks up string <str> of length <len> in "beg" or "end" automaton <ac>, and
+ * returns the first pattern of the list it starts or ends with (depending on
+ * <kind>), or NULL if none.
+ */
+static struct pattern *pat_ac_match_anchored(const struct pat_ac *ac, const char *str, size_t len, int icase, int kind)
+{
+	uint best = ac->order[0];
+	uint node = 0;
+	size_t i;
+	uchar c;
+
+	for (i = 0; i < len && best; i++) {
+		c = str[kind == PAT_AC_END ? len - 1 - i : i];
+		if (icase)
+			c = tolower(c);
+
+		node = node ? pat_ac_child(ac, node, c) : ac->root_next[c];
+		if (!node)
+			break;
+
+		if (ac->order[node] < best)
+			best = ac->order[node];
+	}
+	return best != ~0U ? ac->pats[best] : NULL;
+}
+
 /* Checks that the pattern matches the beginning of the tested string. */
 struct pattern *pat_match_beg(struct sample *smp, struct pattern_expr *expr, int fill)
 {
@@ -644,6 +1496,7 @@ struct pattern *pat_match_beg(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern *pattern;
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
+	const struct pat_ac *ac;
 
 	/* Lookup a string in the expression's pattern tree. */
 	if (!eb_is_empty(&expr->pattern_tree)) {
@@ -699,6 +1552,13 @@ struct pattern *pat_match_beg(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	ac = pat_ac_get(expr, PAT_AC_BEG);
+	if (ac) {
+		ret = pat_ac_match_anchored(ac, smp->data.u.str.area, smp->data.u.str.data,
+		                            expr->mflags & PAT_MF_IGNORE_CASE, PAT_AC_BEG);
+		goto leave;
+	}
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
 
@@ -717,6 +1577,7 @@ struct pattern *pat_match_beg(struct sample *smp, struct pattern_expr *expr, int
 		break;
 	}
 
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->ref->revision, NULL);
 
@@ -731,6 +1592,7 @@ struct pattern *pat_match_end(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern *pattern;
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
+	const struct pat_ac *ac;
 
 	if (pat_lru_tree && !LIST_ISEMPTY(&expr->patterns)) {
 		unsigned long long seed = pat_lru_seed ^ (long)expr;
@@ -743,6 +1605,13 @@ struct pattern *pat_match_end(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	ac = pat_ac_get(expr, PAT_AC_END);
+	if (ac) {
+		ret = pat_ac_match_anchored(ac, smp->data.u.str.area, smp->data.u.str.data,
+		                            expr->mflags & PAT_MF_IGNORE_CASE, PAT_AC_END);
+		goto leave;
+	}
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
 
@@ -761,14 +1630,15 @@ struct pattern *pat_match_end(struct sample *smp, struct pattern_expr *expr, int
 		break;
 	}
 
+ leave:
 	if (lru)
 		lru64_commit(lru, ret, expr, expr->ref->revision, NULL);
 
 	return ret;
 }
 
-/* Checks that the pattern is included inside the tested string.
- * NB: Suboptimal, should be rewritten using a Boyer-Moore method.
+/* Checks that the pattern is included inside the tested string. Long lists are
+ * matched using an Aho-Corasick automaton, short ones are walked.
  */
 struct pattern *pat_match_sub(struct sample *smp, struct pattern_expr *expr, int fill)
 {
@@ -779,6 +1649,7 @@ struct pattern *pat_match_sub(struct sample *smp, struct pattern_expr *expr, int
 	struct pattern *pattern;
 	struct pattern *ret = NULL;
 	struct lru64 *lru = NULL;
+	const struct pat_ac *ac;
 
 	if (pat_lru_tree && !LIST_ISEMPTY(&expr->patterns)) {
 		unsigned long long seed = pat_lru_seed ^ (long)expr;
@@ -791,6 +1662,13 @@ struct pattern *pat_match_sub(struct sample *smp, struct pattern_expr *expr, int
 		}
 	}
 
+	ac = pat_ac_get(expr, PAT_AC_SUB);
+	if (ac) {
+		ret = pat_ac_match_sub(ac, smp->data.u.str.area, smp->data.u.str.data,
+		                       expr->mflags & PAT_MF_IGNORE_CASE);
+		goto leave;
+	}
+
 	list_for_each_entry(lst, &expr->patterns, list) {
 		pattern = &lst->pat;
 
@@ -1046,6 +1924,14 @@ struct pattern *pat_match_ip(struct sample *smp, struct pattern_expr *expr, int
 		pattern = _pat_match_tree_ipv6(&v6, expr, fill);
 		if (pattern)
 			return pattern;
+		/* Then in the precompiled file, the same way */
+		if (expr->ref->bin) {
+			pattern = _pat_match_bin_ipv4(&smp->data.u.ipv4, expr, fill);
+			if (!pattern)
+				pattern = _pat_match_bin_ipv6(&v6, expr, fill);
+			if (pattern)
+				return pattern;
+		}
 		/* eligible for list lookup using IPv4 address */
 		v4 = smp->data.u.ipv4;
 		goto list_lookup;
@@ -1056,6 +1942,11 @@ struct pattern *pat_match_ip(struct sample *smp, struct pattern_expr *expr, int
 		pattern = _pat_match_tree_ipv6(&smp->data.u.ipv6, expr, fill);
 		if (pattern)
 			return pattern;
+		if (expr->ref->bin) {
+			pattern = _pat_match_bin_ipv6(&smp->data.u.ipv6, expr, fill);
+			if (pattern)
+				return pattern;
+		}
 		/* No match in the IPv6 tree. Try to convert 6 to 4 to lookup in
 		 * the IPv4 tree
 		 */
@@ -1063,6 +1954,11 @@ struct pattern *pat_match_ip(struct sample *smp, struct pattern_expr *expr, int
 			pattern = _pat_match_tree_ipv4(&v4, expr, fill);
 			if (pattern)
 				return pattern;
+			if (expr->ref->bin) {
+				pattern = _pat_match_bin_ipv4(&v4, expr, fill);
+				if (pattern)
+					return pattern;
+			}
 			/* eligible for list lookup using IPv4 address */
 			goto list_lookup;
 		}
@@ -1122,6 +2018,14 @@ void free_pattern_tree(struct eb_root *root)
 void pat_prune_gen(struct pattern_expr *expr)
 {
 	struct pattern_list *pat, *tmp;
+	int kind;
+
+	for (kind = 0; kind < PAT_AC_KINDS; kind++) {
+		pat_ac_free(expr->ac[kind]);
+		expr->ac[kind] = NULL;
+	}
+	pat_rset_free(expr->rset);
+	expr->rset = NULL;
 
 	list_for_each_entry_safe(pat, tmp, &expr->patterns, list) {
 		LIST_DELETE(&pat->list);
@@ -1604,6 +2508,7 @@ void pat_ref_delete_by_ptr(struct pat_ref *ref, struct pat_ref_elt *elt)
 	ebmb_delete(&elt->node);
 	free(elt->sample);
 	free(elt);
+	HA_ATOMIC_INC(&ref->updates);
 }
 
 /* This function removes the pattern matching the pointer <refelt> from
@@ -1865,6 +2770,7 @@ struct pat_ref *pat_ref_new(const char *reference, const char *display, unsigned
 	ref->unique_id = -1;
 	ref->revision = 0;
 	ref->entry_cnt = 0;
+	ref->updates = 0;
 
 	LIST_INIT(&ref->head);
 	ref->ebmb_root = EB_ROOT;
@@ -1944,6 +2850,7 @@ struct pat_ref_elt *pat_ref_append(struct pat_ref *ref, const char *pattern, con
 	/* Even if calloc()'ed, ensure this node is not linked to a tree. */
 	elt->node.node.leaf_p = NULL;
 	ebst_insert(&ref->ebmb_root, &elt->node);
+	HA_ATOMIC_INC(&ref->updates);
 	return elt;
  fail:
 	free(elt);
@@ -2115,6 +3022,7 @@ int pat_ref_purge_range(struct pat_ref *ref, uint from, uint to, int budget)
 		ebmb_delete(&elt->node);
 		free(elt->sample);
 		free(elt);
+		HA_ATOMIC_INC(&ref->updates);
 	}
 
 	list_for_each_entry(expr, &ref->pat, list)
@@ -2229,6 +3137,8 @@ struct pattern_expr *pattern_new_expr(struct pattern_head *head, struct pat_ref
 			*reuse = 1;
 	}
 
+	expr->automatons |= pat_automatons(head->match);
+
 	/* The new list element reference the pattern_expr. */
 	list->expr = expr;
 
@@ -2438,8 +3348,18 @@ int pattern_read_from_file(struct pattern_head *head, unsigned int refflags,
 		}
 
 		if (ref->flags & PAT_REF_FILE) {
-			if (load_smp) {
+			int ret = pat_ref_map_bin(ref, load_smp, err);
+
+			if (ret < 0)
+				return 0;
+
+			if (load_smp)
 				ref->flags |= PAT_REF_SMP;
+
+			if (ret > 0) {
+				/* precompiled file, nothing to load */
+			}
+			else if (load_smp) {
 				if (!pat_ref_read_from_file_smp(ref, err))
 					return 0;
 			}
@@ -2510,6 +3430,9 @@ int pattern_read_from_file(struct pattern_head *head, unsigned int refflags,
 	if (reuse)
 		return 1;
 
+	if (ref->bin && !pat_bin_check(ref, head, patflags, err))
+		return 0;
+
 	/* Load reference content in the pattern expression.
 	 * We need to load elements in the same order they were seen in the
 	 * file. Indeed, some list-based matching types may rely on it as the
@@ -2557,6 +3480,7 @@ struct pattern *pattern_exec_match(struct pattern_head *head, struct sample *smp
 
 	list_for_each_entry(list, &head->head, list) {
 		HA_RWLOCK_RDLOCK(PATEXP_LOCK, &list->expr->lock);
+		pat_expr_check_refresh(list->expr, head->match);
 		pat = head->match(smp, list->expr, fill);
 		if (pat) {
 			/* We duplicate the pattern cause it could be modified
@@ -2614,6 +3538,7 @@ void pattern_prune(struct pattern_head *head)
 			HA_RWLOCK_WRLOCK(PATEXP_LOCK, &list->expr->lock);
 			head->prune(list->expr);
 			HA_RWLOCK_WRUNLOCK(PATEXP_LOCK, &list->expr->lock);
+			task_destroy(list->expr->refresh_task);
 			free(list->expr);
 		}
 		free(list);
@@ -2636,7 +3561,7 @@ static int cmp_pat_ref(const void *_a, const void *_b)
 }
 
 /* This function finalizes the configuration parsing. It sets all the
- * automatic ids.
+ * automatic ids, and builds the automatons of the expressions using them.
  */
 int pattern_finalize_config(void)
 {
@@ -2645,10 +3570,27 @@ int pattern_finalize_config(void)
 	int next_unique_id = 0;
 	size_t i, j;
 	struct pat_ref *ref, **arr;
+	struct pattern_expr *expr;
 	struct list pr = LIST_HEAD_INIT(pr);
 
 	pat_lru_seed = ha_random();
 
+	list_for_each_entry(ref, &pattern_reference, list) {
+		list_for_each_entry(expr, &ref->pat, list) {
+			if (!(expr->automatons & ~(pat_rset_enabled ? 0 : PAT_AUTO_RSET)))
+				continue;
+
+			expr->refresh_task = task_new_anywhere();
+			if (!expr->refresh_task) {
+				ha_alert("Out of memory error.\n");
+				return ERR_ALERT | ERR_FATAL;
+			}
+			expr->refresh_task->process = pat_expr_refresh;
+			expr->refresh_task->context = expr;
+			pat_expr_refresh(expr->refresh_task, expr, 0);
+		}
+	}
+
 	/* Count pat_refs with user defined unique_id and totalt count */
 	list_for_each_entry(ref, &pattern_reference, list) {
 		len++;
@@ -2717,3 +3659,48 @@ static void pattern_per_thread_lru_free()
 
 REGISTER_PER_THREAD_ALLOC(pattern_per_thread_lru_alloc);
 REGISTER_PER_THREAD_FREE(pattern_per_thread_lru_free);
+
+/* allocates the fake reference element reporting the entries matched in
+ * precompiled files, if any was loaded.
+ */
+static int pattern_per_thread_bin_alloc()
+{
+	if (!pat_bin_max_key)
+		return 1;
+	pat_bin_elt = calloc(1, sizeof(*pat_bin_elt) + pat_bin_max_key + 1);
+	return !!pat_bin_elt;
+}
+
+static void pattern_per_thread_bin_free()
+{
+	ha_free(&pat_bin_elt);
+}
+
+REGISTER_PER_THREAD_ALLOC(pattern_per_thread_bin_alloc);
+REGISTER_PER_THREAD_FREE(pattern_per_thread_bin_free);
+
+/* config parser for global "tune.pattern.regex-set", accepts "on" or "off" */
+static int cfg_parse_tune_pattern_regex_set(char **args, int section_type, struct proxy *curpx,
+                                            const struct proxy *defpx, const char *file, int line,
+                                            char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		pat_rset_enabled = 1;
+	else if (strcmp(args[1], "off") == 0)
+		pat_rset_enabled = 0;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.pattern.regex-set", cfg_parse_tune_pattern_regex_set },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
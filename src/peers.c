@@ -19,6 +19,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#if defined(USE_ZLIB)
+/* zlib and openssl both define "free_func", see compression.c */
+#define free_func zlib_free_func
+#include <zlib.h>
+#undef free_func
+#endif /* USE_ZLIB */
+
 #include <import/eb32tree.h>
 #include <import/ebmbtree.h>
 #include <import/ebpttree.h>
@@ -103,7 +110,10 @@
 /* unused : 0x00004000  */
 #define PEER_F_ST_RELEASED          0x00008000 /* Used to set a peer in released state.  */
 #define PEER_F_RESYNC_REQUESTED     0x00010000 /* A resnyc was explicitly requested */
-/* unused : 0x00020000..0x10000000 */
+#define PEER_F_BATCH                0x00020000 /* Updates are sent in compressed batches on this session */
+#define PEER_F_DWNGRD_BATCH         0x00040000 /* Do not announce a protocol version supporting compressed batches */
+#define PEER_F_RESYNC_FAILED        0x00080000 /* This local resync stream could not push its part of the tables */
+/* unused : 0x00100000..0x10000000 */
 #define PEER_F_ALIVE                0x20000000 /* Used to flag a peer a alive. */
 #define PEER_F_HEARTBEAT            0x40000000 /* Heartbeat message to send. */
 #define PEER_F_DWNGRD               0x80000000 /* When this flag is enabled, we must downgrade the supported version announced during peer sessions. */
@@ -226,6 +236,25 @@ struct peer_prep_params {
 	} error;
 };
 
+#if defined(USE_ZLIB)
+/* Context used to exchange compressed batches of update messages with a peer.
+ * Each direction uses a single deflate stream for the whole session so that
+ * keys and values already sent remain usable as references by next batches.
+ */
+struct peer_batch {
+	z_stream tx;          /* compression stream for outgoing batches */
+	z_stream rx;          /* decompression stream for incoming batches */
+	char *raw_area;       /* update messages waiting to be compressed */
+	size_t raw_len;
+	size_t raw_size;
+	char *out_area;       /* compressed batch message not yet emitted */
+	size_t out_len;
+	char *rx_area;        /* decompressed data not yet parsed */
+	size_t rx_len;
+	size_t rx_size;
+};
+#endif
+
 /*******************************/
 /* stick table sync mesg types */
 /* Note: ids >= 128 contains   */
@@ -238,6 +267,7 @@ struct peer_prep_params {
 #define PEER_MSG_STKT_ACK              0x84
 #define PEER_MSG_STKT_UPDATE_TIMED     0x85
 #define PEER_MSG_STKT_INCUPDATE_TIMED  0x86
+#define PEER_MSG_STKT_BATCH            0x87
 /* All the stick-table message identifiers abova have the #7 bit set */
 #define PEER_MSG_STKT_BIT                 7
 #define PEER_MSG_STKT_BIT_MASK         (1 << PEER_MSG_STKT_BIT)
@@ -313,9 +343,20 @@ enum {
 
 #define PEER_SESSION_PROTO_NAME         "HAProxyS"
 #define PEER_MAJOR_VER        2
+#if defined(USE_ZLIB)
+#define PEER_MINOR_VER        2
+#else
 #define PEER_MINOR_VER        1
+#endif
+#define PEER_BATCH_MINOR_VER  2 /* first version supporting compressed batches of updates */
+#define PEER_NOBATCH_MINOR_VER 1
 #define PEER_DWNGRD_MINOR_VER 0
 
+/* Amount of uncompressed update messages accumulated before a batch is
+ * compressed and emitted.
+ */
+#define PEER_BATCH_MAX_RAW    8192
+
 static size_t proto_len = sizeof(PEER_SESSION_PROTO_NAME) - 1;
 struct peers *cfg_peers = NULL;
 static int peers_max_updates_at_once = PEER_DEF_MAX_UPDATES_AT_ONCE;
@@ -592,10 +633,22 @@ static int peer_prepare_hellomsg(char *msg, size_t size, struct peer_prep_params
 	struct peer *peer;
 
 	peer = p->hello.peer;
-	min_ver = (peer->flags & PEER_F_DWNGRD) ? PEER_DWNGRD_MINOR_VER : PEER_MINOR_VER;
-	/* Prepare headers */
-	ret = snprintf(msg, size, PEER_SESSION_PROTO_NAME " %d.%d\n%s\n%s %d %d\n",
-		       (int)PEER_MAJOR_VER, min_ver, peer->id, localpeer, (int)getpid(), (int)1);
+	if (peer->flags & PEER_F_DWNGRD)
+		min_ver = PEER_DWNGRD_MINOR_VER;
+	else if (peer->flags & PEER_F_DWNGRD_BATCH)
+		min_ver = PEER_NOBATCH_MINOR_VER;
+	else
+		min_ver = PEER_MINOR_VER;
+	/* Prepare headers. Local resync streams other than the main one are
+	 * identified by their index appended to the last line.
+	 */
+	if (peer->resync_id)
+		ret = snprintf(msg, size, PEER_SESSION_PROTO_NAME " %d.%d\n%s\n%s %d %d %d\n",
+			       (int)PEER_MAJOR_VER, min_ver, peer->id, localpeer, (int)getpid(), (int)1,
+			       peer->resync_id);
+	else
+		ret = snprintf(msg, size, PEER_SESSION_PROTO_NAME " %d.%d\n%s\n%s %d %d\n",
+			       (int)PEER_MAJOR_VER, min_ver, peer->id, localpeer, (int)getpid(), (int)1);
 	if (ret >= size)
 		return 0;
 
@@ -1048,6 +1101,72 @@ static int peer_prepare_ackmsg(char *msg, size_t size, struct peer_prep_params *
 	return (cursor - msg) + datalen;
 }
 
+#if defined(USE_ZLIB)
+/* Returns the batching context of <peer>, allocating it on first use. Returns
+ * NULL if it could not be allocated.
+ */
+static struct peer_batch *peer_batch_get(struct peer *peer)
+{
+	struct peer_batch *b = peer->batch;
+
+	if (b)
+		return b;
+
+	b = calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+
+	/* A batch is compressed once it reaches PEER_BATCH_MAX_RAW bytes, the
+	 * last update message may be as large as a buffer. The receiver must
+	 * also be able to hold a partial message in addition to the data it
+	 * decompresses.
+	 */
+	b->raw_size = PEER_BATCH_MAX_RAW + trash.size;
+	b->rx_size  = PEER_BATCH_MAX_RAW + trash.size + 2 + PEER_MSG_ENC_LENGTH_MAXLEN;
+	b->raw_area = malloc(b->raw_size);
+	b->out_area = malloc(trash.size + 2 + PEER_MSG_ENC_LENGTH_MAXLEN);
+	b->rx_area  = malloc(b->rx_size);
+	if (!b->raw_area || !b->out_area || !b->rx_area)
+		goto fail;
+
+	if (deflateInit2(&b->tx, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		goto fail;
+
+	if (inflateInit2(&b->rx, -MAX_WBITS) != Z_OK)
+		goto fail;
+
+	peer->batch = b;
+	return b;
+
+ fail:
+	/* zlib's End functions are safe on never initialized streams */
+	deflateEnd(&b->tx);
+	inflateEnd(&b->rx);
+	free(b->raw_area);
+	free(b->out_area);
+	free(b->rx_area);
+	free(b);
+	return NULL;
+}
+
+/* Releases the batching context of <peer>, if any. */
+static void peer_batch_free(struct peer *peer)
+{
+	struct peer_batch *b = peer->batch;
+
+	if (!b)
+		return;
+
+	deflateEnd(&b->tx);
+	inflateEnd(&b->rx);
+	free(b->raw_area);
+	free(b->out_area);
+	free(b->rx_area);
+	free(b);
+	peer->batch = NULL;
+}
+#endif
+
 /*
  * Function to deinit connected peer
  */
@@ -1068,6 +1187,9 @@ void __peer_session_deinit(struct peer *peer)
 	HA_ATOMIC_DEC(&active_peers);
 
 	flush_dcache(peer);
+#if defined(USE_ZLIB)
+	peer_batch_free(peer);
+#endif
 
 	/* Re-init current table pointers to force announcement on re-connect */
 	peer->remote_table = peer->last_local_table = peer->stop_local_table = NULL;
@@ -1327,6 +1449,124 @@ static inline int peer_send_updatemsg(struct shared_table *st, struct appctx *ap
 	return peer_send_msg(appctx, peer_prepare_updatemsg, &p);
 }
 
+#if defined(USE_ZLIB)
+/*
+ * Compress the update messages pending in <peer> batch and emit them as one or
+ * several stick-table batch messages. A compressed message which could not be
+ * emitted is kept and emitted first on the next call.
+ * Return 0 if the message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
+ * Returns -1 if there was not enough room left to send the message,
+ * any other negative returned value must  be considered as an error with an appcxt st0
+ * returned value equal to PEER_SESS_ST_END.
+ */
+static int peer_batch_flush(struct appctx *appctx, struct peer *peer)
+{
+	struct peer_batch *b = peer->batch;
+	/* leave enough room for the deflate blocks overhead */
+	size_t max_in = trash.size - trash.size / 16 - 64;
+	size_t in, datalen;
+	char *data, *cursor;
+	int ret;
+
+	if (!b)
+		return 1;
+
+	while (1) {
+		if (b->out_len) {
+			ret = applet_putblk(appctx, b->out_area, b->out_len);
+			if (ret <= 0) {
+				if (ret != -1)
+					appctx->st0 = PEER_SESS_ST_END;
+				return ret;
+			}
+			peer->tx_batch_wire += b->out_len;
+			b->out_len = 0;
+		}
+
+		if (!b->raw_len)
+			return 1;
+
+		in = MIN(b->raw_len, max_in);
+		data = b->out_area + 2 + PEER_MSG_ENC_LENGTH_MAXLEN;
+		b->tx.next_in   = (Bytef *)b->raw_area;
+		b->tx.avail_in  = in;
+		b->tx.next_out  = (Bytef *)data;
+		b->tx.avail_out = trash.size;
+		if (deflate(&b->tx, Z_SYNC_FLUSH) != Z_OK || b->tx.avail_in || !b->tx.avail_out) {
+			/* internal error: the batch does not fit in a message */
+			appctx->st0 = PEER_SESS_ST_END;
+			return 0;
+		}
+
+		datalen = trash.size - b->tx.avail_out;
+		b->raw_len -= in;
+		if (b->raw_len)
+			memmove(b->raw_area, b->raw_area + in, b->raw_len);
+
+		/* prepare message header and move data after it */
+		b->out_area[0] = PEER_MSG_CLASS_STICKTABLE;
+		b->out_area[1] = PEER_MSG_STKT_BATCH;
+		cursor = &b->out_area[2];
+		intencode(datalen, &cursor);
+		memmove(cursor, data, datalen);
+		b->out_len = (cursor - b->out_area) + datalen;
+	}
+}
+
+/*
+ * Append a stick-table update message to the batch of the peer attached to
+ * <appctx>, compressing and emitting the pending batch first if it is full.
+ * Return 0 if the message could not be built modifying the appcxt st0 to PEER_SESS_ST_END value.
+ * Returns -1 if there was not enough room left to send the message,
+ * any other negative returned value must  be considered as an error with an appcxt st0
+ * returned value equal to PEER_SESS_ST_END.
+ */
+static inline int peer_batch_updatemsg(struct shared_table *st, struct appctx *appctx, struct stksess *ts,
+                                       unsigned int updateid, int use_identifier, int use_timed)
+{
+	struct peer *peer = appctx->svcctx;
+	struct peer_batch *b;
+	struct peer_prep_params p = {
+		.updt = {
+			.stksess = ts,
+			.shared_table = st,
+			.updateid = updateid,
+			.use_identifier = use_identifier,
+			.use_timed = use_timed,
+			.peer = peer,
+		},
+	};
+	int ret, msglen;
+
+	b = peer_batch_get(peer);
+	if (!b) {
+		appctx->st0 = PEER_SESS_ST_END;
+		return 0;
+	}
+
+	/* Flush before building the message, which must not be built twice
+	 * as it updates the dictionary cache.
+	 */
+	if (b->raw_len >= PEER_BATCH_MAX_RAW) {
+		ret = peer_batch_flush(appctx, peer);
+		if (ret <= 0)
+			return ret;
+	}
+
+	msglen = peer_prepare_updatemsg(b->raw_area + b->raw_len, b->raw_size - b->raw_len, &p);
+	if (!msglen) {
+		/* internal error: message does not fit in the batch */
+		appctx->st0 = PEER_SESS_ST_END;
+		return 0;
+	}
+
+	b->raw_len += msglen;
+	peer->tx_batch_upd++;
+	peer->tx_batch_raw += msglen;
+	return 1;
+}
+#endif
+
 /*
  * Build a peer protocol control class message.
  * Returns the number of written bytes used to build the message if succeeded,
@@ -1552,6 +1792,33 @@ static inline struct stksess *peer_teach_stage2_stksess_lookup(struct shared_tab
 	return ret;
 }
 
+/*
+ * Return non-zero if <ts> entry of <t> table must not be pushed to <p> local
+ * peer session because it is pushed by another local resync stream. Entries
+ * are distributed over the streams according to the table shard they belong
+ * to. The main session also pushes the entries of the streams which failed.
+ */
+static inline int peer_resync_skip(struct peer *p, struct stktable *t, struct stksess *ts)
+{
+	struct peers *peers = p->peers;
+	size_t len;
+	int id;
+
+	if (!p->local || peers->resync_streams <= 1)
+		return 0;
+
+	if (t->type == SMP_T_STR)
+		len = strlen((const char *)ts->key.key);
+	else
+		len = t->key_size;
+
+	id = stktable_calc_shard_num(t, ts->key.key, len) % peers->resync_streams;
+	if (id == p->resync_id)
+		return 0;
+
+	return p->resync_id || !(HA_ATOMIC_LOAD(&peers->resync_stream[id]->flags) & PEER_F_RESYNC_FAILED);
+}
+
 /*
  * Generic function to emit update messages for <st> stick-table when a lesson must
  * be taught to the peer <p>.
@@ -1604,7 +1871,8 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
 		}
 
 		updateid = ts->upd.key;
-		if (p->srv->shard && ts->shard != p->srv->shard) {
+		if ((p->srv->shard && ts->shard != p->srv->shard) ||
+		    peer_resync_skip(p, st->table, ts)) {
 			/* Skip this entry */
 			st->last_pushed = updateid;
 			new_pushed = 1;
@@ -1614,13 +1882,19 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
 		HA_ATOMIC_INC(&ts->ref_cnt);
 		HA_RWLOCK_RDUNLOCK(STK_TABLE_LOCK, &st->table->updt_lock);
 
-		ret = peer_send_updatemsg(st, appctx, ts, updateid, new_pushed, use_timed);
+#if defined(USE_ZLIB)
+		if (p->flags & PEER_F_BATCH)
+			ret = peer_batch_updatemsg(st, appctx, ts, updateid, new_pushed, use_timed);
+		else
+#endif
+			ret = peer_send_updatemsg(st, appctx, ts, updateid, new_pushed, use_timed);
 		HA_RWLOCK_RDLOCK(STK_TABLE_LOCK, &st->table->updt_lock);
 		HA_ATOMIC_DEC(&ts->ref_cnt);
 		if (ret <= 0)
 			break;
 
 		st->last_pushed = updateid;
+		p->tx_upd++;
 
 		if (peer_stksess_lookup == peer_teach_process_stksess_lookup) {
 			uint commitid = _HA_ATOMIC_LOAD(&st->table->commitupdate);
@@ -1645,6 +1919,11 @@ static inline int peer_send_teachmsgs(struct appctx *appctx, struct peer *p,
 
  out:
 	HA_RWLOCK_RDUNLOCK(STK_TABLE_LOCK, &st->table->updt_lock);
+#if defined(USE_ZLIB)
+	/* the batch must be emitted before any other message */
+	if (ret == 1 && (p->flags & PEER_F_BATCH))
+		ret = peer_batch_flush(appctx, p);
+#endif
 	return ret;
 }
 
@@ -1726,6 +2005,7 @@ static int peer_treat_updatemsg(struct appctx *appctx, struct peer *p, int updt,
 	char *msg_save;
 
 	TRACE_ENTER(PEERS_EV_UPDTMSG, NULL, p);
+	p->rx_upd++;
 	/* Here we have data message */
 	if (!st)
 		goto ignore_msg;
@@ -2122,6 +2402,113 @@ static int peer_treat_updatemsg(struct appctx *appctx, struct peer *p, int updt,
 	return 0;
 }
 
+#if defined(USE_ZLIB)
+/*
+ * Function used to parse a compressed batch of stick-table update messages
+ * received by <p> peer with <msg_cur> as address of the pointer to the position
+ * in the receipt buffer with <msg_end> being the position of the end of the
+ * message. The update messages are decompressed and treated one at a time; a
+ * message cut at the end of the batch is kept until the next batch completes it.
+ * Return 1 if succeeded, 0 if not with the appctx state st0 set to
+ * PEER_SESS_ST_ERRPROTO or PEER_SESS_ST_END.
+ */
+static int peer_treat_batchmsg(struct appctx *appctx, struct peer *p,
+                               char **msg_cur, char *msg_end)
+{
+	struct peer_batch *b;
+	char *cur, *end, *msg;
+	uint64_t len;
+	unsigned char type;
+	int ret, updt, exp;
+
+	TRACE_ENTER(PEERS_EV_UPDTMSG, NULL, p);
+	if (!(p->flags & PEER_F_BATCH)) {
+		TRACE_PROTO("unexpected batch message", PEERS_EV_UPDTMSG, NULL, p);
+		goto malformed_exit;
+	}
+
+	b = peer_batch_get(p);
+	if (!b) {
+		appctx->st0 = PEER_SESS_ST_END;
+		TRACE_DEVEL("leaving in error", PEERS_EV_UPDTMSG);
+		return 0;
+	}
+
+	b->rx.next_in  = (Bytef *)*msg_cur;
+	b->rx.avail_in = msg_end - *msg_cur;
+	do {
+		b->rx.next_out  = (Bytef *)b->rx_area + b->rx_len;
+		b->rx.avail_out = b->rx_size - b->rx_len;
+		ret = inflate(&b->rx, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			TRACE_PROTO("malformed batch message", PEERS_EV_UPDTMSG, NULL, p);
+			goto malformed_exit;
+		}
+
+		cur = b->rx_area;
+		end = b->rx_area + b->rx_size - b->rx.avail_out;
+		while (end - cur >= 2) {
+			/* only update messages may be batched */
+			msg = cur;
+			type = (unsigned char)cur[1];
+			if ((unsigned char)cur[0] != PEER_MSG_CLASS_STICKTABLE ||
+			    (type != PEER_MSG_STKT_UPDATE && type != PEER_MSG_STKT_INCUPDATE &&
+			     type != PEER_MSG_STKT_UPDATE_TIMED && type != PEER_MSG_STKT_INCUPDATE_TIMED)) {
+				TRACE_PROTO("malformed batch message", PEERS_EV_UPDTMSG, NULL, p);
+				goto malformed_exit;
+			}
+
+			updt = type == PEER_MSG_STKT_UPDATE || type == PEER_MSG_STKT_UPDATE_TIMED;
+			exp  = type == PEER_MSG_STKT_UPDATE_TIMED || type == PEER_MSG_STKT_INCUPDATE_TIMED;
+			cur += 2;
+			len = intdecode(&cur, end);
+			if (!cur) {
+				if (end - msg < 2 + PEER_MSG_ENC_LENGTH_MAXLEN) {
+					/* truncated length, wait for more data */
+					cur = msg;
+					break;
+				}
+				TRACE_PROTO("malformed batch message", PEERS_EV_UPDTMSG, NULL, p);
+				goto malformed_exit;
+			}
+
+			if (len > trash.size) {
+				TRACE_PROTO("too large message in batch", PEERS_EV_UPDTMSG, NULL, p);
+				goto malformed_exit;
+			}
+
+			if (len > end - cur) {
+				/* truncated message, wait for more data */
+				cur = msg;
+				break;
+			}
+
+			msg = cur;
+			cur += len;
+			if (!peer_treat_updatemsg(appctx, p, updt, exp, &msg, cur, len, len))
+				return 0;
+		}
+
+		/* keep the partial message, if any */
+		b->rx_len = end - cur;
+		if (b->rx_len == b->rx_size) {
+			TRACE_PROTO("malformed batch message", PEERS_EV_UPDTMSG, NULL, p);
+			goto malformed_exit;
+		}
+		memmove(b->rx_area, cur, b->rx_len);
+	} while (b->rx.avail_in || !b->rx.avail_out);
+
+	*msg_cur = msg_end;
+	TRACE_LEAVE(PEERS_EV_UPDTMSG, NULL, p);
+	return 1;
+
+ malformed_exit:
+	appctx->st0 = PEER_SESS_ST_ERRPROTO;
+	TRACE_DEVEL("leaving in error", PEERS_EV_UPDTMSG);
+	return 0;
+}
+#endif
+
 /*
  * Function used to parse a stick-table update acknowledgement message after it
  * has been received by <p> peer with <msg_cur> as address of the pointer to the position in the
@@ -2526,6 +2913,12 @@ static inline int peer_treat_awaited_msg(struct appctx *appctx, struct peer *pee
 			            NULL, &msg_head[1], peers->local->id, peer->id);
 			/* If stopping state */
 			if (stopping) {
+				/* the lesson was restarted to take over the entries
+				 * of a failed resync stream, wait for the new one.
+				 */
+				if (!(peer->flags & PEER_F_TEACH_FINISHED))
+					return 1;
+
 				/* Close session, push resync no more needed */
 				peer->flags |= PEER_F_TEACH_COMPLETE;
 				appctx->st0 = PEER_SESS_ST_END;
@@ -2572,6 +2965,12 @@ static inline int peer_treat_awaited_msg(struct appctx *appctx, struct peer *pee
 			if (!peer_treat_ackmsg(appctx, peer, msg_cur, msg_end))
 				return 0;
 		}
+#if defined(USE_ZLIB)
+		else if (msg_head[1] == PEER_MSG_STKT_BATCH) {
+			if (!peer_treat_batchmsg(appctx, peer, msg_cur, msg_end))
+				return 0;
+		}
+#endif
 	}
 	else if (msg_head[0] == PEER_MSG_CLASS_RESERVED) {
 		appctx->st0 = PEER_SESS_ST_ERRPROTO;
@@ -2611,6 +3010,13 @@ static inline int peer_send_msgs(struct appctx *appctx,
 {
 	int repl;
 
+#if defined(USE_ZLIB)
+	/* Updates still pending in a batch must leave first */
+	repl = peer_batch_flush(appctx, peer);
+	if (repl <= 0)
+		return repl;
+#endif
+
 	/* Need to request a resync */
 	if ((peer->flags & (PEER_F_LEARN_ASSIGN|PEER_F_LEARN_PROCESS|PEER_F_LEARN_FINISHED)) == PEER_F_LEARN_ASSIGN) {
 		repl = peer_send_resync_reqmsg(appctx, peer, peers);
@@ -2822,6 +3228,23 @@ static inline int peer_getline_last(struct appctx *appctx, struct peer **curpeer
 		appctx->st1 = PEER_SESS_SC_ERRPEER;
 		return -1;
 	}
+
+	/* "<pid> <relative_pid> <resync stream>": the old local process may
+	 * open several sessions to push its tables in parallel.
+	 */
+	p = strchr(p + 1, ' ');
+	if (p)
+		p = strchr(p + 1, ' ');
+	if (p && peer->local) {
+		int id = atoi(p + 1);
+
+		if (id <= 0 || id >= peers->resync_streams) {
+			appctx->st0 = PEER_SESS_ST_EXIT;
+			appctx->st1 = PEER_SESS_SC_ERRPEER;
+			return -1;
+		}
+		peer = peers->resync_stream[id];
+	}
 	*curpeer = peer;
 
 	return 1;
@@ -3023,6 +3446,14 @@ static void peer_io_handler(struct appctx *appctx)
 					else {
 						curpeer->flags &= ~PEER_F_DWNGRD;
 					}
+					if (min_ver < PEER_BATCH_MINOR_VER) {
+						curpeer->flags |= PEER_F_DWNGRD_BATCH;
+						curpeer->flags &= ~PEER_F_BATCH;
+					}
+					else {
+						curpeer->flags &= ~PEER_F_DWNGRD_BATCH;
+						curpeer->flags |= PEER_F_BATCH;
+					}
 				}
 				curpeer->appctx = appctx;
 				curpeer->flags |= PEER_F_ALIVE;
@@ -3108,11 +3539,22 @@ static void peer_io_handler(struct appctx *appctx)
 
 				/* If status code is success */
 				if (curpeer->statuscode == PEER_SESS_SC_SUCCESSCODE) {
+					if (PEER_MINOR_VER >= PEER_BATCH_MINOR_VER &&
+					    !(curpeer->flags & (PEER_F_DWNGRD|PEER_F_DWNGRD_BATCH)))
+						curpeer->flags |= PEER_F_BATCH;
+					else
+						curpeer->flags &= ~PEER_F_BATCH;
 					init_connected_peer(curpeer, curpeers);
 				}
 				else {
-					if (curpeer->statuscode == PEER_SESS_SC_ERRVERSION)
-						curpeer->flags |= PEER_F_DWNGRD;
+					/* downgrade one version at a time */
+					if (curpeer->statuscode == PEER_SESS_SC_ERRVERSION) {
+						if (PEER_MINOR_VER >= PEER_BATCH_MINOR_VER &&
+						    !(curpeer->flags & PEER_F_DWNGRD_BATCH))
+							curpeer->flags |= PEER_F_DWNGRD_BATCH;
+						else
+							curpeer->flags |= PEER_F_DWNGRD;
+					}
 					/* Status code is not success, abort */
 					appctx->st0 = PEER_SESS_ST_END;
 					goto switchstate;
@@ -3400,8 +3842,11 @@ static void __process_peer_state(struct peers *peers, struct peer *peer)
 
 		/* if current peer is local */
 		if (peer->local) {
-			/* if current host need resyncfrom local and no process assigned  */
-			if ((peers->flags & PEERS_RESYNC_STATEMASK) == PEERS_RESYNC_FROMLOCAL &&
+			/* if current host need resyncfrom local and no process assigned.
+			 * Resync streams only complement the main local session.
+			 */
+			if (!peer->resync_id &&
+			    (peers->flags & PEERS_RESYNC_STATEMASK) == PEERS_RESYNC_FROMLOCAL &&
 			    !(peers->flags & PEERS_F_RESYNC_ASSIGN)) {
 				/* assign local peer for a lesson, consider lesson already requested */
 				peer->flags |= PEER_F_LEARN_ASSIGN;
@@ -3447,6 +3892,7 @@ static void __process_running_peer_sync(struct task *task, struct peers *peers,
 {
 	struct peer *ps;
 	struct shared_table *st;
+	int i;
 
 	/* resync timeout set to TICK_ETERNITY means we just start
 	 * a new process and timer was not initialized.
@@ -3584,6 +4030,14 @@ static void __process_running_peer_sync(struct task *task, struct peers *peers,
 		HA_SPIN_UNLOCK(PEER_LOCK, &ps->lock);
 	} /* for */
 
+	/* Sessions accepted from the old process on the resync streams */
+	for (i = 1; i < peers->resync_streams; i++) {
+		ps = peers->resync_stream[i];
+		HA_SPIN_LOCK(PEER_LOCK, &ps->lock);
+		__process_peer_state(peers, ps);
+		HA_SPIN_UNLOCK(PEER_LOCK, &ps->lock);
+	}
+
 	/* Resync from remotes expired: consider resync is finished */
 	if (((peers->flags & PEERS_RESYNC_STATEMASK) == PEERS_RESYNC_FROMREMOTE) &&
 	    !(peers->flags & PEERS_F_RESYNC_ASSIGN) &&
@@ -3605,56 +4059,49 @@ static void __process_running_peer_sync(struct task *task, struct peers *peers,
 	}
 }
 
-static void __process_stopping_peer_sync(struct task *task, struct peers *peers, unsigned int state)
+/*
+ * Restart the lesson of the <peer> main local session from the beginning so
+ * that it pushes the entries of the resync streams which failed.
+ */
+static void __peer_resync_restart(struct peer *peer)
 {
-	struct peer *ps;
 	struct shared_table *st;
 
-
-	/* For each peer */
-	for (ps = peers->remote; ps; ps = ps->next) {
-		HA_SPIN_LOCK(PEER_LOCK, &ps->lock);
-
-		__process_peer_learn_status(peers, ps);
-		__process_peer_state(peers, ps);
-
-		if ((state & TASK_WOKEN_SIGNAL) && !(peers->flags & PEERS_F_DONOTSTOP)) {
-			/* we're killing a connection, we must apply a random delay before
-			 * retrying otherwise the other end will do the same and we can loop
-			 * for a while.
-			 */
-			ps->reconnect = tick_add(now_ms, MS_TO_TICKS(50 + ha_random() % 2000));
-			if (ps->appctx) {
-				peer_session_forceshutdown(ps);
-			}
-		}
-
-		HA_SPIN_UNLOCK(PEER_LOCK, &ps->lock);
+	HA_SPIN_LOCK(PEER_LOCK, &peer->lock);
+	if (peer->flags & PEER_F_TEACH_COMPLETE) {
+		/* the session is closed, a new one will teach everything */
+		peer->flags &= ~PEER_F_TEACH_COMPLETE;
+		peer->reconnect = now_ms;
 	}
-
-	/* We've just received the signal */
-	if (state & TASK_WOKEN_SIGNAL) {
-		if (!(peers->flags & PEERS_F_DONOTSTOP)) {
-			/* add DO NOT STOP flag if not present */
-			_HA_ATOMIC_INC(&jobs);
-			peers->flags |= PEERS_F_DONOTSTOP;
-
-			/* Set resync timeout for the local peer and request a immediate reconnect */
-			peers->resync_timeout = tick_add(now_ms, MS_TO_TICKS(PEER_RESYNC_TIMEOUT));
-			peers->local->reconnect = now_ms;
+	else if (peer->appctx && (peer->flags & PEER_F_TEACH_PROCESS)) {
+		for (st = peer->tables; st; st = st->next) {
+			st->last_pushed = st->teaching_origin;
+			st->flags = 0;
 		}
+		peer->flags &= PEER_TEACH_RESET;
+		peer->flags |= PEER_F_TEACH_PROCESS;
+		appctx_wakeup(peer->appctx);
 	}
+	HA_SPIN_UNLOCK(PEER_LOCK, &peer->lock);
+}
+
+/*
+ * Manage the <ps> local peer session used to push the tables to the new
+ * process while stopping: the main local session or one of the resync streams.
+ * Returns 1 once this session is over, because its lesson is complete or
+ * because it could not be achieved, 0 otherwise.
+ */
+static int __process_stopping_local_peer(struct task *task, struct peers *peers, struct peer *ps)
+{
+	struct shared_table *st;
+	int ret = 0;
 
-	ps = peers->local;
 	HA_SPIN_LOCK(PEER_LOCK, &ps->lock);
-	if (ps->flags & PEER_F_TEACH_COMPLETE) {
-		if (peers->flags & PEERS_F_DONOTSTOP) {
-			/* resync of new process was complete, current process can die now */
-			_HA_ATOMIC_DEC(&jobs);
-			peers->flags &= ~PEERS_F_DONOTSTOP;
-			for (st = ps->tables; st ; st = st->next)
-				HA_ATOMIC_DEC(&st->table->refcnt);
-		}
+	if (ps->resync_id)
+		__process_peer_state(peers, ps);
+
+	if (ps->flags & (PEER_F_TEACH_COMPLETE|PEER_F_RESYNC_FAILED)) {
+		ret = 1;
 	}
 	else if (!ps->appctx) {
 		/* Re-arm resync timeout if necessary */
@@ -3687,13 +4134,14 @@ static void __process_stopping_peer_sync(struct task *task, struct peers *peers,
 			}
 		}
 		else {
-			/* Other error cases */
-			if (peers->flags & PEERS_F_DONOTSTOP) {
-				/* unable to resync new process, current process can die now */
-				_HA_ATOMIC_DEC(&jobs);
-				peers->flags &= ~PEERS_F_DONOTSTOP;
-				for (st = ps->tables; st ; st = st->next)
-					HA_ATOMIC_DEC(&st->table->refcnt);
+			/* Other error cases: the lesson cannot be achieved */
+			ret = 1;
+			if (ps->resync_id && (peers->flags & PEERS_F_DONOTSTOP)) {
+				/* the main session takes over the entries of this stream */
+				HA_ATOMIC_OR(&ps->flags, PEER_F_RESYNC_FAILED);
+				HA_SPIN_UNLOCK(PEER_LOCK, &ps->lock);
+				__peer_resync_restart(peers->local);
+				return ret;
 			}
 		}
 	}
@@ -3711,6 +4159,87 @@ static void __process_stopping_peer_sync(struct task *task, struct peers *peers,
 		}
 	}
 	HA_SPIN_UNLOCK(PEER_LOCK, &ps->lock);
+	return ret;
+}
+
+static void __process_stopping_peer_sync(struct task *task, struct peers *peers, unsigned int state)
+{
+	struct peer *ps;
+	struct shared_table *st;
+	int i, done;
+
+
+	/* For each peer */
+	for (ps = peers->remote; ps; ps = ps->next) {
+		HA_SPIN_LOCK(PEER_LOCK, &ps->lock);
+
+		__process_peer_learn_status(peers, ps);
+		__process_peer_state(peers, ps);
+
+		if ((state & TASK_WOKEN_SIGNAL) && !(peers->flags & PEERS_F_DONOTSTOP)) {
+			/* we're killing a connection, we must apply a random delay before
+			 * retrying otherwise the other end will do the same and we can loop
+			 * for a while.
+			 */
+			ps->reconnect = tick_add(now_ms, MS_TO_TICKS(50 + ha_random() % 2000));
+			if (ps->appctx) {
+				peer_session_forceshutdown(ps);
+			}
+		}
+
+		HA_SPIN_UNLOCK(PEER_LOCK, &ps->lock);
+	}
+
+	/* We've just received the signal */
+	if (state & TASK_WOKEN_SIGNAL) {
+		if (!(peers->flags & PEERS_F_DONOTSTOP)) {
+			/* add DO NOT STOP flag if not present */
+			_HA_ATOMIC_INC(&jobs);
+			peers->flags |= PEERS_F_DONOTSTOP;
+
+			/* Set resync timeout for the local peer and request a immediate reconnect */
+			peers->resync_timeout = tick_add(now_ms, MS_TO_TICKS(PEER_RESYNC_TIMEOUT));
+			peers->local->reconnect = now_ms;
+
+			/* Same for the resync streams */
+			for (i = 1; i < peers->resync_streams; i++) {
+				ps = peers->resync_stream[i];
+				HA_SPIN_LOCK(PEER_LOCK, &ps->lock);
+				if (ps->appctx)
+					peer_session_forceshutdown(ps);
+				ps->reconnect = now_ms;
+				HA_SPIN_UNLOCK(PEER_LOCK, &ps->lock);
+			}
+		}
+	}
+
+	/* Push the tables to the new process over the main local session and
+	 * the resync streams. The process may stop once all of them are over.
+	 */
+	done = 1;
+	for (i = 0; i < peers->resync_streams; i++) {
+		ps = peers->resync_stream[i];
+		if (!__process_stopping_local_peer(task, peers, ps))
+			done = 0;
+		else if (!i && !(HA_ATOMIC_LOAD(&ps->flags) & PEER_F_TEACH_COMPLETE))
+			break; /* the main session failed, give up */
+	}
+
+	/* a failed stream may have restarted the main session */
+	if (!(HA_ATOMIC_LOAD(&peers->local->flags) & PEER_F_TEACH_COMPLETE))
+		done = 0;
+
+	if (i < peers->resync_streams || done) {
+		if (peers->flags & PEERS_F_DONOTSTOP) {
+			/* resync of new process was complete or is impossible,
+			 * current process can die now.
+			 */
+			_HA_ATOMIC_DEC(&jobs);
+			peers->flags &= ~PEERS_F_DONOTSTOP;
+			for (st = peers->local->tables; st ; st = st->next)
+				HA_ATOMIC_DEC(&st->table->refcnt);
+		}
+	}
 }
 
 /*
@@ -3745,11 +4274,40 @@ struct task *process_peer_sync(struct task * task, void *context, unsigned int s
 int peers_init_sync(struct peers *peers)
 {
 	struct peer * curpeer;
+	int i;
 
 	for (curpeer = peers->remote; curpeer; curpeer = curpeer->next) {
 		peers->peers_fe->maxconn += 3;
 	}
 
+	/* The local peer is the first resync stream, the other ones are
+	 * private copies of it only used to push or learn the tables in
+	 * parallel during a reload.
+	 */
+	if (peers->resync_streams < 1)
+		peers->resync_streams = 1;
+
+	peers->resync_stream = calloc(peers->resync_streams, sizeof(*peers->resync_stream));
+	if (!peers->resync_stream)
+		return 0;
+
+	peers->resync_stream[0] = peers->local;
+	for (i = 1; i < peers->resync_streams; i++) {
+		curpeer = calloc(1, sizeof(*curpeer));
+		if (!curpeer)
+			return 0;
+
+		curpeer->local = 1;
+		curpeer->id = peers->local->id;
+		curpeer->conf = peers->local->conf;
+		curpeer->srv = peers->local->srv;
+		curpeer->peers = peers;
+		curpeer->resync_id = i;
+		HA_SPIN_INIT(&curpeer->lock);
+		peers->resync_stream[i] = curpeer;
+		peers->peers_fe->maxconn += 3;
+	}
+
 	peers->sync_task = task_new_anywhere();
 	if (!peers->sync_task)
 		return 0;
@@ -3901,6 +4459,7 @@ static struct ebpt_node *dcache_tx_insert(struct dcache *dc, struct dcache_tx_en
 int peers_alloc_dcache(struct peers *peers)
 {
 	struct peer *p;
+	int i;
 
 	for (p = peers->remote; p; p = p->next) {
 		p->dcache = new_dcache(PEER_STKT_CACHE_MAX_ENTRIES);
@@ -3908,6 +4467,13 @@ int peers_alloc_dcache(struct peers *peers)
 			return 0;
 	}
 
+	for (i = 1; i < peers->resync_streams; i++) {
+		p = peers->resync_stream[i];
+		p->dcache = new_dcache(PEER_STKT_CACHE_MAX_ENTRIES);
+		if (!p->dcache)
+			return 0;
+	}
+
 	return 1;
 }
 
@@ -3921,6 +4487,7 @@ int peers_register_table(struct peers *peers, struct stktable *table)
 	struct peer * curpeer;
 	int id = 0;
 	int retval = 0;
+	int i;
 
 	for (curpeer = peers->remote; curpeer; curpeer = curpeer->next) {
 		st = calloc(1,sizeof(*st));
@@ -3944,6 +4511,20 @@ int peers_register_table(struct peers *peers, struct stktable *table)
 		curpeer->tables = st;
 	}
 
+	/* The resync streams rely on the local peer's reference */
+	for (i = 1; !retval && i < peers->resync_streams; i++) {
+		curpeer = peers->resync_stream[i];
+		st = calloc(1, sizeof(*st));
+		if (!st) {
+			retval = 1;
+			break;
+		}
+		st->table = table;
+		st->next = curpeer->tables;
+		st->local_id = curpeer->tables ? curpeer->tables->local_id + 1 : 1;
+		curpeer->tables = st;
+	}
+
 	table->sync_task = peers->sync_task;
 
 	return retval;
@@ -4065,6 +4646,27 @@ static int peers_dump_peer(struct buffer *msg, struct appctx *appctx, struct pee
 	              peer->confirm, peer->tx_hbt, peer->rx_hbt,
 	              peer->no_hbt, peer->new_conn, peer->proto_err, peer->coll);
 
+	if (peer->tx_batch_upd)
+		chunk_appendf(msg, "        batch_upd=%llu batch_raw=%llu batch_wire=%llu bytes_per_upd=%llu.%02llu\n",
+		              (ullong)peer->tx_batch_upd, (ullong)peer->tx_batch_raw, (ullong)peer->tx_batch_wire,
+		              (ullong)(peer->tx_batch_wire / peer->tx_batch_upd),
+		              (ullong)(peer->tx_batch_wire * 100 / peer->tx_batch_upd % 100));
+
+	if (peer->local && peer->peers->resync_streams > 1) {
+		struct peer *rs;
+		int i;
+
+		/* progress of the parallel resync with the other local process */
+		for (i = 0; i < peer->peers->resync_streams; i++) {
+			rs = peer->peers->resync_stream[i];
+			chunk_appendf(msg, "        resync_stream=%d/%d(%s) last_status=%s flags=0x%x tx_upd=%llu rx_upd=%llu\n",
+			              i, peer->peers->resync_streams,
+			              rs->appctx ? "active" : "inactive",
+			              statuscode_str(rs->statuscode), rs->flags,
+			              (ullong)rs->tx_upd, (ullong)rs->rx_upd);
+		}
+	}
+
 	chunk_appendf(&trash, "        flags=0x%x", peer->flags);
 
 	if (!peer->appctx)
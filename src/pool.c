@@ -11,6 +11,7 @@
  */
 
 #include <errno.h>
+#include <sys/mman.h>
 
 #include <import/plock.h>
 
@@ -85,6 +86,7 @@ static const struct {
 	{ POOL_DBG_TAG,        "tag",        "no-tag",       "add tag at end of allocated objects" },
 	{ POOL_DBG_POISON,     "poison",     "no-poison",    "poison newly allocated objects" },
 	{ POOL_DBG_UAF,        "uaf",        "no-uaf",       "enable use-after-free checks (slow)" },
+	{ POOL_DBG_NUMA,       "numa",       "no-numa",      "use per-node shared caches" },
 	{ 0 /* end */ }
 };
 
@@ -112,6 +114,36 @@ static int disable_trim __read_mostly = 0;
 static int(*my_mallctl)(const char *, void *, size_t *, void *, size_t) = NULL;
 static int(*_malloc_trim)(size_t) = NULL;
 
+/* page types usable by the memory arena */
+enum pool_arena_pages {
+	POOL_ARENA_PG_NORMAL = 0, /* regular pages (THP unavailable) */
+	POOL_ARENA_PG_THP,        /* transparent huge pages via madvise() */
+	POOL_ARENA_PG_2M,         /* 2MB explicit huge pages (MAP_HUGETLB) */
+	POOL_ARENA_PG_1G,         /* 1GB explicit huge pages (MAP_HUGETLB) */
+};
+
+static const char *pool_arena_pg_names[] = {
+	[POOL_ARENA_PG_NORMAL] = "normal",
+	[POOL_ARENA_PG_THP]    = "thp",
+	[POOL_ARENA_PG_2M]     = "2m",
+	[POOL_ARENA_PG_1G]     = "1g",
+};
+
+/* The memory arena is a single area mapped and pre-faulted at boot, from
+ * which the objects of the pools listed in "tune.memory.arena-pools" are
+ * carved. It is never released.
+ */
+static struct {
+	char *area;         /* start of the mapped area, NULL if not mapped */
+	size_t size;        /* configured size, then usable size once mapped */
+	size_t used;        /* number of bytes already carved */
+	int pages;          /* requested page type (POOL_ARENA_PG_*) */
+	int mapped;         /* page type actually obtained (POOL_ARENA_PG_*) */
+	char *pools;        /* comma-delimited list of pool names, or NULL */
+} pool_arena __read_mostly = {
+	.pages = POOL_ARENA_PG_2M,
+};
+
 /* returns the pool hash bucket an object should use based on its pointer.
  * Objects will needed consistent bucket assignment so that they may be
  * allocated on one thread and released on another one. Thus only the
@@ -130,6 +162,39 @@ static forceinline unsigned int pool_tbucket(void)
 	return tid % CONFIG_HAP_POOL_BUCKETS;
 }
 
+/* returns the number of free lists a pool may have in its shared cache: the
+ * pointer-hashed buckets first, followed by the per-node lists.
+ */
+#define POOL_FREE_LISTS (CONFIG_HAP_POOL_BUCKETS + MAX_TGROUPS)
+
+/* returns a pointer to free list <idx> of pool <pool>, <idx> being lower than
+ * POOL_FREE_LISTS.
+ */
+static forceinline struct pool_item **pool_free_list(struct pool_head *pool, uint idx)
+{
+	if (idx < CONFIG_HAP_POOL_BUCKETS)
+		return &pool->buckets[idx].free_list;
+	return &pool->nodes[idx - CONFIG_HAP_POOL_BUCKETS].free_list;
+}
+
+/* returns a pointer to the word storing the node that item <item> of pool
+ * <pool> belongs to. Only valid when POOL_DBG_NUMA is set.
+ */
+static forceinline ulong *pool_node_ptr(const struct pool_head *pool, const void *item)
+{
+	uint ofs = pool->size;
+
+	if (pool_debugging & POOL_DBG_TAG)
+		ofs += POOL_EXTRA_MARK;
+	return (ulong *)((char *)item + ofs);
+}
+
+/* returns the node the calling thread belongs to */
+static forceinline uint pool_local_node(void)
+{
+	return tgid ? tgid - 1 : 0;
+}
+
 /* ask the allocator to trim memory pools.
  * This must run under thread isolation so that competing threads trying to
  * allocate or release memory do not prevent the allocator from completing
@@ -292,7 +357,7 @@ static int mem_should_fail(const struct pool_head *pool)
  */
 struct pool_head *create_pool(char *name, unsigned int size, unsigned int flags)
 {
-	unsigned int extra_mark, extra_caller, extra;
+	unsigned int extra_mark, extra_caller, extra_node, extra;
 	struct pool_head *pool;
 	struct pool_head *entry;
 	struct list *start;
@@ -301,15 +366,17 @@ struct pool_head *create_pool(char *name, unsigned int size, unsigned int flags)
 
 	extra_mark = (pool_debugging & POOL_DBG_TAG) ? POOL_EXTRA_MARK : 0;
 	extra_caller = (pool_debugging & POOL_DBG_CALLER) ? POOL_EXTRA_CALLER : 0;
-	extra = extra_mark + extra_caller;
+	extra_node = (pool_debugging & POOL_DBG_NUMA) ? POOL_EXTRA_NODE : 0;
+	extra = extra_mark + extra_caller + extra_node;
 
 	if (!(pool_debugging & POOL_DBG_NO_CACHE)) {
 		/* we'll store two lists there, we need the room for this. Let's
 		 * make sure it's always OK even when including the extra word
-		 * that is stored after the pci struct.
+		 * that is stored after the pci struct. The node word must not
+		 * be covered since it's needed while the object is cached.
 		 */
-		if (size + extra - extra_caller < sizeof(struct pool_cache_item))
-			size = sizeof(struct pool_cache_item) + extra_caller - extra;
+		if (size + extra_mark < sizeof(struct pool_cache_item))
+			size = sizeof(struct pool_cache_item) - extra_mark;
 	}
 
 	/* Now we know our size is set to the strict minimum possible. It may
@@ -382,9 +449,84 @@ struct pool_head *create_pool(char *name, unsigned int size, unsigned int flags)
 	return pool;
 }
 
+/* returns non-zero if <ptr> was carved from the memory arena */
+static forceinline int pool_in_arena(const void *ptr)
+{
+	return (const char *)ptr >= pool_arena.area &&
+	       (const char *)ptr < pool_arena.area + pool_arena.size;
+}
+
+/* returns the number of bytes an object of pool <pool> occupies in the arena.
+ * Objects are cache-line aligned so that they never share a line.
+ */
+static forceinline size_t pool_arena_objsz(const struct pool_head *pool)
+{
+	return (pool->alloc_sz + 63) & -(size_t)64;
+}
+
+/* Tries to get an object for pool <pool> from the memory arena, first by
+ * recycling one that was released there, then by carving a new one. Returns
+ * NULL if the arena is exhausted. Only used with MEM_F_ARENA.
+ */
+static void *pool_get_from_arena(struct pool_head *pool)
+{
+	struct pool_item *item;
+	size_t sz, ofs;
+
+	/* same locking principle as for the shared cache's free lists */
+	item = _HA_ATOMIC_LOAD(&pool->arena.free_list);
+	while (item) {
+		if (unlikely(item == POOL_BUSY)) {
+			item = (void*)pl_wait_new_long((ulong*)&pool->arena.free_list, (ulong)item);
+			continue;
+		}
+
+		item = _HA_ATOMIC_XCHG(&pool->arena.free_list, POOL_BUSY);
+		if (unlikely(item == POOL_BUSY))
+			continue;
+
+		/* this releases the lock */
+		HA_ATOMIC_STORE(&pool->arena.free_list, item ? item->next : NULL);
+		if (item) {
+			_HA_ATOMIC_DEC(&pool->arena.avail);
+			return item;
+		}
+	}
+
+	sz = pool_arena_objsz(pool);
+	ofs = HA_ATOMIC_LOAD(&pool_arena.used);
+	do {
+		if (ofs + sz > pool_arena.size)
+			return NULL;
+	} while (!HA_ATOMIC_CAS(&pool_arena.used, &ofs, ofs + sz));
+
+	_HA_ATOMIC_INC(&pool->arena.carved);
+	return pool_arena.area + ofs;
+}
+
+/* Releases object <ptr> of pool <pool> which was carved from the memory arena
+ * to the pool's arena free list.
+ */
+static void pool_put_to_arena(struct pool_head *pool, void *ptr)
+{
+	struct pool_item *item = ptr;
+	struct pool_item *free_list;
+
+	free_list = _HA_ATOMIC_LOAD(&pool->arena.free_list);
+	do {
+		while (unlikely(free_list == POOL_BUSY))
+			free_list = (void*)pl_wait_new_long((ulong*)&pool->arena.free_list, (ulong)free_list);
+		_HA_ATOMIC_STORE(&item->next, free_list);
+		__ha_barrier_atomic_store();
+	} while (!_HA_ATOMIC_CAS(&pool->arena.free_list, &free_list, item));
+	__ha_barrier_atomic_store();
+	_HA_ATOMIC_INC(&pool->arena.avail);
+}
+
 /* Tries to allocate an object for the pool <pool> using the system's allocator
  * and directly returns it. The pool's allocated counter is checked but NOT
  * updated, this is left to the caller, and but no other checks are performed.
+ * Pools marked with MEM_F_ARENA first try to use the memory arena.
  */
 void *pool_get_from_os_noinc(struct pool_head *pool)
 {
@@ -393,6 +535,8 @@ void *pool_get_from_os_noinc(struct pool_head *pool)
 
 		if (pool_debugging & POOL_DBG_UAF)
 			ptr = pool_alloc_area_uaf(pool->alloc_sz);
+		else if ((pool->flags & MEM_F_ARENA) && (ptr = pool_get_from_arena(pool)))
+			return ptr;
 		else
 			ptr = pool_alloc_area(pool->alloc_sz);
 		if (ptr)
@@ -407,10 +551,13 @@ void *pool_get_from_os_noinc(struct pool_head *pool)
 /* Releases a pool item back to the operating system but DOES NOT update
  * the allocation counter, it's left to the caller to do it. It may be
  * done before or after, it doesn't matter, the function does not use it.
+ * Items carved from the memory arena go back to the arena instead.
  */
 void pool_put_to_os_nodec(struct pool_head *pool, void *ptr)
 {
-	if (pool_debugging & POOL_DBG_UAF)
+	if (unlikely(pool_in_arena(ptr)))
+		pool_put_to_arena(pool, ptr);
+	else if (pool_debugging & POOL_DBG_UAF)
 		pool_free_area_uaf(ptr, pool->alloc_sz);
 	else
 		pool_free_area(ptr, pool->alloc_sz);
@@ -434,6 +581,10 @@ void *pool_alloc_nocache(struct pool_head *pool, const void *caller)
 	_HA_ATOMIC_INC(&pool->buckets[bucket].allocated);
 	_HA_ATOMIC_INC(&pool->buckets[bucket].used);
 
+	/* the object belongs to the node that touched it first */
+	if (pool_debugging & POOL_DBG_NUMA)
+		*pool_node_ptr(pool, ptr) = pool_local_node();
+
 	/* keep track of where the element was allocated from */
 	POOL_DEBUG_SET_MARK(pool, ptr);
 	POOL_DEBUG_TRACE_CALLER(pool, (struct pool_cache_item *)ptr, caller);
@@ -647,6 +798,39 @@ void pool_put_to_cache(struct pool_head *pool, void *ptr, const void *caller)
 	}
 }
 
+/* Detaches the first cluster of objects from the shared list of node <node>
+ * for pool <pool> and returns it, or NULL if the list is empty. The node's
+ * hit/miss counters are updated. Only used with POOL_DBG_NUMA.
+ */
+static struct pool_item *pool_take_from_node(struct pool_head *pool, uint node)
+{
+	struct pool_item *ret;
+
+	/* same locking principle as for the buckets, except that there is
+	 * no other list to try if this one is busy.
+	 */
+	ret = _HA_ATOMIC_LOAD(&pool->nodes[node].free_list);
+	do {
+		while (unlikely(ret == POOL_BUSY))
+			ret = (void*)pl_wait_new_long((ulong*)&pool->nodes[node].free_list, (ulong)ret);
+		if (ret == NULL)
+			goto miss;
+	} while (unlikely((ret = _HA_ATOMIC_XCHG(&pool->nodes[node].free_list, POOL_BUSY)) == POOL_BUSY));
+
+	if (unlikely(ret == NULL)) {
+		HA_ATOMIC_STORE(&pool->nodes[node].free_list, NULL);
+		goto miss;
+	}
+
+	/* this releases the lock */
+	HA_ATOMIC_STORE(&pool->nodes[node].free_list, ret->next);
+	_HA_ATOMIC_INC(&pool->nodes[node].hits);
+	return ret;
+ miss:
+	_HA_ATOMIC_INC(&pool->nodes[node].misses);
+	return NULL;
+}
+
 /* Tries to refill the local cache <pch> from the shared one for pool <pool>.
  * This is only used when pools are in use and shared pools are enabled. No
  * malloc() is attempted, and poisonning is never performed. The purpose is to
@@ -663,6 +847,16 @@ void pool_refill_local_from_shared(struct pool_head *pool, struct pool_cache_hea
 
 	BUG_ON(pool_debugging & POOL_DBG_NO_CACHE);
 
+	if (unlikely(pool_debugging & POOL_DBG_NUMA)) {
+		/* only objects from the local node are considered, otherwise
+		 * we prefer to allocate new ones that will be local.
+		 */
+		ret = pool_take_from_node(pool, pool_local_node());
+		if (!ret)
+			return;
+		goto store;
+	}
+
 	/* we'll need to reference the first element to figure the next one. We
 	 * must temporarily lock it so that nobody allocates then releases it,
 	 * or the dereference could fail. In order to limit the locking,
@@ -694,6 +888,7 @@ void pool_refill_local_from_shared(struct pool_head *pool, struct pool_cache_hea
 	/* this releases the lock */
 	HA_ATOMIC_STORE(&pool->buckets[bucket].free_list, ret->next);
 
+ store:
 	/* now store the retrieved object(s) into the local cache. Note that
 	 * they don't all have the same hash and that it doesn't necessarily
 	 * match the one from the pool.
@@ -726,6 +921,21 @@ void pool_put_to_shared_cache(struct pool_head *pool, struct pool_item *item)
 	struct pool_item *free_list;
 	uint bucket = pool_pbucket(item);
 
+	if (unlikely(pool_debugging & POOL_DBG_NUMA)) {
+		/* the cluster goes back to the node of its first object */
+		uint node = *pool_node_ptr(pool, item);
+
+		free_list = _HA_ATOMIC_LOAD(&pool->nodes[node].free_list);
+		do {
+			while (unlikely(free_list == POOL_BUSY))
+				free_list = (void*)pl_wait_new_long((ulong*)&pool->nodes[node].free_list, (ulong)free_list);
+			_HA_ATOMIC_STORE(&item->next, free_list);
+			__ha_barrier_atomic_store();
+		} while (!_HA_ATOMIC_CAS(&pool->nodes[node].free_list, &free_list, item));
+		__ha_barrier_atomic_store();
+		return;
+	}
+
 	/* we prefer to put the item into the entry that corresponds to its own
 	 * hash so that on return it remains in the right place, but that's not
 	 * mandatory.
@@ -749,26 +959,29 @@ void pool_put_to_shared_cache(struct pool_head *pool, struct pool_item *item)
 void pool_flush(struct pool_head *pool)
 {
 	struct pool_item *next, *temp, *down;
-	uint bucket;
+	struct pool_item **free_list;
+	uint idx;
 
 	if (!pool || (pool_debugging & (POOL_DBG_NO_CACHE|POOL_DBG_NO_GLOBAL)))
 		return;
 
 	/* The loop below atomically detaches the head of the free list and
-	 * replaces it with a NULL. Then the list can be released.
+	 * replaces it with a NULL. Then the list can be released. Both the
+	 * buckets and the per-node lists are visited.
 	 */
-	for (bucket = 0; bucket < CONFIG_HAP_POOL_BUCKETS; bucket++) {
-		next = pool->buckets[bucket].free_list;
+	for (idx = 0; idx < POOL_FREE_LISTS; idx++) {
+		free_list = pool_free_list(pool, idx);
+		next = *free_list;
 		while (1) {
 			while (unlikely(next == POOL_BUSY))
-				next = (void*)pl_wait_new_long((ulong*)&pool->buckets[bucket].free_list, (ulong)next);
+				next = (void*)pl_wait_new_long((ulong*)free_list, (ulong)next);
 
 			if (next == NULL)
 				break;
 
-			next = _HA_ATOMIC_XCHG(&pool->buckets[bucket].free_list, POOL_BUSY);
+			next = _HA_ATOMIC_XCHG(free_list, POOL_BUSY);
 			if (next != POOL_BUSY) {
-				HA_ATOMIC_STORE(&pool->buckets[bucket].free_list, NULL);
+				HA_ATOMIC_STORE(free_list, NULL);
 				break;
 			}
 		}
@@ -803,18 +1016,20 @@ void pool_gc(struct pool_head *pool_ctx)
 		struct pool_item *temp, *down;
 		uint allocated = pool_allocated(entry);
 		uint used = pool_used(entry);
-		int bucket = 0;
+		uint idx = 0;
 
 		while ((int)(allocated - used) > (int)entry->minavail) {
-			/* ok let's find next entry to evict */
-			while (!entry->buckets[bucket].free_list && bucket < CONFIG_HAP_POOL_BUCKETS)
-				bucket++;
+			/* ok let's find next entry to evict, either in the
+			 * buckets or in the per-node lists.
+			 */
+			while (idx < POOL_FREE_LISTS && !*pool_free_list(entry, idx))
+				idx++;
 
-			if (bucket >= CONFIG_HAP_POOL_BUCKETS)
+			if (idx >= POOL_FREE_LISTS)
 				break;
 
-			temp = entry->buckets[bucket].free_list;
-			entry->buckets[bucket].free_list = temp->next;
+			temp = *pool_free_list(entry, idx);
+			*pool_free_list(entry, idx) = temp->next;
 			for (; temp; temp = down) {
 				down = temp->down;
 				allocated--;
@@ -878,6 +1093,33 @@ void *__pool_alloc(struct pool_head *pool, unsigned int flags)
 	return p;
 }
 
+/* Releases object <ptr> that belongs to another node than the current one.
+ * Instead of being recycled by the local cache, it's directly sent back to
+ * its node's shared list, or to the OS if the pool already has enough free
+ * objects. Only used with POOL_DBG_NUMA.
+ */
+static void pool_put_to_home_node(struct pool_head *pool, void *ptr, const void *caller)
+{
+	struct pool_item *pi = (struct pool_item *)ptr;
+	uint node = *pool_node_ptr(pool, ptr);
+	uint bucket;
+
+	_HA_ATOMIC_INC(&pool->nodes[node].remote);
+	POOL_DEBUG_TRACE_CALLER(pool, (struct pool_cache_item *)ptr, caller);
+
+	if (!pool_releasable(pool)) {
+		pool_free_nocache(pool, ptr);
+		return;
+	}
+
+	bucket = pool_pbucket(ptr);
+	_HA_ATOMIC_DEC(&pool->buckets[bucket].used);
+	swrate_add_opportunistic(&pool->buckets[bucket].needed_avg, POOL_AVG_SAMPLES, pool->buckets[bucket].used);
+
+	pi->down = NULL;
+	pool_put_to_shared_cache(pool, pi);
+}
+
 /*
  * Puts a memory area back to the corresponding pool. <ptr> be valid. Using
  * pool_free() is preferred.
@@ -917,6 +1159,12 @@ void __pool_free(struct pool_head *pool, void *ptr)
 		return;
 	}
 
+	if (unlikely(pool_debugging & POOL_DBG_NUMA) &&
+	    *pool_node_ptr(pool, ptr) != pool_local_node()) {
+		pool_put_to_home_node(pool, ptr, caller);
+		return;
+	}
+
 	pool_put_to_cache(pool, ptr, caller);
 }
 
@@ -1136,6 +1384,7 @@ void dump_pools_to_trash(int by_what, int max, const char *pfx)
 	unsigned long long allocated, used;
 	int nbpools, i;
 	unsigned long long cached_bytes = 0;
+	unsigned long long arena_free = 0;
 	uint cached = 0;
 	uint alloc_items;
 
@@ -1185,13 +1434,36 @@ void dump_pools_to_trash(int by_what, int max, const char *pfx)
 	for (i = 0; i < nbpools && i < max; i++) {
 		chunk_appendf(&trash, "  - Pool %s (%lu bytes) : %lu allocated (%lu bytes), %lu used"
 			      " (~%lu by thread caches)"
-			      ", needed_avg %lu, %lu failures, %u users, @%p%s\n",
+			      ", needed_avg %lu, %lu failures, %u users, @%p%s%s\n",
 		              pool_info[i].entry->name, (ulong)pool_info[i].entry->size,
 			      pool_info[i].alloc_items, pool_info[i].alloc_bytes,
 			      pool_info[i].used_items, pool_info[i].cached_items,
 			      pool_info[i].need_avg, pool_info[i].failed_items,
 		              pool_info[i].entry->users, pool_info[i].entry,
-		              (pool_info[i].entry->flags & MEM_F_SHARED) ? " [SHARED]" : "");
+		              (pool_info[i].entry->flags & MEM_F_SHARED) ? " [SHARED]" : "",
+		              (pool_info[i].entry->flags & MEM_F_ARENA) ? " [ARENA]" : "");
+
+		if (pool_info[i].entry->flags & MEM_F_ARENA) {
+			const struct pool_head *ph = pool_info[i].entry;
+			uint carved = HA_ATOMIC_LOAD(&ph->arena.carved);
+			uint avail  = HA_ATOMIC_LOAD(&ph->arena.avail);
+
+			chunk_appendf(&trash, "      arena: %u carved (%lu bytes), %u free, %u%% fragmentation\n",
+				      carved, (ulong)(carved * pool_arena_objsz(ph)), avail,
+				      carved ? (uint)((ullong)avail * 100 / carved) : 0);
+			arena_free += avail * pool_arena_objsz(ph);
+		}
+
+		if (pool_debugging & POOL_DBG_NUMA) {
+			const struct pool_head *ph = pool_info[i].entry;
+			int node;
+
+			for (node = 0; node < global.nbtgroups; node++)
+				chunk_appendf(&trash, "      node %d: %u hits, %u misses, %u remote frees\n",
+					      node + 1, HA_ATOMIC_LOAD(&ph->nodes[node].hits),
+					      HA_ATOMIC_LOAD(&ph->nodes[node].misses),
+					      HA_ATOMIC_LOAD(&ph->nodes[node].remote));
+		}
 
 		cached_bytes += pool_info[i].cached_items * (ulong)pool_info[i].entry->size;
 		allocated    += pool_info[i].alloc_items  * (ulong)pool_info[i].entry->size;
@@ -1203,6 +1475,15 @@ void dump_pools_to_trash(int by_what, int max, const char *pfx)
 		      ".\n",
 	              nbpools, allocated, used, cached_bytes
 		      );
+
+	if (pool_arena.area) {
+		ullong arena_used = HA_ATOMIC_LOAD(&pool_arena.used);
+
+		chunk_appendf(&trash, "Arena: %llu bytes (%s pages), %llu carved (%u%%), %llu free in pools (%u%% fragmentation).\n",
+			      (ullong)pool_arena.size, pool_arena_pg_names[pool_arena.mapped],
+			      arena_used, (uint)(arena_used * 100 / pool_arena.size),
+			      arena_free, arena_used ? (uint)(arena_free * 100 / arena_used) : 0);
+	}
 }
 
 /* Dump statistics on pools usage. */
@@ -1483,6 +1764,170 @@ static int mem_parse_global_hot_size(char **args, int section_type, struct proxy
 	return 0;
 }
 
+/* Maps and pre-faults the memory arena if configured, and marks the pools it
+ * serves with MEM_F_ARENA. It's registered as a per-thread allocation function
+ * so that it runs in the final process once all pools exist, but only the
+ * first thread does the job. Returns 0 on failure.
+ */
+static int pool_arena_init(void)
+{
+	struct pool_head *entry;
+	size_t page = 2UL << 20;
+	char *area = MAP_FAILED;
+	char *names, *name, *next;
+	size_t ofs;
+
+	if (!pool_arena.size || pool_arena.area)
+		return 1;
+
+	if (pool_debugging & POOL_DBG_UAF) {
+		ha_warning("Memory arena disabled since use-after-free checks are enabled.\n");
+		pool_arena.size = 0;
+		return 1;
+	}
+
+#if defined(MAP_HUGETLB)
+	if (pool_arena.pages >= POOL_ARENA_PG_2M) {
+		int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE;
+
+		if (pool_arena.pages == POOL_ARENA_PG_1G)
+			page = 1UL << 30;
+#if defined(MAP_HUGE_SHIFT)
+		flags |= (pool_arena.pages == POOL_ARENA_PG_1G ? 30 : 21) << MAP_HUGE_SHIFT;
+#endif
+		pool_arena.size = (pool_arena.size + page - 1) & -page;
+		area = mmap(NULL, pool_arena.size, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (area == MAP_FAILED)
+			ha_warning("Failed to map %lu bytes of %s huge pages for the memory arena (%s), "
+				   "falling back to transparent huge pages.\n",
+				   (ulong)pool_arena.size, pool_arena_pg_names[pool_arena.pages], strerror(errno));
+		else
+			pool_arena.mapped = pool_arena.pages;
+	}
+#endif
+
+	if (area == MAP_FAILED) {
+		/* map one extra page to be able to align the area on a huge
+		 * page boundary, which is required for THP to be used.
+		 */
+		page = 2UL << 20;
+		pool_arena.size = (pool_arena.size + page - 1) & -page;
+		area = mmap(NULL, pool_arena.size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (area == MAP_FAILED) {
+			ha_alert("Failed to map %lu bytes for the memory arena (%s).\n",
+				 (ulong)pool_arena.size, strerror(errno));
+			return 0;
+		}
+		area = (char *)(((ulong)area + page - 1) & -page);
+
+		pool_arena.mapped = POOL_ARENA_PG_NORMAL;
+#if defined(MADV_HUGEPAGE)
+		if (madvise(area, pool_arena.size, MADV_HUGEPAGE) == 0)
+			pool_arena.mapped = POOL_ARENA_PG_THP;
+#endif
+		/* pre-fault the whole area now */
+		for (ofs = 0; ofs < pool_arena.size; ofs += 4096)
+			area[ofs] = 0;
+	}
+
+	pool_arena.area = area;
+
+	/* now mark the pools which will use the arena */
+	names = strdup(pool_arena.pools ? pool_arena.pools : "buffer,stream,connection");
+	if (!names) {
+		ha_alert("Out of memory while setting up the memory arena.\n");
+		return 0;
+	}
+
+	for (name = names; name; name = next) {
+		int found = 0;
+
+		next = strchr(name, ',');
+		if (next)
+			*next++ = 0;
+		if (!*name)
+			continue;
+
+		list_for_each_entry(entry, &pools, list) {
+			if (strcmp(entry->name, name) == 0) {
+				entry->flags |= MEM_F_ARENA;
+				found = 1;
+			}
+		}
+
+		if (!found)
+			ha_warning("Memory arena: no pool named '%s', ignoring it.\n", name);
+	}
+	free(names);
+	return 1;
+}
+
+/* config parser for global "tune.memory.arena-size" */
+static int mem_parse_global_arena_size(char **args, int section_type, struct proxy *curpx,
+                                       const struct proxy *defpx, const char *file, int line,
+                                       char **err)
+{
+	ullong size;
+	char *end;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	/* the size may exceed 4GB, so parse_size_err() is not usable */
+	size = strtoull(args[1], &end, 10);
+	switch (*end) {
+	case 'k': case 'K': size <<= 10; end++; break;
+	case 'm': case 'M': size <<= 20; end++; break;
+	case 'g': case 'G': size <<= 30; end++; break;
+	}
+
+	if (end == args[1] || *end) {
+		memprintf(err, "'%s' expects a size in bytes with an optional 'k', 'm' or 'g' suffix.", args[0]);
+		return -1;
+	}
+
+	pool_arena.size = size;
+	return 0;
+}
+
+/* config parser for global "tune.memory.arena-pages" */
+static int mem_parse_global_arena_pages(char **args, int section_type, struct proxy *curpx,
+                                        const struct proxy *defpx, const char *file, int line,
+                                        char **err)
+{
+	int pages;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	for (pages = POOL_ARENA_PG_THP; pages <= POOL_ARENA_PG_1G; pages++) {
+		if (strcmp(args[1], pool_arena_pg_names[pages]) == 0) {
+			pool_arena.pages = pages;
+			return 0;
+		}
+	}
+
+	memprintf(err, "'%s' expects '2m', '1g' or 'thp'.", args[0]);
+	return -1;
+}
+
+/* config parser for global "tune.memory.arena-pools" */
+static int mem_parse_global_arena_pools(char **args, int section_type, struct proxy *curpx,
+                                        const struct proxy *defpx, const char *file, int line,
+                                        char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	ha_free(&pool_arena.pools);
+	pool_arena.pools = strdup(args[1]);
+	if (!pool_arena.pools) {
+		memprintf(err, "out of memory");
+		return -1;
+	}
+	return 0;
+}
+
 /* config parser for global "no-memory-trimming" */
 static int mem_parse_global_no_mem_trim(char **args, int section_type, struct proxy *curpx,
                                        const struct proxy *defpx, const char *file, int line,
@@ -1497,12 +1942,16 @@ static int mem_parse_global_no_mem_trim(char **args, int section_type, struct pr
 /* register global config keywords */
 static struct cfg_kw_list mem_cfg_kws = {ILH, {
 	{ CFG_GLOBAL, "tune.fail-alloc", mem_parse_global_fail_alloc },
+	{ CFG_GLOBAL, "tune.memory.arena-pages", mem_parse_global_arena_pages },
+	{ CFG_GLOBAL, "tune.memory.arena-pools", mem_parse_global_arena_pools },
+	{ CFG_GLOBAL, "tune.memory.arena-size", mem_parse_global_arena_size },
 	{ CFG_GLOBAL, "tune.memory.hot-size", mem_parse_global_hot_size },
 	{ CFG_GLOBAL, "no-memory-trimming", mem_parse_global_no_mem_trim },
 	{ 0, NULL, NULL }
 }};
 
 INITCALL1(STG_REGISTER, cfg_register_keywords, &mem_cfg_kws);
+REGISTER_PER_THREAD_ALLOC(pool_arena_init);
 
 /*
  * Local variables:
@@ -669,6 +669,13 @@ static int quic_bind_listener(struct listener *listener, char *errmsg, int errle
 		break;
 	}
 
+#ifdef HA_HAVE_UDP_GRO
+	/* Let the kernel coalesce datagrams of the same flow on reception. */
+	if (!(global.tune.options & GTUNE_QUIC_NO_UDP_GRO) &&
+	    setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0)
+		listener->rx.flags |= RX_F_UDP_GRO;
+#endif
+
 	if (!quic_alloc_rxbufs_listener(listener)) {
 		msg = "could not initialize tx/rx rings";
 		err |= ERR_WARN;
@@ -10,6 +10,7 @@
  *
  */
 
+#include <ctype.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/types.h>
@@ -18,8 +19,10 @@
 
 #include <import/eb32tree.h>
 #include <import/ebistree.h>
+#include <import/ebsttree.h>
 
 #include <haproxy/acl.h>
+#include <haproxy/activity.h>
 #include <haproxy/api.h>
 #include <haproxy/applet.h>
 #include <haproxy/capture-t.h>
@@ -37,6 +40,7 @@
 #include <haproxy/listener.h>
 #include <haproxy/log.h>
 #include <haproxy/obj_type-t.h>
+#include <haproxy/pattern.h>
 #include <haproxy/peers.h>
 #include <haproxy/pool.h>
 #include <haproxy/protocol.h>
@@ -44,6 +48,7 @@
 #include <haproxy/proxy.h>
 #include <haproxy/sc_strm.h>
 #include <haproxy/quic_tp.h>
+#include <haproxy/sample.h>
 #include <haproxy/server-t.h>
 #include <haproxy/signal.h>
 #include <haproxy/stats-t.h>
@@ -61,6 +66,7 @@ struct eb_root used_proxy_id = EB_ROOT;	/* list of proxy IDs in use */
 struct eb_root proxy_by_name = EB_ROOT; /* tree of proxies sorted by name */
 struct eb_root defproxy_by_name = EB_ROOT; /* tree of default proxies sorted by name (dups possible) */
 unsigned int error_snapshot_id = 0;     /* global ID assigned to each error then incremented */
+struct list switching_tables = LIST_HEAD_INIT(switching_tables); /* list of all switching tables */
 
 /* CLI context used during "show servers {state|conn}" */
 struct show_srv_ctx {
@@ -191,6 +197,375 @@ void free_server_rules(struct list *srules)
 	}
 }
 
+/* minimum number of consecutive switching rules to build a switching table */
+#define SWITCHING_TABLE_MIN_RULES 4
+
+/* The strings indexed by a switching table. Each key holds the position of the
+ * first rule of the chain it appears in.
+ */
+struct switching_keys {
+	struct eb_root keys;			/* keys of case-sensitive rules */
+	struct eb_root ikeys;			/* lower case keys of case-insensitive rules */
+};
+
+struct switching_key {
+	int rule;				/* position of the rule in the chain */
+	struct ebmb_node node;			/* the key, must be last */
+};
+
+/* Returns the ACL expression of switching rule <rule> if the rule may be part
+ * of a switching table, otherwise NULL. This requires an "if" condition made
+ * of a single positive ACL with a single expression matching exact strings
+ * loaded in memory against a sample expression without side effects.
+ */
+static struct acl_expr *switching_rule_table_expr(const struct switching_rule *rule)
+{
+	const struct pattern_expr_list *pel;
+	const struct acl_term_suite *suite;
+	const struct acl_term *term;
+	struct acl_expr *expr;
+
+	if (!rule->cond || rule->cond->pol != ACL_COND_IF)
+		return NULL;
+
+	if (LIST_ISEMPTY(&rule->cond->suites) || rule->cond->suites.n != rule->cond->suites.p)
+		return NULL;
+	suite = LIST_NEXT(&rule->cond->suites, const struct acl_term_suite *, list);
+
+	if (LIST_ISEMPTY(&suite->terms) || suite->terms.n != suite->terms.p)
+		return NULL;
+	term = LIST_NEXT(&suite->terms, const struct acl_term *, list);
+
+	if (term->neg || LIST_ISEMPTY(&term->acl->expr) || term->acl->expr.n != term->acl->expr.p)
+		return NULL;
+	expr = LIST_NEXT(&term->acl->expr, struct acl_expr *, list);
+
+	if (expr->pat.match != pat_match_str || !sample_expr_pure(expr->smp))
+		return NULL;
+
+	list_for_each_entry(pel, &expr->pat.head, list) {
+		if (pel->expr->ref->bin)
+			return NULL;
+	}
+	return expr;
+}
+
+/* Releases the keys <keys> of a switching table. <keys> may be NULL. */
+static void switching_keys_free(struct switching_keys *keys)
+{
+	struct ebmb_node *node;
+
+	if (!keys)
+		return;
+
+	while ((node = ebmb_first(&keys->keys))) {
+		ebmb_delete(node);
+		free(container_of(node, struct switching_key, node));
+	}
+	while ((node = ebmb_first(&keys->ikeys))) {
+		ebmb_delete(node);
+		free(container_of(node, struct switching_key, node));
+	}
+	free(keys);
+}
+
+/* Indexes the current patterns of all the rules of switching table <tbl>.
+ * Returns the new keys, or NULL on memory allocation failure.
+ */
+static struct switching_keys *switching_keys_build(const struct switching_table *tbl)
+{
+	const struct pattern_expr_list *pel;
+	const struct pat_ref_elt *elt;
+	struct switching_keys *keys;
+	struct switching_key *key;
+	struct acl_expr *expr;
+	struct pat_ref *ref;
+	size_t len, i;
+	int icase, rule;
+
+	keys = calloc(1, sizeof(*keys));
+	if (!keys)
+		return NULL;
+
+	keys->keys = EB_ROOT_UNIQUE;
+	keys->ikeys = EB_ROOT_UNIQUE;
+
+	for (rule = 0; rule < tbl->nb_rules; rule++) {
+		expr = switching_rule_table_expr(tbl->rules[rule]);
+		list_for_each_entry(pel, &expr->pat.head, list) {
+			ref = pel->expr->ref;
+			icase = !!(pel->expr->mflags & PAT_MF_IGNORE_CASE);
+
+			HA_RWLOCK_RDLOCK(PATREF_LOCK, &ref->lock);
+			list_for_each_entry(elt, &ref->head, list) {
+				if (elt->gen_id != ref->curr_gen)
+					continue;
+
+				len = strlen(elt->pattern);
+				key = malloc(sizeof(*key) + len + 1);
+				if (!key) {
+					HA_RWLOCK_RDUNLOCK(PATREF_LOCK, &ref->lock);
+					switching_keys_free(keys);
+					return NULL;
+				}
+
+				key->rule = rule;
+				for (i = 0; i < len; i++)
+					key->node.key[i] = icase ? tolower((unsigned char)elt->pattern[i]) : elt->pattern[i];
+				key->node.key[len] = 0;
+
+				/* keys already present belong to earlier rules */
+				if (ebst_insert(icase ? &keys->ikeys : &keys->keys, &key->node) != &key->node)
+					free(key);
+			}
+			HA_RWLOCK_RDUNLOCK(PATREF_LOCK, &ref->lock);
+		}
+	}
+	return keys;
+}
+
+/* Returns the generation of the patterns of switching table <tbl>, which is
+ * the sum of the updates counters of its pattern references.
+ */
+static unsigned int switching_table_gen(const struct switching_table *tbl)
+{
+	unsigned int gen = 0;
+	int i;
+
+	for (i = 0; i < tbl->nb_refs; i++)
+		gen += HA_ATOMIC_LOAD(&tbl->refs[i]->updates);
+	return gen;
+}
+
+/* Task rebuilding the keys of the switching table passed in <context> when
+ * its pattern references changed. The generation is read first so that
+ * changes made during the build cause another one.
+ */
+static struct task *switching_table_refresh(struct task *t, void *context, unsigned int state)
+{
+	struct switching_table *tbl = context;
+	struct switching_keys *keys, *old;
+	unsigned int gen;
+
+	gen = switching_table_gen(tbl);
+	if (gen == HA_ATOMIC_LOAD(&tbl->gen))
+		return t;
+
+	/* on failure, the next lookup will try again */
+	keys = switching_keys_build(tbl);
+	if (!keys)
+		return t;
+
+	HA_RWLOCK_WRLOCK(SWTBL_LOCK, &tbl->lock);
+	old = tbl->keys;
+	tbl->keys = keys;
+	HA_ATOMIC_STORE(&tbl->gen, gen);
+	HA_RWLOCK_WRUNLOCK(SWTBL_LOCK, &tbl->lock);
+	switching_keys_free(old);
+	return t;
+}
+
+/* Looks up string <str> in switching keys <keys>. Returns the position of the
+ * first rule matching it, -1 if none does, or -2 if the string cannot be looked
+ * up because it contains zeroes or is too large.
+ */
+static int switching_keys_find(const struct switching_keys *keys, const struct buffer *str)
+{
+	struct buffer *tmp = get_trash_chunk();
+	struct ebmb_node *node;
+	int best = -1;
+	size_t i;
+
+	if (str->data >= tmp->size || memchr(str->area, 0, str->data))
+		return -2;
+
+	memcpy(tmp->area, str->area, str->data);
+	tmp->area[str->data] = 0;
+
+	node = ebst_lookup((struct eb_root *)&keys->keys, tmp->area);
+	if (node)
+		best = container_of(node, struct switching_key, node)->rule;
+
+	if (!eb_is_empty(&keys->ikeys)) {
+		for (i = 0; i < str->data; i++)
+			tmp->area[i] = tolower((unsigned char)tmp->area[i]);
+
+		node = ebst_lookup((struct eb_root *)&keys->ikeys, tmp->area);
+		if (node && (best < 0 || container_of(node, struct switching_key, node)->rule < best))
+			best = container_of(node, struct switching_key, node)->rule;
+	}
+	return best;
+}
+
+/* Evaluates at once the chain of switching rules of table <tbl> for stream
+ * <strm>. Returns the position in the chain of the first rule whose condition
+ * is met, -1 if none is, or -2 if the table could not be used, in which case
+ * the rules have to be evaluated one at a time.
+ */
+int switching_table_lookup(struct switching_table *tbl, struct proxy *px,
+                           struct session *sess, struct stream *strm)
+{
+	struct sample smp;
+	uint64_t start = 0;
+	int best = -1;
+	int idx;
+
+	if (unlikely(profiling & HA_PROF_RULES))
+		start = now_mono_time();
+
+	HA_RWLOCK_RDLOCK(SWTBL_LOCK, &tbl->lock);
+
+	if (unlikely(HA_ATOMIC_LOAD(&tbl->gen) != switching_table_gen(tbl))) {
+		/* some patterns changed, the rules are evaluated one at a
+		 * time until the task has rebuilt the keys.
+		 */
+		HA_RWLOCK_RDUNLOCK(SWTBL_LOCK, &tbl->lock);
+		task_wakeup(tbl->task, TASK_WOKEN_OTHER);
+		return -2;
+	}
+
+	memset(&smp, 0, sizeof(smp));
+	while (sample_process(px, sess, strm, SMP_OPT_DIR_REQ | SMP_OPT_FINAL | SMP_OPT_ITERATE, tbl->expr, &smp)) {
+		if (sample_convert(&smp, SMP_T_STR)) {
+			idx = switching_keys_find(tbl->keys, &smp.data.u.str);
+			if (idx == -2) {
+				best = -2;
+				break;
+			}
+			if (idx >= 0 && (best < 0 || idx < best))
+				best = idx;
+		}
+
+		if (!best || !(smp.flags & SMP_F_NOT_LAST))
+			break;
+	}
+
+	HA_RWLOCK_RDUNLOCK(SWTBL_LOCK, &tbl->lock);
+
+	if (unlikely(start)) {
+		HA_ATOMIC_ADD(&tbl->prof_time, now_mono_time() - start);
+		HA_ATOMIC_INC(&tbl->prof_lookups);
+		if (best >= 0)
+			HA_ATOMIC_INC(&tbl->prof_hits);
+	}
+	return best;
+}
+
+/* Releases switching table <tbl>. */
+static void switching_table_free(struct switching_table *tbl)
+{
+	LIST_DELETE(&tbl->list);
+	task_destroy(tbl->task);
+	switching_keys_free(tbl->keys);
+	HA_RWLOCK_DESTROY(&tbl->lock);
+	free(tbl->refs);
+	free(tbl->rules);
+	free(tbl);
+}
+
+/* Creates a switching table for the chain of <nb> switching rules starting at
+ * <first> in proxy <px>. Returns an error code.
+ */
+static int switching_table_create(struct proxy *px, struct switching_rule *first, int nb)
+{
+	const struct pattern_expr_list *pel;
+	struct switching_table *tbl;
+	struct switching_rule *rule;
+	int i, j, nb_refs = 0;
+
+	tbl = calloc(1, sizeof(*tbl));
+	if (!tbl)
+		goto oom;
+
+	HA_RWLOCK_INIT(&tbl->lock);
+	LIST_APPEND(&switching_tables, &tbl->list);
+	first->table = tbl;
+
+	tbl->rules = calloc(nb, sizeof(*tbl->rules));
+	if (!tbl->rules)
+		goto oom;
+
+	for (i = 0, rule = first; i < nb; i++, rule = LIST_NEXT(&rule->list, struct switching_rule *, list)) {
+		tbl->rules[i] = rule;
+		list_for_each_entry(pel, &switching_rule_table_expr(rule)->pat.head, list)
+			nb_refs++;
+	}
+
+	tbl->nb_rules = nb;
+	tbl->expr = switching_rule_table_expr(first)->smp;
+
+	/* the pattern references whose changes cause a rebuild */
+	tbl->refs = calloc(nb_refs, sizeof(*tbl->refs));
+	if (!tbl->refs)
+		goto oom;
+
+	for (i = 0; i < nb; i++) {
+		list_for_each_entry(pel, &switching_rule_table_expr(tbl->rules[i])->pat.head, list) {
+			for (j = 0; j < tbl->nb_refs && tbl->refs[j] != pel->expr->ref; j++)
+				;
+			if (j == tbl->nb_refs)
+				tbl->refs[tbl->nb_refs++] = pel->expr->ref;
+		}
+	}
+
+	tbl->task = task_new_anywhere();
+	if (!tbl->task)
+		goto oom;
+	tbl->task->process = switching_table_refresh;
+	tbl->task->context = tbl;
+
+	/* the keys are built at boot, then by the task */
+	tbl->gen = switching_table_gen(tbl);
+	tbl->keys = switching_keys_build(tbl);
+	if (!tbl->keys)
+		goto oom;
+
+	return ERR_NONE;
+
+ oom:
+	ha_alert("%s '%s': out of memory while building a switching table.\n",
+	         proxy_type_str(px), px->id);
+	return ERR_ALERT | ERR_FATAL;
+}
+
+/* Replaces the chains of at least SWITCHING_TABLE_MIN_RULES consecutive
+ * switching rules of proxy <px> comparing the same sample expression to strings
+ * with switching tables, when "tune.rules.optimize" is set. Returns an error
+ * code.
+ */
+static int proxy_build_switching_tables(struct proxy *px)
+{
+	struct switching_rule *rule, *first = NULL;
+	struct acl_expr *expr, *first_expr = NULL;
+	int err = ERR_NONE;
+	int nb = 0;
+
+	if (!acl_rules_optimize)
+		return ERR_NONE;
+
+	list_for_each_entry(rule, &px->switching_rules, list) {
+		expr = switching_rule_table_expr(rule);
+		if (expr && first && sample_expr_eq(expr->smp, first_expr->smp)) {
+			nb++;
+			continue;
+		}
+
+		if (nb >= SWITCHING_TABLE_MIN_RULES)
+			err |= switching_table_create(px, first, nb);
+
+		first = expr ? rule : NULL;
+		first_expr = expr;
+		nb = !!expr;
+	}
+
+	if (nb >= SWITCHING_TABLE_MIN_RULES)
+		err |= switching_table_create(px, first, nb);
+
+	return err;
+}
+
+REGISTER_POST_PROXY_CHECK(proxy_build_switching_tables);
+
 void free_proxy(struct proxy *p)
 {
 	struct server *s;
@@ -248,6 +623,8 @@ void free_proxy(struct proxy *p)
 
 	list_for_each_entry_safe(rule, ruleb, &p->switching_rules, list) {
 		LIST_DELETE(&rule->list);
+		if (rule->table)
+			switching_table_free(rule->table);
 		free_acl_cond(rule->cond);
 		if (rule->dynamic)
 			lf_expr_deinit(&rule->be.expr);
@@ -1927,11 +2304,13 @@ struct task *manage_proxy(struct task *t, void *context, unsigned int state)
 	 */
 	if (unlikely(stopping && (p->flags & (PR_FL_DISABLED|PR_FL_STOPPED)) && p->table && p->table->current)) {
 
-		if (!p->table->refcnt) {
+		if (!p->table->refcnt && !p->table->snapshot) {
 			/* !table->refcnt means there
 			 * is no more pending full resync
 			 * to push to a new process and
 			 * we are free to flush the table.
+			 * Tables with a snapshot are kept
+			 * until they are dumped on exit.
 			 */
 			int budget;
 			int cleaned_up;
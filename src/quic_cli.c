@@ -305,6 +305,8 @@ static void dump_quic_full(struct show_quic_ctx *ctx, struct quic_conn *qc)
 		              qc->path->loss.srtt, qc->path->loss.rtt_var,
 		              qc->path->loss.rtt_min, qc->path->loss.pto_count, (ullong)qc->path->cwnd,
 		              (ullong)qc->path->mcwnd, (ullong)qc->cntrs.sent_pkt, (ullong)qc->path->loss.nb_lost_pkt, (ullong)qc->path->loss.nb_reordered_pkt);
+		chunk_appendf(&trash, "  sentdgrams=%-6llu sndcalls=%-6llu\n",
+		              (ullong)qc->cntrs.sent_dgram, (ullong)qc->cntrs.snd_syscall);
 	}
 
 	if (qc->cntrs.dropped_pkt) {
@@ -1289,6 +1289,8 @@ static inline void quic_conn_prx_cntrs_update(struct quic_conn *qc)
 	HA_ATOMIC_ADD(&qc->prx_counters->sendto_err, qc->cntrs.sendto_err);
 	HA_ATOMIC_ADD(&qc->prx_counters->sendto_err_unknown, qc->cntrs.sendto_err_unknown);
 	HA_ATOMIC_ADD(&qc->prx_counters->sent_pkt, qc->cntrs.sent_pkt);
+	HA_ATOMIC_ADD(&qc->prx_counters->sent_dgram, qc->cntrs.sent_dgram);
+	HA_ATOMIC_ADD(&qc->prx_counters->snd_syscall, qc->cntrs.snd_syscall);
 	/* It is possible that ->path was not initialized. For instance if a
 	 * QUIC connection allocation has failed.
 	 */
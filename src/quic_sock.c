@@ -337,63 +337,35 @@ static struct quic_dgram *quic_rxbuf_purge_dgrams(struct quic_receiver_buf *rbuf
 	return prev;
 }
 
-/* Receive data from datagram socket <fd>. Data are placed in <out> buffer of
- * length <len>.
- *
- * Datagram addresses will be returned via the next arguments. <from> will be
- * the peer address and <to> the reception one. Note that <to> can only be
- * retrieved if the socket supports IP_PKTINFO or affiliated options. If not,
- * <to> will be set as AF_UNSPEC. The caller must specify <to_port> to ensure
- * that <to> address is completely filled.
- *
- * Returns value from recvmsg syscall.
- */
-static ssize_t quic_recv(int fd, void *out, size_t len,
-                         struct sockaddr *from, socklen_t from_len,
-                         struct sockaddr *to, socklen_t to_len,
-                         uint16_t dst_port)
-{
-	union pktinfo {
+/* Ancillary data which may be attached to a received datagram. */
+union quic_rx_pktinfo {
 #ifdef IP_PKTINFO
-		struct in_pktinfo in;
+	struct in_pktinfo in;
 #else /* !IP_PKTINFO */
-		struct in_addr addr;
+	struct in_addr addr;
 #endif
 #ifdef IPV6_RECVPKTINFO
-		struct in6_pktinfo in6;
+	struct in6_pktinfo in6;
 #endif
-	};
-	char cdata[CMSG_SPACE(sizeof(union pktinfo))];
-	struct msghdr msg;
-	struct iovec vec;
-	struct cmsghdr *cmsg;
-	ssize_t ret;
-
-	vec.iov_base = out;
-	vec.iov_len  = len;
-
-	memset(&msg, 0, sizeof(msg));
-	msg.msg_name    = from;
-	msg.msg_namelen = from_len;
-	msg.msg_iov     = &vec;
-	msg.msg_iovlen  = 1;
-	msg.msg_control = &cdata;
-	msg.msg_controllen = sizeof(cdata);
+};
 
-	clear_addr((struct sockaddr_storage *)to);
+#define QUIC_RX_CMSG_SPACE (CMSG_SPACE(sizeof(union quic_rx_pktinfo)) + CMSG_SPACE(sizeof(int)))
 
-	do {
-		ret = recvmsg(fd, &msg, 0);
-	} while (ret < 0 && errno == EINTR);
-
-	/* TODO handle errno. On EAGAIN/EWOULDBLOCK use fd_cant_recv() if
-	 * using dedicated connection socket.
-	 */
+/* Parse ancillary data of <msg> received on a QUIC socket. <to> is filled with
+ * the reception address if the socket supports IP_PKTINFO or affiliated
+ * options, with <dst_port> as port. If <seg_sz> is not NULL, it is set to the
+ * UDP GRO segment size when several datagrams were coalesced, or 0 if not.
+ */
+static void quic_recv_parse_cmsg(struct msghdr *msg,
+                                 struct sockaddr *to, socklen_t to_len,
+                                 uint16_t dst_port, size_t *seg_sz)
+{
+	struct cmsghdr *cmsg;
 
-	if (ret < 0)
-		goto end;
+	if (seg_sz)
+		*seg_sz = 0;
 
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
 		switch (cmsg->cmsg_level) {
 		case IPPROTO_IP:
 #if defined(IP_PKTINFO)
@@ -435,29 +407,156 @@ static ssize_t quic_recv(int fd, void *out, size_t len,
 			}
 #endif
 			break;
+
+#ifdef HA_HAVE_UDP_GRO
+		case SOL_UDP:
+			if (cmsg->cmsg_type == UDP_GRO && seg_sz) {
+				int gso_size;
+
+				memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+				*seg_sz = gso_size > 0 ? gso_size : 0;
+			}
+			break;
+#endif
 		}
 	}
+}
+
+/* Receive data from datagram socket <fd>. Data are placed in <out> buffer of
+ * length <len>.
+ *
+ * Datagram addresses will be returned via the next arguments. <from> will be
+ * the peer address and <to> the reception one. Note that <to> can only be
+ * retrieved if the socket supports IP_PKTINFO or affiliated options. If not,
+ * <to> will be set as AF_UNSPEC. The caller must specify <to_port> to ensure
+ * that <to> address is completely filled. If <seg_sz> is not NULL, it is set
+ * to the segment size of datagrams coalesced by UDP GRO, or 0 if there is
+ * only one datagram in <out>.
+ *
+ * Returns value from recvmsg syscall.
+ */
+static ssize_t quic_recv(int fd, void *out, size_t len,
+                         struct sockaddr *from, socklen_t from_len,
+                         struct sockaddr *to, socklen_t to_len,
+                         uint16_t dst_port, size_t *seg_sz)
+{
+	char cdata[QUIC_RX_CMSG_SPACE];
+	struct msghdr msg;
+	struct iovec vec;
+	ssize_t ret;
+
+	vec.iov_base = out;
+	vec.iov_len  = len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name    = from;
+	msg.msg_namelen = from_len;
+	msg.msg_iov     = &vec;
+	msg.msg_iovlen  = 1;
+	msg.msg_control = &cdata;
+	msg.msg_controllen = sizeof(cdata);
+
+	clear_addr((struct sockaddr_storage *)to);
+
+	do {
+		ret = recvmsg(fd, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	/* TODO handle errno. On EAGAIN/EWOULDBLOCK use fd_cant_recv() if
+	 * using dedicated connection socket.
+	 */
+
+	if (ret < 0)
+		goto end;
+
+	quic_recv_parse_cmsg(&msg, to, to_len, dst_port, seg_sz);
 
  end:
 	return ret;
 }
 
+/* Receive up to <nb> datagrams from socket <fd> in a single syscall. Each
+ * datagram is stored in its own slot of <slot_sz> bytes so that the i-th one
+ * starts at <out> + i * <slot_sz>. Addresses, lengths and GRO segment sizes
+ * are reported in <slots> which must contain at least <nb> entries. <dst_port>
+ * is used to complete the reception addresses. recvmmsg() is used when
+ * supported and more than one slot is requested.
+ *
+ * Returns the number of slots filled, or the syscall value if none was.
+ */
+static int quic_recv_batch(int fd, unsigned char *out, size_t slot_sz, int nb,
+                           struct quic_rx_slot *slots, uint16_t dst_port)
+{
+#ifdef HA_HAVE_MMSG
+	struct mmsghdr msgs[QUIC_MAX_RCV_DGRAMS];
+	struct iovec vecs[QUIC_MAX_RCV_DGRAMS];
+	char cdata[QUIC_MAX_RCV_DGRAMS][QUIC_RX_CMSG_SPACE];
+	int i, ret;
+
+	if (nb > QUIC_MAX_RCV_DGRAMS)
+		nb = QUIC_MAX_RCV_DGRAMS;
+
+	if (nb > 1) {
+		for (i = 0; i < nb; i++) {
+			vecs[i].iov_base = out + i * slot_sz;
+			vecs[i].iov_len  = slot_sz;
+
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name    = &slots[i].saddr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(slots[i].saddr);
+			msgs[i].msg_hdr.msg_iov     = &vecs[i];
+			msgs[i].msg_hdr.msg_iovlen  = 1;
+			msgs[i].msg_hdr.msg_control = cdata[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(cdata[i]);
+		}
+
+		do {
+			ret = recvmmsg(fd, msgs, nb, MSG_DONTWAIT, NULL);
+		} while (ret < 0 && errno == EINTR);
+
+		for (i = 0; i < ret; i++) {
+			clear_addr(&slots[i].daddr);
+			quic_recv_parse_cmsg(&msgs[i].msg_hdr,
+			                     (struct sockaddr *)&slots[i].daddr, sizeof(slots[i].daddr),
+			                     dst_port, &slots[i].seg_sz);
+			slots[i].len = msgs[i].msg_len;
+		}
+
+		return ret;
+	}
+#endif
+	{
+		ssize_t ret;
+
+		ret = quic_recv(fd, out, slot_sz,
+		                (struct sockaddr *)&slots[0].saddr, sizeof(slots[0].saddr),
+		                (struct sockaddr *)&slots[0].daddr, sizeof(slots[0].daddr),
+		                dst_port, &slots[0].seg_sz);
+		if (ret < 0)
+			return ret;
+
+		slots[0].len = ret;
+		return !!ret;
+	}
+}
+
 /* Function called on a read event from a listening socket. It tries
  * to handle as many connections as possible.
  */
 void quic_lstnr_sock_fd_iocb(int fd)
 {
-	ssize_t ret;
+	int ret;
 	struct quic_receiver_buf *rxbuf;
 	struct buffer *buf;
 	struct listener *l = objt_listener(fdtab[fd].owner);
 	struct quic_transport_params *params;
-	/* Source address */
-	struct sockaddr_storage saddr = {0}, daddr = {0};
-	size_t max_sz, cspace;
+	struct quic_counters *prx_counters;
+	struct quic_rx_slot slots[QUIC_MAX_RCV_DGRAMS];
+	size_t max_sz, slot_sz, cspace;
 	struct quic_dgram *new_dgram;
 	unsigned char *dgram_buf;
-	int max_dgrams;
+	int max_dgrams, nb_slots, i;
+	long long nb_dgrams = 0, nb_calls = 0;
 
 	BUG_ON(!l);
 
@@ -468,6 +567,7 @@ void quic_lstnr_sock_fd_iocb(int fd)
 	if (!(fdtab[fd].state & FD_POLL_IN) || !fd_recv_ready(fd))
 		return;
 
+	prx_counters = EXTRA_COUNTERS_GET(l->bind_conf->frontend->extra_counters_fe, &quic_stats_module);
 	rxbuf = MT_LIST_POP(&l->rx.rxbuf_list, typeof(rxbuf), rxbuf_el);
 	if (!rxbuf)
 		goto out;
@@ -484,10 +584,12 @@ void quic_lstnr_sock_fd_iocb(int fd)
 
 	params = &l->bind_conf->quic_params;
 	max_sz = params->max_udp_payload_size;
+	/* With UDP GRO, the kernel may deliver up to 64kB of coalesced
+	 * datagrams at once, which must never be truncated.
+	 */
+	slot_sz = (l->rx.flags & RX_F_UDP_GRO) ? QUIC_GRO_RCV_SZ : max_sz;
 	cspace = b_contig_space(buf);
-	if (cspace < max_sz) {
-		struct proxy *px = l->bind_conf->frontend;
-		struct quic_counters *prx_counters = EXTRA_COUNTERS_GET(px->extra_counters_fe, &quic_stats_module);
+	if (cspace < slot_sz) {
 		struct quic_dgram *dgram;
 
 		/* Do no mark <buf> as full, and do not try to consume it
@@ -515,32 +617,69 @@ void quic_lstnr_sock_fd_iocb(int fd)
 
 		/* Consume the remaining space */
 		b_add(buf, cspace);
-		if (b_contig_space(buf) < max_sz) {
+		if (b_contig_space(buf) < slot_sz) {
 			HA_ATOMIC_INC(&prx_counters->rxbuf_full);
 			goto out;
 		}
 	}
 
+	/* Without GRO, try to fill several slots with a single syscall. */
+	nb_slots = 1;
+	if (!(l->rx.flags & RX_F_UDP_GRO)) {
+		nb_slots = b_contig_space(buf) / slot_sz;
+		if (nb_slots > max_dgrams)
+			nb_slots = max_dgrams;
+		if (nb_slots > QUIC_MAX_RCV_DGRAMS)
+			nb_slots = QUIC_MAX_RCV_DGRAMS;
+	}
+
 	dgram_buf = (unsigned char *)b_tail(buf);
-	ret = quic_recv(fd, dgram_buf, max_sz,
-	                (struct sockaddr *)&saddr, sizeof(saddr),
-	                (struct sockaddr *)&daddr, sizeof(daddr),
-	                get_net_port(&l->rx.addr));
+	ret = quic_recv_batch(fd, dgram_buf, slot_sz, nb_slots, slots,
+	                      get_net_port(&l->rx.addr));
 	if (ret <= 0)
 		goto out;
 
-	b_add(buf, ret);
-	if (!quic_lstnr_dgram_dispatch(dgram_buf, ret, l, &saddr, &daddr,
-	                               new_dgram, &rxbuf->dgram_list)) {
-		/* If wrong, consume this datagram */
-		b_sub(buf, ret);
+	nb_calls++;
+	for (i = 0; i < ret; i++) {
+		unsigned char *src = dgram_buf + i * slot_sz;
+		size_t ofs, len, seg_sz = slots[i].seg_sz;
+
+		if (!seg_sz || seg_sz > slots[i].len)
+			seg_sz = slots[i].len;
+
+		/* Split GRO segments and pack all datagrams one after the
+		 * other in <buf>. Data are only moved backwards, never over
+		 * an already dispatched datagram.
+		 */
+		for (ofs = 0; ofs < slots[i].len; ofs += len) {
+			unsigned char *pos = (unsigned char *)b_tail(buf);
+
+			len = MIN(seg_sz, slots[i].len - ofs);
+			if (pos != src + ofs)
+				memmove(pos, src + ofs, len);
+
+			b_add(buf, len);
+			nb_dgrams++;
+			max_dgrams--;
+			if (!quic_lstnr_dgram_dispatch(pos, len, l, &slots[i].saddr, &slots[i].daddr,
+			                               new_dgram, &rxbuf->dgram_list)) {
+				/* If wrong, consume this datagram */
+				b_sub(buf, len);
+			}
+			new_dgram = NULL;
+		}
 	}
-	new_dgram = NULL;
-	if (--max_dgrams > 0)
+
+	if (max_dgrams > 0)
 		goto start;
  out:
+	if (nb_calls) {
+		HA_ATOMIC_ADD(&prx_counters->rcv_syscall, nb_calls);
+		HA_ATOMIC_ADD(&prx_counters->rcvd_dgram, nb_dgrams);
+	}
 	pool_free(pool_head_quic_dgram, new_dgram);
-	MT_LIST_APPEND(&l->rx.rxbuf_list, &rxbuf->rxbuf_el);
+	if (rxbuf)
+		MT_LIST_APPEND(&l->rx.rxbuf_list, &rxbuf->rxbuf_el);
 }
 
 /* FD-owned quic-conn socket callback. */
@@ -646,38 +785,63 @@ static void cmsg_set_saddr(struct msghdr *msg, struct cmsghdr **cmsg,
 	}
 }
 
-/* Send a datagram stored into <buf> buffer with <sz> as size.
- * The caller must ensure there is at least <sz> bytes in this buffer.
- *
- * Returns the total bytes sent over the socket. 0 is returned if a transient
- * error is encountered which allows send to be retry later. A negative value
- * is used for a fatal error which guarantee that all future send operation for
- * this connection will fail.
+#ifdef HA_HAVE_UDP_GSO
+/* Append a UDP_SEGMENT ancillary data to <msg> so that its payload is split by
+ * the kernel into datagrams of <gso_size> bytes. <cmsg> points to the last
+ * ancillary data already set, or NULL if none.
+ */
+static void cmsg_set_gso(struct msghdr *msg, struct cmsghdr **cmsg,
+                         uint16_t gso_size)
+{
+	struct cmsghdr *c;
+	size_t sz = sizeof(gso_size);
+
+	/* Set first msg_controllen to be able to use CMSG_* macros. */
+	msg->msg_controllen += CMSG_SPACE(sz);
+
+	*cmsg = !(*cmsg) ? CMSG_FIRSTHDR(msg) : CMSG_NXTHDR(msg, *cmsg);
+	ALREADY_CHECKED(*cmsg);
+	c = *cmsg;
+	c->cmsg_len = CMSG_LEN(sz);
+	c->cmsg_level = SOL_UDP;
+	c->cmsg_type = UDP_SEGMENT;
+	memcpy(CMSG_DATA(c), &gso_size, sz);
+}
+#endif /* HA_HAVE_UDP_GSO */
+
+/* Send <nb> datagrams described by <iov> array for <qc> connection, all
+ * to the same peer. If <gso_size> is not null, they are coalesced in a single
+ * sendmsg() call using UDP GSO : all of them must be <gso_size> bytes long
+ * except the last one which may be shorter. If GSO is not supported on the
+ * path, it is disabled on the listener and datagrams are sent again without
+ * it. Else, sendmmsg() is used when supported to send them in a single
+ * syscall, or they are sent one at a time.
  *
- * TODO standardize this function for a generic UDP sendto wrapper. This can be
- * done by removing the <qc> arg and replace it with address/port.
+ * Returns the number of datagrams sent over the socket, which may be less than
+ * <nb>. 0 is returned if a transient error is encountered on the first
+ * datagram which allows send to be retried later. A negative value is used
+ * for a fatal error which guarantees that all future send operations for this
+ * connection will fail.
  */
-int qc_snd_buf(struct quic_conn *qc, const struct buffer *buf, size_t sz,
-               int flags)
+int qc_snd_dgrams(struct quic_conn *qc, struct iovec *iov, int nb,
+                  uint16_t gso_size)
 {
 	ssize_t ret;
+	int i, sent = 0;
 	struct msghdr msg;
-	struct iovec vec;
 	struct cmsghdr *cmsg __maybe_unused = NULL;
-
 	union {
 #ifdef IP_PKTINFO
-		char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+		char buf[CMSG_SPACE(sizeof(struct in_pktinfo)) + CMSG_SPACE(sizeof(uint16_t))];
 #endif /* IP_PKTINFO */
 #ifdef IPV6_RECVPKTINFO
-		char buf6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+		char buf6[CMSG_SPACE(sizeof(struct in6_pktinfo)) + CMSG_SPACE(sizeof(uint16_t))];
 #endif /* IPV6_RECVPKTINFO */
-		char bufaddr[CMSG_SPACE(sizeof(struct in_addr))];
+		char bufaddr[CMSG_SPACE(sizeof(struct in_addr)) + CMSG_SPACE(sizeof(uint16_t))];
 		struct cmsghdr align;
 	} ancillary_data;
 
-	vec.iov_base = b_peek(buf, b_head_ofs(buf));
-	vec.iov_len = sz;
+	BUG_ON(nb > QUIC_MAX_SND_DGRAMS);
 
 	/* man 2 sendmsg
 	 *
@@ -696,7 +860,7 @@ int qc_snd_buf(struct quic_conn *qc, const struct buffer *buf, size_t sz,
 		msg.msg_namelen = 0;
 	}
 
-	msg.msg_iov = &vec;
+	msg.msg_iov = iov;
 	msg.msg_iovlen = 1;
 	msg.msg_control = NULL;
 	msg.msg_controllen = 0;
@@ -705,46 +869,161 @@ int qc_snd_buf(struct quic_conn *qc, const struct buffer *buf, size_t sz,
 	if (qc_test_fd(qc) && !fd_send_ready(qc->fd))
 		return 0;
 
+	/* CMSG_NXTHDR() may read the next header length, it must be zeroed. */
+	memset(&ancillary_data, 0, sizeof(ancillary_data));
+
 	/* Set source address when using listener socket if possible. */
 	if (!qc_test_fd(qc) && is_addr(&qc->local_addr)) {
 		msg.msg_control = ancillary_data.bufaddr;
 		cmsg_set_saddr(&msg, &cmsg, &qc->local_addr);
 	}
 
-	do {
-		ret = sendmsg(qc_fd(qc), &msg, MSG_DONTWAIT|MSG_NOSIGNAL);
-	} while (ret < 0 && errno == EINTR);
+#ifdef HA_HAVE_UDP_GSO
+	if (gso_size && nb > 1 && !(HA_ATOMIC_LOAD(&qc->li->flags) & LI_F_UDP_GSO_NOTSUPP)) {
+		struct cmsghdr *gso_cmsg = cmsg;
+		size_t controllen = msg.msg_controllen;
+		size_t total = 0;
 
-	if (ret < 0) {
-		if (errno == EAGAIN || errno == EWOULDBLOCK ||
-		    errno == ENOTCONN || errno == EINPROGRESS) {
-			/* transient error */
-			if (errno == EAGAIN || errno == EWOULDBLOCK)
-				qc->cntrs.socket_full++;
-			else
-				qc->cntrs.sendto_err++;
-
-			if (qc_test_fd(qc)) {
-				fd_want_send(qc->fd);
-				fd_cant_send(qc->fd);
-			}
-			TRACE_PRINTF(TRACE_LEVEL_USER, QUIC_EV_CONN_SPPKTS, qc, 0, 0, 0,
-			             "UDP send failure errno=%d (%s)", errno, strerror(errno));
-			return 0;
+		for (i = 0; i < nb; i++)
+			total += iov[i].iov_len;
+
+		msg.msg_control = ancillary_data.bufaddr;
+		cmsg_set_gso(&msg, &gso_cmsg, gso_size);
+		msg.msg_iovlen = nb;
+
+		do {
+			ret = sendmsg(qc_fd(qc), &msg, MSG_DONTWAIT|MSG_NOSIGNAL);
+		} while (ret < 0 && errno == EINTR);
+		qc->cntrs.snd_syscall++;
+
+		if (ret >= 0) {
+			/* the whole payload is sent at once or not at all */
+			if (ret != total)
+				return 0;
+
+			qc->cntrs.sent_dgram += nb;
+			return nb;
+		}
+
+		if (errno != EIO && errno != EINVAL)
+			goto err;
+
+		/* EIO is reported when the output device does not support
+		 * checksum offload. Fallback to regular sending from now on.
+		 */
+		TRACE_PRINTF(TRACE_LEVEL_USER, QUIC_EV_CONN_SPPKTS, qc, 0, 0, 0,
+		             "UDP GSO failure errno=%d (%s), disabling it", errno, strerror(errno));
+		HA_ATOMIC_OR(&qc->li->flags, LI_F_UDP_GSO_NOTSUPP);
+		msg.msg_iovlen = 1;
+		msg.msg_controllen = controllen;
+		if (!controllen)
+			msg.msg_control = NULL;
+	}
+#endif /* HA_HAVE_UDP_GSO */
+
+#ifdef HA_HAVE_MMSG
+	if (nb > 1) {
+		struct mmsghdr msgs[QUIC_MAX_SND_DGRAMS];
+
+		for (i = 0; i < nb; i++) {
+			msgs[i].msg_hdr = msg;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_len = 0;
+		}
+
+		do {
+			ret = sendmmsg(qc_fd(qc), msgs, nb, MSG_DONTWAIT|MSG_NOSIGNAL);
+		} while (ret < 0 && errno == EINTR);
+		qc->cntrs.snd_syscall++;
+
+		if (ret < 0)
+			goto err;
+
+		/* a truncated datagram ends the batch */
+		for (sent = 0; sent < ret; sent++) {
+			if (msgs[sent].msg_len != iov[sent].iov_len)
+				break;
 		}
-		else {
-			/* unrecoverable error */
-			qc->cntrs.sendto_err_unknown++;
-			TRACE_PRINTF(TRACE_LEVEL_USER, QUIC_EV_CONN_SPPKTS, qc, 0, 0, 0,
-			             "UDP send failure errno=%d (%s)", errno, strerror(errno));
-			return -1;
+
+		qc->cntrs.sent_dgram += sent;
+		return sent;
+	}
+#endif /* HA_HAVE_MMSG */
+
+	for (i = 0; i < nb; i++) {
+		msg.msg_iov = &iov[i];
+		do {
+			ret = sendmsg(qc_fd(qc), &msg, MSG_DONTWAIT|MSG_NOSIGNAL);
+		} while (ret < 0 && errno == EINTR);
+		qc->cntrs.snd_syscall++;
+
+		if (ret < 0) {
+			/* errors are only reported if nothing could be sent */
+			if (sent)
+				break;
+			goto err;
 		}
+
+		if (ret != iov[i].iov_len)
+			break;
+
+		sent++;
+		qc->cntrs.sent_dgram++;
 	}
 
-	if (ret != sz)
+	return sent;
+
+ err:
+	if (errno == EAGAIN || errno == EWOULDBLOCK ||
+	    errno == ENOTCONN || errno == EINPROGRESS) {
+		/* transient error */
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			qc->cntrs.socket_full++;
+		else
+			qc->cntrs.sendto_err++;
+
+		if (qc_test_fd(qc)) {
+			fd_want_send(qc->fd);
+			fd_cant_send(qc->fd);
+		}
+		TRACE_PRINTF(TRACE_LEVEL_USER, QUIC_EV_CONN_SPPKTS, qc, 0, 0, 0,
+		             "UDP send failure errno=%d (%s)", errno, strerror(errno));
 		return 0;
+	}
+	else {
+		/* unrecoverable error */
+		qc->cntrs.sendto_err_unknown++;
+		TRACE_PRINTF(TRACE_LEVEL_USER, QUIC_EV_CONN_SPPKTS, qc, 0, 0, 0,
+		             "UDP send failure errno=%d (%s)", errno, strerror(errno));
+		return -1;
+	}
+}
 
-	return ret;
+/* Send a datagram stored into <buf> buffer with <sz> as size.
+ * The caller must ensure there is at least <sz> bytes in this buffer.
+ *
+ * Returns the total bytes sent over the socket. 0 is returned if a transient
+ * error is encountered which allows send to be retry later. A negative value
+ * is used for a fatal error which guarantee that all future send operation for
+ * this connection will fail.
+ *
+ * TODO standardize this function for a generic UDP sendto wrapper. This can be
+ * done by removing the <qc> arg and replace it with address/port.
+ */
+int qc_snd_buf(struct quic_conn *qc, const struct buffer *buf, size_t sz,
+               int flags)
+{
+	struct iovec vec;
+	int ret;
+
+	vec.iov_base = b_peek(buf, b_head_ofs(buf));
+	vec.iov_len = sz;
+
+	ret = qc_snd_dgrams(qc, &vec, 1, 0);
+	if (ret <= 0)
+		return ret;
+
+	return sz;
 }
 
 /* Receive datagram on <qc> FD-owned socket.
@@ -786,7 +1065,7 @@ int qc_rcv_buf(struct quic_conn *qc)
 		ret = quic_recv(qc->fd, dgram_buf, max_sz,
 		                (struct sockaddr *)&saddr, sizeof(saddr),
 		                (struct sockaddr *)&daddr, sizeof(daddr),
-		                get_net_port(&qc->local_addr));
+		                get_net_port(&qc->local_addr), NULL);
 		if (ret <= 0) {
 			/* Subscribe FD for future reception. */
 			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN)
@@ -35,6 +35,14 @@ static struct name_desc quic_stats[] = {
 	                                  .desc = "Total number of handshake failures" },
 	[QUIC_ST_STATELESS_RESET_SENT] = { .name = "quic_stless_rst_sent",
 	                                  .desc = "Total number of stateless reset packet sent" },
+	[QUIC_ST_SENT_DGRAM]          = { .name = "quic_sent_dgram",
+	                                  .desc = "Total number of sent datagrams" },
+	[QUIC_ST_SND_SYSCALL]         = { .name = "quic_snd_syscall",
+	                                  .desc = "Total number of syscalls used to send datagrams (sendmsg/sendmmsg)" },
+	[QUIC_ST_RCVD_DGRAM]          = { .name = "quic_rcvd_dgram",
+	                                  .desc = "Total number of datagrams received on listener sockets" },
+	[QUIC_ST_RCV_SYSCALL]         = { .name = "quic_rcv_syscall",
+	                                  .desc = "Total number of syscalls used to receive datagrams on listener sockets (recvmsg/recvmmsg)" },
 	/* Special events of interest */
 	[QUIC_ST_CONN_MIGRATION_DONE] = { .name = "quic_conn_migration_done",
 	                                  .desc = "Total number of connection migration proceeded" },
@@ -147,6 +155,18 @@ static int quic_fill_stats(void *data, struct field *stats, unsigned int *select
 		case QUIC_ST_STATELESS_RESET_SENT:
 			metric = mkf_u64(FN_COUNTER, counters->stateless_reset_sent);
 			break;
+		case QUIC_ST_SENT_DGRAM:
+			metric = mkf_u64(FN_COUNTER, counters->sent_dgram);
+			break;
+		case QUIC_ST_SND_SYSCALL:
+			metric = mkf_u64(FN_COUNTER, counters->snd_syscall);
+			break;
+		case QUIC_ST_RCVD_DGRAM:
+			metric = mkf_u64(FN_COUNTER, counters->rcvd_dgram);
+			break;
+		case QUIC_ST_RCV_SYSCALL:
+			metric = mkf_u64(FN_COUNTER, counters->rcv_syscall);
+			break;
 
 		/* Special events of interest */
 		case QUIC_ST_CONN_MIGRATION_DONE:
@@ -253,7 +253,123 @@ static void qc_purge_tx_buf(struct quic_conn *qc, struct buffer *buf)
 	BUG_ON(b_data(buf));
 }
 
-/* Send datagrams stored in <buf>.
+/* Fill <iov> with the datagrams stored at the head of <buf> which may be sent
+ * with a single syscall. If UDP GSO may be used, the first datagram size is
+ * stored into <gso_size> and only the next datagrams of the same size are
+ * collected, the last one being allowed to be shorter. Else <gso_size> is set
+ * to 0 and datagrams of any size are collected.
+ *
+ * Returns the number of datagrams collected, at least one.
+ */
+static int qc_txb_collect_dgrams(struct quic_conn *qc, struct buffer *buf,
+                                 struct iovec *iov, uint16_t *gso_size)
+{
+	const size_t headlen = sizeof(uint16_t) + sizeof(void *);
+	size_t ofs = 0, total = 0, data = b_contig_data(buf, 0);
+	int gso = 0, nb = 0;
+
+#ifdef HA_HAVE_UDP_GSO
+	gso = !(global.tune.options & GTUNE_QUIC_NO_UDP_GSO) &&
+	      !(HA_ATOMIC_LOAD(&qc->li->flags) & LI_F_UDP_GSO_NOTSUPP);
+#endif
+	*gso_size = 0;
+
+	while (ofs + headlen <= data && nb < QUIC_MAX_SND_DGRAMS) {
+		unsigned char *pos = (unsigned char *)b_head(buf) + ofs;
+		uint16_t dglen = read_u16(pos);
+
+		BUG_ON_HOT(!dglen); /* this should not happen */
+		if (nb && gso &&
+		    (dglen > *gso_size || total + dglen > QUIC_MAX_GSO_PAYLOAD))
+			break;
+
+		iov[nb].iov_base = pos + headlen;
+		iov[nb].iov_len = dglen;
+		nb++;
+		total += dglen;
+		ofs += headlen + dglen;
+
+		if (gso) {
+			if (nb == 1)
+				*gso_size = dglen;
+			else if (dglen < *gso_size)
+				break; /* a shorter segment must be the last one */
+		}
+	}
+
+	return nb;
+}
+
+/* Remove the datagram at the head of <buf> after it has been sent and update
+ * the state of each of its coalesced packets for <qc> connection.
+ */
+static void qc_txb_dgram_sent(struct quic_conn *qc, struct buffer *buf)
+{
+	struct quic_tx_packet *first_pkt, *pkt, *next_pkt;
+	uint16_t dglen;
+	size_t headlen = sizeof dglen + sizeof first_pkt;
+	unsigned int time_sent;
+
+	dglen = read_u16(b_head(buf));
+	first_pkt = read_ptr(b_head(buf) + sizeof dglen);
+	b_del(buf, dglen + headlen);
+	qc->bytes.tx += dglen;
+	time_sent = now_ms;
+
+	for (pkt = first_pkt; pkt; pkt = next_pkt) {
+		struct quic_cc *cc = &qc->path->cc;
+		/* RFC 9000 14.1 Initial datagram size
+		 * a server MUST expand the payload of all UDP datagrams carrying ack-eliciting
+		 * Initial packets to at least the smallest allowed maximum datagram size of
+		 * 1200 bytes.
+		 */
+		qc->cntrs.sent_pkt++;
+		BUG_ON_HOT(pkt->type == QUIC_PACKET_TYPE_INITIAL &&
+		           (pkt->flags & QUIC_FL_TX_PACKET_ACK_ELICITING) &&
+		           dglen < QUIC_INITIAL_PACKET_MINLEN);
+
+		pkt->time_sent = time_sent;
+		if (pkt->flags & QUIC_FL_TX_PACKET_ACK_ELICITING) {
+			pkt->pktns->tx.time_of_last_eliciting = time_sent;
+			qc->path->ifae_pkts++;
+			if (qc->flags & QUIC_FL_CONN_IDLE_TIMER_RESTARTED_AFTER_READ)
+				qc_idle_timer_rearm(qc, 0, 0);
+		}
+		if (!(qc->flags & QUIC_FL_CONN_CLOSING) &&
+		    (pkt->flags & QUIC_FL_TX_PACKET_CC)) {
+			qc->flags |= QUIC_FL_CONN_CLOSING;
+			qc_detach_th_ctx_list(qc, 1);
+
+			/* RFC 9000 10.2. Immediate Close:
+			 * The closing and draining connection states exist to ensure
+			 * that connections close cleanly and that delayed or reordered
+			 * packets are properly discarded. These states SHOULD persist
+			 * for at least three times the current PTO interval...
+			 *
+			 * Rearm the idle timeout only one time when entering closing
+			 * state.
+			 */
+			qc_idle_timer_do_rearm(qc, 0);
+			if (qc->timer_task) {
+				task_destroy(qc->timer_task);
+				qc->timer_task = NULL;
+			}
+		}
+		qc->path->in_flight += pkt->in_flight_len;
+		pkt->pktns->tx.in_flight += pkt->in_flight_len;
+		if ((global.tune.options & GTUNE_QUIC_CC_HYSTART) && pkt->pktns == qc->apktns)
+			cc->algo->hystart_start_round(cc, pkt->pn_node.key);
+		if (pkt->in_flight_len)
+			qc_set_timer(qc);
+		TRACE_PROTO("TX pkt", QUIC_EV_CONN_SPPKTS, qc, pkt);
+		next_pkt = pkt->next;
+		quic_tx_packet_refinc(pkt);
+		eb64_insert(&pkt->pktns->tx.pkts, &pkt->pn_node);
+	}
+}
+
+/* Send datagrams stored in <buf>. Consecutive datagrams are sent with a
+ * single syscall when possible, using UDP GSO or sendmmsg().
  *
  * This function returns 1 for success. On error, there is several behavior
  * depending on underlying sendto() error :
@@ -273,22 +389,12 @@ static int qc_send_ppkts(struct buffer *buf, struct ssl_sock_ctx *ctx)
 	qc = ctx->qc;
 	TRACE_ENTER(QUIC_EV_CONN_SPPKTS, qc);
 	while (b_contig_data(buf, 0)) {
-		unsigned char *pos;
-		struct buffer tmpbuf = { };
-		struct quic_tx_packet *first_pkt, *pkt, *next_pkt;
-		uint16_t dglen;
-		size_t headlen = sizeof dglen + sizeof first_pkt;
-		unsigned int time_sent;
+		struct iovec iov[QUIC_MAX_SND_DGRAMS];
+		uint16_t gso_size;
+		int nb_dgrams, sent;
 
-		pos = (unsigned char *)b_head(buf);
-		dglen = read_u16(pos);
-		BUG_ON_HOT(!dglen); /* this should not happen */
-
-		pos += sizeof dglen;
-		first_pkt = read_ptr(pos);
-		pos += sizeof first_pkt;
-		tmpbuf.area = (char *)pos;
-		tmpbuf.size = tmpbuf.data = dglen;
+		nb_dgrams = qc_txb_collect_dgrams(qc, buf, iov, &gso_size);
+		sent = nb_dgrams;
 
 		TRACE_PROTO("TX dgram", QUIC_EV_CONN_SPPKTS, qc);
 		/* If sendto is on error just skip the call to it for the rest
@@ -302,16 +408,14 @@ static int qc_send_ppkts(struct buffer *buf, struct ssl_sock_ctx *ctx)
 		 * quic-conn fd management.
 		 */
 		if (!skip_sendto) {
-			int ret = qc_snd_buf(qc, &tmpbuf, tmpbuf.data, 0);
-			if (ret < 0) {
-				TRACE_ERROR("sendto fatal error", QUIC_EV_CONN_SPPKTS, qc, first_pkt);
+			sent = qc_snd_dgrams(qc, iov, nb_dgrams, gso_size);
+			if (sent < 0) {
+				TRACE_ERROR("sendto fatal error", QUIC_EV_CONN_SPPKTS, qc);
 				qc_kill_conn(qc);
-				qc_free_tx_coalesced_pkts(qc, first_pkt);
-				b_del(buf, dglen + headlen);
 				qc_purge_tx_buf(qc, buf);
 				goto leave;
 			}
-			else if (!ret) {
+			else if (!sent) {
 				/* Connection owned socket : poller will wake us up when transient error is cleared. */
 				if (qc_test_fd(qc)) {
 					TRACE_ERROR("sendto error, subscribe to poller", QUIC_EV_CONN_SPPKTS, qc);
@@ -320,64 +424,16 @@ static int qc_send_ppkts(struct buffer *buf, struct ssl_sock_ctx *ctx)
 
 				/* No connection owned-socket : rely on retransmission to retry sending. */
 				skip_sendto = 1;
+				sent = nb_dgrams;
 				TRACE_ERROR("sendto error, simulate sending for the rest of data", QUIC_EV_CONN_SPPKTS, qc);
 			}
 		}
 
-		b_del(buf, dglen + headlen);
-		qc->bytes.tx += tmpbuf.data;
-		time_sent = now_ms;
-
-		for (pkt = first_pkt; pkt; pkt = next_pkt) {
-			struct quic_cc *cc = &qc->path->cc;
-			/* RFC 9000 14.1 Initial datagram size
-			 * a server MUST expand the payload of all UDP datagrams carrying ack-eliciting
-			 * Initial packets to at least the smallest allowed maximum datagram size of
-			 * 1200 bytes.
-			 */
-			qc->cntrs.sent_pkt++;
-			BUG_ON_HOT(pkt->type == QUIC_PACKET_TYPE_INITIAL &&
-			           (pkt->flags & QUIC_FL_TX_PACKET_ACK_ELICITING) &&
-			           dglen < QUIC_INITIAL_PACKET_MINLEN);
-
-			pkt->time_sent = time_sent;
-			if (pkt->flags & QUIC_FL_TX_PACKET_ACK_ELICITING) {
-				pkt->pktns->tx.time_of_last_eliciting = time_sent;
-				qc->path->ifae_pkts++;
-				if (qc->flags & QUIC_FL_CONN_IDLE_TIMER_RESTARTED_AFTER_READ)
-					qc_idle_timer_rearm(qc, 0, 0);
-			}
-			if (!(qc->flags & QUIC_FL_CONN_CLOSING) &&
-			    (pkt->flags & QUIC_FL_TX_PACKET_CC)) {
-				qc->flags |= QUIC_FL_CONN_CLOSING;
-				qc_detach_th_ctx_list(qc, 1);
-
-				/* RFC 9000 10.2. Immediate Close:
-				 * The closing and draining connection states exist to ensure
-				 * that connections close cleanly and that delayed or reordered
-				 * packets are properly discarded. These states SHOULD persist
-				 * for at least three times the current PTO interval...
-				 *
-				 * Rearm the idle timeout only one time when entering closing
-				 * state.
-				 */
-				qc_idle_timer_do_rearm(qc, 0);
-				if (qc->timer_task) {
-					task_destroy(qc->timer_task);
-					qc->timer_task = NULL;
-				}
-			}
-			qc->path->in_flight += pkt->in_flight_len;
-			pkt->pktns->tx.in_flight += pkt->in_flight_len;
-			if ((global.tune.options & GTUNE_QUIC_CC_HYSTART) && pkt->pktns == qc->apktns)
-				cc->algo->hystart_start_round(cc, pkt->pn_node.key);
-			if (pkt->in_flight_len)
-				qc_set_timer(qc);
-			TRACE_PROTO("TX pkt", QUIC_EV_CONN_SPPKTS, qc, pkt);
-			next_pkt = pkt->next;
-			quic_tx_packet_refinc(pkt);
-			eb64_insert(&pkt->pktns->tx.pkts, &pkt->pn_node);
-		}
+		/* Datagrams not sent because of a partial send are retried on
+		 * next loop.
+		 */
+		while (sent--)
+			qc_txb_dgram_sent(qc, buf);
 	}
 
 	ret = 1;
@@ -29,9 +29,37 @@
 #include <haproxy/global.h>
 #include <haproxy/pipe.h>
 #include <haproxy/proxy.h>
+#include <haproxy/sock.h>
 #include <haproxy/tools.h>
 
 
+/* MSG_ZEROCOPY completions are reported by the poller as errors on the FD.
+ * Consume them before checking FD_POLL_ERR so that only real errors remain.
+ */
+static inline void raw_sock_zc_check_err(struct connection *conn)
+{
+	if (unlikely(conn->zc) && (fdtab[conn->handle.fd].state & FD_POLL_ERR))
+		sock_conn_zc_drain(conn);
+}
+
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+/* Enables MSG_ZEROCOPY on <conn>'s socket and allocates the context used to
+ * track completions. On failure, zero-copy is disabled for this connection.
+ * Returns non-zero if zero-copy sends may be performed.
+ */
+static int raw_sock_zc_init(struct connection *conn)
+{
+	int one = 1;
+
+	if (setsockopt(conn->handle.fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0 ||
+	    (conn->zc = pool_zalloc(pool_head_conn_zc)) == NULL) {
+		conn->flags &= ~CO_FL_OPT_ZEROCOPY;
+		return 0;
+	}
+	return 1;
+}
+#endif
+
 #if defined(USE_LINUX_SPLICE)
 
 /* A pipe contains 16 segments max, and it's common to see segments of 1448 bytes
@@ -65,6 +93,7 @@ int raw_sock_to_pipe(struct connection *conn, void *xprt_ctx, struct pipe *pipe,
 
 	conn->flags &= ~CO_FL_WAIT_ROOM;
 	errno = 0;
+	raw_sock_zc_check_err(conn);
 
 	/* Under Linux, if FD_POLL_HUP is set, we have reached the end.
 	 * Since older splice() implementations were buggy and returned
@@ -115,9 +144,13 @@ int raw_sock_to_pipe(struct connection *conn, void *xprt_ctx, struct pipe *pipe,
 			}
 			else if (errno == ENOSYS || errno == EINVAL || errno == EBADF) {
 				/* splice not supported on this end, disable it.
-				 * We can safely return -1 since there is no
-				 * chance that any data has been piped yet.
+				 * We can only return -1 if no data has been
+				 * piped yet, otherwise it will be reported on
+				 * next call. This happens with kernel TLS when
+				 * a non-data record is pending.
 				 */
+				if (retval)
+					break;
 				retval = -1;
 				goto leave;
 			}
@@ -239,6 +272,7 @@ static size_t raw_sock_to_buf(struct connection *conn, void *xprt_ctx, struct bu
 
 	conn->flags &= ~CO_FL_WAIT_ROOM;
 	errno = 0;
+	raw_sock_zc_check_err(conn);
 
 	if (unlikely(!(fdtab[conn->handle.fd].state & FD_POLL_IN))) {
 		/* stop here if we reached the end of data */
@@ -342,13 +376,17 @@ static size_t raw_sock_to_buf(struct connection *conn, void *xprt_ctx, struct bu
  * for taking care of those events and avoiding the call if inappropriate. The
  * function does not call the connection's polling update function, so the caller
  * is responsible for this. It's up to the caller to update the buffer's contents
- * based on the return value.
+ * based on the return value. With CO_SFL_ZEROCOPY, if the connection has
+ * CO_FL_OPT_ZEROCOPY, the data may be sent using MSG_ZEROCOPY, in which case
+ * conn->zc->next_id is advanced and the caller must not modify nor release the
+ * buffer's area before it is handed over to conn_zc_hold().
  */
 static size_t raw_sock_from_buf(struct connection *conn, void *xprt_ctx, const struct buffer *buf, size_t count, int flags)
 {
 	ssize_t ret;
 	size_t try, done;
 	int send_flag;
+	int zc_flag = 0;
 
 	if (!conn_ctrl_ready(conn))
 		return 0;
@@ -358,6 +396,17 @@ static size_t raw_sock_from_buf(struct connection *conn, void *xprt_ctx, const s
 	if (!fd_send_ready(conn->handle.fd))
 		return 0;
 
+	raw_sock_zc_check_err(conn);
+
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	if ((flags & CO_SFL_ZEROCOPY) && (conn->flags & CO_FL_OPT_ZEROCOPY) &&
+	    (conn->zc || raw_sock_zc_init(conn)))
+		zc_flag = MSG_ZEROCOPY;
+
+	if (conn->zc)
+		conn->zc->last_sent = 0;
+#endif
+
 	if (unlikely(fdtab[conn->handle.fd].state & FD_POLL_ERR)) {
 		/* an error was reported on the FD, we can't send anymore */
 		conn->flags |= CO_FL_ERROR | CO_FL_SOCK_WR_SH | CO_FL_SOCK_RD_SH;
@@ -382,13 +431,19 @@ static size_t raw_sock_from_buf(struct connection *conn, void *xprt_ctx, const s
 		if (try > count)
 			try = count;
 
-		send_flag = MSG_DONTWAIT | MSG_NOSIGNAL;
+		send_flag = MSG_DONTWAIT | MSG_NOSIGNAL | zc_flag;
 		if (try < count || flags & CO_SFL_MSG_MORE)
 			send_flag |= MSG_MORE;
 
 		ret = send(conn->handle.fd, b_peek(buf, done), try, send_flag);
 
 		if (ret > 0) {
+			/* each zero-copy send consumes one completion id */
+			if (zc_flag) {
+				conn->zc->next_id++;
+				conn->zc->last_sent += ret;
+			}
+
 			count -= ret;
 			done += ret;
 
@@ -405,6 +460,10 @@ static size_t raw_sock_from_buf(struct connection *conn, void *xprt_ctx, const s
 			fd_cant_send(conn->handle.fd);
 			break;
 		}
+		else if (zc_flag && errno == ENOBUFS) {
+			/* too many pinned pages, fall back to a regular copy */
+			zc_flag = 0;
+		}
 		else if (errno != EINTR) {
 			conn->flags |= CO_FL_ERROR | CO_FL_SOCK_RD_SH | CO_FL_SOCK_WR_SH;
 			break;
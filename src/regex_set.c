@@ -0,0 +1,961 @@
+/*
+ * Sets of regular expressions matched at once.
+ *
+ * A set of regular expressions is compiled into a single Thompson NFA, which
+ * is turned into a DFA on the fly while matching subjects: each DFA state is
+ * a set of NFA nodes, and is created the first time a transition leads to it.
+ * The number of cached DFA states is bounded, and the caller is told when the
+ * cache is full so that it can fall back to matching each regex separately.
+ *
+ * Only a subset of the regex syntax is supported, that the regex engine
+ * haproxy was built with interprets the same way. Regexes using any other
+ * construct (back-references, look-arounds, word boundaries, possessive
+ * quantifiers, anchors inside groups...) are rejected by regex_set_add() and
+ * must be matched separately by the caller.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ *
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <haproxy/api.h>
+#include <haproxy/regex_set.h>
+#include <haproxy/thread.h>
+#include <haproxy/tools.h>
+#include <haproxy/xxhash.h>
+
+/* the PCRE syntax supports a few more escape sequences than POSIX EREs, and
+ * its dot does not match a line feed.
+ */
+#if defined(USE_PCRE) || defined(USE_PCRE_JIT) || defined(USE_PCRE2) || defined(USE_PCRE2_JIT)
+#define RSET_PCRE_SYNTAX
+#endif
+
+#define RSET_BAD           (~0U)  /* invalid node or unsupported construct */
+#define RSET_MAX_AST       4096   /* max number of syntax nodes per regex */
+#define RSET_MAX_REPEAT    100    /* max bound of a counted repetition */
+#define RSET_MAX_DEPTH     64     /* max nesting level of groups */
+#define RSET_MAX_NODES     200000 /* max number of NFA nodes per set */
+
+/* syntax tree node types */
+enum {
+	RSET_A_EMPTY = 0, /* matches the empty string */
+	RSET_A_SET,       /* one byte from set <set> */
+	RSET_A_CAT,       /* <l> followed by <r> */
+	RSET_A_ALT,       /* <l> or <r> */
+	RSET_A_REP,       /* <l> repeated <min> to <max> times (-1 = infinite) */
+	RSET_A_BOL,       /* beginning of subject */
+	RSET_A_EOL,       /* end of subject */
+};
+
+struct rset_ast {
+	int type;
+	int min, max;
+	int anchored;  /* contains a BOL or EOL node */
+	unsigned int l, r;
+	unsigned int set;
+};
+
+struct rset_parser {
+	struct regex_set *rs;
+	const char *p;
+	const char *branch; /* beginning of the current top-level branch */
+	struct rset_ast *ast;
+	unsigned int nb_ast;
+	int depth;
+};
+
+static inline void rset_bit_set(uint64_t *set, unsigned char c)
+{
+	set[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline int rset_bit_get(const uint64_t *set, unsigned char c)
+{
+	return !!(set[c >> 6] & (1ULL << (c & 63)));
+}
+
+/* makes <set> contain both cases of any letter it contains */
+static void rset_fold_case(uint64_t *set)
+{
+	int c;
+
+	for (c = 'a'; c <= 'z'; c++) {
+		if (rset_bit_get(set, c) || rset_bit_get(set, toupper(c))) {
+			rset_bit_set(set, c);
+			rset_bit_set(set, toupper(c));
+		}
+	}
+}
+
+/* allocates a new NFA node and returns its number, or RSET_BAD */
+static unsigned int rset_new_node(struct regex_set *rs, int type, unsigned int out, unsigned int out1, unsigned int arg)
+{
+	struct rset_node *nodes;
+	unsigned int n;
+
+	if (rs->nb_nodes >= RSET_MAX_NODES)
+		return RSET_BAD;
+
+	if (rs->nb_nodes == rs->alloc_nodes) {
+		n = rs->alloc_nodes ? rs->alloc_nodes * 2 : 256;
+		nodes = realloc(rs->nodes, n * sizeof(*nodes));
+		if (!nodes)
+			return RSET_BAD;
+		rs->nodes = nodes;
+		rs->alloc_nodes = n;
+	}
+
+	n = rs->nb_nodes++;
+	rs->nodes[n].type = type;
+	rs->nodes[n].out  = out;
+	rs->nodes[n].out1 = out1;
+	rs->nodes[n].arg  = arg;
+	return n;
+}
+
+/* allocates a new empty byte set and returns its number, or RSET_BAD */
+static unsigned int rset_new_set(struct regex_set *rs)
+{
+	uint64_t (*sets)[4];
+	unsigned int n;
+
+	if (rs->nb_sets == rs->alloc_sets) {
+		n = rs->alloc_sets ? rs->alloc_sets * 2 : 64;
+		sets = realloc(rs->sets, n * sizeof(*sets));
+		if (!sets)
+			return RSET_BAD;
+		rs->sets = sets;
+		rs->alloc_sets = n;
+	}
+
+	n = rs->nb_sets++;
+	memset(rs->sets[n], 0, sizeof(rs->sets[n]));
+	return n;
+}
+
+/* allocates a new syntax node and returns its number, or RSET_BAD */
+static unsigned int rset_new_ast(struct rset_parser *ps, int type, unsigned int l, unsigned int r)
+{
+	unsigned int n;
+
+	if (ps->nb_ast >= RSET_MAX_AST)
+		return RSET_BAD;
+
+	n = ps->nb_ast++;
+	ps->ast[n].type = type;
+	ps->ast[n].l = l;
+	ps->ast[n].r = r;
+	ps->ast[n].min = ps->ast[n].max = 0;
+	ps->ast[n].set = 0;
+	ps->ast[n].anchored = (type == RSET_A_BOL || type == RSET_A_EOL) ||
+		((type == RSET_A_CAT || type == RSET_A_ALT) && (ps->ast[l].anchored || ps->ast[r].anchored));
+	return n;
+}
+
+/* adds the bytes of predefined class <c> (one of "dDwWsS") to <set>. Returns
+ * 0 if <c> is not a supported class.
+ */
+static int rset_add_class(uint64_t *set, char c)
+{
+	int (*fct)(int);
+	int neg = 0;
+	int i;
+
+	switch (c) {
+#ifdef RSET_PCRE_SYNTAX
+	case 'D': neg = 1; __fallthrough;
+	case 'd': fct = isdigit; break;
+#endif
+	case 'W': neg = 1; __fallthrough;
+	case 'w': fct = isalnum; break;
+	case 'S': neg = 1; __fallthrough;
+	case 's': fct = isspace; break;
+	default:
+		return 0;
+	}
+
+	for (i = 0; i < 256; i++) {
+		int in = i < 128 && (fct(i) || (fct == isalnum && i == '_'));
+
+		if (in != neg)
+			rset_bit_set(set, i);
+	}
+	return 1;
+}
+
+/* parses the escape sequence at <ps->p> (just after the backslash) and adds
+ * the bytes it designates to <set>. Returns 0 if it is not supported.
+ */
+static int rset_parse_escape(struct rset_parser *ps, uint64_t *set)
+{
+	unsigned char c = *ps->p;
+
+	if (!c)
+		return 0;
+
+	ps->p++;
+	if (!isalnum(c)) {
+		rset_bit_set(set, c);
+		return 1;
+	}
+
+	if (rset_add_class(set, c))
+		return 1;
+
+#ifdef RSET_PCRE_SYNTAX
+	switch (c) {
+	case 't': rset_bit_set(set, '\t'); return 1;
+	case 'n': rset_bit_set(set, '\n'); return 1;
+	case 'r': rset_bit_set(set, '\r'); return 1;
+	case 'f': rset_bit_set(set, '\f'); return 1;
+	case 'v': rset_bit_set(set, '\v'); return 1;
+	case 'a': rset_bit_set(set, 0x07); return 1;
+	case 'e': rset_bit_set(set, 0x1b); return 1;
+	case 'x': {
+		int h, v = 0, i;
+
+		for (i = 0; i < 2 && (h = hex2i(*ps->p)) >= 0; i++, ps->p++)
+			v = v * 16 + h;
+		if (!i || *ps->p == '{')
+			return 0;
+		rset_bit_set(set, v);
+		return 1;
+	}
+	}
+#endif
+	/* back-references, assertions, octal, properties... */
+	return 0;
+}
+
+/* parses a POSIX character class such as "[:alpha:]" at <ps->p> inside a
+ * bracket expression and adds its bytes to <set>. Returns 0 if it is not
+ * supported.
+ */
+static int rset_parse_posix_class(struct rset_parser *ps, uint64_t *set)
+{
+	static const struct {
+		const char *name;
+		int (*fct)(int);
+	} classes[] = {
+		{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+		{ "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+		{ "lower", islower }, { "print", isprint }, { "punct", ispunct },
+		{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+	};
+	const char *end = strstr(ps->p + 2, ":]");
+	int i, c;
+
+	if (!end)
+		return 0;
+
+	for (i = 0; i < sizeof(classes) / sizeof(*classes); i++) {
+		if (strlen(classes[i].name) == end - ps->p - 2 &&
+		    memcmp(classes[i].name, ps->p + 2, end - ps->p - 2) == 0)
+			break;
+	}
+
+	if (i == sizeof(classes) / sizeof(*classes))
+		return 0;
+
+	for (c = 0; c < 128; c++) {
+		if (classes[i].fct(c))
+			rset_bit_set(set, c);
+	}
+	ps->p = end + 2;
+	return 1;
+}
+
+/* parses a bracket expression at <ps->p> (just after the '[') and returns the
+ * corresponding set number, or RSET_BAD.
+ */
+static unsigned int rset_parse_bracket(struct rset_parser *ps)
+{
+	unsigned int set = rset_new_set(ps->rs);
+	uint64_t tmp[4] = { 0 };
+	unsigned char c, d;
+	int neg = 0;
+	int first = 1;
+	int i;
+
+	if (set == RSET_BAD)
+		return RSET_BAD;
+
+	if (*ps->p == '^') {
+		neg = 1;
+		ps->p++;
+	}
+
+	while (1) {
+		c = *ps->p;
+		if (!c)
+			return RSET_BAD;
+		if (c == ']' && !first)
+			break;
+		first = 0;
+
+		if (c == '[' && ps->p[1] == ':') {
+			if (!rset_parse_posix_class(ps, tmp))
+				return RSET_BAD;
+			continue;
+		}
+
+		if (c == '[' && (ps->p[1] == '.' || ps->p[1] == '='))
+			return RSET_BAD;
+
+		ps->p++;
+		if (c == '\\') {
+#ifdef RSET_PCRE_SYNTAX
+			if (*ps->p == 'b' || !rset_parse_escape(ps, tmp))
+				return RSET_BAD;
+			continue;
+#else
+			/* a literal backslash in POSIX, better not mix them */
+			return RSET_BAD;
+#endif
+		}
+
+		if (*ps->p == '-' && ps->p[1] && ps->p[1] != ']') {
+			d = ps->p[1];
+			if (d == '\\' || d == '[' || d < c)
+				return RSET_BAD;
+			ps->p += 2;
+		}
+		else
+			d = c;
+
+		for (i = c; i <= d; i++)
+			rset_bit_set(tmp, i);
+	}
+	ps->p++;
+
+	if (ps->rs->icase)
+		rset_fold_case(tmp);
+
+	for (i = 0; i < 4; i++)
+		ps->rs->sets[set][i] = neg ? ~tmp[i] : tmp[i];
+	return set;
+}
+
+/* returns a new set made of byte <c>, taking the case into account */
+static unsigned int rset_char_set(struct regex_set *rs, unsigned char c)
+{
+	unsigned int set = rset_new_set(rs);
+
+	if (set == RSET_BAD)
+		return RSET_BAD;
+
+	rset_bit_set(rs->sets[set], c);
+	if (rs->icase && isalpha(c)) {
+		rset_bit_set(rs->sets[set], tolower(c));
+		rset_bit_set(rs->sets[set], toupper(c));
+	}
+	return set;
+}
+
+static unsigned int rset_parse_alt(struct rset_parser *ps);
+
+/* parses an atom and returns its syntax node, or RSET_BAD */
+static unsigned int rset_parse_atom(struct rset_parser *ps)
+{
+	unsigned char c = *ps->p;
+	unsigned int set, node;
+	int i;
+
+	switch (c) {
+	case '(':
+		ps->p++;
+		if (*ps->p == '?') {
+			/* only non-capturing groups are supported */
+			if (ps->p[1] != ':')
+				return RSET_BAD;
+			ps->p += 2;
+		}
+		if (++ps->depth > RSET_MAX_DEPTH)
+			return RSET_BAD;
+		node = rset_parse_alt(ps);
+		ps->depth--;
+		if (node == RSET_BAD || *ps->p != ')')
+			return RSET_BAD;
+		ps->p++;
+		return node;
+
+	case '[':
+		ps->p++;
+		set = rset_parse_bracket(ps);
+		break;
+
+	case '.':
+		ps->p++;
+		set = rset_new_set(ps->rs);
+		if (set == RSET_BAD)
+			return RSET_BAD;
+		for (i = 0; i < 4; i++)
+			ps->rs->sets[set][i] = ~0ULL;
+#ifdef RSET_PCRE_SYNTAX
+		ps->rs->sets[set]['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+#endif
+		break;
+
+	/* anchors are only supported at the edges of top-level branches, as
+	 * engines disagree on their meaning anywhere else.
+	 */
+	case '^':
+		if (ps->depth || ps->p != ps->branch)
+			return RSET_BAD;
+		ps->p++;
+		return rset_new_ast(ps, RSET_A_BOL, 0, 0);
+
+	case '$':
+		ps->p++;
+		if (ps->depth || (*ps->p && *ps->p != '|'))
+			return RSET_BAD;
+		return rset_new_ast(ps, RSET_A_EOL, 0, 0);
+
+	case '\\': {
+		uint64_t tmp[4] = { 0 };
+
+		ps->p++;
+		if (!rset_parse_escape(ps, tmp))
+			return RSET_BAD;
+		set = rset_new_set(ps->rs);
+		if (set == RSET_BAD)
+			return RSET_BAD;
+		if (ps->rs->icase)
+			rset_fold_case(tmp);
+		memcpy(ps->rs->sets[set], tmp, sizeof(tmp));
+		break;
+	}
+
+	case '*': case '+': case '?': case '{': case ')': case '|': case 0:
+		/* nothing to repeat or unbalanced, let the regex engine decide */
+		return RSET_BAD;
+
+	default:
+		ps->p++;
+		set = rset_char_set(ps->rs, c);
+		break;
+	}
+
+	if (set == RSET_BAD)
+		return RSET_BAD;
+
+	node = rset_new_ast(ps, RSET_A_SET, 0, 0);
+	if (node != RSET_BAD)
+		ps->ast[node].set = set;
+	return node;
+}
+
+/* parses a decimal number of at most RSET_MAX_REPEAT, returns -1 if none */
+static int rset_parse_bound(struct rset_parser *ps)
+{
+	int v = 0;
+
+	if (!isdigit((unsigned char)*ps->p))
+		return -1;
+
+	while (isdigit((unsigned char)*ps->p)) {
+		v = v * 10 + *ps->p++ - '0';
+		if (v > RSET_MAX_REPEAT)
+			return -1;
+	}
+	return v;
+}
+
+/* parses an atom followed by any number of quantifiers */
+static unsigned int rset_parse_repeat(struct rset_parser *ps)
+{
+	unsigned int node = rset_parse_atom(ps);
+	unsigned int rep;
+	int min, max;
+
+	while (node != RSET_BAD) {
+		switch (*ps->p) {
+		case '*': min = 0; max = -1; ps->p++; break;
+		case '+': min = 1; max = -1; ps->p++; break;
+		case '?': min = 0; max = 1; ps->p++; break;
+		case '{':
+			ps->p++;
+			min = max = rset_parse_bound(ps);
+			if (min < 0)
+				return RSET_BAD;
+			if (*ps->p == ',') {
+				ps->p++;
+				max = (*ps->p == '}') ? -1 : rset_parse_bound(ps);
+				if (max != -1 && max < min)
+					return RSET_BAD;
+				if (max < 0 && *ps->p != '}')
+					return RSET_BAD;
+			}
+			if (*ps->p != '}')
+				return RSET_BAD;
+			ps->p++;
+			break;
+		default:
+			return node;
+		}
+
+#ifdef RSET_PCRE_SYNTAX
+		/* lazy quantifiers match the same subjects, possessive ones don't.
+		 * POSIX just applies the next quantifier to the repetition.
+		 */
+		if (*ps->p == '?')
+			ps->p++;
+		else if (*ps->p == '+')
+			return RSET_BAD;
+#endif
+
+		/* engines disagree on repeated anchors */
+		if (ps->ast[node].anchored)
+			return RSET_BAD;
+
+		rep = rset_new_ast(ps, RSET_A_REP, node, 0);
+		if (rep == RSET_BAD)
+			return RSET_BAD;
+		ps->ast[rep].min = min;
+		ps->ast[rep].max = max;
+		node = rep;
+	}
+	return node;
+}
+
+/* parses a sequence of atoms up to the end, a '|' or a ')' */
+static unsigned int rset_parse_concat(struct rset_parser *ps)
+{
+	unsigned int node = RSET_BAD;
+	unsigned int next;
+
+	if (!ps->depth)
+		ps->branch = ps->p;
+
+	while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+		next = rset_parse_repeat(ps);
+		if (next == RSET_BAD)
+			return RSET_BAD;
+		node = (node == RSET_BAD) ? next : rset_new_ast(ps, RSET_A_CAT, node, next);
+		if (node == RSET_BAD)
+			return RSET_BAD;
+	}
+
+	if (node == RSET_BAD)
+		node = rset_new_ast(ps, RSET_A_EMPTY, 0, 0);
+	return node;
+}
+
+/* parses alternatives up to the end or a ')' */
+static unsigned int rset_parse_alt(struct rset_parser *ps)
+{
+	unsigned int node = rset_parse_concat(ps);
+	unsigned int next;
+
+	while (node != RSET_BAD && *ps->p == '|') {
+		ps->p++;
+		next = rset_parse_concat(ps);
+		if (next == RSET_BAD)
+			return RSET_BAD;
+		node = rset_new_ast(ps, RSET_A_ALT, node, next);
+	}
+	return node;
+}
+
+/* compiles syntax node <node> into NFA nodes leading to <next>, and returns
+ * the entry node, or RSET_BAD.
+ */
+static unsigned int rset_compile_ast(struct regex_set *rs, const struct rset_ast *ast,
+                                     unsigned int node, unsigned int next)
+{
+	const struct rset_ast *a = &ast[node];
+	unsigned int tail, loop, body;
+	int i;
+
+	if (next == RSET_BAD)
+		return RSET_BAD;
+
+	switch (a->type) {
+	case RSET_A_EMPTY:
+		return next;
+
+	case RSET_A_SET:
+		return rset_new_node(rs, RSET_N_SET, next, 0, a->set);
+
+	case RSET_A_BOL:
+		return rset_new_node(rs, RSET_N_BOL, next, 0, 0);
+
+	case RSET_A_EOL:
+		return rset_new_node(rs, RSET_N_EOL, next, 0, 0);
+
+	case RSET_A_CAT:
+		return rset_compile_ast(rs, ast, a->l, rset_compile_ast(rs, ast, a->r, next));
+
+	case RSET_A_ALT:
+		tail = rset_compile_ast(rs, ast, a->r, next);
+		if (tail == RSET_BAD)
+			return RSET_BAD;
+		body = rset_compile_ast(rs, ast, a->l, next);
+		if (body == RSET_BAD)
+			return RSET_BAD;
+		return rset_new_node(rs, RSET_N_SPLIT, body, tail, 0);
+
+	case RSET_A_REP:
+		tail = next;
+		if (a->max < 0) {
+			/* loop: split to the body or out, the body returns to it */
+			loop = rset_new_node(rs, RSET_N_SPLIT, 0, next, 0);
+			if (loop == RSET_BAD)
+				return RSET_BAD;
+			body = rset_compile_ast(rs, ast, a->l, loop);
+			if (body == RSET_BAD)
+				return RSET_BAD;
+			rs->nodes[loop].out = body;
+			tail = loop;
+		}
+		else {
+			/* optional copies: (x(x)?)? */
+			for (i = a->min; i < a->max; i++) {
+				body = rset_compile_ast(rs, ast, a->l, tail);
+				if (body == RSET_BAD)
+					return RSET_BAD;
+				tail = rset_new_node(rs, RSET_N_SPLIT, body, next, 0);
+				if (tail == RSET_BAD)
+					return RSET_BAD;
+			}
+		}
+
+		/* mandatory copies */
+		for (i = 0; i < a->min; i++) {
+			tail = rset_compile_ast(rs, ast, a->l, tail);
+			if (tail == RSET_BAD)
+				return RSET_BAD;
+		}
+		return tail;
+	}
+	return RSET_BAD;
+}
+
+/* Allocates a new empty regex set. If <icase> is non-zero, the regexes will
+ * ignore the case. Returns NULL on memory shortage.
+ */
+struct regex_set *regex_set_new(int icase)
+{
+	struct regex_set *rs;
+
+	rs = calloc(1, sizeof(*rs));
+	if (!rs)
+		return NULL;
+
+	rs->icase = icase;
+	rs->root = RSET_BAD;
+	HA_SPIN_INIT(&rs->lock);
+	return rs;
+}
+
+/* Adds regex <str> to set <rs>, which will report <order> when it matches.
+ * Returns non-zero on success, or 0 if the regex uses an unsupported construct
+ * or on memory shortage, in which case the set is left unchanged and the
+ * regex has to be matched separately.
+ */
+int regex_set_add(struct regex_set *rs, const char *str, unsigned int order)
+{
+	unsigned int nb_nodes = rs->nb_nodes;
+	unsigned int nb_sets = rs->nb_sets;
+	struct rset_parser ps = { .rs = rs, .p = str };
+	unsigned int node, start;
+
+	ps.ast = malloc(RSET_MAX_AST * sizeof(*ps.ast));
+	if (!ps.ast)
+		return 0;
+
+	node = rset_parse_alt(&ps);
+	if (node == RSET_BAD || *ps.p)
+		goto fail;
+
+	start = rset_compile_ast(rs, ps.ast, node, rset_new_node(rs, RSET_N_MATCH, 0, 0, order));
+	if (start == RSET_BAD)
+		goto fail;
+
+	if (rs->root != RSET_BAD) {
+		start = rset_new_node(rs, RSET_N_SPLIT, start, rs->root, 0);
+		if (start == RSET_BAD)
+			goto fail;
+	}
+
+	rs->root = start;
+	free(ps.ast);
+	return 1;
+
+ fail:
+	rs->nb_nodes = nb_nodes;
+	rs->nb_sets = nb_sets;
+	free(ps.ast);
+	return 0;
+}
+
+/* Appends to <list> (holding <*nb> entries) the consuming, matching and end
+ * anchor nodes reachable from <node> without consuming anything, and which
+ * were not reached yet since the last mark change. Beginning and end anchors
+ * are only crossed if <bol> and <eol> are set respectively.
+ */
+static void rset_closure(struct regex_set *rs, unsigned int node, int bol, int eol,
+                         unsigned int *list, unsigned int *nb)
+{
+	unsigned int *stack = rs->work + rs->nb_nodes;
+	const struct rset_node *n;
+	unsigned int sp = 0;
+
+#define RSET_PUSH(x) do {                                        \
+		if (rs->marks[x] != rs->mark) {                  \
+			rs->marks[x] = rs->mark;                 \
+			stack[sp++] = (x);                       \
+		}                                                \
+	} while (0)
+
+	RSET_PUSH(node);
+	while (sp) {
+		node = stack[--sp];
+		n = &rs->nodes[node];
+		switch (n->type) {
+		case RSET_N_SPLIT:
+			RSET_PUSH(n->out1);
+			RSET_PUSH(n->out);
+			break;
+		case RSET_N_BOL:
+			if (bol)
+				RSET_PUSH(n->out);
+			break;
+		case RSET_N_EOL:
+			if (eol)
+				RSET_PUSH(n->out);
+			else
+				list[(*nb)++] = node;
+			break;
+		default:
+			list[(*nb)++] = node;
+			break;
+		}
+	}
+#undef RSET_PUSH
+}
+
+/* starts a new closure computation */
+static inline void rset_new_mark(struct regex_set *rs)
+{
+	if (!++rs->mark) {
+		memset(rs->marks, 0, rs->nb_nodes * sizeof(*rs->marks));
+		rs->mark = 1;
+	}
+}
+
+static int rset_cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Returns the DFA state made of the <nb> NFA nodes in <list>, creating it if
+ * needed. <initial> indicates the initial state, which is not indexed. Returns
+ * the state number, or 0 if the cache is full or on memory shortage. Must be
+ * called with the lock held.
+ */
+static unsigned int rset_get_state(struct regex_set *rs, unsigned int *list, unsigned int nb, int initial)
+{
+	struct rset_state *st;
+	unsigned int *elist;
+	unsigned int enb = 0;
+	unsigned int id, i;
+	uint64_t hash;
+
+	qsort(list, nb, sizeof(*list), rset_cmp_uint);
+	hash = XXH3(list, nb * sizeof(*list), 0);
+
+	if (!initial) {
+		for (id = rs->hash[hash % RSET_MAX_STATES]; id; id = rs->states[id]->hnext) {
+			st = rs->states[id];
+			if (st->hash == hash && st->nb_nodes == nb &&
+			    memcmp(st->nodes, list, nb * sizeof(*list)) == 0)
+				return id;
+		}
+	}
+
+	if (rs->nb_states >= RSET_MAX_STATES)
+		return 0;
+
+	st = calloc(1, sizeof(*st) + nb * sizeof(*list));
+	if (!st)
+		return 0;
+
+	memcpy(st->nodes, list, nb * sizeof(*list));
+	st->nb_nodes = nb;
+	st->hash = hash;
+
+	/* regexes matched here, and those matched if the subject ends here */
+	st->order = st->eorder = RSET_NOMATCH;
+	elist = rs->work + 2 * rs->nb_nodes;
+	rset_new_mark(rs);
+	for (i = 0; i < nb; i++) {
+		if (rs->nodes[list[i]].type == RSET_N_MATCH && rs->nodes[list[i]].arg < st->order)
+			st->order = rs->nodes[list[i]].arg;
+		else if (rs->nodes[list[i]].type == RSET_N_EOL)
+			rset_closure(rs, rs->nodes[list[i]].out, initial, 1, elist, &enb);
+	}
+
+	st->eorder = st->order;
+	for (i = 0; i < enb; i++) {
+		if (rs->nodes[elist[i]].type == RSET_N_MATCH && rs->nodes[elist[i]].arg < st->eorder)
+			st->eorder = rs->nodes[elist[i]].arg;
+	}
+
+	id = rs->nb_states;
+	if (!initial) {
+		st->hnext = rs->hash[hash % RSET_MAX_STATES];
+		rs->hash[hash % RSET_MAX_STATES] = id;
+	}
+	HA_ATOMIC_STORE(&rs->states[id], st);
+	HA_ATOMIC_STORE(&rs->nb_states, id + 1);
+	return id;
+}
+
+/* Finalizes set <rs> once all regexes were added, and creates the initial
+ * DFA state. Returns non-zero on success, or 0 if the set is empty or on
+ * memory shortage.
+ */
+int regex_set_compile(struct regex_set *rs)
+{
+	unsigned int nb = 0;
+
+	if (rs->root == RSET_BAD)
+		return 0;
+
+	rs->marks = calloc(rs->nb_nodes, sizeof(*rs->marks));
+	rs->work = malloc(3 * rs->nb_nodes * sizeof(*rs->work));
+	if (!rs->marks || !rs->work)
+		return 0;
+
+	rset_new_mark(rs);
+	rset_closure(rs, rs->root, 1, 0, rs->work, &nb);
+	return rset_get_state(rs, rs->work, nb, 1) == 0 && rs->nb_states == 1;
+}
+
+/* computes the transition from state <st> on byte <c>, and returns the next
+ * state number, or 0 if the cache is full. This happens while matching, so
+ * the threads discovering new states of the same set are serialized on its
+ * lock, which is why it is not taken anymore once the cache is full.
+ */
+static unsigned int rset_step(struct regex_set *rs, struct rset_state *st, unsigned char c)
+{
+	unsigned int nb = 0;
+	unsigned int next;
+	unsigned int i;
+
+	/* don't contend on the lock once there is no more room */
+	if (HA_ATOMIC_LOAD(&rs->nb_states) >= RSET_MAX_STATES)
+		return 0;
+
+	HA_SPIN_LOCK(PATEXP_LOCK, &rs->lock);
+
+	next = st->trans[c];
+	if (next)
+		goto leave;
+
+	rset_new_mark(rs);
+	for (i = 0; i < st->nb_nodes; i++) {
+		const struct rset_node *n = &rs->nodes[st->nodes[i]];
+
+		if (n->type == RSET_N_SET && rset_bit_get(rs->sets[n->arg], c))
+			rset_closure(rs, n->out, 0, 0, rs->work, &nb);
+	}
+
+	/* the regexes may start anywhere */
+	rset_closure(rs, rs->root, 0, 0, rs->work, &nb);
+
+	next = rset_get_state(rs, rs->work, nb, 0);
+	if (next)
+		HA_ATOMIC_STORE(&st->trans[c], next);
+ leave:
+	HA_SPIN_UNLOCK(PATEXP_LOCK, &rs->lock);
+	return next;
+}
+
+/* Looks for regexes of set <rs> matching anywhere in <str> of length <len>.
+ * Returns the lowest order among the matching regexes, RSET_NOMATCH if none
+ * matches, or RSET_FULL if the DFA cache is full, in which case the caller
+ * has to match each regex by itself.
+ */
+unsigned int regex_set_exec(struct regex_set *rs, const char *str, size_t len)
+{
+	struct rset_state *st = rs->states[0];
+	unsigned int best = st->order;
+	unsigned int next;
+	unsigned char c;
+	size_t i;
+
+#ifndef RSET_PCRE_SYNTAX
+	/* POSIX regexes stop at the first zero */
+	len = strnlen(str, len);
+#endif
+
+	for (i = 0; i < len && best; i++) {
+		c = str[i];
+#ifdef RSET_PCRE_SYNTAX
+		/* PCRE's '$' also matches before a trailing line feed */
+		if (c == '\n' && i == len - 1 && st->eorder < best)
+			best = st->eorder;
+#endif
+		next = HA_ATOMIC_LOAD(&st->trans[c]);
+		if (!next) {
+			next = rset_step(rs, st, c);
+			if (!next)
+				return RSET_FULL;
+		}
+		st = HA_ATOMIC_LOAD(&rs->states[next]);
+		if (st->order < best)
+			best = st->order;
+	}
+
+	if (st->eorder < best)
+		best = st->eorder;
+	return best;
+}
+
+/* Flushes the DFA cache of set <rs> so that new states can be created again.
+ * It must not be used by any other thread during the operation.
+ */
+void regex_set_flush(struct regex_set *rs)
+{
+	unsigned int i;
+
+	for (i = 1; i < rs->nb_states; i++) {
+		free(rs->states[i]);
+		rs->states[i] = NULL;
+	}
+
+	if (rs->nb_states)
+		memset(rs->states[0]->trans, 0, sizeof(rs->states[0]->trans));
+	memset(rs->hash, 0, sizeof(rs->hash));
+	rs->nb_states = !!rs->nb_states;
+}
+
+/* releases set <rs> and all its states */
+void regex_set_free(struct regex_set *rs)
+{
+	unsigned int i;
+
+	if (!rs)
+		return;
+
+	for (i = 0; i < rs->nb_states; i++)
+		free(rs->states[i]);
+	free(rs->nodes);
+	free(rs->sets);
+	free(rs->work);
+	free(rs->marks);
+	HA_SPIN_DESTROY(&rs->lock);
+	free(rs);
+}
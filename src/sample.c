@@ -19,11 +19,13 @@
 #include <import/mjson.h>
 #include <import/sha1.h>
 
+#include <haproxy/activity.h>
 #include <haproxy/api.h>
 #include <haproxy/arg.h>
 #include <haproxy/auth.h>
 #include <haproxy/base64.h>
 #include <haproxy/buf.h>
+#include <haproxy/cfgparse.h>
 #include <haproxy/chunk.h>
 #include <haproxy/clock.h>
 #include <haproxy/errors.h>
@@ -31,15 +33,20 @@
 #include <haproxy/global.h>
 #include <haproxy/hash.h>
 #include <haproxy/http.h>
+#include <haproxy/http_ana-t.h>
+#include <haproxy/http_htx.h>
+#include <haproxy/htx.h>
 #include <haproxy/istbuf.h>
 #include <haproxy/mqtt.h>
 #include <haproxy/net_helper.h>
+#include <haproxy/pool.h>
 #include <haproxy/protobuf.h>
 #include <haproxy/proxy.h>
 #include <haproxy/regex.h>
 #include <haproxy/sample.h>
 #include <haproxy/sink.h>
 #include <haproxy/stick_table.h>
+#include <haproxy/stream.h>
 #include <haproxy/time.h>
 #include <haproxy/tools.h>
 #include <haproxy/uri_auth-t.h>
@@ -1333,6 +1340,338 @@ int sample_process_cnv(struct sample_expr *expr, struct sample *p)
 	return 1;
 }
 
+/* Sample fetch results cache, enabled with "tune.sample-cache". Fetches which
+ * only depend on the start-line and headers of an HTTP message report either
+ * SMP_F_VOL_1ST or SMP_F_VOL_HDR, and their results remain valid as long as
+ * no start-line or header block changes, which is tracked by htx_hdr_gen. Note
+ * that blocks modified in place, without the HTX API, are only covered if the
+ * caller reports it using htx_hdr_changed(). The results are kept per stream so
+ * that rules referencing the same headers again do not need to scan the
+ * message again.
+ */
+static unsigned int smp_cache_size = 0; /* entries per stream, 0 = disabled */
+static struct pool_head *pool_head_smp_cache __read_mostly = NULL;
+
+/* set in smp->ctx.a[0] when iterating over cached results */
+static char smp_cache_iter;
+
+#define SMP_CACHE_RES_PER_ENT   2    /* results per entry */
+#define SMP_CACHE_AREA_PER_ENT  128  /* bytes of string storage per entry */
+
+/* fetch sources which only involve HTTP start-lines and headers */
+#define SMP_USE_HTTP_HDRS (SMP_USE_HRQHV | SMP_USE_HRQHP | SMP_USE_HRSHV | SMP_USE_HRSHP)
+
+/* Releases a stream's sample cache. <cache> may be NULL. */
+void smp_cache_free(struct smp_cache *cache)
+{
+	pool_free(pool_head_smp_cache, cache);
+}
+
+/* Returns non-zero if the argument lists <a> and <b> hold the same values.
+ * Pointers to resolved objects only match when they are identical.
+ */
+int sample_args_eq(const struct arg *a, const struct arg *b)
+{
+	if (a == b)
+		return 1;
+	if (!a || !b)
+		return 0;
+
+	for (; a->type == b->type && a->type_flags == b->type_flags; a++, b++) {
+		switch (a->type) {
+		case ARGT_STOP:
+			return 1;
+		case ARGT_STR:
+			if (a->data.str.data != b->data.str.data ||
+			    (a->data.str.data && memcmp(a->data.str.area, b->data.str.area, a->data.str.data) != 0))
+				return 0;
+			break;
+		case ARGT_SINT:
+		case ARGT_TIME:
+		case ARGT_SIZE:
+			if (a->data.sint != b->data.sint)
+				return 0;
+			break;
+		case ARGT_IPV4:
+		case ARGT_MSK4:
+			if (a->data.ipv4.s_addr != b->data.ipv4.s_addr)
+				return 0;
+			break;
+		case ARGT_IPV6:
+		case ARGT_MSK6:
+			if (memcmp(&a->data.ipv6, &b->data.ipv6, sizeof(a->data.ipv6)) != 0)
+				return 0;
+			break;
+		default:
+			if (memcmp(&a->data, &b->data, sizeof(a->data)) != 0)
+				return 0;
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Returns non-zero if the sample expressions <a> and <b> use the same fetch
+ * and the same converters with the same arguments.
+ */
+int sample_expr_eq(const struct sample_expr *a, const struct sample_expr *b)
+{
+	const struct list *la, *lb;
+
+	if (a->fetch != b->fetch || !sample_args_eq(a->arg_p, b->arg_p))
+		return 0;
+
+	for (la = a->conv_exprs.n, lb = b->conv_exprs.n;
+	     la != &a->conv_exprs && lb != &b->conv_exprs;
+	     la = la->n, lb = lb->n) {
+		const struct sample_conv_expr *ca = LIST_ELEM(la, struct sample_conv_expr *, list);
+		const struct sample_conv_expr *cb = LIST_ELEM(lb, struct sample_conv_expr *, list);
+
+		if (ca->conv != cb->conv || !sample_args_eq(ca->arg_p, cb->arg_p))
+			return 0;
+	}
+	return la == &a->conv_exprs && lb == &b->conv_exprs;
+}
+
+/* Returns non-zero if evaluating sample expression <expr> has no side effect
+ * and yields the same result when repeated, so that it may be evaluated in a
+ * different order or less often than it was written. This is the case when
+ * none of its fetch and converters is flagged SMP_KW_F_SIDE_EFFECT nor
+ * SMP_KW_F_VOLATILE.
+ */
+int sample_expr_pure(const struct sample_expr *expr)
+{
+	const struct sample_conv_expr *conv;
+
+	if (expr->fetch->flags & (SMP_KW_F_SIDE_EFFECT | SMP_KW_F_VOLATILE))
+		return 0;
+
+	list_for_each_entry(conv, &expr->conv_exprs, list) {
+		if (conv->conv->flags & (SMP_KW_F_SIDE_EFFECT | SMP_KW_F_VOLATILE))
+			return 0;
+	}
+	return 1;
+}
+
+/* Returns non-zero if the results of fetch <fetch> called with options <opt>
+ * on stream <s> may be looked up in or stored into the cache. The message must
+ * have been parsed and its start-line not forwarded yet.
+ */
+static inline int smp_cache_usable(const struct stream *s, const struct sample_fetch *fetch,
+                                   unsigned int opt)
+{
+	const struct channel *chn;
+	const struct http_msg *msg;
+
+	if (!s || !IS_HTX_STRM(s) || !s->txn)
+		return 0;
+
+	if (!fetch->use || (fetch->use & ~SMP_USE_HTTP_HDRS))
+		return 0;
+
+	if ((opt & SMP_OPT_DIR) == SMP_OPT_DIR_REQ) {
+		chn = &s->req;
+		msg = &s->txn->req;
+	}
+	else {
+		chn = &s->res;
+		msg = &s->txn->rsp;
+	}
+
+	if (msg->msg_state < HTTP_MSG_BODY)
+		return 0;
+	return http_get_stline(htxbuf(&chn->buf)) != NULL;
+}
+
+/* Returns non-zero if the outcome of the fetch which just filled <smp> only
+ * depends on the message's start-line and headers.
+ */
+static inline int smp_cache_stable(const struct sample *smp)
+{
+	return (smp->flags & (SMP_F_VOL_1ST | SMP_F_VOL_HDR)) &&
+	       !(smp->flags & (SMP_F_MAY_CHANGE | SMP_F_VOL_TEST));
+}
+
+/* Empties cache <cache> */
+static inline void smp_cache_flush(struct smp_cache *cache)
+{
+	cache->nb_ent = cache->nb_res = cache->area_used = 0;
+}
+
+/* Appends a copy of the result in <smp> to the results of cache <cache>.
+ * Returns 0 if there is not enough room left.
+ */
+static int smp_cache_put(struct smp_cache *cache, const struct sample *smp)
+{
+	struct smp_cache_res *res;
+	struct buffer *str = NULL;
+
+	if (cache->nb_res >= smp_cache_size * SMP_CACHE_RES_PER_ENT)
+		return 0;
+
+	res = &cache->res[cache->nb_res];
+	res->data = smp->data;
+	res->flags = smp->flags;
+
+	if (smp->data.type == SMP_T_STR || smp->data.type == SMP_T_BIN)
+		str = &res->data.u.str;
+	else if (smp->data.type == SMP_T_METH && smp->data.u.meth.meth == HTTP_METH_OTHER)
+		str = &res->data.u.meth.str;
+
+	if (str) {
+		if (str->data > smp_cache_size * SMP_CACHE_AREA_PER_ENT - cache->area_used)
+			return 0;
+		memcpy(cache->area + cache->area_used, str->area, str->data);
+		str->area = cache->area + cache->area_used;
+		str->size = str->data;
+		str->head = 0;
+		cache->area_used += str->data;
+	}
+	cache->nb_res++;
+	return 1;
+}
+
+/* Fills <smp> with the result <idx> of entry <ent_idx> of cache <cache>, and
+ * prepares it for the next iteration if other results follow. The sample is
+ * marked constant since it points to the cache. Always returns 1.
+ */
+static int smp_cache_get(struct smp_cache *cache, unsigned int ent_idx, unsigned int idx,
+                         struct sample *smp)
+{
+	const struct smp_cache_ent *ent = &cache->ent[ent_idx];
+	const struct smp_cache_res *res = &cache->res[ent->first + idx];
+
+	smp->data = res->data;
+	smp->flags = (res->flags & ~SMP_F_NOT_LAST) | SMP_F_CONST;
+	if (idx + 1 < ent->count) {
+		smp->flags |= SMP_F_NOT_LAST;
+		smp->ctx.a[0] = &smp_cache_iter;
+		smp->ctx.a[1] = (void *)(long)ent_idx;
+		smp->ctx.a[2] = (void *)(long)(idx + 1);
+	}
+	return 1;
+}
+
+/* Calls the fetch function of expression <expr> on sample <smp>, possibly
+ * using the stream's sample cache. All the results of an iterated fetch are
+ * collected at once so that later iterations are served from the cache.
+ * Returns the fetch's return value.
+ */
+static int smp_fetch_cached(struct sample_expr *expr, struct sample *smp)
+{
+	const struct sample_fetch *fetch = expr->fetch;
+	struct stream *s = smp->strm;
+	struct smp_cache *cache;
+	struct smp_cache_ent *ent;
+	union smp_ctx ctx;
+	unsigned int opt, flags, idx, area_used;
+	int ret;
+
+	if (smp->flags & SMP_F_NOT_LAST) {
+		/* next occurrence of an iterated fetch */
+		if (smp->ctx.a[0] != &smp_cache_iter)
+			goto no_cache;
+
+		cache = s->smp_cache;
+		idx = (long)smp->ctx.a[1];
+		if (cache->gen != htx_hdr_gen || idx >= cache->nb_ent) {
+			smp->flags &= ~SMP_F_NOT_LAST;
+			return 0;
+		}
+		return smp_cache_get(cache, idx, (long)smp->ctx.a[2], smp);
+	}
+
+	if (!smp_cache_usable(s, fetch, smp->opt))
+		goto no_cache;
+
+	cache = s->smp_cache;
+	if (!cache) {
+		cache = pool_alloc(pool_head_smp_cache);
+		if (!cache)
+			goto no_cache;
+		cache->ent  = (struct smp_cache_ent *)(cache + 1);
+		cache->res  = (struct smp_cache_res *)(cache->ent + smp_cache_size);
+		cache->area = (char *)(cache->res + smp_cache_size * SMP_CACHE_RES_PER_ENT);
+		cache->gen  = htx_hdr_gen;
+		smp_cache_flush(cache);
+		s->smp_cache = cache;
+	}
+	else if (cache->gen != htx_hdr_gen) {
+		cache->gen = htx_hdr_gen;
+		smp_cache_flush(cache);
+	}
+
+	opt = smp->opt & (SMP_OPT_DIR | SMP_OPT_ITERATE);
+	for (idx = 0; idx < cache->nb_ent; idx++) {
+		ent = &cache->ent[idx];
+		if (ent->fetch == fetch && ent->opt == opt && sample_args_eq(ent->args, expr->arg_p)) {
+			activity[tid].smp_cache_hit++;
+			if (!ent->count) {
+				smp->flags = ent->flags;
+				return 0;
+			}
+			return smp_cache_get(cache, idx, 0, smp);
+		}
+	}
+
+	activity[tid].smp_cache_miss++;
+	flags = smp->flags;
+	ctx = smp->ctx;
+	ret = fetch->process(expr->arg_p, smp, fetch->kw, fetch->private);
+	if (!smp_cache_stable(smp))
+		return ret;
+
+	if (cache->nb_ent >= smp_cache_size)
+		smp_cache_flush(cache);
+
+	ent = &cache->ent[cache->nb_ent];
+	ent->fetch = fetch;
+	ent->args  = expr->arg_p;
+	ent->opt   = opt;
+	ent->flags = smp->flags & ~SMP_F_NOT_LAST;
+	ent->first = cache->nb_res;
+	ent->count = 0;
+	area_used  = cache->area_used;
+
+	while (ret) {
+		if (!smp_cache_put(cache, smp)) {
+			if (ent->count || !ent->first)
+				goto drop;
+			/* no more room, start over with only this entry */
+			cache->ent[0] = *ent;
+			smp_cache_flush(cache);
+			ent = &cache->ent[0];
+			ent->first = area_used = 0;
+			if (!smp_cache_put(cache, smp))
+				goto drop;
+		}
+		ent->count++;
+		if (!(smp->flags & SMP_F_NOT_LAST))
+			break;
+		ret = fetch->process(expr->arg_p, smp, fetch->kw, fetch->private);
+		if (!smp_cache_stable(smp))
+			goto drop;
+	}
+
+	idx = cache->nb_ent++;
+	if (!ent->count)
+		return 0;
+	return smp_cache_get(cache, idx, 0, smp);
+
+ drop:
+	/* forget this entry. If the fetch was iterated, it is restarted from
+	 * its first result.
+	 */
+	cache->nb_res = ent->first;
+	cache->area_used = area_used;
+	if (!ent->count)
+		return ret;
+	smp->flags = flags;
+	smp->ctx = ctx;
+ no_cache:
+	return fetch->process(expr->arg_p, smp, fetch->kw, fetch->private);
+}
+
 /*
  * Process a fetch + format conversion of defined by the sample expression <expr>
  * on request or response considering the <opt> parameter.
@@ -1367,7 +1706,11 @@ struct sample *sample_process(struct proxy *px, struct session *sess,
 	}
 
 	smp_set_owner(p, px, sess, strm, opt);
-	if (!expr->fetch->process(expr->arg_p, p, expr->fetch->kw, expr->fetch->private))
+	if (smp_cache_size && strm) {
+		if (!smp_fetch_cached(expr, p))
+			return NULL;
+	}
+	else if (!expr->fetch->process(expr->arg_p, p, expr->fetch->kw, expr->fetch->private))
 		return NULL;
 
 	if (!sample_process_cnv(expr, p))
@@ -5103,9 +5446,9 @@ static struct sample_fetch_kw_list smp_kws = {ILH, {
 	{ "proc",         smp_fetch_proc,  0,            NULL, SMP_T_SINT, SMP_USE_CONST },
 	{ "quic_enabled", smp_fetch_quic_enabled, 0,     NULL, SMP_T_BOOL, SMP_USE_CONST },
 	{ "thread",       smp_fetch_thread,  0,          NULL, SMP_T_SINT, SMP_USE_CONST },
-	{ "rand",         smp_fetch_rand,  ARG1(0,SINT), NULL, SMP_T_SINT, SMP_USE_CONST },
+	{ "rand",         smp_fetch_rand,  ARG1(0,SINT), NULL, SMP_T_SINT, SMP_USE_CONST, .flags = SMP_KW_F_VOLATILE },
 	{ "stopping",     smp_fetch_stopping, 0,         NULL, SMP_T_BOOL, SMP_USE_INTRN },
-	{ "uuid",         smp_fetch_uuid,  ARG1(0, SINT),      smp_check_uuid, SMP_T_STR, SMP_USE_CONST },
+	{ "uuid",         smp_fetch_uuid,  ARG1(0, SINT),      smp_check_uuid, SMP_T_STR, SMP_USE_CONST, .flags = SMP_KW_F_VOLATILE },
 
 	{ "cpu_calls",    smp_fetch_cpu_calls,  0,       NULL, SMP_T_SINT, SMP_USE_INTRN },
 	{ "cpu_ns_avg",   smp_fetch_cpu_ns_avg, 0,       NULL, SMP_T_SINT, SMP_USE_INTRN },
@@ -5129,7 +5472,7 @@ INITCALL1(STG_REGISTER, sample_register_fetches, &smp_kws);
 /* Note: must not be declared <const> as its list will be overwritten */
 static struct sample_conv_kw_list sample_conv_kws = {ILH, {
 	{ "add_item",sample_conv_add_item,     ARG3(2,STR,STR,STR),   smp_check_add_item,       SMP_T_STR,  SMP_T_STR  },
-	{ "debug",   sample_conv_debug,        ARG2(0,STR,STR),       smp_check_debug,          SMP_T_ANY,  SMP_T_SAME },
+	{ "debug",   sample_conv_debug,        ARG2(0,STR,STR),       smp_check_debug,          SMP_T_ANY,  SMP_T_SAME, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "b64dec",  sample_conv_base642bin,   0,                     NULL,                     SMP_T_STR,  SMP_T_BIN  },
 	{ "base64",  sample_conv_bin2base64,   0,                     NULL,                     SMP_T_BIN,  SMP_T_STR  },
 	{ "concat",  sample_conv_concat,       ARG3(1,STR,STR,STR),   smp_check_concat,         SMP_T_STR,  SMP_T_STR  },
@@ -5213,3 +5556,48 @@ static struct sample_conv_kw_list sample_conv_kws = {ILH, {
 }};
 
 INITCALL1(STG_REGISTER, sample_register_convs, &sample_conv_kws);
+
+/* config parser for global "tune.sample-cache", accepts a number of entries */
+static int cfg_parse_tune_sample_cache(char **args, int section_type, struct proxy *curpx,
+                                       const struct proxy *defpx, const char *file, int line,
+                                       char **err)
+{
+	char *stop;
+	long val;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	val = strtol(args[1], &stop, 10);
+	if (!*args[1] || *stop || val < 0 || val > 1024) {
+		memprintf(err, "'%s' expects a number of entries between 0 and 1024 but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+
+	if (pool_head_smp_cache) {
+		memprintf(err, "'%s' is already configured.", args[0]);
+		return -1;
+	}
+
+	smp_cache_size = val;
+	if (!smp_cache_size)
+		return 0;
+
+	pool_head_smp_cache = create_pool("smp_cache", sizeof(struct smp_cache) +
+	                                  smp_cache_size * (sizeof(struct smp_cache_ent) +
+	                                                    SMP_CACHE_RES_PER_ENT * sizeof(struct smp_cache_res) +
+	                                                    SMP_CACHE_AREA_PER_ENT),
+	                                  MEM_F_SHARED);
+	if (!pool_head_smp_cache) {
+		memprintf(err, "Out of memory error.");
+		return -1;
+	}
+	return 0;
+}
+
+static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.sample-cache", cfg_parse_tune_sample_cache },
+	{ 0, NULL, NULL }
+}};
+
+INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
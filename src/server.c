@@ -1305,6 +1305,14 @@ static int srv_parse_shard(char **args, int *cur_arg,
 	return 0;
 }
 
+/* Parse the "no-msg-zerocopy" server keyword */
+static int srv_parse_no_msg_zerocopy(char **args, int *cur_arg,
+                                     struct proxy *curproxy, struct server *newsrv, char **err)
+{
+	newsrv->flags &= ~SRV_F_ZEROCOPY;
+	return 0;
+}
+
 /* Parse the "no-tfo" server keyword */
 static int srv_parse_no_tfo(char **args, int *cur_arg,
                             struct proxy *curproxy, struct server *newsrv, char **err)
@@ -1922,6 +1930,18 @@ static int srv_parse_socks4(char **args, int *cur_arg,
 }
 
 
+/* parse the "msg-zerocopy" server keyword */
+static int srv_parse_msg_zerocopy(char **args, int *cur_arg, struct proxy *px, struct server *newsrv, char **err)
+{
+#ifdef HA_HAVE_MSG_ZEROCOPY
+	newsrv->flags |= SRV_F_ZEROCOPY;
+	return 0;
+#else
+	memprintf(err, "'%s' is not supported on this platform", args[*cur_arg]);
+	return ERR_ALERT | ERR_FATAL;
+#endif
+}
+
 /* parse the "tfo" server keyword */
 static int srv_parse_tfo(char **args, int *cur_arg, struct proxy *px, struct server *newsrv, char **err)
 {
@@ -2285,8 +2305,10 @@ static struct srv_kw_list srv_kws = { "ALL", { }, {
 	{ "maxqueue",             srv_parse_maxqueue,             1,  1,  1 }, /* Set the max number of connection to put in queue */
 	{ "max-reuse",            srv_parse_max_reuse,            1,  1,  0 }, /* Set the max number of requests on a connection, -1 means unlimited */
 	{ "minconn",              srv_parse_minconn,              1,  1,  1 }, /* Enable a dynamic maxconn limit */
+	{ "msg-zerocopy",         srv_parse_msg_zerocopy,         0,  1,  1 }, /* Send large requests with MSG_ZEROCOPY */
 	{ "namespace",            srv_parse_namespace,            1,  1,  0 }, /* Namespace the server socket belongs to (if supported) */
 	{ "no-backup",            srv_parse_no_backup,            0,  1,  1 }, /* Flag as non-backup server */
+	{ "no-msg-zerocopy",      srv_parse_no_msg_zerocopy,      0,  1,  1 }, /* Disable use of MSG_ZEROCOPY */
 	{ "no-send-proxy",        srv_parse_no_send_proxy,        0,  1,  1 }, /* Disable use of PROXY V1 protocol */
 	{ "no-send-proxy-v2",     srv_parse_no_send_proxy_v2,     0,  1,  1 }, /* Disable use of PROXY V2 protocol */
 	{ "no-tfo",               srv_parse_no_tfo,               0,  1,  1 }, /* Disable use of TCP Fast Open */
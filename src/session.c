@@ -175,6 +175,10 @@ int session_accept_fd(struct connection *cli_conn)
 		if (l->bind_conf->options & BC_O_ACC_CIP)
 			cli_conn->flags |= CO_FL_ACCEPT_CIP;
 
+		/* large responses may be sent using MSG_ZEROCOPY */
+		if (l->bind_conf->options & BC_O_ZEROCOPY)
+			cli_conn->flags |= CO_FL_OPT_ZEROCOPY;
+
 		/* Add the handshake pseudo-XPRT */
 		if (cli_conn->flags & (CO_FL_ACCEPT_PROXY | CO_FL_ACCEPT_CIP)) {
 			if (xprt_add_hs(cli_conn) != 0)
@@ -13,10 +13,12 @@
 #define _GNU_SOURCE
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <sys/param.h>
 #include <sys/socket.h>
@@ -27,14 +29,23 @@
 #include <haproxy/api.h>
 #include <haproxy/activity.h>
 #include <haproxy/connection.h>
+#include <haproxy/global.h>
 #include <haproxy/listener.h>
 #include <haproxy/log.h>
 #include <haproxy/namespace.h>
 #include <haproxy/proto_sockpair.h>
 #include <haproxy/sock.h>
 #include <haproxy/sock_inet.h>
+#include <haproxy/task.h>
 #include <haproxy/tools.h>
 
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+static void sock_conn_zc_park(struct connection *conn);
+#endif
+
 #define SOCK_XFER_OPT_FOREIGN 0x000000001
 #define SOCK_XFER_OPT_V6ONLY  0x000000002
 #define SOCK_XFER_OPT_DGRAM   0x000000004
@@ -726,6 +737,10 @@ void sock_conn_ctrl_init(struct connection *conn)
 void sock_conn_ctrl_close(struct connection *conn)
 {
 	BUG_ON(conn->flags & CO_FL_FDLESS);
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	if (unlikely(conn->zc))
+		sock_conn_zc_park(conn);
+#endif
 	fd_delete(conn->handle.fd);
 	conn->handle.fd = DEAD_FD_MAGIC;
 }
@@ -830,6 +845,192 @@ int sock_conn_check(struct connection *conn)
 	return 0;
 }
 
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+/* Delay between two checks of the parked zero-copy contexts, and delay after
+ * which a parked context whose sends are still not completed is released by
+ * resetting its socket.
+ */
+#define SOCK_ZC_PARK_CHECK   100
+#define SOCK_ZC_PARK_TIMEOUT 60000
+
+/* per-thread list of zero-copy contexts parked after their connection was
+ * closed, and the task collecting their completions.
+ */
+static struct {
+	struct list list;
+	struct task *task;
+} sock_zc_parked[MAX_THREADS];
+
+/* Reads the MSG_ZEROCOPY completion notifications queued on the error queue of
+ * socket <fd> and advances <zc>'s completed ids accordingly. Returns non-zero
+ * if the kernel reported that it had to copy the data anyway.
+ */
+static int sock_zc_read_errqueue(int fd, struct conn_zc *zc)
+{
+	char control[128] ALIGNED(sizeof(size_t));
+	struct sock_extended_err *serr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	int copied = 0;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+			    !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+				continue;
+
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+
+			/* ids ee_info to ee_data are completed. TCP reports
+			 * them in order so we only need to advance done_id.
+			 */
+			if ((int)(serr->ee_data + 1 - zc->done_id) > 0)
+				zc->done_id = serr->ee_data + 1;
+
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				copied = 1;
+		}
+	}
+	return copied;
+}
+
+/* Collects the completions of the zero-copy contexts parked on the current
+ * thread. Contexts whose buffers were all released are freed with their FD.
+ * Those which are still waiting after SOCK_ZC_PARK_TIMEOUT have their socket
+ * reset, which purges its queues, and their buffers released.
+ */
+static struct task *sock_zc_parked_process(struct task *t, void *context, unsigned int state)
+{
+	struct conn_zc *zc, *back;
+
+	list_for_each_entry_safe(zc, back, &sock_zc_parked[tid].list, list) {
+		sock_zc_read_errqueue(zc->fd, zc);
+		conn_zc_release(zc, 0);
+
+		if (zc->count && !tick_is_expired(zc->expire, now_ms))
+			continue;
+
+		if (zc->count) {
+			DISGUISE(setsockopt(zc->fd, SOL_SOCKET, SO_LINGER,
+			                    (struct linger *) &nolinger, sizeof(struct linger)));
+			close(zc->fd);
+			conn_zc_release(zc, 1);
+		}
+		else
+			close(zc->fd);
+
+		LIST_DELETE(&zc->list);
+		pool_free(pool_head_conn_zc, zc);
+	}
+
+	t->expire = TICK_ETERNITY;
+	if (!LIST_ISEMPTY(&sock_zc_parked[tid].list))
+		t->expire = tick_add(now_ms, MS_TO_TICKS(SOCK_ZC_PARK_CHECK));
+	return t;
+}
+
+/* Called when closing <conn>'s socket while some of its buffers may still be
+ * referenced by zero-copy sends. Pending completions are collected first. If
+ * buffers remain, the socket is kept open through a duplicate FD, which is
+ * shut down for writes as the close would have done, and the zero-copy
+ * context is moved from the connection to the thread's parked list until its
+ * sends complete. This is not done when the socket is about to be reset since
+ * this purges its queues. On failure, the context is left on the connection,
+ * which releases the buffers when it is freed.
+ */
+static void sock_conn_zc_park(struct connection *conn)
+{
+	struct conn_zc *zc = conn->zc;
+	int fd = conn->handle.fd;
+	struct task *t;
+
+	sock_zc_read_errqueue(fd, zc);
+	conn_zc_release(zc, 0);
+
+	if (!zc->count || (fdtab[fd].state & FD_LINGER_RISK))
+		return;
+
+	t = sock_zc_parked[tid].task;
+	if (!t) {
+		t = task_new_here();
+		if (!t)
+			return;
+		t->process = sock_zc_parked_process;
+		LIST_INIT(&sock_zc_parked[tid].list);
+		sock_zc_parked[tid].task = t;
+	}
+
+	zc->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	if (zc->fd < 0)
+		return;
+
+	shutdown(zc->fd, SHUT_WR);
+	zc->expire = tick_add(now_ms, MS_TO_TICKS(SOCK_ZC_PARK_TIMEOUT));
+	LIST_APPEND(&sock_zc_parked[tid].list, &zc->list);
+	conn->zc = NULL;
+	task_schedule(t, tick_add(now_ms, MS_TO_TICKS(SOCK_ZC_PARK_CHECK)));
+}
+
+/* Releases the parked zero-copy contexts of the current thread on exit */
+static void sock_zc_parked_deinit(void)
+{
+	struct conn_zc *zc, *back;
+
+	if (!sock_zc_parked[tid].task)
+		return;
+
+	list_for_each_entry_safe(zc, back, &sock_zc_parked[tid].list, list) {
+		close(zc->fd);
+		conn_zc_release(zc, 1);
+		LIST_DELETE(&zc->list);
+		pool_free(pool_head_conn_zc, zc);
+	}
+	task_destroy(sock_zc_parked[tid].task);
+	sock_zc_parked[tid].task = NULL;
+}
+REGISTER_PER_THREAD_FREE(sock_zc_parked_deinit);
+#endif
+
+/* Drains the MSG_ZEROCOPY completion notifications queued on the error queue
+ * of <conn>'s socket, which must have a zero-copy context, and releases the
+ * buffers the completed sends were holding. If the kernel reports that it had
+ * to copy the data anyway (e.g. over loopback or through a device lacking
+ * scatter-gather), zero-copy is disabled on the connection since it only adds
+ * overhead. The notifications make the poller report an error on the FD, so
+ * FD_POLL_ERR is cleared once they are consumed unless a real socket error is
+ * pending.
+ */
+void sock_conn_zc_drain(struct connection *conn)
+{
+#if defined(HA_HAVE_MSG_ZEROCOPY)
+	int fd = conn->handle.fd;
+	socklen_t lskerr;
+	int skerr;
+
+	if (sock_zc_read_errqueue(fd, conn->zc))
+		conn->flags &= ~CO_FL_OPT_ZEROCOPY;
+
+	conn_zc_release(conn->zc, 0);
+
+	lskerr = sizeof(skerr);
+	if ((fdtab[fd].state & FD_POLL_ERR) &&
+	    getsockopt(fd, SOL_SOCKET, SO_ERROR, &skerr, &lskerr) == 0 && !skerr)
+		HA_ATOMIC_AND(&fdtab[fd].state, ~FD_POLL_ERR);
+#endif
+}
+
 /* I/O callback for fd-based connections. It calls the read/write handlers
  * provided by the connection's sock_ops, which must be valid.
  */
@@ -847,6 +1048,10 @@ void sock_conn_iocb(int fd)
 
 	flags = conn->flags & ~CO_FL_ERROR; /* ensure to call the wake handler upon error */
 
+	/* zero-copy completions are reported as errors */
+	if (unlikely(conn->zc) && (fdtab[fd].state & FD_POLL_ERR))
+		sock_conn_zc_drain(conn);
+
 	if (unlikely(conn->flags & CO_FL_WAIT_L4_CONN) &&
 	    ((fd_send_ready(fd) && fd_send_active(fd)) ||
 	     (fd_recv_ready(fd) && fd_recv_active(fd)))) {
@@ -87,6 +87,10 @@
 #include <haproxy/istbuf.h>
 #include <haproxy/ssl_ocsp.h>
 
+#ifdef HAVE_SSL_KTLS
+#include <linux/tls.h>
+#endif
+
 
 /* ***** READ THIS before adding code here! *****
  *
@@ -155,6 +159,7 @@ enum {
 	SSL_ST_SESS,
 	SSL_ST_REUSED_SESS,
 	SSL_ST_FAILED_HANDSHAKE,
+	SSL_ST_KTLS,
 
 	SSL_ST_STATS_COUNT /* must be the last member of the enum */
 };
@@ -166,12 +171,15 @@ static struct name_desc ssl_stats[] = {
 	                              .desc = "Total number of ssl sessions reused" },
 	[SSL_ST_FAILED_HANDSHAKE] = { .name = "ssl_failed_handshake",
 	                              .desc = "Total number of failed handshake" },
+	[SSL_ST_KTLS]             = { .name = "ssl_ktls",
+	                              .desc = "Total number of ssl connections offloaded to kernel TLS" },
 };
 
 static struct ssl_counters {
 	long long sess;
 	long long reused_sess;
 	long long failed_handshake;
+	long long ktls;
 } ssl_counters;
 
 static int ssl_fill_stats(void *data, struct field *stats, unsigned int *selected_field)
@@ -192,6 +200,9 @@ static int ssl_fill_stats(void *data, struct field *stats, unsigned int *selecte
 		case SSL_ST_FAILED_HANDSHAKE:
 			metric = mkf_u64(FN_COUNTER, counters->failed_handshake);
 			break;
+		case SSL_ST_KTLS:
+			metric = mkf_u64(FN_COUNTER, counters->ktls);
+			break;
 		default:
 			/* not used for frontends. If a specific metric
 			 * is requested, return an error. Otherwise continue.
@@ -237,6 +248,172 @@ struct show_keys_ctx {
 struct task *ssl_sock_io_cb(struct task *, void *, unsigned int);
 static int ssl_sock_handshake(struct connection *conn, unsigned int flag);
 
+#ifdef HAVE_SSL_KTLS
+/* transport-layer operations for SSL sockets offloaded to kernel TLS, indexed
+ * by (tx | rx << 1) - 1. They only differ from ssl_sock by the support of
+ * splicing in the offloaded directions.
+ */
+static struct xprt_ops ssl_sock_ktls[3];
+
+/* Returns the length of the kernel crypto info matching the cipher announced
+ * in <info>, or 0 if it is not known.
+ */
+static size_t ssl_sock_ktls_info_len(const struct tls_crypto_info *info)
+{
+	switch (info->cipher_type) {
+#ifdef TLS_CIPHER_AES_GCM_128
+	case TLS_CIPHER_AES_GCM_128:
+		return sizeof(struct tls12_crypto_info_aes_gcm_128);
+#endif
+#ifdef TLS_CIPHER_AES_GCM_256
+	case TLS_CIPHER_AES_GCM_256:
+		return sizeof(struct tls12_crypto_info_aes_gcm_256);
+#endif
+#ifdef TLS_CIPHER_AES_CCM_128
+	case TLS_CIPHER_AES_CCM_128:
+		return sizeof(struct tls12_crypto_info_aes_ccm_128);
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case TLS_CIPHER_CHACHA20_POLY1305:
+		return sizeof(struct tls12_crypto_info_chacha20_poly1305);
+#endif
+	}
+	return 0;
+}
+
+/* Called by the SSL library through the BIO once the traffic keys for the
+ * direction <is_tx> are known, to hand them to the kernel. Returns 1 if the
+ * kernel now processes the records in this direction, otherwise 0 and the
+ * library keeps doing it.
+ */
+static int ssl_sock_set_ktls(struct ssl_sock_ctx *ctx, int is_tx, const struct tls_crypto_info *info)
+{
+	struct connection *conn = ctx->conn;
+	size_t len = ssl_sock_ktls_info_len(info);
+	int fd;
+
+	if (!len || !conn_ctrl_ready(conn) || (conn->flags & CO_FL_FDLESS) ||
+	    conn->xprt_ctx != ctx)
+		return 0;
+
+	fd = conn->handle.fd;
+	if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 && errno != EEXIST)
+		return 0;
+
+	if (setsockopt(fd, SOL_TLS, is_tx ? TLS_TX : TLS_RX, info, len) < 0)
+		return 0;
+
+	ctx->xprt_st |= is_tx ? SSL_SOCK_KTLS_TX : SSL_SOCK_KTLS_RX;
+	conn->xprt = &ssl_sock_ktls[((ctx->xprt_st & SSL_SOCK_KTLS_TX) ? 1 : 0) +
+	                            ((ctx->xprt_st & SSL_SOCK_KTLS_RX) ? 2 : 0) - 1];
+	return 1;
+}
+
+/* Reads one record decrypted by the kernel into <buf>, preceded by the record
+ * header the SSL library expects. Returns the number of bytes stored, or 0 if
+ * nothing could be read, in which case the connection's flags and the FD's
+ * state are updated as the raw socket layer does.
+ */
+static int ssl_sock_ktls_recv(struct ssl_sock_ctx *ctx, char *buf, int size)
+{
+	struct connection *conn = ctx->conn;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(unsigned char))];
+	} cmsgbuf;
+	struct msghdr msg = { };
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int ret;
+
+	if (!fd_recv_ready(conn->handle.fd))
+		return 0;
+
+	if (size < SSL3_RT_HEADER_LENGTH + EVP_GCM_TLS_TAG_LEN) {
+		conn->flags |= CO_FL_ERROR | CO_FL_SOCK_RD_SH;
+		return 0;
+	}
+
+	iov.iov_base = buf + SSL3_RT_HEADER_LENGTH;
+	iov.iov_len  = size - SSL3_RT_HEADER_LENGTH - EVP_GCM_TLS_TAG_LEN;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+	do {
+		ret = recvmsg(conn->handle.fd, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret > 0) {
+		cmsg = CMSG_FIRSTHDR(&msg);
+		buf[0] = SSL3_RT_APPLICATION_DATA;
+		if (cmsg && cmsg->cmsg_level == SOL_TLS && cmsg->cmsg_type == TLS_GET_RECORD_TYPE)
+			buf[0] = *(unsigned char *)CMSG_DATA(cmsg);
+		buf[1] = TLS1_2_VERSION_MAJOR;
+		buf[2] = TLS1_2_VERSION_MINOR;
+		buf[3] = ret >> 8;
+		buf[4] = ret;
+		return ret + SSL3_RT_HEADER_LENGTH;
+	}
+
+	if (ret == 0)
+		conn_sock_read0(conn);
+	else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN)
+		fd_cant_recv(conn->handle.fd);
+	else
+		conn->flags |= CO_FL_ERROR | CO_FL_SOCK_RD_SH;
+	return 0;
+}
+
+/* Sends <num> bytes from <buf> as a single non-application record of the type
+ * previously set by the SSL library. Returns the number of bytes sent, or 0
+ * if nothing could be sent, with the connection's flags and the FD's state
+ * updated as the raw socket layer does.
+ */
+static int ssl_sock_ktls_send_ctrl(struct ssl_sock_ctx *ctx, const char *buf, int num)
+{
+	struct connection *conn = ctx->conn;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(unsigned char))];
+	} cmsgbuf;
+	struct msghdr msg = { };
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	int ret;
+
+	if (!fd_send_ready(conn->handle.fd))
+		return 0;
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len  = num;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*(unsigned char *)CMSG_DATA(cmsg) = ctx->ktls_rec_type;
+
+	do {
+		ret = sendmsg(conn->handle.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret > 0)
+		return ret;
+
+	if (ret == 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN || errno == EINPROGRESS)
+		fd_cant_send(conn->handle.fd);
+	else
+		conn->flags |= CO_FL_ERROR | CO_FL_SOCK_WR_SH;
+	return 0;
+}
+#endif /* HAVE_SSL_KTLS */
+
 /* Methods to implement OpenSSL BIO */
 static int ha_ssl_write(BIO *h, const char *buf, int num)
 {
@@ -246,12 +423,21 @@ static int ha_ssl_write(BIO *h, const char *buf, int num)
 	int ret;
 
 	ctx = BIO_get_data(h);
+#ifdef HAVE_SSL_KTLS
+	if (ctx->ktls_rec_type) {
+		ret = ssl_sock_ktls_send_ctrl(ctx, buf, num);
+		goto done;
+	}
+#endif
 	tmpbuf.size = num;
 	tmpbuf.area = (void *)(uintptr_t)buf;
 	tmpbuf.data = num;
 	tmpbuf.head = 0;
 	flags = (ctx->xprt_st & SSL_SOCK_SEND_MORE) ? CO_SFL_MSG_MORE : 0;
 	ret = ctx->xprt->snd_buf(ctx->conn, ctx->xprt_ctx, &tmpbuf, num, flags);
+#ifdef HAVE_SSL_KTLS
+ done:
+#endif
 	BIO_clear_retry_flags(h);
 	if (ret == 0 && !(ctx->conn->flags & (CO_FL_ERROR | CO_FL_SOCK_WR_SH))) {
 		BIO_set_retry_write(h);
@@ -279,11 +465,20 @@ static int ha_ssl_read(BIO *h, char *buf, int size)
 	int ret;
 
 	ctx = BIO_get_data(h);
+#ifdef HAVE_SSL_KTLS
+	if (ctx->xprt_st & SSL_SOCK_KTLS_RX) {
+		ret = ssl_sock_ktls_recv(ctx, buf, size);
+		goto done;
+	}
+#endif
 	tmpbuf.size = size;
 	tmpbuf.area = buf;
 	tmpbuf.data = 0;
 	tmpbuf.head = 0;
 	ret = ctx->xprt->rcv_buf(ctx->conn, ctx->xprt_ctx, &tmpbuf, size, 0);
+#ifdef HAVE_SSL_KTLS
+ done:
+#endif
 	BIO_clear_retry_flags(h);
 	if (ret == 0 && !(ctx->conn->flags & (CO_FL_ERROR | CO_FL_SOCK_RD_SH))) {
 		BIO_set_retry_read(h);
@@ -295,12 +490,38 @@ static int ha_ssl_read(BIO *h, char *buf, int size)
 
 static long ha_ssl_ctrl(BIO *h, int cmd, long arg1, void *arg2)
 {
+#ifdef HAVE_SSL_KTLS
+	struct ssl_sock_ctx *ctx = BIO_get_data(h);
+#endif
 	int ret = 0;
 	switch (cmd) {
 	case BIO_CTRL_DUP:
 	case BIO_CTRL_FLUSH:
 		ret = 1;
 		break;
+#ifdef HAVE_SSL_KTLS
+	case HA_BIO_CTRL_SET_KTLS:
+		ret = ctx && ssl_sock_set_ktls(ctx, arg1, arg2);
+		break;
+	case BIO_CTRL_GET_KTLS_SEND:
+		ret = ctx && (ctx->xprt_st & SSL_SOCK_KTLS_TX);
+		break;
+	case BIO_CTRL_GET_KTLS_RECV:
+		ret = ctx && (ctx->xprt_st & SSL_SOCK_KTLS_RX);
+		break;
+	case HA_BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+		if (ctx) {
+			ctx->ktls_rec_type = arg1;
+			ret = 1;
+		}
+		break;
+	case HA_BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+		if (ctx) {
+			ctx->ktls_rec_type = 0;
+			ret = 1;
+		}
+		break;
+#endif
 	}
 	return ret;
 }
@@ -628,9 +849,21 @@ static void ssl_sock_unregister_msg_callbacks(void)
 	}
 }
 
+/* Returns non-zero if <xprt> is one of the SSL transport layers, which may be
+ * the regular one or one of its variants once kernel TLS is enabled.
+ */
+static inline int ssl_sock_is_xprt(const struct xprt_ops *xprt)
+{
+#ifdef HAVE_SSL_KTLS
+	if (xprt >= &ssl_sock_ktls[0] && xprt < &ssl_sock_ktls[sizeof(ssl_sock_ktls) / sizeof(*ssl_sock_ktls)])
+		return 1;
+#endif
+	return xprt == xprt_get(XPRT_SSL);
+}
+
 static struct ssl_sock_ctx *ssl_sock_get_ctx(struct connection *conn)
 {
-	if (!conn || conn->xprt != xprt_get(XPRT_SSL) || !conn->xprt_ctx)
+	if (!conn || !ssl_sock_is_xprt(conn->xprt) || !conn->xprt_ctx)
 		return NULL;
 
 	return (struct ssl_sock_ctx *)conn->xprt_ctx;
@@ -4071,6 +4304,10 @@ ssl_sock_initial_ctx(struct bind_conf *bind_conf)
 		options |= SSL_OP_NO_TICKET;
 	if (bind_conf->ssl_options & BC_SSL_O_PREF_CLIE_CIPH)
 		options &= ~SSL_OP_CIPHER_SERVER_PREFERENCE;
+#ifdef HAVE_SSL_KTLS
+	if (bind_conf->ssl_options & BC_SSL_O_KTLS)
+		options |= SSL_OP_ENABLE_KTLS;
+#endif
 
 #ifdef SSL_OP_NO_RENEGOTIATION
 	options |= SSL_OP_NO_RENEGOTIATION;
@@ -5083,6 +5320,10 @@ static int ssl_sock_prepare_srv_ssl_ctx(const struct server *srv, SSL_CTX *ctx)
 
 	if (srv->ssl_ctx.options & SRV_SSL_O_NO_TLS_TICKETS)
 		options |= SSL_OP_NO_TICKET;
+#ifdef HAVE_SSL_KTLS
+	if (srv->ssl_ctx.options & SRV_SSL_O_KTLS)
+		options |= SSL_OP_ENABLE_KTLS;
+#endif
 	SSL_CTX_set_options(ctx, options);
 
 #ifdef SSL_MODE_ASYNC
@@ -5608,6 +5849,9 @@ static int ssl_sock_init(struct connection *conn, void **xprt_ctx)
 	ctx->wait_event.events = 0;
 	ctx->sent_early_data = 0;
 	ctx->early_buf = BUF_NULL;
+#ifdef HAVE_SSL_KTLS
+	ctx->ktls_rec_type = 0;
+#endif
 	ctx->conn = conn;
 	ctx->subs = NULL;
 	ctx->xprt_st = 0;
@@ -6081,6 +6325,11 @@ static int ssl_sock_handshake(struct connection *conn, unsigned int flag)
 		HA_ATOMIC_INC(&counters_px->reused_sess);
 	}
 
+	if (counters && (ctx->xprt_st & (SSL_SOCK_KTLS_TX | SSL_SOCK_KTLS_RX))) {
+		HA_ATOMIC_INC(&counters->ktls);
+		HA_ATOMIC_INC(&counters_px->ktls);
+	}
+
 	/* The connection is now established at both layers, it's time to leave */
 	conn->flags &= ~(flag | CO_FL_WAIT_L4_CONN | CO_FL_WAIT_L6_CONN);
 	return 1;
@@ -7403,6 +7652,36 @@ static struct cli_kw_list cli_kws = {{ },{
 
 INITCALL1(STG_REGISTER, cli_register_kw, &cli_kws);
 
+#if defined(HAVE_SSL_KTLS) && defined(USE_LINUX_SPLICE)
+/* Splices up to <count> bytes from the connection into <pipe> once records are
+ * decrypted by the kernel. Returns -1 so that the caller falls back to buffers
+ * if the SSL library still holds some data, which must be delivered first.
+ */
+static int ssl_sock_to_pipe(struct connection *conn, void *xprt_ctx, struct pipe *pipe, unsigned int count)
+{
+	struct ssl_sock_ctx *ctx = xprt_ctx;
+
+	if (!ctx->xprt->rcv_pipe || (conn->flags & CO_FL_SSL_WAIT_HS) ||
+	    SSL_pending(ctx->ssl) || SSL_has_pending(ctx->ssl))
+		return -1;
+
+	return ctx->xprt->rcv_pipe(conn, ctx->xprt_ctx, pipe, count);
+}
+
+/* Splices up to <count> bytes from <pipe> to the connection once records are
+ * encrypted by the kernel.
+ */
+static int ssl_sock_from_pipe(struct connection *conn, void *xprt_ctx, struct pipe *pipe, unsigned int count)
+{
+	struct ssl_sock_ctx *ctx = xprt_ctx;
+
+	if (!ctx->xprt->snd_pipe || (conn->flags & CO_FL_SSL_WAIT_HS))
+		return 0;
+
+	return ctx->xprt->snd_pipe(conn, ctx->xprt_ctx, pipe, count);
+}
+#endif
+
 /* transport-layer operations for SSL sockets */
 struct xprt_ops ssl_sock = {
 	.snd_buf  = ssl_sock_from_buf,
@@ -7518,6 +7797,9 @@ static void ssl_sock_clt_sni_free_func(void *parent, void *ptr, CRYPTO_EX_DATA *
 
 static void __ssl_sock_init(void)
 {
+#ifdef HAVE_SSL_KTLS
+	int i;
+#endif
 #if (!defined(OPENSSL_NO_COMP) && !defined(SSL_OP_NO_COMPRESSION))
 	STACK_OF(SSL_COMP)* cm;
 	int n;
@@ -7535,6 +7817,17 @@ static void __ssl_sock_init(void)
 #endif
 
 	xprt_register(XPRT_SSL, &ssl_sock);
+#ifdef HAVE_SSL_KTLS
+	for (i = 0; i < sizeof(ssl_sock_ktls) / sizeof(*ssl_sock_ktls); i++) {
+		ssl_sock_ktls[i] = ssl_sock;
+#if defined(USE_LINUX_SPLICE)
+		if ((i + 1) & 1)
+			ssl_sock_ktls[i].snd_pipe = ssl_sock_from_pipe;
+		if ((i + 1) & 2)
+			ssl_sock_ktls[i].rcv_pipe = ssl_sock_to_pipe;
+#endif
+	}
+#endif
 #if HA_OPENSSL_VERSION_NUMBER < 0x10100000L
 	SSL_library_init();
 #elif HA_OPENSSL_VERSION_NUMBER >= 0x10100000L
@@ -13,6 +13,10 @@
 
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <import/ebmbtree.h>
 #include <import/ebsttree.h>
@@ -23,6 +27,7 @@
 #include <haproxy/arg.h>
 #include <haproxy/cfgparse.h>
 #include <haproxy/cli.h>
+#include <haproxy/clock.h>
 #include <haproxy/dict.h>
 #include <haproxy/errors.h>
 #include <haproxy/global.h>
@@ -518,6 +523,24 @@ struct stksess *stktable_lookup(struct stktable *t, struct stksess *ts)
 	return lts;
 }
 
+/* Queues <ts> at the end of the update tree of table <t> as a local update so
+ * that it's pushed to the peers. The table's updt_lock must be held for writes.
+ */
+static inline void __stktable_queue_local_update(struct stktable *t, struct stksess *ts)
+{
+	struct eb32_node *eb;
+
+	ts->seen = 0;
+	ts->upd.key = ++t->update;
+	t->localupdate = t->update;
+	eb32_delete(&ts->upd);
+	eb = eb32_insert(&t->updates, &ts->upd);
+	if (eb != &ts->upd)  {
+		eb32_delete(eb);
+		eb32_insert(&t->updates, &ts->upd);
+	}
+}
+
 /* Update the expiration timer for <ts> but do not touch its expiration node.
  * The table's expiration timer is updated if set.
  * The node will be also inserted into the update tree if needed, at a position
@@ -560,16 +583,7 @@ void stktable_touch_with_exp(struct stktable *t, struct stksess *ts, int local,
 				}
 
 				/* here we're write-locked */
-
-				ts->seen = 0;
-				ts->upd.key = ++t->update;
-				t->localupdate = t->update;
-				eb32_delete(&ts->upd);
-				eb = eb32_insert(&t->updates, &ts->upd);
-				if (eb != &ts->upd)  {
-					eb32_delete(eb);
-					eb32_insert(&t->updates, &ts->upd);
-				}
+				__stktable_queue_local_update(t, ts);
 			}
 			do_wakeup = 1;
 		}
@@ -630,6 +644,219 @@ void stktable_touch_local(struct stktable *t, struct stksess *ts, int decrefcnt)
 
 	stktable_touch_with_exp(t, ts, 1, expire, decrefcnt);
 }
+
+/* Deferred counter updates. On tables declared with "deferred-updates", the
+ * counter and rate increments are not applied to the entry immediately but
+ * accumulated into a small per-thread cache of slots indexed by entry and data
+ * type. The slots are merged by a per-thread tasklet woken up on the first
+ * deferred update, so that all the events processed by a thread during one
+ * scheduler round cost a single entry lock per entry and a single updt_lock
+ * per table. A slot is merged earlier when another entry needs it. Readers may
+ * thus miss at most the events processed by each thread during one round.
+ */
+#define STKTABLE_DEFER_SLOTS 64 /* must be a power of two */
+
+struct stktable_defer_slot {
+	struct stktable *table;   /* table of the entry, NULL if the slot is free */
+	struct stksess *ts;       /* entry, one reference is held on it */
+	unsigned long long delta; /* pending increment */
+	unsigned int idx;         /* element index for array types, otherwise 0 */
+	short cnt_type;           /* data type of the cumulated counter */
+	short rate_type;          /* data type of the rate counter */
+};
+
+struct stktable_defer_ctx {
+	struct stktable_defer_slot slots[STKTABLE_DEFER_SLOTS];
+	struct tasklet *tasklet;  /* merges the pending slots */
+	unsigned int used;        /* number of slots in use */
+};
+
+static THREAD_LOCAL struct stktable_defer_ctx *stk_defer = NULL;
+
+/* Applies the pending increment of <slot> to its entry. Neither the expiration
+ * date nor the update tree are touched.
+ */
+static void stktable_defer_apply(const struct stktable_defer_slot *slot)
+{
+	struct stktable *t = slot->table;
+	struct stksess *ts = slot->ts;
+	void *ptr1, *ptr2;
+
+	ptr1 = stktable_data_ptr_idx(t, ts, slot->cnt_type, slot->idx);
+	ptr2 = stktable_data_ptr_idx(t, ts, slot->rate_type, slot->idx);
+
+	HA_RWLOCK_WRLOCK(STK_SESS_LOCK, &ts->lock);
+
+	if (ptr1) {
+		if (stktable_data_types[slot->cnt_type].std_type == STD_T_ULL)
+			stktable_data_cast(ptr1, std_t_ull) += slot->delta;
+		else
+			stktable_data_cast(ptr1, std_t_uint) += slot->delta;
+	}
+
+	if (ptr2)
+		update_freq_ctr_period(&stktable_data_cast(ptr2, std_t_frqp),
+				       t->data_arg[slot->rate_type].u, slot->delta);
+
+	HA_RWLOCK_WRUNLOCK(STK_SESS_LOCK, &ts->lock);
+}
+
+/* Merges all the pending slots of the current thread. Slots are processed
+ * table by table so that the updt_lock is taken only once per table.
+ */
+static void stktable_defer_merge(struct stktable_defer_ctx *ctx)
+{
+	struct stktable_defer_slot *slot;
+	struct stktable *t;
+	int expire;
+	int i, j;
+
+	for (i = 0; ctx->used && i < STKTABLE_DEFER_SLOTS; i++) {
+		t = ctx->slots[i].table;
+		if (!t)
+			continue;
+
+		expire = tick_add(now_ms, MS_TO_TICKS(t->expire));
+		for (j = i; j < STKTABLE_DEFER_SLOTS; j++) {
+			slot = &ctx->slots[j];
+			if (slot->table != t)
+				continue;
+
+			stktable_defer_apply(slot);
+			if (expire != HA_ATOMIC_LOAD(&slot->ts->expire)) {
+				HA_ATOMIC_STORE(&slot->ts->expire, expire);
+				stktable_requeue_exp(t, slot->ts);
+			}
+		}
+
+		if (t->sync_task) {
+			HA_RWLOCK_WRLOCK(STK_TABLE_LOCK, &t->updt_lock);
+			for (j = i; j < STKTABLE_DEFER_SLOTS; j++) {
+				slot = &ctx->slots[j];
+				if (slot->table != t)
+					continue;
+				if (!slot->ts->upd.node.leaf_p || _HA_ATOMIC_LOAD(&slot->ts->seen))
+					__stktable_queue_local_update(t, slot->ts);
+			}
+			HA_RWLOCK_WRUNLOCK(STK_TABLE_LOCK, &t->updt_lock);
+			task_wakeup(t->sync_task, TASK_WOKEN_MSG);
+		}
+
+		for (j = i; j < STKTABLE_DEFER_SLOTS; j++) {
+			slot = &ctx->slots[j];
+			if (slot->table != t)
+				continue;
+			HA_ATOMIC_DEC(&slot->ts->ref_cnt);
+			slot->table = NULL;
+			slot->ts = NULL;
+			ctx->used--;
+		}
+	}
+}
+
+/* Tasklet merging the deferred updates of the current thread */
+static struct task *stktable_defer_io_cb(struct task *t, void *context, unsigned int state)
+{
+	stktable_defer_merge(context);
+	return t;
+}
+
+/* Allocates the deferred updates context of the current thread. Returns it,
+ * or NULL on memory allocation failure.
+ */
+static struct stktable_defer_ctx *stktable_defer_alloc(void)
+{
+	struct stktable_defer_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return NULL;
+
+	ctx->tasklet = tasklet_new();
+	if (!ctx->tasklet) {
+		free(ctx);
+		return NULL;
+	}
+	ctx->tasklet->process = stktable_defer_io_cb;
+	ctx->tasklet->context = ctx;
+	stk_defer = ctx;
+	return ctx;
+}
+
+/* Adds <inc> to the cumulated counter <cnt_type> and to the rate counter
+ * <rate_type> of entry <ts> in table <t>, at index <idx> for array types. The
+ * update is deferred to the end of the current scheduler round, or performed
+ * immediately if the per-thread context cannot be allocated. A reference is
+ * held on <ts> while the update is pending. It always returns 1 so that it may
+ * directly be used as the return value of the stkctr_inc_* functions.
+ */
+int stktable_defer_ctr(struct stktable *t, struct stksess *ts, int cnt_type, int rate_type,
+                       unsigned int idx, unsigned long long inc)
+{
+	struct stktable_defer_ctx *ctx = stk_defer;
+	struct stktable_defer_slot *slot;
+	uint hash;
+
+	if (!stktable_data_ptr_idx(t, ts, cnt_type, idx) &&
+	    !stktable_data_ptr_idx(t, ts, rate_type, idx))
+		return 1;
+
+	if (unlikely(!ctx) && !(ctx = stktable_defer_alloc())) {
+		struct stktable_defer_slot tmp = {
+			.table = t, .ts = ts, .delta = inc, .idx = idx,
+			.cnt_type = cnt_type, .rate_type = rate_type,
+		};
+
+		stktable_defer_apply(&tmp);
+		stktable_touch_local(t, ts, 0);
+		return 1;
+	}
+
+	hash = ((ulong)ts >> 4) * 2654435761U + cnt_type * 31 + idx;
+	slot = &ctx->slots[hash & (STKTABLE_DEFER_SLOTS - 1)];
+
+	if (slot->table) {
+		if (slot->table == t && slot->ts == ts &&
+		    slot->cnt_type == cnt_type && slot->rate_type == rate_type &&
+		    slot->idx == idx && slot->delta + inc <= UINT_MAX) {
+			slot->delta += inc;
+			return 1;
+		}
+
+		/* the slot is needed for another update, merge it now */
+		stktable_defer_apply(slot);
+		stktable_touch_local(slot->table, slot->ts, 1);
+		ctx->used--;
+	}
+
+	HA_ATOMIC_INC(&ts->ref_cnt);
+	slot->table = t;
+	slot->ts = ts;
+	slot->delta = inc;
+	slot->idx = idx;
+	slot->cnt_type = cnt_type;
+	slot->rate_type = rate_type;
+	ctx->used++;
+	tasklet_wakeup(ctx->tasklet);
+	return 1;
+}
+
+/* Releases the deferred updates context of the current thread on exit. The
+ * pending updates are simply dropped.
+ */
+static int stktable_defer_free_per_thread(void)
+{
+	struct stktable_defer_ctx *ctx = stk_defer;
+
+	if (!ctx)
+		return 1;
+
+	tasklet_free(ctx->tasklet);
+	free(ctx);
+	stk_defer = NULL;
+	return 1;
+}
+REGISTER_PER_THREAD_FREE(stktable_defer_free_per_thread);
 /* Just decrease the ref_cnt of the current session. Does nothing if <ts> is NULL.
  * Note that we still need to take the read lock because a number of other places
  * (including in Lua and peers) update the ref_cnt non-atomically under the write
@@ -691,6 +918,144 @@ void stktable_requeue_exp(struct stktable *t, const struct stksess *ts)
 	HA_RWLOCK_WRUNLOCK(STK_TABLE_LOCK, &t->lock);
 }
 
+/*
+ * Heavy-hitter tables. A table declared with "sketch <width>" maintains a
+ * count-min sketch of STKTABLE_SKETCH_DEPTH rows of <width> counters which is
+ * fed with every key looked up for tracking. Once the table is full, a new key
+ * is only admitted if its estimated count exceeds the one of the oldest entry
+ * it would replace, so that the table converges to the most frequent keys and
+ * a flood of distinct keys neither causes allocations nor purges. The sketch
+ * is halved every expiration period so that it reflects recent activity. Its
+ * memory usage and update cost do not depend on the number of keys. Such
+ * tables always have an expiration since only expiring entries are purged.
+ */
+
+/* Computes the sketch columns of key <key> of length <len> for table <t> into
+ * <col>, using double hashing on a single 64-bit hash.
+ */
+static inline void stktable_sketch_cols(const struct stktable *t, const void *key, size_t len,
+                                        uint *col)
+{
+	uint64_t hash = XXH64(key, len, t->hash_seed ^ 0x5ce7c4);
+	uint h1 = hash, h2 = (hash >> 32) | 1;
+	int row;
+
+	for (row = 0; row < STKTABLE_SKETCH_DEPTH; row++)
+		col[row] = row * t->sketch_width + (h1 + row * h2) % t->sketch_width;
+}
+
+/* Returns the estimated count of key <key> of length <len> in table <t> */
+static uint stktable_sketch_estimate(const struct stktable *t, const void *key, size_t len)
+{
+	uint col[STKTABLE_SKETCH_DEPTH];
+	uint est = ~0U;
+	int row;
+
+	stktable_sketch_cols(t, key, len, col);
+	for (row = 0; row < STKTABLE_SKETCH_DEPTH; row++)
+		est = MIN(est, HA_ATOMIC_LOAD(&t->sketch[col[row]]));
+	return est;
+}
+
+/* Counts one more occurrence of key <key> of length <len> in table <t> and
+ * returns its new estimated count. A conservative update is used: only the
+ * counters holding the minimum are incremented, which limits the
+ * overestimation caused by collisions.
+ */
+static uint stktable_sketch_update(struct stktable *t, const void *key, size_t len)
+{
+	uint col[STKTABLE_SKETCH_DEPTH];
+	uint est = ~0U;
+	int row;
+
+	stktable_sketch_cols(t, key, len, col);
+	for (row = 0; row < STKTABLE_SKETCH_DEPTH; row++)
+		est = MIN(est, HA_ATOMIC_LOAD(&t->sketch[col[row]]));
+
+	for (row = 0; row < STKTABLE_SKETCH_DEPTH; row++) {
+		if (HA_ATOMIC_LOAD(&t->sketch[col[row]]) == est)
+			HA_ATOMIC_INC(&t->sketch[col[row]]);
+	}
+	return est + 1;
+}
+
+/* Returns the estimated count of the entry of table <t> which expires first
+ * among all shards, which is the first one to be purged, or 0 if there is
+ * none. The expiration trees are looked up the same way as the purge does so
+ * that wrapping dates are correctly ordered.
+ */
+static uint stktable_sketch_victim(struct stktable *t)
+{
+	struct eb32_node *eb;
+	struct stksess *ts;
+	uint victim = 0;
+	int exp = TICK_ETERNITY;
+	int shard;
+
+	for (shard = 0; shard < CONFIG_HAP_TBL_BUCKETS; shard++) {
+		HA_RWLOCK_RDLOCK(STK_TABLE_LOCK, &t->shards[shard].sh_lock);
+		eb = eb32_lookup_ge(&t->shards[shard].exps, now_ms - TIMER_LOOK_BACK);
+		if (!eb)
+			eb = eb32_first(&t->shards[shard].exps);
+		if (eb && (!tick_isset(exp) || tick_is_lt(eb->key, exp))) {
+			ts = eb32_entry(eb, struct stksess, exp);
+			exp = eb->key;
+			victim = stktable_sketch_estimate(t, ts->key.key,
+			                                  t->type == SMP_T_STR ? strlen((char *)ts->key.key) : t->key_size);
+		}
+		HA_RWLOCK_RDUNLOCK(STK_TABLE_LOCK, &t->shards[shard].sh_lock);
+	}
+
+	return victim;
+}
+
+/* Tells whether a missing key whose estimated count is <est> may be admitted
+ * into the full table <t>, i.e. if it is more frequent than the entry it would
+ * replace. Since most misses are rejected during a flood, the victim's
+ * estimate is not looked up for each of them but cached, and refreshed at most
+ * once per millisecond by a single thread, or after an admission since the
+ * victim is then purged.
+ */
+static int stktable_sketch_admit(struct stktable *t, uint est)
+{
+	uint date = HA_ATOMIC_LOAD(&t->sketch_victim_date);
+
+	if (date != now_ms && HA_ATOMIC_CAS(&t->sketch_victim_date, &date, now_ms))
+		HA_ATOMIC_STORE(&t->sketch_victim, stktable_sketch_victim(t));
+
+	if (est <= HA_ATOMIC_LOAD(&t->sketch_victim))
+		return 0;
+
+	HA_ATOMIC_STORE(&t->sketch_victim_date, now_ms - 1);
+	return 1;
+}
+
+/* Task halving all the counters of the sketch of the table passed in
+ * <context> once per period. At most STKTABLE_SKETCH_DECAY_BATCH counters are
+ * processed per call, the task wakes itself up until the whole sketch is done.
+ */
+static struct task *process_table_sketch(struct task *task, void *context, unsigned int state)
+{
+	struct stktable *t = context;
+	uint total = STKTABLE_SKETCH_DEPTH * t->sketch_width;
+	uint i, end;
+
+	end = t->sketch_decay_pos + MIN(total - t->sketch_decay_pos, STKTABLE_SKETCH_DECAY_BATCH);
+	for (i = t->sketch_decay_pos; i < end; i++)
+		HA_ATOMIC_STORE(&t->sketch[i], HA_ATOMIC_LOAD(&t->sketch[i]) >> 1);
+
+	if (end < total) {
+		t->sketch_decay_pos = end;
+		task->expire = TICK_ETERNITY;
+		task_wakeup(task, TASK_WOKEN_OTHER);
+		return task;
+	}
+
+	t->sketch_decay_pos = 0;
+	task->expire = tick_add(now_ms, MS_TO_TICKS(t->expire));
+	return task;
+}
+
 /* Returns a valid or initialized stksess for the specified stktable_key in the
  * specified table, or NULL if the key was NULL, or if no entry was found nor
  * could be created. The entry's expiration is updated. This function locks the
@@ -717,6 +1082,16 @@ struct stksess *stktable_get_entry(struct stktable *table, struct stktable_key *
 	if (ts)
 		HA_ATOMIC_INC(&ts->ref_cnt);
 	HA_RWLOCK_RDUNLOCK(STK_TABLE_LOCK, &table->shards[shard].sh_lock);
+
+	if (table->sketch) {
+		uint est = stktable_sketch_update(table, key->key, len);
+
+		/* a full heavy-hitter table only admits more frequent keys */
+		if (!ts && HA_ATOMIC_LOAD(&table->current) >= table->size &&
+		    !stktable_sketch_admit(table, est))
+			return NULL;
+	}
+
 	if (ts)
 		return ts;
 
@@ -956,6 +1331,16 @@ int stktable_init(struct stktable *t, char **err_msg)
 			t->exp_task->process = process_table_expire;
 			t->exp_task->context = (void *)t;
 		}
+		if (t->sketch_width) {
+			t->sketch = calloc(STKTABLE_SKETCH_DEPTH * t->sketch_width, sizeof(*t->sketch));
+			t->sketch_task = task_new_anywhere();
+			if (!t->sketch || !t->sketch_task)
+				goto mem_error;
+			t->sketch_task->process = process_table_sketch;
+			t->sketch_task->context = (void *)t;
+			t->sketch_victim_date = now_ms - 1;
+			task_schedule(t->sketch_task, tick_add(now_ms, MS_TO_TICKS(t->expire)));
+		}
 		if (t->peers.p && t->peers.p->peers_fe && !(t->peers.p->peers_fe->flags & (PR_FL_DISABLED|PR_FL_STOPPED))) {
 			peers_retval = peers_register_table(t->peers.p, t);
 		}
@@ -1011,9 +1396,397 @@ void stktable_deinit(struct stktable *t)
 	if (!t)
 		return;
 	task_destroy(t->exp_task);
+	task_destroy(t->sketch_task);
 	pool_destroy(t->pool);
+	ha_free(&t->sketch);
+	ha_free(&t->snapshot);
 }
 
+/*
+ * Snapshots. A table declared with "snapshot <file>" is dumped to this file
+ * when the process stops or upon "save table" on the CLI, and is reloaded from
+ * it at boot, before the listeners are enabled. The file starts with a header
+ * describing the table's layout, followed by fixed-size records made of the
+ * remaining time to live in milliseconds, the key and the raw data area. Since
+ * ticks are process-relative, the header also carries the wall-clock date of
+ * the dump so that the expiration dates and the frequency counters can be
+ * rebased on load. A snapshot whose layout does not match the table is
+ * ignored, so changing the stored data types simply discards it.
+ */
+#define STKTABLE_SNAP_MAGIC  "HAPSTKS1"
+#define STKTABLE_SNAP_NOEXP  0xFFFFFFFFU  /* entry without expiration date */
+#define STKTABLE_SNAP_BATCH  256          /* records copied per shard lock hold */
+
+struct stktable_snap_hdr {
+	char magic[8];          /* STKTABLE_SNAP_MAGIC */
+	uint32_t type;          /* table type (SMP_T_*) */
+	uint32_t key_size;      /* size of the keys */
+	uint32_t data_size;     /* size of the data area */
+	uint32_t nb_types;      /* STKTABLE_DATA_TYPES */
+	uint64_t count;         /* number of records */
+	uint64_t date_ms;       /* wall-clock date of the dump, in milliseconds */
+	int32_t data_ofs[STKTABLE_DATA_TYPES];
+	uint32_t data_nbelem[STKTABLE_DATA_TYPES];
+	uint32_t data_arg[STKTABLE_DATA_TYPES];
+};
+
+/* returns the wall-clock date in milliseconds */
+static inline uint64_t stktable_snap_date(void)
+{
+	return (uint64_t)date.tv_sec * 1000 + date.tv_usec / 1000;
+}
+
+/* Prepares the data area <data> of an entry of table <t> for being stored
+ * (<load> = 0) or loaded (<load> = 1) after <elapsed> milliseconds. On dump,
+ * the frequency counters' dates are converted to ages. On load, they are turned
+ * back into dates relative to now_ms, those older than two periods are reset
+ * as well as the local-only counters, and the dictionary entries which cannot
+ * survive the process are dropped.
+ */
+static void stktable_snap_fix_data(struct stktable *t, char *data, int load, uint64_t elapsed)
+{
+	int type;
+	uint idx;
+
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		int std_type = stktable_data_types[type].std_type;
+		char *ptr;
+
+		if (!t->data_ofs[type])
+			continue;
+
+		ptr = data + t->data_size + t->data_ofs[type];
+		if (load && stktable_data_types[type].is_local) {
+			memset(ptr, 0, t->data_nbelem[type] * stktable_type_size(std_type));
+			continue;
+		}
+
+		for (idx = 0; idx < t->data_nbelem[type]; idx++) {
+			if (std_type == STD_T_DICT) {
+				if (load)
+					memset(ptr, 0, sizeof(struct dict_entry *));
+			}
+			else if (std_type == STD_T_FRQP) {
+				struct freq_ctr *ctr = (struct freq_ctr *)ptr;
+				uint64_t age;
+
+				if (!load)
+					ctr->curr_tick = now_ms - ctr->curr_tick;
+				else {
+					age = ctr->curr_tick + elapsed;
+					if (age >= 2 * (uint64_t)t->data_arg[type].u)
+						memset(ctr, 0, sizeof(*ctr));
+					else
+						ctr->curr_tick = now_ms - age;
+				}
+			}
+			ptr += stktable_type_size(std_type);
+		}
+	}
+}
+
+/* Dumps table <t> into its snapshot file. The file is written under a
+ * temporary name then renamed so that a valid snapshot is always present.
+ * Returns the number of entries dumped, or -1 on error with <err> filled.
+ */
+int stktable_snapshot_save(struct stktable *t, char **err)
+{
+	struct stktable_snap_hdr hdr;
+	struct ebmb_node *eb;
+	struct stksess *ts;
+	char *tmp = NULL;
+	char *rec = NULL;
+	size_t rec_size, nbrec, i;
+	FILE *f = NULL;
+	int shard;
+	int type;
+
+	if (!t->snapshot || !t->size) {
+		memprintf(err, "no snapshot configured for table '%s'", t->id);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, STKTABLE_SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.type = t->type;
+	hdr.key_size = t->key_size;
+	hdr.data_size = t->data_size;
+	hdr.nb_types = STKTABLE_DATA_TYPES;
+	hdr.date_ms = stktable_snap_date();
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		hdr.data_ofs[type] = t->data_ofs[type];
+		hdr.data_nbelem[type] = t->data_nbelem[type];
+		hdr.data_arg[type] = t->data_arg[type].u;
+	}
+
+	rec_size = sizeof(uint32_t) + t->key_size + t->data_size;
+	rec = malloc(rec_size * STKTABLE_SNAP_BATCH);
+	if (!rec || !memprintf(&tmp, "%s.tmp", t->snapshot)) {
+		memprintf(err, "out of memory while saving table '%s'", t->id);
+		goto fail;
+	}
+
+	f = fopen(tmp, "w");
+	if (!f || fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		memprintf(err, "cannot write snapshot '%s' of table '%s': %s", tmp, t->id, strerror(errno));
+		goto fail;
+	}
+
+	/* Records are copied under the shard lock into a batch which is written
+	 * once the lock is released. When the batch is full, the last entry is
+	 * referenced so that it stays in the tree and the walk can resume from
+	 * it after the write.
+	 */
+	for (shard = 0; shard < CONFIG_HAP_TBL_BUCKETS; shard++) {
+		HA_RWLOCK_RDLOCK(STK_TABLE_LOCK, &t->shards[shard].sh_lock);
+		eb = ebmb_first(&t->shards[shard].keys);
+		while (1) {
+			nbrec = 0;
+			ts = NULL;
+			for (; eb && nbrec < STKTABLE_SNAP_BATCH; eb = ebmb_next(eb)) {
+				char *cur = rec + nbrec * rec_size;
+				uint32_t ttl = STKTABLE_SNAP_NOEXP;
+
+				ts = ebmb_entry(eb, struct stksess, key);
+				if (t->expire && tick_isset(ts->expire)) {
+					if (tick_is_expired(ts->expire, now_ms))
+						continue;
+					ttl = TICKS_TO_MS(tick_remain(now_ms, ts->expire));
+				}
+
+				memcpy(cur, &ttl, sizeof(ttl));
+				memcpy(cur + sizeof(ttl), ts->key.key, t->key_size);
+				HA_RWLOCK_RDLOCK(STK_SESS_LOCK, &ts->lock);
+				memcpy(cur + sizeof(ttl) + t->key_size, (char *)ts - t->data_size, t->data_size);
+				HA_RWLOCK_RDUNLOCK(STK_SESS_LOCK, &ts->lock);
+				nbrec++;
+			}
+
+			if (eb)
+				HA_ATOMIC_INC(&ts->ref_cnt);
+			HA_RWLOCK_RDUNLOCK(STK_TABLE_LOCK, &t->shards[shard].sh_lock);
+
+			for (i = 0; i < nbrec; i++)
+				stktable_snap_fix_data(t, rec + i * rec_size + sizeof(uint32_t) + t->key_size, 0, 0);
+
+			if (nbrec && fwrite(rec, rec_size, nbrec, f) != nbrec) {
+				if (eb)
+					HA_ATOMIC_DEC(&ts->ref_cnt);
+				memprintf(err, "cannot write snapshot '%s' of table '%s': %s", tmp, t->id, strerror(errno));
+				goto fail;
+			}
+			hdr.count += nbrec;
+
+			if (!eb)
+				break;
+
+			/* the referenced entry cannot have left the tree */
+			HA_RWLOCK_RDLOCK(STK_TABLE_LOCK, &t->shards[shard].sh_lock);
+			eb = ebmb_next(&ts->key);
+			HA_ATOMIC_DEC(&ts->ref_cnt);
+		}
+	}
+
+	/* the header is rewritten with the final count */
+	if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&hdr, sizeof(hdr), 1, f) != 1 || fclose(f) != 0) {
+		f = NULL;
+		memprintf(err, "cannot write snapshot '%s' of table '%s': %s", tmp, t->id, strerror(errno));
+		goto fail;
+	}
+	f = NULL;
+
+	if (rename(tmp, t->snapshot) != 0) {
+		memprintf(err, "cannot rename snapshot '%s' to '%s': %s", tmp, t->snapshot, strerror(errno));
+		goto fail;
+	}
+
+	free(tmp);
+	free(rec);
+	return hdr.count;
+
+ fail:
+	if (f) {
+		fclose(f);
+		unlink(tmp);
+	}
+	free(tmp);
+	free(rec);
+	return -1;
+}
+
+/* Loads the snapshot file of table <t> into it. The file is mapped and its
+ * records are directly inserted into the shards, existing keys being left
+ * untouched. It must be called before the listeners are enabled. A missing
+ * file is not an error. Returns the number of entries loaded, or -1 on error
+ * with <err> filled.
+ */
+int stktable_snapshot_load(struct stktable *t, char **err)
+{
+	const struct stktable_snap_hdr *hdr;
+	struct stktable_key key;
+	struct stksess *ts, *first = NULL;
+	struct stat st;
+	uint64_t elapsed, rec;
+	size_t rec_size;
+	const char *area, *ptr;
+	uint shard;
+	int loaded = 0;
+	int type;
+	int fd;
+
+	if (!t->snapshot || !t->size)
+		return 0;
+
+	fd = open(t->snapshot, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		memprintf(err, "cannot open snapshot '%s': %s", t->snapshot, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(*hdr)) {
+		memprintf(err, "snapshot '%s' is truncated", t->snapshot);
+		close(fd);
+		return -1;
+	}
+
+	area = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (area == MAP_FAILED) {
+		memprintf(err, "cannot map snapshot '%s': %s", t->snapshot, strerror(errno));
+		return -1;
+	}
+	madvise((void *)area, st.st_size, MADV_SEQUENTIAL);
+
+	hdr = (const struct stktable_snap_hdr *)area;
+	rec_size = sizeof(uint32_t) + t->key_size + t->data_size;
+
+	if (memcmp(hdr->magic, STKTABLE_SNAP_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->type != t->type || hdr->key_size != t->key_size ||
+	    hdr->data_size != t->data_size || hdr->nb_types != STKTABLE_DATA_TYPES)
+		goto mismatch;
+
+	for (type = 0; type < STKTABLE_DATA_TYPES; type++) {
+		if (hdr->data_ofs[type] != t->data_ofs[type] ||
+		    hdr->data_nbelem[type] != t->data_nbelem[type] ||
+		    hdr->data_arg[type] != t->data_arg[type].u)
+			goto mismatch;
+	}
+
+	if (hdr->count > (st.st_size - sizeof(*hdr)) / rec_size) {
+		memprintf(err, "snapshot '%s' is truncated", t->snapshot);
+		munmap((void *)area, st.st_size);
+		return -1;
+	}
+
+	elapsed = stktable_snap_date();
+	elapsed = elapsed > hdr->date_ms ? elapsed - hdr->date_ms : 0;
+
+	ptr = area + sizeof(*hdr);
+	for (rec = 0; rec < hdr->count; rec++, ptr += rec_size) {
+		uint32_t ttl;
+
+		memcpy(&ttl, ptr, sizeof(ttl));
+		if (ttl != STKTABLE_SNAP_NOEXP) {
+			if (ttl <= elapsed)
+				continue;
+			ttl -= elapsed;
+		}
+
+		ts = stksess_new(t, NULL);
+		if (!ts)
+			break;
+
+		memcpy(ts->key.key, ptr + sizeof(ttl), t->key_size);
+		key.key = ts->key.key;
+		if (t->type == SMP_T_STR) {
+			ts->key.key[t->key_size - 1] = 0;
+			key.key_len = strlen((char *)ts->key.key);
+		}
+		else
+			key.key_len = t->key_size;
+		stksess_setkey_shard(t, ts, &key);
+
+		memcpy((char *)ts - t->data_size, ptr + sizeof(ttl) + t->key_size, t->data_size);
+		stktable_snap_fix_data(t, (char *)ts - t->data_size, 1, elapsed);
+
+		if (ttl != STKTABLE_SNAP_NOEXP && t->expire)
+			ts->expire = tick_add(now_ms, MS_TO_TICKS(MIN(ttl, t->expire)));
+
+		/* an already present key is left untouched */
+		shard = stktable_calc_shard_num(t, key.key, key.key_len);
+		HA_RWLOCK_WRLOCK(STK_TABLE_LOCK, &t->shards[shard].sh_lock);
+		if (__stktable_store(t, ts, shard) != ts) {
+			HA_RWLOCK_WRUNLOCK(STK_TABLE_LOCK, &t->shards[shard].sh_lock);
+			stksess_free(t, ts);
+			continue;
+		}
+		HA_RWLOCK_WRUNLOCK(STK_TABLE_LOCK, &t->shards[shard].sh_lock);
+
+		if (!first || tick_is_lt(ts->expire, first->expire))
+			first = ts;
+		loaded++;
+	}
+
+	/* the expiration task only needs to know about the earliest entry */
+	if (first)
+		stktable_requeue_exp(t, first);
+
+	munmap((void *)area, st.st_size);
+	return loaded;
+
+ mismatch:
+	memprintf(err, "snapshot '%s' does not match the layout of table '%s', ignored", t->snapshot, t->id);
+	munmap((void *)area, st.st_size);
+	return -1;
+}
+
+/* loads the snapshots of all tables at boot */
+static int stktable_snapshot_load_all(void)
+{
+	struct stktable *t;
+	char *err = NULL;
+	int ret;
+
+	for (t = stktables_list; t; t = t->next) {
+		if (!t->snapshot)
+			continue;
+
+		ret = stktable_snapshot_load(t, &err);
+		if (ret < 0) {
+			ha_warning("stick-table '%s': %s.\n", t->id, err);
+			ha_free(&err);
+		}
+	}
+	return ERR_NONE;
+}
+REGISTER_POST_CHECK(stktable_snapshot_load_all);
+
+/* Dumps the snapshots of all tables when the last thread leaves. The master
+ * process never does it since it doesn't hold the tables' contents.
+ */
+static void stktable_snapshot_save_all(void)
+{
+	static unsigned int stopped_threads;
+	struct stktable *t;
+	char *err = NULL;
+
+	if (HA_ATOMIC_ADD_FETCH(&stopped_threads, 1) != global.nbthread || master)
+		return;
+
+	for (t = stktables_list; t; t = t->next) {
+		if (!t->snapshot)
+			continue;
+
+		if (stktable_snapshot_save(t, &err) < 0) {
+			ha_warning("stick-table '%s': %s.\n", t->id, err);
+			ha_free(&err);
+		}
+	}
+}
+REGISTER_PER_THREAD_DEINIT(stktable_snapshot_save_all);
+
 /*
  * Configuration keywords of known table types
  */
@@ -1222,6 +1995,43 @@ int parse_stick_table(const char *file, int linenum, char **args,
 			t->nopurge = 1;
 			idx++;
 		}
+		else if (strcmp(args[idx], "deferred-updates") == 0) {
+			t->deferred = 1;
+			idx++;
+		}
+		else if (strcmp(args[idx], "sketch") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			if ((err = parse_size_err(args[idx], &t->sketch_width))) {
+				ha_alert("parsing [%s:%d] : %s: unexpected character '%c' in argument of '%s'.\n",
+					 file, linenum, args[0], *err, args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			if (!t->sketch_width || t->sketch_width > (1U << 26)) {
+				ha_alert("parsing [%s:%d] : %s: '%s' expects a width between 1 and 64m.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			idx++;
+		}
+		else if (strcmp(args[idx], "snapshot") == 0) {
+			idx++;
+			if (!*(args[idx])) {
+				ha_alert("parsing [%s:%d] : %s: missing argument after '%s'.\n",
+					 file, linenum, args[0], args[idx-1]);
+				err_code |= ERR_ALERT | ERR_FATAL;
+				goto out;
+			}
+			ha_free(&t->snapshot);
+			t->snapshot = strdup(args[idx++]);
+		}
 		else if (strcmp(args[idx], "type") == 0) {
 			idx++;
 			if (stktable_parse_type(args, &idx, &t->type, &t->key_size, file, linenum) != 0) {
@@ -1382,6 +2192,16 @@ int parse_stick_table(const char *file, int linenum, char **args,
 		goto out;
 	}
 
+	/* admissions are decided against the entry which expires first, and
+	 * entries without expiration can neither be compared nor purged.
+	 */
+	if (t->sketch_width && !t->expire) {
+		ha_alert("parsing [%s:%d] : %s: 'sketch' requires 'expire' to be set.\n",
+			 file, linenum, args[0]);
+		err_code |= ERR_ALERT | ERR_FATAL;
+		goto out;
+	}
+
  out:
 	return err_code;
 }
@@ -2730,7 +3550,11 @@ static enum act_return action_inc_gpc(struct act_rule *rule, struct proxy *px,
 		stkctr = &sess->stkctr[rule->arg.gpc.sc];
 
 	ts = stkctr_entry(stkctr);
-	if (ts) {
+	if (ts && stkctr->table->deferred) {
+		stktable_defer_ctr(stkctr->table, ts, STKTABLE_DT_GPC, STKTABLE_DT_GPC_RATE,
+		                   rule->arg.gpc.idx, 1);
+	}
+	else if (ts) {
 		void *ptr1, *ptr2;
 
 		/* First, update gpc_rate if it's tracked. Second, update its gpc if tracked. */
@@ -5711,9 +6535,34 @@ static void stkt_late_init(void)
 
 INITCALL0(STG_INIT, stkt_late_init);
 
+/* parse a "save table" command. It dumps the table into its snapshot file. */
+static int cli_parse_save_table(char **args, char *payload, struct appctx *appctx, void *private)
+{
+	struct stktable *t;
+	char *err = NULL;
+	int ret;
+
+	if (!cli_has_level(appctx, ACCESS_LVL_ADMIN))
+		return 1;
+
+	if (!*args[2])
+		return cli_err(appctx, "Required argument: <table>\n");
+
+	t = stktable_find_by_name(args[2]);
+	if (!t)
+		return cli_err(appctx, "No such table\n");
+
+	ret = stktable_snapshot_save(t, &err);
+	if (ret < 0)
+		return cli_dynerr(appctx, memprintf(&err, "%s\n", err));
+
+	return cli_dynmsg(appctx, LOG_INFO, memprintf(&err, "%d entries saved to '%s'.\n", ret, t->snapshot));
+}
+
 /* register cli keywords */
 static struct cli_kw_list cli_kws = {{ },{
 	{ { "clear", "table", NULL }, "clear table <table> [<filter>]*         : remove an entry from a table (filter: data/key)",                           cli_parse_table_req, cli_io_handler_table, cli_release_show_table, (void *)STK_CLI_ACT_CLR },
+	{ { "save",  "table", NULL }, "save table <table>                      : dump a table into its snapshot file",                                         cli_parse_save_table, NULL, NULL },
 	{ { "set",   "table", NULL }, "set table <table> key <k> [data.* <v>]* : update or create a table entry's data",                                     cli_parse_table_req, cli_io_handler_table, NULL, (void *)STK_CLI_ACT_SET },
 	{ { "show",  "table", NULL }, "show table <table> [<filter>]*          : report table usage stats or dump this table's contents (filter: data/key)", cli_parse_table_req, cli_io_handler_table, cli_release_show_table, (void *)STK_CLI_ACT_SHOW },
 	{{},}
@@ -5811,9 +6660,9 @@ INITCALL1(STG_REGISTER, http_after_res_keywords_register, &http_after_res_kws);
 static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc_bytes_in_rate",   smp_fetch_sc_bytes_in_rate,  ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc_bytes_out_rate",  smp_fetch_sc_bytes_out_rate, ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc_clr_gpc",         smp_fetch_sc_clr_gpc,        ARG3(2,SINT,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc_clr_gpc0",        smp_fetch_sc_clr_gpc0,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc_clr_gpc1",        smp_fetch_sc_clr_gpc1,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN },
+	{ "sc_clr_gpc",         smp_fetch_sc_clr_gpc,        ARG3(2,SINT,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc_clr_gpc0",        smp_fetch_sc_clr_gpc0,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc_clr_gpc1",        smp_fetch_sc_clr_gpc1,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "sc_conn_cnt",        smp_fetch_sc_conn_cnt,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc_conn_cur",        smp_fetch_sc_conn_cur,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc_conn_rate",       smp_fetch_sc_conn_rate,      ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
@@ -5833,9 +6682,9 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc_http_fail_rate",  smp_fetch_sc_http_fail_rate, ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc_http_req_cnt",    smp_fetch_sc_http_req_cnt,   ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc_http_req_rate",   smp_fetch_sc_http_req_rate,  ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc_inc_gpc",         smp_fetch_sc_inc_gpc,        ARG3(2,SINT,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc_inc_gpc0",        smp_fetch_sc_inc_gpc0,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc_inc_gpc1",        smp_fetch_sc_inc_gpc1,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
+	{ "sc_inc_gpc",         smp_fetch_sc_inc_gpc,        ARG3(2,SINT,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc_inc_gpc0",        smp_fetch_sc_inc_gpc0,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc_inc_gpc1",        smp_fetch_sc_inc_gpc1,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "sc_kbytes_in",       smp_fetch_sc_kbytes_in,      ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "sc_kbytes_out",      smp_fetch_sc_kbytes_out,     ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "sc_sess_cnt",        smp_fetch_sc_sess_cnt,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
@@ -5844,8 +6693,8 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc_trackers",        smp_fetch_sc_trackers,       ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc0_bytes_in_rate",  smp_fetch_sc_bytes_in_rate,  ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc0_bytes_out_rate", smp_fetch_sc_bytes_out_rate, ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc0_clr_gpc0",       smp_fetch_sc_clr_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc0_clr_gpc1",       smp_fetch_sc_clr_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
+	{ "sc0_clr_gpc0",       smp_fetch_sc_clr_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc0_clr_gpc1",       smp_fetch_sc_clr_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "sc0_conn_cnt",       smp_fetch_sc_conn_cnt,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc0_conn_cur",       smp_fetch_sc_conn_cur,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc0_conn_rate",      smp_fetch_sc_conn_rate,      ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
@@ -5862,8 +6711,8 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc0_http_fail_rate", smp_fetch_sc_http_fail_rate, ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc0_http_req_cnt",   smp_fetch_sc_http_req_cnt,   ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc0_http_req_rate",  smp_fetch_sc_http_req_rate,  ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc0_inc_gpc0",       smp_fetch_sc_inc_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc0_inc_gpc1",       smp_fetch_sc_inc_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
+	{ "sc0_inc_gpc0",       smp_fetch_sc_inc_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc0_inc_gpc1",       smp_fetch_sc_inc_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "sc0_kbytes_in",      smp_fetch_sc_kbytes_in,      ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "sc0_kbytes_out",     smp_fetch_sc_kbytes_out,     ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "sc0_sess_cnt",       smp_fetch_sc_sess_cnt,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
@@ -5872,9 +6721,9 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc0_trackers",       smp_fetch_sc_trackers,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc1_bytes_in_rate",  smp_fetch_sc_bytes_in_rate,  ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc1_bytes_out_rate", smp_fetch_sc_bytes_out_rate, ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc1_clr_gpc",        smp_fetch_sc_clr_gpc,        ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc1_clr_gpc0",       smp_fetch_sc_clr_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc1_clr_gpc1",       smp_fetch_sc_clr_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
+	{ "sc1_clr_gpc",        smp_fetch_sc_clr_gpc,        ARG2(1,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc1_clr_gpc0",       smp_fetch_sc_clr_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc1_clr_gpc1",       smp_fetch_sc_clr_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "sc1_conn_cnt",       smp_fetch_sc_conn_cnt,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc1_conn_cur",       smp_fetch_sc_conn_cur,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc1_conn_rate",      smp_fetch_sc_conn_rate,      ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
@@ -5891,8 +6740,8 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc1_http_fail_rate", smp_fetch_sc_http_fail_rate, ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc1_http_req_cnt",   smp_fetch_sc_http_req_cnt,   ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc1_http_req_rate",  smp_fetch_sc_http_req_rate,  ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc1_inc_gpc0",       smp_fetch_sc_inc_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc1_inc_gpc1",       smp_fetch_sc_inc_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
+	{ "sc1_inc_gpc0",       smp_fetch_sc_inc_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc1_inc_gpc1",       smp_fetch_sc_inc_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "sc1_kbytes_in",      smp_fetch_sc_kbytes_in,      ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "sc1_kbytes_out",     smp_fetch_sc_kbytes_out,     ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "sc1_sess_cnt",       smp_fetch_sc_sess_cnt,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
@@ -5901,8 +6750,8 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc1_trackers",       smp_fetch_sc_trackers,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc2_bytes_in_rate",  smp_fetch_sc_bytes_in_rate,  ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc2_bytes_out_rate", smp_fetch_sc_bytes_out_rate, ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc2_clr_gpc0",       smp_fetch_sc_clr_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc2_clr_gpc1",       smp_fetch_sc_clr_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
+	{ "sc2_clr_gpc0",       smp_fetch_sc_clr_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc2_clr_gpc1",       smp_fetch_sc_clr_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "sc2_conn_cnt",       smp_fetch_sc_conn_cnt,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc2_conn_cur",       smp_fetch_sc_conn_cur,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc2_conn_rate",      smp_fetch_sc_conn_rate,      ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
@@ -5919,8 +6768,8 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc2_http_fail_rate", smp_fetch_sc_http_fail_rate, ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc2_http_req_cnt",   smp_fetch_sc_http_req_cnt,   ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "sc2_http_req_rate",  smp_fetch_sc_http_req_rate,  ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc2_inc_gpc0",       smp_fetch_sc_inc_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
-	{ "sc2_inc_gpc1",       smp_fetch_sc_inc_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
+	{ "sc2_inc_gpc0",       smp_fetch_sc_inc_gpc0,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "sc2_inc_gpc1",       smp_fetch_sc_inc_gpc1,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "sc2_kbytes_in",      smp_fetch_sc_kbytes_in,      ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "sc2_kbytes_out",     smp_fetch_sc_kbytes_out,     ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "sc2_sess_cnt",       smp_fetch_sc_sess_cnt,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
@@ -5929,9 +6778,9 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "sc2_trackers",       smp_fetch_sc_trackers,       ARG1(0,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "src_bytes_in_rate",  smp_fetch_sc_bytes_in_rate,  ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "src_bytes_out_rate", smp_fetch_sc_bytes_out_rate, ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
-	{ "src_clr_gpc",        smp_fetch_sc_clr_gpc,        ARG2(2,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_L4CLI, },
-	{ "src_clr_gpc0",       smp_fetch_sc_clr_gpc0,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
-	{ "src_clr_gpc1",       smp_fetch_sc_clr_gpc1,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
+	{ "src_clr_gpc",        smp_fetch_sc_clr_gpc,        ARG2(2,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_L4CLI, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "src_clr_gpc0",       smp_fetch_sc_clr_gpc0,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "src_clr_gpc1",       smp_fetch_sc_clr_gpc1,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "src_conn_cnt",       smp_fetch_sc_conn_cnt,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "src_conn_cur",       smp_fetch_sc_conn_cur,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "src_conn_rate",      smp_fetch_sc_conn_rate,      ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
@@ -5951,14 +6800,14 @@ static struct sample_fetch_kw_list smp_fetch_keywords = {ILH, {
 	{ "src_http_fail_rate", smp_fetch_sc_http_fail_rate, ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "src_http_req_cnt",   smp_fetch_sc_http_req_cnt,   ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "src_http_req_rate",  smp_fetch_sc_http_req_rate,  ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
-	{ "src_inc_gpc",        smp_fetch_sc_inc_gpc,        ARG2(2,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_L4CLI, },
-	{ "src_inc_gpc0",       smp_fetch_sc_inc_gpc0,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
-	{ "src_inc_gpc1",       smp_fetch_sc_inc_gpc1,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
+	{ "src_inc_gpc",        smp_fetch_sc_inc_gpc,        ARG2(2,SINT,TAB), NULL, SMP_T_SINT, SMP_USE_L4CLI, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "src_inc_gpc0",       smp_fetch_sc_inc_gpc0,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "src_inc_gpc1",       smp_fetch_sc_inc_gpc1,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "src_kbytes_in",      smp_fetch_sc_kbytes_in,      ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "src_kbytes_out",     smp_fetch_sc_kbytes_out,     ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "src_sess_cnt",       smp_fetch_sc_sess_cnt,       ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
 	{ "src_sess_rate",      smp_fetch_sc_sess_rate,      ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
-	{ "src_updt_conn_cnt",  smp_fetch_src_updt_conn_cnt, ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, },
+	{ "src_updt_conn_cnt",  smp_fetch_src_updt_conn_cnt, ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_L4CLI, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ "table_avl",          smp_fetch_table_avl,         ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ "table_cnt",          smp_fetch_table_cnt,         ARG1(1,TAB),      NULL, SMP_T_SINT, SMP_USE_INTRN, },
 	{ /* END */ },
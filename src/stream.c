@@ -537,6 +537,7 @@ struct stream *stream_new(struct session *sess, struct stconn *sc, struct buffer
 	s->res.analyse_exp = TICK_ETERNITY;
 
 	s->txn = NULL;
+	s->smp_cache = NULL;
 	s->hlua[0] = s->hlua[1] = NULL;
 
 	s->resolv_ctx.requester = NULL;
@@ -698,11 +699,14 @@ void stream_free(struct stream *s)
 	}
 
 	/* Cleanup all variable contexts. */
-	if (!LIST_ISEMPTY(&s->vars_txn.head))
+	if (!vars_is_empty(&s->vars_txn))
 		vars_prune(&s->vars_txn, s->sess, s);
-	if (!LIST_ISEMPTY(&s->vars_reqres.head))
+	if (!vars_is_empty(&s->vars_reqres))
 		vars_prune(&s->vars_reqres, s->sess, s);
 
+	smp_cache_free(s->smp_cache);
+	s->smp_cache = NULL;
+
 	stream_store_counters(s);
 	pool_free(pool_head_stk_ctr, s->stkctr);
 
@@ -1051,11 +1055,20 @@ static int process_switching_rules(struct stream *s, struct channel *req, int an
 	/* now check whether we have some switching rules for this request */
 	if (!(s->flags & SF_BE_ASSIGNED)) {
 		struct switching_rule *rule;
+		int idx;
 
 		list_for_each_entry(rule, &fe->switching_rules, list) {
 			int ret = 1;
 
-			if (rule->cond) {
+			if (rule->table && (idx = switching_table_lookup(rule->table, fe, sess, s)) != -2) {
+				/* the whole chain starting here was evaluated at once */
+				if (idx < 0) {
+					rule = rule->table->rules[rule->table->nb_rules - 1];
+					continue;
+				}
+				rule = rule->table->rules[idx];
+			}
+			else if (rule->cond) {
 				ret = acl_exec_cond(rule->cond, fe, sess, s, SMP_OPT_DIR_REQ|SMP_OPT_FINAL);
 				ret = acl_pass(ret);
 				if (rule->cond->pol == ACL_COND_UNLESS)
@@ -1639,7 +1652,7 @@ static void stream_cond_update_cpu_usage(struct stream *s)
 
 	cpu = (uint32_t)now_mono_time() - th_ctx->sched_call_date;
 	s->cpu_time += cpu;
-	HA_ATOMIC_ADD(&th_ctx->sched_profile_entry->cpu_time, cpu);
+	sched_activity_add_cpu(th_ctx->sched_profile_entry, cpu);
 	th_ctx->sched_wake_date = 0;
 }
 
@@ -2317,7 +2330,7 @@ struct task *process_stream(struct task *t, void *context, unsigned int state)
 	if (sc_state_in(scb->state, SC_SB_REQ|SC_SB_QUE|SC_SB_TAR|SC_SB_ASS)) {
 		/* prune the request variables and swap to the response variables. */
 		if (s->vars_reqres.scope != SCOPE_RES) {
-			if (!LIST_ISEMPTY(&s->vars_reqres.head))
+			if (!vars_is_empty(&s->vars_reqres))
 				vars_prune(&s->vars_reqres, s->sess, s);
 			vars_init_head(&s->vars_reqres, SCOPE_RES);
 		}
@@ -19,6 +19,7 @@
 #include <haproxy/cfgparse.h>
 #include <haproxy/clock.h>
 #include <haproxy/fd.h>
+#include <haproxy/freq_ctr.h>
 #include <haproxy/list.h>
 #include <haproxy/pool.h>
 #include <haproxy/task.h>
@@ -35,6 +36,22 @@ DECLARE_POOL(pool_head_tasklet, "tasklet", sizeof(struct tasklet));
  */
 DECLARE_POOL(pool_head_notification, "notification", sizeof(struct notification));
 
+/* default per-class weights of the scheduler's budget */
+static const uint sched_default_weights[TL_CLASSES] = {
+	[TL_URGENT] = 64, // ~50% of CPU bandwidth for I/O
+	[TL_NORMAL] = 48, // ~37% of CPU bandwidth for tasks
+	[TL_BULK]   = 16, // ~13% of CPU bandwidth for self-wakers
+	[TL_HEAVY]  = 1,  // never more than 1 heavy task at once
+};
+
+/* set by "tune.sched.adaptive": the weights above are adjusted on each loop to
+ * keep the queue latency of the urgent class below sched_target_lat (in us).
+ */
+static int sched_adaptive __read_mostly = 0;
+static uint sched_target_lat __read_mostly = 1000;
+
+#define SCHED_WEIGHT_MAX 255 /* upper bound for adaptive weights */
+
 /* The lock protecting all wait queues at once. For now we have no better
  * alternative since a task may have to be removed from a queue and placed
  * into another one. Storing the WQ index into the task doesn't seem to be
@@ -239,7 +256,7 @@ void __task_wakeup(struct task *t)
 		t->rq.key += offset;
 	}
 
-	if (_HA_ATOMIC_LOAD(&th_ctx->flags) & TH_FL_TASK_PROFILING)
+	if (_HA_ATOMIC_LOAD(&th_ctx->flags) & (TH_FL_TASK_PROFILING | TH_FL_SCHED_ADAPTIVE))
 		t->wake_date = now_mono_time();
 
 	eb32_insert(root, &t->rq);
@@ -566,17 +583,26 @@ unsigned int run_tasks_from_lists(unsigned int budgets[])
 		process = t->process;
 		t->calls++;
 
-		th_ctx->sched_wake_date = t->wake_date;
-		if (th_ctx->sched_wake_date) {
+		th_ctx->sched_wake_date = 0;
+		if (t->wake_date) {
 			uint32_t now_ns = now_mono_time();
-			uint32_t lat = now_ns - th_ctx->sched_wake_date;
+			uint32_t lat = now_ns - t->wake_date;
 
+			/* the adaptive scheduler wants the latency per class */
+			if (th_ctx->flags & TH_FL_SCHED_ADAPTIVE) {
+				th_ctx->sched_lat_sum[queue] += lat;
+				th_ctx->sched_lat_cnt[queue]++;
+			}
+
+			if (_HA_ATOMIC_LOAD(&th_ctx->flags) & TH_FL_TASK_PROFILING) {
+				th_ctx->sched_wake_date = t->wake_date;
+				th_ctx->sched_call_date = now_ns;
+				profile_entry = sched_activity_entry(sched_activity, t->process, t->caller);
+				th_ctx->sched_profile_entry = profile_entry;
+				sched_activity_add_lat(profile_entry, lat);
+				HA_ATOMIC_INC(&profile_entry->calls);
+			}
 			t->wake_date = 0;
-			th_ctx->sched_call_date = now_ns;
-			profile_entry = sched_activity_entry(sched_activity, t->process, t->caller);
-			th_ctx->sched_profile_entry = profile_entry;
-			HA_ATOMIC_ADD(&profile_entry->lat_time, lat);
-			HA_ATOMIC_INC(&profile_entry->calls);
 		}
 		__ha_barrier_store();
 
@@ -665,7 +691,7 @@ unsigned int run_tasks_from_lists(unsigned int budgets[])
 
 		/* stats are only registered for non-zero wake dates */
 		if (unlikely(th_ctx->sched_wake_date))
-			HA_ATOMIC_ADD(&profile_entry->cpu_time, (uint32_t)(now_mono_time() - th_ctx->sched_call_date));
+			sched_activity_add_cpu(profile_entry, (uint32_t)(now_mono_time() - th_ctx->sched_call_date));
 		done++;
 	}
 	th_ctx->current_queue = -1;
@@ -673,6 +699,56 @@ unsigned int run_tasks_from_lists(unsigned int budgets[])
 	return done;
 }
 
+/* Adjusts the current thread's per-class weights from the queue latencies
+ * measured by run_tasks_from_lists() since the previous call. The average
+ * latency of each class is smoothed over SCHED_LAT_SAMPLES loops. When the
+ * urgent class (I/O) is above the target latency, its weight is raised and the
+ * bulk class is shrunk. When it is below half of the target, the urgent weight
+ * goes back to its default and the bulk class, if used, is given more room, up
+ * to SCHED_WEIGHT_MAX. The other classes keep their default weights.
+ */
+static void sched_adapt_weights(struct thread_ctx *tt)
+{
+	uint *w = tt->sched_weights;
+	uint seen = 0;
+	uint q, lat;
+
+	for (q = 0; q < TL_CLASSES; q++) {
+		if (!tt->sched_lat_cnt[q])
+			continue;
+
+		lat = tt->sched_lat_sum[q] / tt->sched_lat_cnt[q] / 1000;
+		swrate_add_opportunistic(&tt->sched_lat_avg[q], SCHED_LAT_SAMPLES, lat);
+		tt->sched_lat_sum[q] = 0;
+		tt->sched_lat_cnt[q] = 0;
+		seen |= 1 << q;
+	}
+
+	if (!(seen & (1 << TL_URGENT)))
+		return;
+
+	lat = swrate_avg(tt->sched_lat_avg[TL_URGENT], SCHED_LAT_SAMPLES);
+	if (lat > sched_target_lat) {
+		/* I/O is late: widen the urgent class, squeeze the bulk one */
+		w[TL_URGENT] += w[TL_URGENT] / 8 + 1;
+		if (w[TL_URGENT] > SCHED_WEIGHT_MAX)
+			w[TL_URGENT] = SCHED_WEIGHT_MAX;
+		w[TL_BULK] = w[TL_BULK] * 3 / 4;
+		if (!w[TL_BULK])
+			w[TL_BULK] = 1;
+	}
+	else if (lat < sched_target_lat / 2) {
+		/* there is room left: give it back to the bulk class */
+		if (w[TL_URGENT] > sched_default_weights[TL_URGENT])
+			w[TL_URGENT] -= (w[TL_URGENT] - sched_default_weights[TL_URGENT]) / 8 + 1;
+		if (seen & (1 << TL_BULK)) {
+			w[TL_BULK] += w[TL_BULK] / 8 + 1;
+			if (w[TL_BULK] > SCHED_WEIGHT_MAX)
+				w[TL_BULK] = SCHED_WEIGHT_MAX;
+		}
+	}
+}
+
 /* The run queue is chronologically sorted in a tree. An insertion counter is
  * used to assign a position to each task. This counter may be combined with
  * other variables (eg: nice value) to set the final position in the tree. The
@@ -692,12 +768,7 @@ void process_runnable_tasks()
 	struct eb32_node *lrq; // next local run queue entry
 	struct eb32_node *grq; // next global run queue entry
 	struct task *t;
-	const unsigned int default_weights[TL_CLASSES] = {
-		[TL_URGENT] = 64, // ~50% of CPU bandwidth for I/O
-		[TL_NORMAL] = 48, // ~37% of CPU bandwidth for tasks
-		[TL_BULK]   = 16, // ~13% of CPU bandwidth for self-wakers
-		[TL_HEAVY]  = 1,  // never more than 1 heavy task at once
-	};
+	const uint *weights = tt->sched_weights;
 	unsigned int max[TL_CLASSES]; // max to be run per class
 	unsigned int max_total;       // sum of max above
 	struct mt_list *tmp_list;
@@ -709,6 +780,9 @@ void process_runnable_tasks()
 
 	_HA_ATOMIC_AND(&th_ctx->flags, ~TH_FL_STUCK); // this thread is still running
 
+	if (unlikely(sched_adaptive))
+		sched_adapt_weights(tt);
+
 	if (!thread_has_tasks()) {
 		activity[tid].empty_rq++;
 		return;
@@ -732,16 +806,16 @@ void process_runnable_tasks()
 	/* urgent tasklets list gets a default weight of ~50% */
 	if ((tt->tl_class_mask & (1 << TL_URGENT)) ||
 	    !MT_LIST_ISEMPTY(&tt->shared_tasklet_list))
-		max[TL_URGENT] = default_weights[TL_URGENT];
+		max[TL_URGENT] = weights[TL_URGENT];
 
 	/* normal tasklets list gets a default weight of ~37% */
 	if ((tt->tl_class_mask & (1 << TL_NORMAL)) ||
 	    !eb_is_empty(&th_ctx->rqueue) || !eb_is_empty(&th_ctx->rqueue_shared))
-		max[TL_NORMAL] = default_weights[TL_NORMAL];
+		max[TL_NORMAL] = weights[TL_NORMAL];
 
 	/* bulk tasklets list gets a default weight of ~13% */
 	if ((tt->tl_class_mask & (1 << TL_BULK)))
-		max[TL_BULK] = default_weights[TL_BULK];
+		max[TL_BULK] = weights[TL_BULK];
 
 	/* heavy tasks are processed only once and never refilled in a
 	 * call round. That budget is not lost either as we don't reset
@@ -749,7 +823,7 @@ void process_runnable_tasks()
 	 */
 	if (!heavy_queued) {
 		if ((tt->tl_class_mask & (1 << TL_HEAVY)))
-			max[TL_HEAVY] = default_weights[TL_HEAVY];
+			max[TL_HEAVY] = weights[TL_HEAVY];
 		else
 			max[TL_HEAVY] = 0;
 		heavy_queued = 1;
@@ -940,9 +1014,20 @@ static void init_task()
 		for (q = 0; q < TL_CLASSES; q++)
 			LIST_INIT(&ha_thread_ctx[i].tasklets[q]);
 		MT_LIST_INIT(&ha_thread_ctx[i].shared_tasklet_list);
+		memcpy(ha_thread_ctx[i].sched_weights, sched_default_weights, sizeof(sched_default_weights));
 	}
 }
 
+/* enables per-class latency measurement on the current thread when the
+ * adaptive scheduler is configured.
+ */
+static int init_task_per_thread()
+{
+	if (sched_adaptive)
+		_HA_ATOMIC_OR(&th_ctx->flags, TH_FL_SCHED_ADAPTIVE);
+	return 1;
+}
+
 /* config parser for global "tune.sched.low-latency", accepts "on" or "off" */
 static int cfg_parse_tune_sched_low_latency(char **args, int section_type, struct proxy *curpx,
                                       const struct proxy *defpx, const char *file, int line,
@@ -962,14 +1047,65 @@ static int cfg_parse_tune_sched_low_latency(char **args, int section_type, struc
 	return 0;
 }
 
+/* config parser for global "tune.sched.adaptive", accepts "on" or "off" */
+static int cfg_parse_tune_sched_adaptive(char **args, int section_type, struct proxy *curpx,
+                                         const struct proxy *defpx, const char *file, int line,
+                                         char **err)
+{
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	if (strcmp(args[1], "on") == 0)
+		sched_adaptive = 1;
+	else if (strcmp(args[1], "off") == 0)
+		sched_adaptive = 0;
+	else {
+		memprintf(err, "'%s' expects either 'on' or 'off' but got '%s'.", args[0], args[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* config parser for global "tune.sched.target-latency", accepts a time */
+static int cfg_parse_tune_sched_target_latency(char **args, int section_type, struct proxy *curpx,
+                                               const struct proxy *defpx, const char *file, int line,
+                                               char **err)
+{
+	const char *res;
+	uint val;
+
+	if (too_many_args(1, args, err, NULL))
+		return -1;
+
+	res = parse_time_err(args[1], &val, TIME_UNIT_US);
+	if (res == PARSE_TIME_OVER) {
+		memprintf(err, "timer overflow in argument '%s' to '%s'.", args[1], args[0]);
+		return -1;
+	}
+	else if (res == PARSE_TIME_UNDER || (!res && !val)) {
+		memprintf(err, "'%s' expects a non-null delay.", args[0]);
+		return -1;
+	}
+	else if (res) {
+		memprintf(err, "unexpected character '%c' in argument to '%s'.", *res, args[0]);
+		return -1;
+	}
+
+	sched_target_lat = val;
+	return 0;
+}
+
 /* config keyword parsers */
 static struct cfg_kw_list cfg_kws = {ILH, {
+	{ CFG_GLOBAL, "tune.sched.adaptive", cfg_parse_tune_sched_adaptive },
 	{ CFG_GLOBAL, "tune.sched.low-latency", cfg_parse_tune_sched_low_latency },
+	{ CFG_GLOBAL, "tune.sched.target-latency", cfg_parse_tune_sched_target_latency },
 	{ 0, NULL, NULL }
 }};
 
 INITCALL1(STG_REGISTER, cfg_register_keywords, &cfg_kws);
 INITCALL0(STG_PREPARE, init_task);
+REGISTER_PER_THREAD_INIT(init_task_per_thread);
 
 /*
  * Local variables:
@@ -158,11 +158,140 @@ static int var_accounting_add(struct vars *vars, struct session *sess, struct st
 	return 1;
 }
 
-/* This function removes a variable from the list and frees the memory it was
+/* Largest table size (in slots) reached so far by each scope, used to size
+ * new tables at once instead of growing them step by step on each request.
+ */
+static unsigned int vars_slots_hint[SCOPE_CHECK + 1];
+
+/* Hints are capped to this number of slots so that a single abnormal request
+ * cannot make all the next ones allocate huge tables.
+ */
+#define VARS_MAX_HINT_SLOTS 256
+
+/* Returns the slot where <name_hash> is stored in <vars>, or the empty slot
+ * where it would have to be inserted. There is always at least one empty slot.
+ */
+static inline struct var **vars_lookup_slot(struct vars *vars, uint64_t name_hash)
+{
+	struct var **slots = vars_slots(vars);
+	unsigned int idx = name_hash & vars->mask;
+
+	while (slots[idx] && slots[idx]->name_hash != name_hash)
+		idx = (idx + 1) & vars->mask;
+	return &slots[idx];
+}
+
+/* Makes sure that <vars> can receive one more variable while keeping the table
+ * at most 3/4 full, by moving all entries to a larger table if needed. The
+ * size of allocated tables is accounted like variables, using <sess> and
+ * <strm>. Returns 0 on allocation failure or if the memory limits do not
+ * allow to grow the table, otherwise non-zero.
+ */
+static int vars_reserve(struct vars *vars, struct session *sess, struct stream *strm)
+{
+	struct var **old = vars_slots(vars);
+	struct var **new;
+	unsigned int old_slots = vars->mask + 1;
+	unsigned int slots = old_slots;
+	unsigned int hint, idx, i;
+	int extra;
+
+	if ((vars->count + 1) * 4 <= old_slots * 3)
+		return 1;
+
+	slots *= 2;
+	hint = HA_ATOMIC_LOAD(&vars_slots_hint[vars->scope]);
+	if (!vars->tab && hint > slots)
+		slots = hint;
+
+	extra = (slots - (vars->tab ? old_slots : 0)) * sizeof(*new);
+	if (!var_accounting_add(vars, sess, strm, extra))
+		return 0;
+
+	new = calloc(slots, sizeof(*new));
+	if (!new) {
+		var_accounting_diff(vars, sess, strm, -extra);
+		return 0;
+	}
+
+	for (i = 0; i < old_slots; i++) {
+		if (!old[i])
+			continue;
+		idx = old[i]->name_hash & (slots - 1);
+		while (new[idx])
+			idx = (idx + 1) & (slots - 1);
+		new[idx] = old[i];
+	}
+
+	if (vars->tab)
+		free(vars->tab);
+	else
+		memset(vars->inl, 0, sizeof(vars->inl));
+	vars->tab = new;
+	vars->mask = slots - 1;
+
+	if (slots > hint && slots <= VARS_MAX_HINT_SLOTS)
+		HA_ATOMIC_STORE(&vars_slots_hint[vars->scope], slots);
+	return 1;
+}
+
+/* Removes variable <var> from the table of <vars>. The following entries of
+ * the same cluster are shifted back so that no tombstone is needed.
+ */
+static void vars_unlink(struct vars *vars, struct var *var)
+{
+	struct var **slots = vars_slots(vars);
+	unsigned int mask = vars->mask;
+	unsigned int hole, idx, home;
+
+	hole = vars_lookup_slot(vars, var->name_hash) - slots;
+	slots[hole] = NULL;
+	vars->count--;
+
+	for (idx = (hole + 1) & mask; slots[idx]; idx = (idx + 1) & mask) {
+		home = slots[idx]->name_hash & mask;
+		/* entries whose home slot is cyclically in ]hole, idx] stay */
+		if (hole <= idx ? (hole < home && home <= idx) : (hole < home || home <= idx))
+			continue;
+		slots[hole] = slots[idx];
+		slots[idx] = NULL;
+		hole = idx;
+	}
+}
+
+/* Releases all the variables of <vars> and reverts it to its inline table.
+ * Returns the freed size, including the allocated table if any. The caller is
+ * responsible for locking.
+ */
+static unsigned int vars_release_all(struct vars *vars)
+{
+	struct var **slots = vars_slots(vars);
+	unsigned int size = 0;
+	unsigned int i;
+
+	for (i = 0; vars->count && i <= vars->mask; i++) {
+		if (slots[i]) {
+			size += var_clear(NULL, slots[i], 1);
+			vars->count--;
+		}
+	}
+
+	if (vars->tab) {
+		size += (vars->mask + 1) * sizeof(*vars->tab);
+		ha_free(&vars->tab);
+		vars->mask = VARS_INLINE_SLOTS - 1;
+	}
+	memset(vars->inl, 0, sizeof(vars->inl));
+	vars->count = 0;
+	return size;
+}
+
+/* This function removes a variable from <vars> and frees the memory it was
  * using. If the variable is marked "VF_PERMANENT", the sample_data is only
- * reset to SMP_T_ANY unless <force> is non nul. Returns the freed size.
+ * reset to SMP_T_ANY unless <force> is non nul. <vars> may be NULL when the
+ * caller takes care of resetting the whole table. Returns the freed size.
  */
-unsigned int var_clear(struct var *var, int force)
+unsigned int var_clear(struct vars *vars, struct var *var, int force)
 {
 	unsigned int size = 0;
 
@@ -178,7 +307,8 @@ unsigned int var_clear(struct var *var, int force)
 	var->data.type = SMP_T_ANY;
 
 	if (!(var->flags & VF_PERMANENT) || force) {
-		LIST_DELETE(&var->l);
+		if (vars)
+			vars_unlink(vars, var);
 		pool_free(var_pool, var);
 		size += sizeof(struct var);
 	}
@@ -190,13 +320,10 @@ unsigned int var_clear(struct var *var, int force)
  */
 void vars_prune(struct vars *vars, struct session *sess, struct stream *strm)
 {
-	struct var *var, *tmp;
 	unsigned int size = 0;
 
 	vars_wrlock(vars);
-	list_for_each_entry_safe(var, tmp, &vars->head, l) {
-		size += var_clear(var, 1);
-	}
+	size = vars_release_all(vars);
 	vars_wrunlock(vars);
 	var_accounting_diff(vars, sess, strm, -size);
 }
@@ -206,13 +333,10 @@ void vars_prune(struct vars *vars, struct session *sess, struct stream *strm)
  */
 void vars_prune_per_sess(struct vars *vars)
 {
-	struct var *var, *tmp;
 	unsigned int size = 0;
 
 	vars_wrlock(vars);
-	list_for_each_entry_safe(var, tmp, &vars->head, l) {
-		size += var_clear(var, 1);
-	}
+	size = vars_release_all(vars);
 	vars_wrunlock(vars);
 
 	if (var_sess_limit)
@@ -221,10 +345,13 @@ void vars_prune_per_sess(struct vars *vars)
 		_HA_ATOMIC_SUB(&proc_vars.size, size);
 }
 
-/* This function initializes a variables list head */
+/* This function initializes an empty variables table */
 void vars_init_head(struct vars *vars, enum vars_scope scope)
 {
-	LIST_INIT(&vars->head);
+	vars->tab = NULL;
+	vars->mask = VARS_INLINE_SLOTS - 1;
+	vars->count = 0;
+	memset(vars->inl, 0, sizeof(vars->inl));
 	vars->scope = scope;
 	vars->size = 0;
 	HA_RWLOCK_INIT(&vars->rwlock);
@@ -294,19 +421,13 @@ static int vars_hash_name(const char *name, int len, enum vars_scope *scope,
 	return 1;
 }
 
-/* This function returns the variable from the given list that matches
- * <name_hash> or returns NULL if not found. It's only a linked list since it
- * is not expected to have many variables per scope (a few tens at best).
- * The caller is responsible for ensuring that <vars> is properly locked.
+/* This function returns the variable from <vars> that matches <name_hash> or
+ * returns NULL if not found. The caller is responsible for ensuring that
+ * <vars> is properly locked.
  */
 static struct var *var_get(struct vars *vars, uint64_t name_hash)
 {
-	struct var *var;
-
-	list_for_each_entry(var, &vars->head, l)
-		if (var->name_hash == name_hash)
-			return var;
-	return NULL;
+	return *vars_lookup_slot(vars, name_hash);
 }
 
 /* Returns 0 if fails, else returns 1. */
@@ -391,6 +512,10 @@ int var_set(uint64_t name_hash, enum vars_scope scope, struct sample *smp, uint
 		if (flags & VF_COND_IFEXISTS)
 			goto unlock;
 
+		/* Make room in the table */
+		if (!vars_reserve(vars, smp->sess, smp->strm))
+			goto unlock;
+
 		/* Check memory available. */
 		if (!var_accounting_add(vars, smp->sess, smp->strm, sizeof(struct var)))
 			goto unlock;
@@ -399,8 +524,9 @@ int var_set(uint64_t name_hash, enum vars_scope scope, struct sample *smp, uint
 		var = pool_alloc(var_pool);
 		if (!var)
 			goto unlock;
-		LIST_APPEND(&vars->head, &var->l);
 		var->name_hash = name_hash;
+		*vars_lookup_slot(vars, name_hash) = var;
+		vars->count++;
 		var->flags = flags & VF_PERMANENT;
 		var->data.type = SMP_T_ANY;
 	}
@@ -529,7 +655,7 @@ int var_unset(uint64_t name_hash, enum vars_scope scope, struct sample *smp)
 	vars_wrlock(vars);
 	var = var_get(vars, name_hash);
 	if (var) {
-		size = var_clear(var, 0);
+		size = var_clear(vars, var, 0);
 		var_accounting_diff(vars, smp->sess, smp->strm, -size);
 	}
 	vars_wrunlock(vars);
@@ -1341,8 +1467,8 @@ static struct sample_fetch_kw_list sample_fetch_keywords = {ILH, {
 INITCALL1(STG_REGISTER, sample_register_fetches, &sample_fetch_keywords);
 
 static struct sample_conv_kw_list sample_conv_kws = {ILH, {
-	{ "set-var",   smp_conv_store, ARG5(1,STR,STR,STR,STR,STR), conv_check_var, SMP_T_ANY, SMP_T_ANY },
-	{ "unset-var", smp_conv_clear, ARG1(1,STR), conv_check_var, SMP_T_ANY, SMP_T_ANY },
+	{ "set-var",   smp_conv_store, ARG5(1,STR,STR,STR,STR,STR), conv_check_var, SMP_T_ANY, SMP_T_ANY, .flags = SMP_KW_F_SIDE_EFFECT },
+	{ "unset-var", smp_conv_clear, ARG1(1,STR), conv_check_var, SMP_T_ANY, SMP_T_ANY, .flags = SMP_KW_F_SIDE_EFFECT },
 	{ /* END */ },
 }};
 
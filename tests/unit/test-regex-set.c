@@ -0,0 +1,207 @@
+/* Differential test of the regex sets against the POSIX regex library.
+ *
+ * Random regexes are built from a small grammar covering the constructs
+ * supported by regex_set_add(), then random subjects are matched both by the
+ * set and by each regex in turn with regexec(). The lowest matching regex
+ * must be the same. Regexes rejected by the set are skipped, as the caller
+ * matches them separately.
+ *
+ * Build from the haproxy directory with :
+ *   cc -Iinclude -O2 -Wno-address-of-packed-member -o test-regex-set tests/unit/test-regex-set.c src/regex_set.c
+ *
+ * Arguments are the random seed and the number of rounds (default 1 1000) :
+ *   ./test-regex-set 1 1000
+ */
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <haproxy/regex_set.h>
+
+#define NB_REGEX    8     /* regexes per set */
+#define NB_SUBJECTS 200   /* subjects per set */
+
+static unsigned int rnd_state;
+
+static unsigned int rnd(unsigned int max)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state % max;
+}
+
+/* appends string <str> to <out>, which is always large enough here */
+static void append(char *out, const char *str)
+{
+	size_t len = strlen(out);
+
+	memcpy(out + len, str, strlen(str) + 1);
+}
+
+/* small alphabet so that random subjects often match */
+static const char alphabet[] = "abcAB-.\n";
+
+/* appends a random atom to <out> */
+static void gen_atom(char *out, int depth)
+{
+	static const char *classes[] = {
+		"[ab]", "[^a]", "[a-c]", "[[:alpha:]]", "[.-]", "\\.", ".", "\\w", "\\s",
+	};
+	/* constructs rejected by the set, which must be left unchanged */
+	static const char *unsupported[] = {
+		"(^a)", "(b$)", "\\b", "(a)\\1",
+	};
+	char lit[2] = { alphabet[rnd(6)], 0 };
+
+	if (!rnd(50)) {
+		append(out, unsupported[rnd(sizeof(unsupported) / sizeof(*unsupported))]);
+		return;
+	}
+
+	switch (depth < 2 ? rnd(4) : rnd(2)) {
+	case 0:
+		append(out, lit);
+		break;
+	case 1:
+		append(out, classes[rnd(sizeof(classes) / sizeof(*classes))]);
+		break;
+	default: {
+		int i, nb = 1 + rnd(3);
+
+		append(out, "(");
+		for (i = 0; i < nb; i++) {
+			if (i)
+				append(out, "|");
+			gen_atom(out, depth + 1);
+			gen_atom(out, depth + 1);
+		}
+		append(out, ")");
+		break;
+	}
+	}
+}
+
+/* appends a random quantifier to <out> */
+static void gen_quant(char *out)
+{
+	static const char *quants[] = {
+		"", "", "", "*", "+", "?", "{2}", "{1,3}", "{2,}", "*?", "+?", "??",
+	};
+
+	append(out, quants[rnd(sizeof(quants) / sizeof(*quants))]);
+}
+
+/* builds a random regex into <out> */
+static void gen_regex(char *out)
+{
+	int branch, nb_branches = 1 + rnd(2);
+	int i, nb;
+
+	*out = 0;
+	for (branch = 0; branch < nb_branches; branch++) {
+		if (branch)
+			append(out, "|");
+		if (!rnd(3))
+			append(out, "^");
+		nb = 1 + rnd(4);
+		for (i = 0; i < nb; i++) {
+			gen_atom(out, 0);
+			gen_quant(out);
+		}
+		if (!rnd(3))
+			append(out, "$");
+	}
+}
+
+/* builds a random subject into <out>, returns its length */
+static size_t gen_subject(char *out)
+{
+	size_t i, len = rnd(12);
+
+	for (i = 0; i < len; i++)
+		out[i] = alphabet[rnd(sizeof(alphabet) - 1)];
+	out[len] = 0;
+	return len;
+}
+
+int main(int argc, char **argv)
+{
+	char regex[NB_REGEX][4096];
+	regex_t reg[NB_REGEX];
+	int in_set[NB_REGEX];
+	char subject[16];
+	int rounds, round, icase;
+	int errors = 0, checks = 0, skipped = 0;
+
+	rnd_state = argc > 1 ? atoi(argv[1]) : 1;
+	rounds = argc > 2 ? atoi(argv[2]) : 1000;
+	if (!rnd_state)
+		rnd_state = 1;
+
+	for (round = 0; round < rounds; round++) {
+		struct regex_set *rs;
+		int i, s, nb_set = 0;
+
+		icase = rnd(2);
+		rs = regex_set_new(icase);
+		if (!rs) {
+			fprintf(stderr, "out of memory\n");
+			return 2;
+		}
+
+		for (i = 0; i < NB_REGEX; i++) {
+			/* regexes refused by the regex library are regenerated */
+			do {
+				gen_regex(regex[i]);
+			} while (regcomp(&reg[i], regex[i], REG_EXTENDED | REG_NOSUB | (icase ? REG_ICASE : 0)) != 0);
+
+			in_set[i] = regex_set_add(rs, regex[i], i);
+			nb_set += in_set[i];
+			skipped += !in_set[i];
+		}
+
+		if (!nb_set || !regex_set_compile(rs))
+			goto next;
+
+		for (s = 0; s < NB_SUBJECTS; s++) {
+			size_t len = gen_subject(subject);
+			unsigned int got, exp = RSET_NOMATCH;
+
+			got = regex_set_exec(rs, subject, len);
+			if (got == RSET_FULL) {
+				regex_set_flush(rs);
+				continue;
+			}
+
+			for (i = 0; i < NB_REGEX; i++) {
+				if (in_set[i] && regexec(&reg[i], subject, 0, NULL, 0) == 0) {
+					exp = i;
+					break;
+				}
+			}
+
+			checks++;
+			if (got != exp) {
+				errors++;
+				printf("round %d: subject \"", round);
+				for (i = 0; i < (int)len; i++)
+					printf(subject[i] == '\n' ? "\\n" : "%c", subject[i]);
+				printf("\" icase=%d expected %d got %d\n", icase,
+				       exp == RSET_NOMATCH ? -1 : (int)exp,
+				       got == RSET_NOMATCH ? -1 : (int)got);
+				for (i = 0; i < NB_REGEX; i++)
+					printf("  %c %d: %s\n", in_set[i] ? '+' : '-', i, regex[i]);
+			}
+		}
+	next:
+		for (i = 0; i < NB_REGEX; i++)
+			regfree(&reg[i]);
+		regex_set_free(rs);
+	}
+
+	printf("%d checks, %d errors, %d regexes matched separately\n", checks, errors, skipped);
+	return !!errors;
+}